@@ -0,0 +1,385 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "til.h"
+#include "til_fb.h"
+#include "til_settings.h"
+#include "til_util.h"
+
+#include "bench.h"
+#include "setup.h"
+
+/* Headless module benchmarking for rototiller.
+ *
+ * Every selected module is rendered for a fixed number of frames into the mem
+ * fb backend, for every combination of the selected sizes, thread counts, and
+ * shadow modes.  Results are written to stdout as CSV, one row per
+ * module/size/threads/shadow combination, intended for tracking performance regressions over time.
+ *
+ * Settings are the usual key=value[,key=value...] form, with lists using ':'
+ * as a separator:
+ *
+ *   frames=N		frames measured per module (default 100)
+ *   warmup=N		frames rendered before measuring (default 10)
+ *   sizes=WxH[:WxH...]	frame sizes (default 640x480)
+ *   threads=N[:N...]	rendering thread counts, 0 is a thread per cpu (default 0)
+ *   modules=name[:name...]	modules to benchmark (default all modules)
+ *   pipelined=on|off	render like the frontend with til_module_render_pipelined() (default on)
+ *   shadow=off|on[:off|on]	fb shadow modes, rendering into cached pages published to the fb's (default off)
+ *
+ * Ticks are advanced synthetically at 60hz rather than from the clock, so
+ * the animated content is the same regardless of how fast the frames render.
+ */
+
+#define BENCH_DEFAULT_FRAMES	"100"
+#define BENCH_DEFAULT_WARMUP	"10"
+#define BENCH_DEFAULT_SIZES	"640x480"
+#define BENCH_DEFAULT_THREADS	"0"
+#define BENCH_DEFAULT_PIPELINED	"on"
+#define BENCH_DEFAULT_SHADOW	"off"
+#define BENCH_TICKS_PER_FRAME	(1000 / 60)
+
+extern til_fb_ops_t	mem_fb_ops;
+
+typedef struct bench_result_t {
+	uint64_t	*frame_ns;	/* wall time of each measured frame, sorted when reporting */
+	uint64_t	prepare_ns, simulate_ns, render_ns, finish_ns;
+	uint64_t	flip_ns;	/* putting and flipping the finished pages, including their publishing when shadowed */
+} bench_result_t;
+
+
+static const char * bench_get_value(const til_settings_t *settings, const char *key, const char *preferred)
+{
+	const char	*value;
+
+	if (!settings)
+		return preferred;
+
+	value = til_settings_get_value(settings, key, NULL);
+
+	return value ? : preferred;
+}
+
+
+/* splits a ':'-separated list into a NULL-terminated strv, free with bench_strv_free() */
+static char ** bench_split(const char *list)
+{
+	unsigned	n = 1;
+	char		**strv;
+	const char	*p;
+
+	for (p = list; *p; p++) {
+		if (*p == ':')
+			n++;
+	}
+
+	strv = calloc(n + 1, sizeof(char *));
+	if (!strv)
+		return NULL;
+
+	for (unsigned i = 0; i < n; i++) {
+		size_t	len = strcspn(list, ":");
+
+		strv[i] = strndup(list, len);
+		if (!strv[i])
+			goto _err;
+
+		list += len + 1;
+	}
+
+	return strv;
+
+_err:
+	for (unsigned i = 0; strv[i]; i++)
+		free(strv[i]);
+	free(strv);
+
+	return NULL;
+}
+
+
+static void bench_strv_free(char **strv)
+{
+	if (!strv)
+		return;
+
+	for (unsigned i = 0; strv[i]; i++)
+		free(strv[i]);
+
+	free(strv);
+}
+
+
+static int bench_cmp_ns(const void *a, const void *b)
+{
+	uint64_t	A = *(const uint64_t *)a, B = *(const uint64_t *)b;
+
+	return A < B ? -1 : A > B;
+}
+
+
+static double bench_ms(uint64_t ns)
+{
+	return (double)ns / 1000000.0;
+}
+
+
+/* put the page containing fragment, and flip it so the page becomes available again */
+static int bench_put_page(til_fb_t *fb, til_fb_fragment_t *fragment)
+{
+	til_fb_page_put(fb, (til_fb_page_t *)fragment);
+
+	return til_fb_flip(fb);
+}
+
+
+/* render n_warmup + n_frames frames of module into fb, recording the latter n_frames in res */
+static int bench_module(const til_module_t *module, til_fb_t *fb, unsigned pipelined, unsigned n_warmup, unsigned n_frames, bench_result_t *res)
+{
+	const til_setting_desc_t	*failed_desc = NULL;
+	til_module_context_t		*context = NULL;
+	til_fb_fragment_t		*finished;
+	til_settings_t			*settings;
+	til_setup_t			*setup = NULL;
+	unsigned			ticks = 0;
+	int				r;
+
+	settings = til_settings_new(module->name);
+	if (!settings)
+		return -ENOMEM;
+
+	/* benchmarks always use the module's default settings */
+	r = setup_interactively(settings, til_module_setup, 1, &setup, &failed_desc);
+	if (r < 0)
+		goto _out;
+
+	r = til_module_create_context(module, 0, ticks, 0, setup, &context);
+	if (r < 0)
+		goto _out;
+
+	for (unsigned i = 0; i < n_warmup + n_frames; i++, ticks += BENCH_TICKS_PER_FRAME) {
+		til_frame_stats_t	stats = {};
+		til_fb_page_t		*page;
+		uint64_t		t0;
+
+		page = til_fb_page_get(fb);
+
+		/* frame time is what the frontend's dispatch thread spends per frame */
+		t0 = til_get_ns();
+		if (pipelined) {
+			finished = til_module_render_pipelined(context, ticks, &page->fragment, &stats);
+		} else {
+			til_module_render_timed(context, ticks, &page->fragment, &stats);
+			finished = &page->fragment;
+		}
+
+		if (i >= n_warmup) {
+			res->frame_ns[i - n_warmup] = til_get_ns() - t0;
+			res->prepare_ns += stats.prepare_ns;
+			res->simulate_ns += stats.simulate_ns;
+			res->render_ns += stats.render_ns;
+			res->finish_ns += stats.finish_ns;
+		}
+
+		if (finished) {
+			t0 = til_get_ns();
+			r = bench_put_page(fb, finished);
+			if (r < 0)
+				goto _out;
+
+			if (i >= n_warmup)
+				res->flip_ns += til_get_ns() - t0;
+		}
+	}
+
+	finished = til_module_render_flush(context, NULL);
+	if (finished)
+		r = bench_put_page(fb, finished);
+
+_out:
+	til_module_context_free(context);
+	til_setup_free(setup);
+	til_settings_free(settings);
+
+	return r;
+}
+
+
+static void bench_report(const til_module_t *module, unsigned width, unsigned height, unsigned n_threads, const char *shadow, unsigned n_frames, bench_result_t *res)
+{
+	uint64_t	total_ns = 0;
+
+	qsort(res->frame_ns, n_frames, sizeof(*res->frame_ns), bench_cmp_ns);
+
+	for (unsigned i = 0; i < n_frames; i++)
+		total_ns += res->frame_ns[i];
+
+	printf("%s,%u,%u,%u,%s,%u,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.4f,%.2f\n",
+		module->name,
+		width, height,
+		n_threads,
+		shadow,
+		n_frames,
+		bench_ms(total_ns / n_frames),
+		bench_ms(res->frame_ns[n_frames / 2]),
+		bench_ms(res->frame_ns[MIN(n_frames - 1, (n_frames * 99) / 100)]),
+		bench_ms(res->prepare_ns / n_frames),
+		bench_ms(res->simulate_ns / n_frames),
+		bench_ms(res->render_ns / n_frames),
+		bench_ms(res->finish_ns / n_frames),
+		bench_ms(res->flip_ns / n_frames),
+		total_ns ? (double)n_frames * 1000000000.0 / total_ns : 0.0);
+	fflush(stdout);
+}
+
+
+static int bench_size(const til_module_t **modules, size_t n_modules, const char *size, const char *shadow, unsigned n_threads, unsigned n_pages, unsigned pipelined, unsigned n_warmup, unsigned n_frames)
+{
+	til_settings_t	*fb_settings;
+	bench_result_t	res = {};
+	unsigned	width, height;
+	char		buf[80];
+	til_fb_t	*fb;
+	int		r;
+
+	if (sscanf(size, "%u%*[xX]%u", &width, &height) != 2)
+		return -EINVAL;
+
+	snprintf(buf, sizeof(buf), "mem,size=%ux%u,shadow=%s", width, height, shadow);
+	fb_settings = til_settings_new(buf);
+	if (!fb_settings)
+		return -ENOMEM;
+
+	r = til_fb_new(&mem_fb_ops, fb_settings, n_pages, &fb);
+	if (r < 0)
+		goto _out_settings;
+
+	res.frame_ns = calloc(n_frames, sizeof(*res.frame_ns));
+	if (!res.frame_ns) {
+		r = -ENOMEM;
+		goto _out_fb;
+	}
+
+	for (size_t i = 0; i < n_modules; i++) {
+		res.prepare_ns = res.simulate_ns = res.render_ns = res.finish_ns = res.flip_ns = 0;
+
+		r = bench_module(modules[i], fb, pipelined, n_warmup, n_frames, &res);
+		if (r < 0) {
+			fprintf(stderr, "unable to benchmark module \"%s\": %s\n", modules[i]->name, strerror(-r));
+			continue;
+		}
+
+		bench_report(modules[i], width, height, n_threads, shadow, n_frames, &res);
+	}
+
+	r = 0;
+
+	free(res.frame_ns);
+_out_fb:
+	til_fb_free(fb);
+_out_settings:
+	til_settings_free(fb_settings);
+
+	return r;
+}
+
+
+/* run the benchmarks described by settings, results are printed on stdout */
+int bench_run(const char *settings_str, unsigned n_pages)
+{
+	const til_module_t	**modules, **selected;
+	char			**sizes = NULL, **threads = NULL, **shadows = NULL, **names = NULL;
+	unsigned		n_frames, n_warmup, pipelined;
+	til_settings_t		*settings = NULL;
+	size_t			n_modules, n_selected = 0;
+	const char		*value;
+	int			r = -ENOMEM;
+
+	if (settings_str && *settings_str) {
+		settings = til_settings_new(settings_str);
+		if (!settings)
+			return -ENOMEM;
+	}
+
+	n_frames = atoi(bench_get_value(settings, "frames", BENCH_DEFAULT_FRAMES));
+	n_warmup = atoi(bench_get_value(settings, "warmup", BENCH_DEFAULT_WARMUP));
+	pipelined = !strcasecmp(bench_get_value(settings, "pipelined", BENCH_DEFAULT_PIPELINED), "on");
+	if (!n_frames) {
+		r = -EINVAL;
+		goto _out;
+	}
+
+	sizes = bench_split(bench_get_value(settings, "sizes", BENCH_DEFAULT_SIZES));
+	if (!sizes)
+		goto _out;
+
+	threads = bench_split(bench_get_value(settings, "threads", BENCH_DEFAULT_THREADS));
+	if (!threads)
+		goto _out;
+
+	shadows = bench_split(bench_get_value(settings, "shadow", BENCH_DEFAULT_SHADOW));
+	if (!shadows)
+		goto _out;
+
+	til_get_modules(&modules, &n_modules);
+	selected = calloc(n_modules, sizeof(*selected));
+	if (!selected)
+		goto _out;
+
+	value = bench_get_value(settings, "modules", NULL);
+	if (value) {
+		names = bench_split(value);
+		if (!names)
+			goto _out_selected;
+
+		for (unsigned i = 0; names[i] && n_selected < n_modules; i++) {
+			const til_module_t	*module = til_lookup_module(names[i]);
+
+			if (!module) {
+				fprintf(stderr, "unknown module \"%s\"\n", names[i]);
+				r = -EINVAL;
+				goto _out_selected;
+			}
+
+			selected[n_selected++] = module;
+		}
+	} else {
+		for (size_t i = 0; i < n_modules; i++)
+			selected[n_selected++] = modules[i];
+	}
+
+	printf("module,width,height,threads,shadow,frames,mean_ms,p50_ms,p99_ms,prepare_ms,simulate_ms,render_ms,finish_ms,flip_ms,fps\n");
+
+	for (unsigned t = 0; threads[t]; t++) {
+		unsigned	n_threads = atoi(threads[t]);
+
+		r = til_set_n_threads(n_threads);
+		if (r < 0)
+			goto _out_selected;
+
+		for (unsigned s = 0; sizes[s]; s++) {
+			for (unsigned m = 0; shadows[m]; m++) {
+				r = bench_size(selected, n_selected, sizes[s], shadows[m], n_threads ? : til_get_ncpus(), n_pages, pipelined, n_warmup, n_frames);
+				if (r < 0)
+					goto _out_selected;
+			}
+		}
+	}
+
+	r = 0;
+
+_out_selected:
+	free(selected);
+_out:
+	bench_strv_free(names);
+	bench_strv_free(shadows);
+	bench_strv_free(threads);
+	bench_strv_free(sizes);
+	til_settings_free(settings);
+
+	return r;
+}
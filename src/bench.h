@@ -0,0 +1,6 @@
+#ifndef _BENCH_H
+#define _BENCH_H
+
+int bench_run(const char *settings, unsigned n_pages);
+
+#endif
@@ -23,6 +23,7 @@ typedef struct drm_fb_t {
 	drmModeCrtc		*crtc;
 	drmModeConnector	*connector;
 	drmModeModeInfo		*mode;
+	unsigned		no_dirtyfb:1;	/* the driver doesn't support DIRTYFB, stop bothering it */
 } drm_fb_t;
 
 typedef struct drm_fb_page_t drm_fb_page_t;
@@ -302,10 +303,16 @@ static int drm_fb_setup(const til_settings_t *settings, til_setting_t **res_sett
 						},
 					};
 
+	int				r;
+
 	if (!drmAvailable())
 		return -ENOSYS;
 
-	return til_settings_apply_desc_generators(settings, generators, nelems(generators), &context, res_setting, res_desc);
+	r = til_settings_apply_desc_generators(settings, generators, nelems(generators), &context, res_setting, res_desc);
+	if (r)
+		return r;
+
+	return til_fb_setup_shadow(settings, res_setting, res_desc, 1);
 }
 
 
@@ -529,6 +536,29 @@ static int drm_fb_page_flip(til_fb_t *fb, void *context, void *page)
 	drm_fb_t	*c = context;
 	drm_fb_page_t	*p = page;
 
+	/* tell drivers needing it what actually changed, they'll otherwise assume the whole page did */
+	if (!c->no_dirtyfb) {
+		const til_fb_rect_t	*rects;
+		unsigned		n_rects;
+
+		n_rects = til_fb_flip_damage(fb, &rects);
+		if (n_rects) {
+			drmModeClip	clips[n_rects];
+
+			for (unsigned i = 0; i < n_rects; i++) {
+				clips[i] = (drmModeClip){
+						.x1 = rects[i].x,
+						.y1 = rects[i].y,
+						.x2 = rects[i].x + rects[i].width,
+						.y2 = rects[i].y + rects[i].height,
+					};
+			}
+
+			if (drmModeDirtyFB(c->drm_fd, p->drm_fb_id, clips, n_rects) == -ENOSYS)
+				c->no_dirtyfb = 1;
+		}
+	}
+
 	if (drmModePageFlip(c->drm_fd, c->crtc->crtc_id, p->drm_fb_id, DRM_MODE_PAGE_FLIP_EVENT, NULL) < 0)
 		return -1;
 
@@ -544,5 +574,6 @@ til_fb_ops_t drm_fb_ops = {
 	.release = drm_fb_release,
 	.page_alloc = drm_fb_page_alloc,
 	.page_free = drm_fb_page_free,
-	.page_flip = drm_fb_page_flip
+	.page_flip = drm_fb_page_flip,
+	.shadow = 1,	/* dumb buffers are write-combined, reading them back is painfully slow */
 };
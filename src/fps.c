@@ -2,7 +2,9 @@
 #include <stdio.h>
 #include <sys/time.h>
 
+#include "til.h"
 #include "til_fb.h"
+#include "til_governor.h"
 #include "til_util.h"
 
 
@@ -36,7 +38,8 @@ int fps_setup(void)
 }
 
 
-void fps_print(til_fb_t *fb)
+/* print the frame rate once a second, and the resolution scale when module_context is a governor */
+void fps_print(til_fb_t *fb, til_module_context_t *module_context)
 {
 #ifdef __WIN32__
 
@@ -47,7 +50,10 @@ void fps_print(til_fb_t *fb)
 		return;
 
 	til_fb_get_put_pages_count(fb, &n);
-	printf("FPS: %u\n", n);
+	if (til_governor_is_context(module_context))
+		printf("FPS: %u scale: %.2f\n", n, til_governor_get_scale(module_context));
+	else
+		printf("FPS: %u\n", n);
 
 	print_fps = 0;
 #endif
@@ -2,8 +2,9 @@
 #define _FPS_H
 
 #include "til_fb.h"
+#include "til_module_context.h"
 
 int fps_setup(void);
-void fps_print(til_fb_t *fb);
+void fps_print(til_fb_t *fb, til_module_context_t *module_context);
 
 #endif
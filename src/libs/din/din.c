@@ -2,22 +2,28 @@
 /* https://en.wikipedia.org/wiki/Perlin_noise */
 
 #include <assert.h>
+#include <math.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include "til_rand.h"
+#include "til_util.h"
 
 #include "din.h"
 #include "v3f.h"
 
 typedef struct din_t {
-	int	width, height, depth;
-	int	W_x_H;
-	v3f_t	grid[];
+	int		width, height, depth;
+	int		W_x_H;
+	til_rand_t	rand;
+	v3f_t		grid[];
 } din_t;
 
 
 /* return random number between -1 and +1 */
-static inline float randf(void)
+static inline float randf(din_t *din)
 {
-	return 2.f / RAND_MAX * rand() - 1.f;
+	return til_rand_range(&din->rand, -1.f, 1.f);
 }
 
 
@@ -30,9 +36,9 @@ void din_randomize(din_t *din)
 			for (x = 0; x < din->width; x++) {
 				v3f_t	r;
 
-				r.x = randf();
-				r.y = randf();
-				r.z = randf();
+				r.x = randf(din);
+				r.y = randf(din);
+				r.z = randf(din);
 
 				din->grid[z * din->W_x_H + y * din->width + x] = v3f_normalize(&r);
 			}
@@ -41,7 +47,7 @@ void din_randomize(din_t *din)
 }
 
 
-din_t * din_new(int width, int height, int depth)
+din_t * din_new(int width, int height, int depth, unsigned seed)
 {
 	din_t	*din;
 
@@ -60,6 +66,7 @@ din_t * din_new(int width, int height, int depth)
 	/* premultiply this since we do it a lot in addressing din->grid[] */
 	din->W_x_H = width * height;
 
+	til_rand_seed(&din->rand, seed, 0);
 	din_randomize(din);
 
 	return din;
@@ -72,6 +79,19 @@ void din_free(din_t *din)
 }
 
 
+/* din_batch() evaluates DIN_LANES points at a time.  Runs of points within the same
+ * lattice cell, the norm for coherent rows of coordinates, share the cell's gradients
+ * while the rest fall back to din_point().
+ *
+ * Both evaluate exactly the same floating point operations as din(), so they agree
+ * to the bit.
+ */
+#define DIN_LANES	8
+
+typedef float	din_lanes_t __attribute__((vector_size(DIN_LANES * sizeof(float))));
+typedef int32_t	din_ilanes_t __attribute__((vector_size(DIN_LANES * sizeof(int32_t))));
+
+
 static inline float dotgradient(const din_t *din, int x, int y, int z, const v3f_t *coordinate)
 {
 	v3f_t	distance = v3f_sub(coordinate, &(v3f_t){.x = x, .y = y, .z = z});
@@ -104,24 +124,36 @@ static inline float smootherstep(float edge0, float edge1, float x) {
 }
 
 
-/* coordinate is in a unit cube of -1...+1 */
-float din(din_t *din, v3f_t *coordinate)
+/* coordinates outside the unit cube of -1...+1 would index past the grid */
+static inline void din_assert_coordinate(float x, float y, float z)
+{
+	assert(x >= -1.f && x <= 1.f);
+	assert(y >= -1.f && y <= 1.f);
+	assert(z >= -1.f && z <= 1.f);
+}
+
+
+/* map a coordinate in -1...+1 into the grid's lattice */
+static inline v3f_t din_lattice(const din_t *din, float x, float y, float z)
+{
+	return (v3f_t){
+		.x = .5f + (x * .5f + .5f) * (float)(din->width - 2),
+		.y = .5f + (y * .5f + .5f) * (float)(din->height - 2),
+		.z = .5f + (z * .5f + .5f) * (float)(din->depth - 2),
+	};
+}
+
+
+/* evaluate the noise at coordinate already mapped into the lattice, always inlined so
+ * din_batch()'s avx2 build doesn't call into non-VEX code from its loop
+ */
+static inline __attribute__((always_inline)) float din_point(const din_t *din, const v3f_t *coordinate)
 {
 	int	x0, y0, z0, x1, y1, z1;
 	float	i1, i2, ii1, ii2;
 	float	tx, ty, tz;
 	float	n0, n1;
 
-	assert(din);
-	assert(coordinate);
-	assert(coordinate->x >= -1.f && coordinate->x <= 1.f);
-	assert(coordinate->y >= -1.f && coordinate->y <= 1.f);
-	assert(coordinate->z >= -1.f && coordinate->z <= 1.f);
-
-	coordinate->x = .5f + (coordinate->x * .5f + .5f) * (float)(din->width - 2);
-	coordinate->y = .5f + (coordinate->y * .5f + .5f) * (float)(din->height - 2);
-	coordinate->z = .5f + (coordinate->z * .5f + .5f) * (float)(din->depth - 2);
-
 	x0 = floorf(coordinate->x);
 	y0 = floorf(coordinate->y);
 	z0 = floorf(coordinate->z);
@@ -160,3 +192,145 @@ float din(din_t *din, v3f_t *coordinate)
 
 	return lerp(ii1, ii2, tz) * 1.1547005383792515290182975610039f;
 }
+
+
+/* coordinate is in a unit cube of -1...+1 */
+float din(din_t *din, v3f_t *coordinate)
+{
+	assert(din);
+	assert(coordinate);
+	din_assert_coordinate(coordinate->x, coordinate->y, coordinate->z);
+
+	*coordinate = din_lattice(din, coordinate->x, coordinate->y, coordinate->z);
+
+	return din_point(din, coordinate);
+}
+
+
+/* din_point()'s dotgradient(), lerp() and smootherstep() for the lanes, kept as macros so no
+ * vector values cross function boundaries.  DIN_LANES_DOTGRADIENT() shares the corner's
+ * gradient g across all lanes, and DIN_LANES_SMOOTHERSTEP() expects t already within 0...1
+ * where smootherstep()'s scaling and clamping are exact no-ops.
+ */
+#define DIN_LANES_DOTGRADIENT(_g, _dx, _dy, _dz)	((_g)->x * (_dx) + (_g)->y * (_dy) + (_g)->z * (_dz))
+#define DIN_LANES_LERP(_a, _b, _t)			((1.0f - (_t)) * (_a) + (_t) * (_b))
+#define DIN_LANES_SMOOTHERSTEP(_t)			((_t) * (_t) * (_t) * ((_t) * ((_t) * 6.f - 15.f) + 10.f))
+
+
+static inline __attribute__((always_inline)) void din_batch_lanes(const din_t *din, const float *xs, const float *ys, const float *zs, unsigned n, float *res)
+{
+	unsigned	i = 0;
+
+	for (; i + DIN_LANES <= n; i += DIN_LANES) {
+		din_lanes_t	x, y, z, tx, ty, tz, dx0, dy0, dz0, dx1, dy1, dz1, i1, i2, ii1, ii2, r;
+		din_ilanes_t	x0, y0, z0;
+		const v3f_t	*g;
+
+		memcpy(&x, &xs[i], sizeof(x));
+		memcpy(&y, &ys[i], sizeof(y));
+		memcpy(&z, &zs[i], sizeof(z));
+
+		/* range check all the lanes at once, only asserting per lane to report an offender */
+		{
+			din_ilanes_t	in = (x >= -1.f) & (x <= 1.f) & (y >= -1.f) & (y <= 1.f) & (z >= -1.f) & (z <= 1.f);
+			int32_t		all = -1;
+
+			for (unsigned l = 0; l < DIN_LANES; l++)
+				all &= in[l];
+
+			if (!all) {
+				for (unsigned l = 0; l < DIN_LANES; l++)
+					din_assert_coordinate(xs[i + l], ys[i + l], zs[i + l]);
+			}
+		}
+
+		x = .5f + (x * .5f + .5f) * (float)(din->width - 2);
+		y = .5f + (y * .5f + .5f) * (float)(din->height - 2);
+		z = .5f + (z * .5f + .5f) * (float)(din->depth - 2);
+
+		/* the lattice coordinates are all positive, so truncating is flooring */
+		x0 = __builtin_convertvector(x, din_ilanes_t);
+		y0 = __builtin_convertvector(y, din_ilanes_t);
+		z0 = __builtin_convertvector(z, din_ilanes_t);
+
+		{
+			din_ilanes_t	diff = (x0 ^ x0[0]) | (y0 ^ y0[0]) | (z0 ^ z0[0]);
+			int32_t		any = 0;
+
+			for (unsigned l = 0; l < DIN_LANES; l++)
+				any |= diff[l];
+
+			if (any) {
+				for (unsigned l = 0; l < DIN_LANES; l++)
+					res[i + l] = din_point(din, &(v3f_t){ .x = x[l], .y = y[l], .z = z[l] });
+
+				continue;
+			}
+		}
+
+		dx0 = x - (float)x0[0];
+		dy0 = y - (float)y0[0];
+		dz0 = z - (float)z0[0];
+		dx1 = x - (float)(x0[0] + 1);
+		dy1 = y - (float)(y0[0] + 1);
+		dz1 = z - (float)(z0[0] + 1);
+
+		tx = DIN_LANES_SMOOTHERSTEP(dx0);
+		ty = DIN_LANES_SMOOTHERSTEP(dy0);
+		tz = DIN_LANES_SMOOTHERSTEP(dz0);
+
+		g = &din->grid[z0[0] * din->W_x_H + y0[0] * din->width + x0[0]];
+
+		i1 = DIN_LANES_LERP(DIN_LANES_DOTGRADIENT(&g[0], dx0, dy0, dz0), DIN_LANES_DOTGRADIENT(&g[1], dx1, dy0, dz0), tx);
+		i2 = DIN_LANES_LERP(DIN_LANES_DOTGRADIENT(&g[din->width], dx0, dy1, dz0), DIN_LANES_DOTGRADIENT(&g[din->width + 1], dx1, dy1, dz0), tx);
+		ii1 = DIN_LANES_LERP(i1, i2, ty);
+
+		g += din->W_x_H;
+		i1 = DIN_LANES_LERP(DIN_LANES_DOTGRADIENT(&g[0], dx0, dy0, dz1), DIN_LANES_DOTGRADIENT(&g[1], dx1, dy0, dz1), tx);
+		i2 = DIN_LANES_LERP(DIN_LANES_DOTGRADIENT(&g[din->width], dx0, dy1, dz1), DIN_LANES_DOTGRADIENT(&g[din->width + 1], dx1, dy1, dz1), tx);
+		ii2 = DIN_LANES_LERP(i1, i2, ty);
+
+		r = DIN_LANES_LERP(ii1, ii2, tz) * 1.1547005383792515290182975610039f;
+		memcpy(&res[i], &r, sizeof(r));
+	}
+
+	for (; i < n; i++) {
+		v3f_t	coordinate;
+
+		din_assert_coordinate(xs[i], ys[i], zs[i]);
+		coordinate = din_lattice(din, xs[i], ys[i], zs[i]);
+
+		res[i] = din_point(din, &coordinate);
+	}
+}
+
+
+static void din_batch_generic(const din_t *din, const float *xs, const float *ys, const float *zs, unsigned n, float *res)
+{
+	din_batch_lanes(din, xs, ys, zs, n, res);
+}
+
+
+#ifdef TIL_CPU_X86
+__attribute__((target("avx2")))
+static void din_batch_avx2(const din_t *din, const float *xs, const float *ys, const float *zs, unsigned n, float *res)
+{
+	din_batch_lanes(din, xs, ys, zs, n, res);
+}
+#endif
+
+TIL_CPU_DISPATCH(din_batch_func, din_batch_generic, din_batch_avx2)
+
+
+/* Evaluate din() at the n coordinates xs[i],ys[i],zs[i] in a unit cube of -1...+1, storing
+ * the results in res.  Unlike din() the coordinates are left untouched, and for the best
+ * performance neighboring coordinates should be near one another like the pixels of a row.
+ */
+void din_batch(const din_t *din, const float *xs, const float *ys, const float *zs, unsigned n, float *res)
+{
+	assert(din);
+	assert(xs && ys && zs);
+	assert(res);
+
+	din_batch_func(din, xs, ys, zs, n, res);
+}
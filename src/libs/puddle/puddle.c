@@ -55,19 +55,22 @@ void puddle_free(puddle_t *puddle)
 }
 
 
-/* Run the puddle simulation for a tick, using the supplied viscosity value.
- * A good viscosity value is ~.01, YMMV.
+/* Run the puddle simulation for a tick on n_rows rows starting at row, using
+ * the supplied viscosity value.  This permits splitting a tick across threads,
+ * as the rows may be ticked concurrently.  Once every row has been ticked,
+ * puddle_tick_finish() must be called before any other use of the puddle.
  */
-void puddle_tick(puddle_t *puddle, float viscosity)
+void puddle_tick_rows(puddle_t *puddle, float viscosity, int row, int n_rows)
 {
 	float	*a, *b;
 
 	assert(puddle);
+	assert(row >= 0 && n_rows >= 0 && row + n_rows <= puddle->h);
 
 	a = puddle->a;
 	b = puddle->b;
 
-	for (int y = 0, i = 0; y < puddle->h; y++) {
+	for (int y = row, i = row * puddle->w; y < row + n_rows; y++) {
 		for (int x = 0; x < puddle->w; x++, i++) {
 			float	tmp =	a[i - puddle->w] +
 					a[i - 1] +
@@ -81,9 +84,31 @@ void puddle_tick(puddle_t *puddle, float viscosity)
 			b[i] = tmp;
 		}
 	}
+}
+
+
+/* Complete a tick performed via puddle_tick_rows() */
+void puddle_tick_finish(puddle_t *puddle)
+{
+	float	*tmp;
+
+	assert(puddle);
+
+	tmp = puddle->a;
+	puddle->a = puddle->b;
+	puddle->b = tmp;
+}
+
+
+/* Run the puddle simulation for a tick, using the supplied viscosity value.
+ * A good viscosity value is ~.01, YMMV.
+ */
+void puddle_tick(puddle_t *puddle, float viscosity)
+{
+	assert(puddle);
 
-	puddle->b = a;
-	puddle->a = b;
+	puddle_tick_rows(puddle, viscosity, 0, puddle->h);
+	puddle_tick_finish(puddle);
 }
 
 
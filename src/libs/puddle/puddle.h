@@ -23,6 +23,8 @@ typedef struct v2f_t v2f_t;
 puddle_t * puddle_new(int w, int h);
 void puddle_free(puddle_t *puddle);
 void puddle_tick(puddle_t *puddle, float viscosity);
+void puddle_tick_rows(puddle_t *puddle, float viscosity, int row, int n_rows);
+void puddle_tick_finish(puddle_t *puddle);
 void puddle_set(puddle_t *puddle, int x, int y, float v);
 float puddle_sample(const puddle_t *puddle, const v2f_t *coordinate);
 
@@ -0,0 +1,680 @@
+#include <float.h>
+#include <math.h>
+#include <stdlib.h>
+
+#include "ray_3f.h"
+#include "ray_bvh.h"
+#include "ray_packet.h"
+#include "ray_ray.h"
+#include "ray_render_object.h"
+
+/* Bounding volume hierarchy over the bounded objects of a prepared scene.
+ *
+ * This is a binary tree of axis-aligned boxes built top-down using the surface
+ * area heuristic over binned object centroids.  The nodes are stored in a flat
+ * array where siblings are adjacent and always follow their parent, so the
+ * bounds may be recomputed bottom-up by walking the array in reverse.
+ *
+ * Unbounded objects (planes) are kept in a separate list which is always
+ * tested before traversing the tree, their intersections usefully limit how
+ * far the traversal needs to go.
+ */
+
+#define RAY_BVH_BINS		12	/* centroid bins evaluated per split */
+#define RAY_BVH_LEAF_SIZE	2	/* nodes with this many objects or fewer are always leaves */
+#define RAY_BVH_MAX_LEAF_SIZE	8	/* nodes with more objects than this are always split */
+#define RAY_BVH_MAX_DEPTH	48	/* SAH splits stop here, halving the remaining objects instead */
+#define RAY_BVH_STACK_SIZE	(RAY_BVH_MAX_DEPTH + 32)
+#define RAY_BVH_TRAVERSAL_COST	1.0f	/* relative to an object intersection test */
+
+typedef struct ray_bvh_node_t {
+	ray_3f_t		min, max;
+	unsigned		first;		/* index of first child node when n_objects is 0, otherwise index of first object */
+	unsigned		n_objects;
+} ray_bvh_node_t;
+
+typedef struct ray_bvh_item_t {
+	ray_render_object_t	*object;
+	ray_3f_t		min, max, centroid;
+} ray_bvh_item_t;
+
+struct ray_bvh_t {
+	ray_render_object_t	**unbounded;	/* NULL-terminated */
+	ray_render_object_t	**objects;	/* bounded objects in leaf order */
+	ray_bvh_node_t		*nodes;
+	unsigned		n_nodes;
+};
+
+
+static inline float ray_3f_get(const ray_3f_t *v, unsigned axis)
+{
+	return axis == 0 ? v->x : (axis == 1 ? v->y : v->z);
+}
+
+
+static inline ray_3f_t ray_3f_min(const ray_3f_t *a, const ray_3f_t *b)
+{
+	return (ray_3f_t){ .x = fminf(a->x, b->x), .y = fminf(a->y, b->y), .z = fminf(a->z, b->z) };
+}
+
+
+static inline ray_3f_t ray_3f_max(const ray_3f_t *a, const ray_3f_t *b)
+{
+	return (ray_3f_t){ .x = fmaxf(a->x, b->x), .y = fmaxf(a->y, b->y), .z = fmaxf(a->z, b->z) };
+}
+
+
+static inline float ray_bvh_area(const ray_3f_t *min, const ray_3f_t *max)
+{
+	ray_3f_t	d = ray_3f_sub(max, min);
+
+	return 2.0f * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
+
+
+typedef struct ray_bvh_bin_t {
+	ray_3f_t	min, max;
+	unsigned	n_items;
+} ray_bvh_bin_t;
+
+
+static void ray_bvh_bin_add(ray_bvh_bin_t *bin, const ray_3f_t *min, const ray_3f_t *max)
+{
+	if (!bin->n_items) {
+		bin->min = *min;
+		bin->max = *max;
+	} else {
+		bin->min = ray_3f_min(&bin->min, min);
+		bin->max = ray_3f_max(&bin->max, max);
+	}
+
+	bin->n_items++;
+}
+
+
+static void ray_bvh_bin_merge(ray_bvh_bin_t *bin, const ray_bvh_bin_t *other)
+{
+	if (!other->n_items)
+		return;
+
+	if (!bin->n_items) {
+		*bin = *other;
+
+		return;
+	}
+
+	bin->min = ray_3f_min(&bin->min, &other->min);
+	bin->max = ray_3f_max(&bin->max, &other->max);
+	bin->n_items += other->n_items;
+}
+
+
+/* the SAH cost of the bin's items, sans the normalizing division by their parent's area */
+static float ray_bvh_bin_cost(const ray_bvh_bin_t *bin)
+{
+	return bin->n_items ? (float)bin->n_items * ray_bvh_area(&bin->min, &bin->max) : 0.0f;
+}
+
+
+static inline unsigned ray_bvh_bin_index(float centroid, float lo, float scale)
+{
+	unsigned	bin = (unsigned)((centroid - lo) * scale);
+
+	return bin < RAY_BVH_BINS ? bin : RAY_BVH_BINS - 1;
+}
+
+
+/* find the SAH-cheapest split of items along their centroid bounds' largest axis.
+ * returns the number of items to the left of the split after partitioning, 0 if leaving them unsplit is cheaper.
+ */
+static unsigned ray_bvh_split(ray_bvh_node_t *node, ray_bvh_item_t *items, unsigned n_items)
+{
+	ray_bvh_bin_t	bins[RAY_BVH_BINS] = {}, left = {}, right = {};
+	float		costs[RAY_BVH_BINS - 1];
+	ray_3f_t	cmin = items[0].centroid, cmax = items[0].centroid;
+	float		extent, lo, best_cost;
+	unsigned	axis = 0, best = 0, n_left = 0;
+
+	for (unsigned i = 1; i < n_items; i++) {
+		cmin = ray_3f_min(&cmin, &items[i].centroid);
+		cmax = ray_3f_max(&cmax, &items[i].centroid);
+	}
+
+	if (cmax.y - cmin.y > cmax.x - cmin.x)
+		axis = 1;
+
+	if (cmax.z - cmin.z > ray_3f_get(&cmax, axis) - ray_3f_get(&cmin, axis))
+		axis = 2;
+
+	lo = ray_3f_get(&cmin, axis);
+	extent = ray_3f_get(&cmax, axis) - lo;
+	if (extent <= 0.0f)
+		return 0;
+
+#define RAY_BVH_BIN(_item)	ray_bvh_bin_index(ray_3f_get(&(_item)->centroid, axis), lo, RAY_BVH_BINS / extent)
+	for (unsigned i = 0; i < n_items; i++)
+		ray_bvh_bin_add(&bins[RAY_BVH_BIN(&items[i])], &items[i].min, &items[i].max);
+
+	/* sweep from the right recording the right sides' costs, then from the left for the cheapest split */
+	for (unsigned i = RAY_BVH_BINS - 1; i > 0; i--) {
+		ray_bvh_bin_merge(&right, &bins[i]);
+		costs[i - 1] = ray_bvh_bin_cost(&right);
+	}
+
+	best_cost = INFINITY;
+	for (unsigned i = 0; i < RAY_BVH_BINS - 1; i++) {
+		float	cost;
+
+		ray_bvh_bin_merge(&left, &bins[i]);
+		cost = ray_bvh_bin_cost(&left) + costs[i];
+		if (cost < best_cost) {
+			best_cost = cost;
+			best = i;
+		}
+	}
+
+	best_cost = RAY_BVH_TRAVERSAL_COST + best_cost / ray_bvh_area(&node->min, &node->max);
+	if (n_items <= RAY_BVH_MAX_LEAF_SIZE && best_cost >= (float)n_items)
+		return 0;
+
+	/* partition the items about the chosen bin boundary */
+	for (unsigned i = 0, j = n_items; i < j;) {
+		if (RAY_BVH_BIN(&items[i]) <= best) {
+			i++;
+			n_left++;
+		} else {
+			ray_bvh_item_t	tmp = items[i];
+
+			items[i] = items[--j];
+			items[j] = tmp;
+		}
+	}
+#undef RAY_BVH_BIN
+
+	if (!n_left || n_left == n_items)
+		return 0;
+
+	return n_left;
+}
+
+
+static void ray_bvh_build(ray_bvh_t *bvh, unsigned node_idx, ray_bvh_item_t *items, unsigned first, unsigned n_items, unsigned depth)
+{
+	ray_bvh_node_t	*node = &bvh->nodes[node_idx];
+	unsigned	n_left = 0;
+
+	node->min = items[first].min;
+	node->max = items[first].max;
+	for (unsigned i = first + 1; i < first + n_items; i++) {
+		node->min = ray_3f_min(&node->min, &items[i].min);
+		node->max = ray_3f_max(&node->max, &items[i].max);
+	}
+
+	if (n_items > RAY_BVH_LEAF_SIZE) {
+		if (depth < RAY_BVH_MAX_DEPTH)
+			n_left = ray_bvh_split(node, &items[first], n_items);
+
+		/* there's no useful split, but this many objects in a leaf is worse than an arbitrary one */
+		if (!n_left && n_items > RAY_BVH_MAX_LEAF_SIZE)
+			n_left = n_items / 2;
+	}
+
+	if (!n_left) {
+		node->first = first;
+		node->n_objects = n_items;
+
+		return;
+	}
+
+	node->first = bvh->n_nodes;
+	node->n_objects = 0;
+	bvh->n_nodes += 2;
+
+	ray_bvh_build(bvh, node->first, items, first, n_left, depth + 1);
+	ray_bvh_build(bvh, node->first + 1, items, first + n_left, n_items - n_left, depth + 1);
+}
+
+
+/* Build a bvh over the prepared objects, which must remain unchanged while the bvh is in use,
+ * unless the bvh is refit with ray_bvh_refit() after changing them.
+ */
+ray_bvh_t * ray_bvh_new(ray_render_object_t *objects)
+{
+	unsigned		n_objects = 0, n_bounded = 0, n_unbounded = 0;
+	ray_render_object_t	*object;
+	ray_bvh_item_t		*items;
+	ray_bvh_t		*bvh;
+
+	for (object = objects; object->type; object++)
+		n_objects++;
+
+	bvh = calloc(1, sizeof(ray_bvh_t) +
+			(n_objects + 1) * sizeof(ray_render_object_t *) +
+			n_objects * sizeof(ray_render_object_t *) +
+			(n_objects ? 2 * n_objects - 1 : 0) * sizeof(ray_bvh_node_t));
+	if (!bvh)
+		return NULL;
+
+	items = malloc(n_objects * sizeof(ray_bvh_item_t) + 1);
+	if (!items) {
+		free(bvh);
+
+		return NULL;
+	}
+
+	bvh->nodes = (ray_bvh_node_t *)&bvh[1];
+	bvh->unbounded = (ray_render_object_t **)&bvh->nodes[n_objects ? 2 * n_objects - 1 : 0];
+	bvh->objects = &bvh->unbounded[n_objects + 1];
+
+	for (object = objects; object->type; object++) {
+		ray_bvh_item_t	*item = &items[n_bounded];
+
+		if (!ray_render_object_bounds(object, &item->min, &item->max)) {
+			bvh->unbounded[n_unbounded++] = object;
+			continue;
+		}
+
+		item->object = object;
+		item->centroid = ray_3f_add(&item->min, &item->max);
+		item->centroid = ray_3f_mult_scalar(&item->centroid, .5f);
+		n_bounded++;
+	}
+
+	if (n_bounded) {
+		bvh->n_nodes = 1;
+		ray_bvh_build(bvh, 0, items, 0, n_bounded, 0);
+
+		for (unsigned i = 0; i < n_bounded; i++)
+			bvh->objects[i] = items[i].object;
+	}
+
+	free(items);
+
+	return bvh;
+}
+
+
+/* Recompute the bounds of every node from the objects' current bounds, after they've moved.
+ * The tree's structure is kept as-is, so this is much cheaper than building a new bvh, but
+ * its quality degrades as the objects stray from where they were when it was built.
+ */
+void ray_bvh_refit(ray_bvh_t *bvh)
+{
+	for (unsigned i = bvh->n_nodes; i > 0; i--) {
+		ray_bvh_node_t	*node = &bvh->nodes[i - 1];
+
+		if (!node->n_objects) {
+			ray_bvh_node_t	*children = &bvh->nodes[node->first];
+
+			node->min = ray_3f_min(&children[0].min, &children[1].min);
+			node->max = ray_3f_max(&children[0].max, &children[1].max);
+
+			continue;
+		}
+
+		node->min = (ray_3f_t){ .x = FLT_MAX, .y = FLT_MAX, .z = FLT_MAX };
+		node->max = (ray_3f_t){ .x = -FLT_MAX, .y = -FLT_MAX, .z = -FLT_MAX };
+		for (unsigned j = 0; j < node->n_objects; j++) {
+			ray_3f_t	min, max;
+
+			/* ray_bvh_new() only puts bounded objects in leaves, an object losing its bounds just stops contributing */
+			if (!ray_render_object_bounds(bvh->objects[node->first + j], &min, &max))
+				continue;
+
+			node->min = ray_3f_min(&node->min, &min);
+			node->max = ray_3f_max(&node->max, &max);
+		}
+	}
+}
+
+
+void ray_bvh_free(ray_bvh_t *bvh)
+{
+	free(bvh);
+}
+
+
+/* compute the reciprocal of direction for the box tests, avoiding infinities as -ffast-math assumes there are none */
+static inline ray_3f_t ray_bvh_inv_direction(const ray_3f_t *direction)
+{
+	return (ray_3f_t){
+		.x = 1.0f / (fabsf(direction->x) > 1e-20f ? direction->x : copysignf(1e-20f, direction->x)),
+		.y = 1.0f / (fabsf(direction->y) > 1e-20f ? direction->y : copysignf(1e-20f, direction->y)),
+		.z = 1.0f / (fabsf(direction->z) > 1e-20f ? direction->z : copysignf(1e-20f, direction->z)),
+	};
+}
+
+
+/* Determine if the ray enters the node's box before max_distance, storing where in res_distance. */
+static inline int ray_bvh_node_intersects_ray(const ray_bvh_node_t *node, const ray_3f_t *origin, const ray_3f_t *inv_direction, float max_distance, float *res_distance)
+{
+	float	x0 = (node->min.x - origin->x) * inv_direction->x, x1 = (node->max.x - origin->x) * inv_direction->x;
+	float	y0 = (node->min.y - origin->y) * inv_direction->y, y1 = (node->max.y - origin->y) * inv_direction->y;
+	float	z0 = (node->min.z - origin->z) * inv_direction->z, z1 = (node->max.z - origin->z) * inv_direction->z;
+	float	near = fmaxf(fmaxf(fminf(x0, x1), fminf(y0, y1)), fmaxf(fminf(z0, z1), 0.0f));
+	float	far = fminf(fminf(fmaxf(x0, x1), fmaxf(y0, y1)), fminf(fmaxf(z0, z1), max_distance));
+
+	*res_distance = near;
+
+	return near <= far;
+}
+
+
+/* Find the nearest object intersected by ray, excluding reflector, storing the distance to it in res_distance. */
+ray_render_object_t * ray_bvh_nearest_intersection(ray_bvh_t *bvh, ray_render_object_t *reflector, ray_ray_t *ray, unsigned depth, float *res_distance)
+{
+	ray_render_object_t	*nearest_object = NULL;
+	float			nearest_object_distance = INFINITY;
+	unsigned		stack[RAY_BVH_STACK_SIZE], n_stack = 0;
+	float			stack_distance[RAY_BVH_STACK_SIZE];
+	ray_3f_t		inv_direction;
+	float			distance;
+
+	for (ray_render_object_t **object = bvh->unbounded; *object; object++) {
+		/* Don't bother checking if a reflected ray intersects the object reflecting it,
+		 * reflector = NULL for primary rays, which will never compare as true here. */
+		if (*object == reflector)
+			continue;
+
+		if (ray_render_object_intersects_ray(*object, depth, ray, &distance) &&
+		    distance < nearest_object_distance) {
+			nearest_object = *object;
+			nearest_object_distance = distance;
+		}
+	}
+
+	if (!bvh->n_nodes)
+		goto _out;
+
+	inv_direction = ray_bvh_inv_direction(&ray->direction);
+	if (!ray_bvh_node_intersects_ray(&bvh->nodes[0], &ray->origin, &inv_direction, nearest_object_distance, &distance))
+		goto _out;
+
+	stack[n_stack] = 0;
+	stack_distance[n_stack++] = distance;
+
+	while (n_stack) {
+		ray_bvh_node_t	*node;
+		float		d0, d1;
+		int		hit0, hit1;
+
+		n_stack--;
+		if (stack_distance[n_stack] > nearest_object_distance)
+			continue;
+
+		node = &bvh->nodes[stack[n_stack]];
+		if (node->n_objects) {
+			for (unsigned i = node->first; i < node->first + node->n_objects; i++) {
+				ray_render_object_t	*object = bvh->objects[i];
+
+				if (object == reflector)
+					continue;
+
+				if (ray_render_object_intersects_ray(object, depth, ray, &distance) &&
+				    distance < nearest_object_distance) {
+					nearest_object = object;
+					nearest_object_distance = distance;
+				}
+			}
+
+			continue;
+		}
+
+		/* push the farther child first so the nearer one is visited first */
+		hit0 = ray_bvh_node_intersects_ray(&bvh->nodes[node->first], &ray->origin, &inv_direction, nearest_object_distance, &d0);
+		hit1 = ray_bvh_node_intersects_ray(&bvh->nodes[node->first + 1], &ray->origin, &inv_direction, nearest_object_distance, &d1);
+		if (hit0 && hit1 && d0 < d1) {
+			stack[n_stack] = node->first + 1;
+			stack_distance[n_stack++] = d1;
+			hit1 = 0;
+		}
+
+		if (hit0) {
+			stack[n_stack] = node->first;
+			stack_distance[n_stack++] = d0;
+		}
+
+		if (hit1) {
+			stack[n_stack] = node->first + 1;
+			stack_distance[n_stack++] = d1;
+		}
+	}
+
+_out:
+	if (nearest_object)
+		*res_distance = nearest_object_distance;
+
+	return nearest_object;
+}
+
+
+/* Determine if the ray is obstructed by any object within the supplied distance. */
+int ray_bvh_is_obstructed(ray_bvh_t *bvh, ray_ray_t *ray, unsigned depth, float distance)
+{
+	unsigned	stack[RAY_BVH_STACK_SIZE], n_stack = 0;
+	ray_3f_t	inv_direction;
+	float		ood;
+
+	for (ray_render_object_t **object = bvh->unbounded; *object; object++) {
+		if (ray_render_object_intersects_ray(*object, depth, ray, &ood) &&
+		    ood < distance)
+			return 1;
+	}
+
+	if (!bvh->n_nodes)
+		return 0;
+
+	inv_direction = ray_bvh_inv_direction(&ray->direction);
+	stack[n_stack++] = 0;
+
+	while (n_stack) {
+		ray_bvh_node_t	*node = &bvh->nodes[stack[--n_stack]];
+
+		if (!ray_bvh_node_intersects_ray(node, &ray->origin, &inv_direction, distance, &ood))
+			continue;
+
+		if (!node->n_objects) {
+			stack[n_stack++] = node->first;
+			stack[n_stack++] = node->first + 1;
+
+			continue;
+		}
+
+		for (unsigned i = node->first; i < node->first + node->n_objects; i++) {
+			if (ray_render_object_intersects_ray(bvh->objects[i], depth, ray, &ood) &&
+			    ood < distance)
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+#if RAY_PACKET_SIZE
+/* ray_bvh_inv_direction() for a packet */
+static inline ray_packet_3f_t ray_bvh_inv_direction_packet(const ray_packet_3f_t *direction)
+{
+	ray_packet_3f_t	inv_direction;
+
+	for (unsigned i = 0; i < RAY_PACKET_SIZE; i++) {
+		ray_3f_t	lane = { .x = direction->x[i], .y = direction->y[i], .z = direction->z[i] };
+
+		lane = ray_bvh_inv_direction(&lane);
+		inv_direction.x[i] = lane.x;
+		inv_direction.y[i] = lane.y;
+		inv_direction.z[i] = lane.z;
+	}
+
+	return inv_direction;
+}
+
+
+/* ray_bvh_node_intersects_ray() for a packet, returns the mask of lanes entering the node's box before their max_distance */
+static inline ray_packet_mask_t ray_bvh_node_intersects_packet(const ray_bvh_node_t *node, const ray_packet_3f_t *origin, const ray_packet_3f_t *inv_direction, ray_packet_f_t max_distance)
+{
+	ray_packet_f_t	x0 = (node->min.x - origin->x) * inv_direction->x, x1 = (node->max.x - origin->x) * inv_direction->x;
+	ray_packet_f_t	y0 = (node->min.y - origin->y) * inv_direction->y, y1 = (node->max.y - origin->y) * inv_direction->y;
+	ray_packet_f_t	z0 = (node->min.z - origin->z) * inv_direction->z, z1 = (node->max.z - origin->z) * inv_direction->z;
+	ray_packet_f_t	near, far;
+
+	near = ray_packet_max(ray_packet_max(ray_packet_min(x0, x1), ray_packet_min(y0, y1)), ray_packet_max(ray_packet_min(z0, z1), ray_packet_f(0.0f)));
+	far = ray_packet_min(ray_packet_min(ray_packet_max(x0, x1), ray_packet_max(y0, y1)), ray_packet_min(ray_packet_max(z0, z1), max_distance));
+
+	return near <= far;
+}
+
+
+/* push the children of node, ordered so the one nearer along the first active lane's direction is visited first */
+static inline unsigned ray_bvh_push_children_packet(ray_bvh_t *bvh, ray_bvh_node_t *node, const ray_3f_t *direction, unsigned *stack, unsigned n_stack)
+{
+	ray_bvh_node_t	*a = &bvh->nodes[node->first], *b = &bvh->nodes[node->first + 1];
+	ray_3f_t	delta = ray_3f_add(&b->min, &b->max);
+
+	delta = ray_3f_sub(&delta, &a->min);
+	delta = ray_3f_sub(&delta, &a->max);
+
+	if (ray_3f_dot(&delta, direction) > 0.0f) {
+		stack[n_stack++] = node->first + 1;
+		stack[n_stack++] = node->first;
+	} else {
+		stack[n_stack++] = node->first;
+		stack[n_stack++] = node->first + 1;
+	}
+
+	return n_stack;
+}
+
+
+static inline ray_3f_t ray_bvh_packet_first_direction(ray_packet_t *packet, ray_packet_mask_t active)
+{
+	unsigned	i;
+
+	for (i = 0; i < RAY_PACKET_SIZE - 1 && !active[i]; i++);
+
+	return (ray_3f_t){ .x = packet->direction.x[i], .y = packet->direction.y[i], .z = packet->direction.z[i] };
+}
+
+
+/* update the nearest intersections of packet with object */
+static inline void ray_bvh_nearest_intersection_packet_object(ray_render_object_t *object, ray_packet_t *packet, unsigned depth, ray_packet_f_t *nearest, ray_render_object_t **res_objects)
+{
+	ray_packet_f_t		distance;
+	ray_packet_mask_t	hit;
+
+	hit = ray_render_object_intersects_packet(object, depth, packet, &distance);
+	hit &= distance < *nearest;
+	if (!ray_packet_any(hit))
+		return;
+
+	*nearest = ray_packet_select(hit, distance, *nearest);
+	for (unsigned i = 0; i < RAY_PACKET_SIZE; i++) {
+		if (hit[i])
+			res_objects[i] = object;
+	}
+}
+
+
+/* Find the nearest objects intersected by the active rays of packet, storing them in res_objects and their
+ * distances in res_distances.  Inactive lanes and lanes without an intersection get NULL objects.
+ * Unlike ray_bvh_nearest_intersection(), there's no reflector exclusion, this is intended for primary rays.
+ */
+void ray_bvh_nearest_intersection_packet(ray_bvh_t *bvh, ray_packet_t *packet, ray_packet_mask_t active, unsigned depth, ray_render_object_t **res_objects, ray_packet_f_t *res_distances)
+{
+	ray_packet_f_t		nearest = ray_packet_select(active, ray_packet_f(INFINITY), ray_packet_f(-1.0f));
+	unsigned		stack[RAY_BVH_STACK_SIZE], n_stack = 0;
+	ray_packet_3f_t		inv_direction;
+	ray_3f_t		first_direction;
+
+	for (unsigned i = 0; i < RAY_PACKET_SIZE; i++)
+		res_objects[i] = NULL;
+
+	for (ray_render_object_t **object = bvh->unbounded; *object; object++)
+		ray_bvh_nearest_intersection_packet_object(*object, packet, depth, &nearest, res_objects);
+
+	if (!bvh->n_nodes)
+		goto _out;
+
+	inv_direction = ray_bvh_inv_direction_packet(&packet->direction);
+	first_direction = ray_bvh_packet_first_direction(packet, active);
+	stack[n_stack++] = 0;
+
+	while (n_stack) {
+		ray_bvh_node_t	*node = &bvh->nodes[stack[--n_stack]];
+
+		if (!ray_packet_any(ray_bvh_node_intersects_packet(node, &packet->origin, &inv_direction, nearest)))
+			continue;
+
+		if (!node->n_objects) {
+			n_stack = ray_bvh_push_children_packet(bvh, node, &first_direction, stack, n_stack);
+
+			continue;
+		}
+
+		for (unsigned i = node->first; i < node->first + node->n_objects; i++)
+			ray_bvh_nearest_intersection_packet_object(bvh->objects[i], packet, depth, &nearest, res_objects);
+	}
+
+_out:
+	*res_distances = nearest;
+}
+
+
+/* accumulate the active lanes of packet obstructed by object into obstructed, deactivating them.
+ * returns nonzero while any lanes remain active.
+ */
+static inline int ray_bvh_is_obstructed_packet_object(ray_render_object_t *object, ray_packet_t *packet, unsigned depth, ray_packet_f_t distances, ray_packet_mask_t *active, ray_packet_mask_t *obstructed)
+{
+	ray_packet_f_t	distance;
+
+	*obstructed |= *active & ray_render_object_intersects_packet(object, depth, packet, &distance) & (distance < distances);
+	*active &= ~*obstructed;
+
+	return ray_packet_any(*active);
+}
+
+
+/* Determine which of the active rays of packet are obstructed by any object within their distances. */
+ray_packet_mask_t ray_bvh_is_obstructed_packet(ray_bvh_t *bvh, ray_packet_t *packet, ray_packet_mask_t active, unsigned depth, ray_packet_f_t distances)
+{
+	ray_packet_mask_t	obstructed = {};
+	unsigned		stack[RAY_BVH_STACK_SIZE], n_stack = 0;
+	ray_packet_3f_t		inv_direction;
+	ray_3f_t		first_direction;
+
+	if (!ray_packet_any(active))
+		return obstructed;
+
+	for (ray_render_object_t **object = bvh->unbounded; *object; object++) {
+		if (!ray_bvh_is_obstructed_packet_object(*object, packet, depth, distances, &active, &obstructed))
+			return obstructed;
+	}
+
+	if (!bvh->n_nodes)
+		return obstructed;
+
+	inv_direction = ray_bvh_inv_direction_packet(&packet->direction);
+	first_direction = ray_bvh_packet_first_direction(packet, active);
+	stack[n_stack++] = 0;
+
+	while (n_stack) {
+		ray_bvh_node_t	*node = &bvh->nodes[stack[--n_stack]];
+
+		if (!ray_packet_any(ray_bvh_node_intersects_packet(node, &packet->origin, &inv_direction, ray_packet_select(active, distances, ray_packet_f(-1.0f)))))
+			continue;
+
+		if (!node->n_objects) {
+			n_stack = ray_bvh_push_children_packet(bvh, node, &first_direction, stack, n_stack);
+
+			continue;
+		}
+
+		for (unsigned i = node->first; i < node->first + node->n_objects; i++) {
+			if (!ray_bvh_is_obstructed_packet_object(bvh->objects[i], packet, depth, distances, &active, &obstructed))
+				return obstructed;
+		}
+	}
+
+	return obstructed;
+}
+#endif
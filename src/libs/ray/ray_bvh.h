@@ -0,0 +1,20 @@
+#ifndef _RAY_BVH_H
+#define _RAY_BVH_H
+
+#include "ray_packet.h"
+#include "ray_ray.h"
+#include "ray_render_object.h"
+
+typedef struct ray_bvh_t ray_bvh_t;
+
+ray_bvh_t * ray_bvh_new(ray_render_object_t *objects);
+void ray_bvh_refit(ray_bvh_t *bvh);
+void ray_bvh_free(ray_bvh_t *bvh);
+ray_render_object_t * ray_bvh_nearest_intersection(ray_bvh_t *bvh, ray_render_object_t *reflector, ray_ray_t *ray, unsigned depth, float *res_distance);
+int ray_bvh_is_obstructed(ray_bvh_t *bvh, ray_ray_t *ray, unsigned depth, float distance);
+#if RAY_PACKET_SIZE
+void ray_bvh_nearest_intersection_packet(ray_bvh_t *bvh, ray_packet_t *packet, ray_packet_mask_t active, unsigned depth, ray_render_object_t **res_objects, ray_packet_f_t *res_distances);
+ray_packet_mask_t ray_bvh_is_obstructed_packet(ray_bvh_t *bvh, ray_packet_t *packet, ray_packet_mask_t active, unsigned depth, ray_packet_f_t distances);
+#endif
+
+#endif
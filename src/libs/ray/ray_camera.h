@@ -52,6 +52,18 @@ void ray_camera_frame_prepare(const ray_camera_t *camera, unsigned frame_width,
 void ray_camera_fragment_begin(ray_camera_frame_t *frame, til_fb_fragment_t *fb_fragment, ray_ray_t *res_ray, ray_camera_fragment_t *res_fragment);
 
 
+/* Produce the ray through frame coordinate x,y, which needn't be integral when sampling within pixels. */
+/* This is for sampling arbitrarily, the fragment stepping functions are cheaper for visiting every pixel. */
+static inline void ray_camera_frame_ray(const ray_camera_frame_t *frame, float x, float y, ray_ray_t *res_ray)
+{
+	ray_3f_t	w = ray_3f_lerp(&frame->nw, &frame->sw, frame->y_delta * y);
+	ray_3f_t	e = ray_3f_lerp(&frame->ne, &frame->se, frame->y_delta * y);
+
+	res_ray->origin = frame->camera->position;
+	res_ray->direction = ray_3f_nlerp(&w, &e, frame->x_delta * x);
+}
+
+
 /* Step the ray through the fragment on the x axis, returns 1 when rays remain on this axis, 0 at the end. */
 /* When 1 is returned, fragment->ray is left pointing through the new coordinate. */
 static inline int ray_camera_fragment_x_step(ray_camera_fragment_t *fragment)
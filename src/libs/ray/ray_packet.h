@@ -0,0 +1,120 @@
+#ifndef _RAY_PACKET_H
+#define _RAY_PACKET_H
+
+#include <math.h>
+#include <stdint.h>
+
+#include "ray_3f.h"
+#include "ray_ray.h"
+
+/* Packets of coherent rays traced together, a ray per SIMD lane.
+ *
+ * These use the compiler's vector extensions rather than intrinsics, so the
+ * packet size follows whatever the target supports, and RAY_PACKET_SIZE is 0
+ * when there's no vector support at all, leaving only the scalar paths.
+ */
+#if defined(__GNUC__) && defined(__AVX__)
+#define RAY_PACKET_SIZE		8
+#elif defined(__GNUC__) && (defined(__SSE2__) || defined(__ARM_NEON))
+#define RAY_PACKET_SIZE		4
+#else
+#define RAY_PACKET_SIZE		0
+#endif
+
+#if RAY_PACKET_SIZE
+
+typedef float ray_packet_f_t __attribute__((vector_size(RAY_PACKET_SIZE * sizeof(float))));
+typedef int32_t ray_packet_mask_t __attribute__((vector_size(RAY_PACKET_SIZE * sizeof(int32_t))));	/* lanes are 0 or -1 */
+
+typedef struct ray_packet_3f_t {
+	ray_packet_f_t	x, y, z;
+} ray_packet_3f_t;
+
+typedef struct ray_packet_t {
+	ray_packet_3f_t	origin;
+	ray_packet_3f_t	direction;
+} ray_packet_t;
+
+
+/* return f in every lane */
+static inline ray_packet_f_t ray_packet_f(float f)
+{
+	return (ray_packet_f_t){} + f;
+}
+
+
+/* return a where mask is set, b elsewhere */
+static inline ray_packet_f_t ray_packet_select(ray_packet_mask_t mask, ray_packet_f_t a, ray_packet_f_t b)
+{
+	return (ray_packet_f_t)((mask & (ray_packet_mask_t)a) | (~mask & (ray_packet_mask_t)b));
+}
+
+
+static inline ray_packet_f_t ray_packet_min(ray_packet_f_t a, ray_packet_f_t b)
+{
+	return ray_packet_select(a < b, a, b);
+}
+
+
+static inline ray_packet_f_t ray_packet_max(ray_packet_f_t a, ray_packet_f_t b)
+{
+	return ray_packet_select(a > b, a, b);
+}
+
+
+static inline ray_packet_f_t ray_packet_sqrt(ray_packet_f_t v)
+{
+	for (unsigned i = 0; i < RAY_PACKET_SIZE; i++)
+		v[i] = sqrtf(v[i]);
+
+	return v;
+}
+
+
+/* return if any lane of mask is set */
+static inline int ray_packet_any(ray_packet_mask_t mask)
+{
+	int32_t	any = 0;
+
+	for (unsigned i = 0; i < RAY_PACKET_SIZE; i++)
+		any |= mask[i];
+
+	return any;
+}
+
+
+/* return v in every lane */
+static inline ray_packet_3f_t ray_packet_3f(const ray_3f_t *v)
+{
+	return (ray_packet_3f_t){ .x = ray_packet_f(v->x), .y = ray_packet_f(v->y), .z = ray_packet_f(v->z) };
+}
+
+
+/* return the result of (a - b) */
+static inline ray_packet_3f_t ray_packet_3f_sub(const ray_packet_3f_t *a, const ray_packet_3f_t *b)
+{
+	return (ray_packet_3f_t){ .x = a->x - b->x, .y = a->y - b->y, .z = a->z - b->z };
+}
+
+
+/* return the result of (a . b) */
+static inline ray_packet_f_t ray_packet_3f_dot(const ray_packet_3f_t *a, const ray_packet_3f_t *b)
+{
+	return a->x * b->x + a->y * b->y + a->z * b->z;
+}
+
+
+/* store ray in lane of packet */
+static inline void ray_packet_set_ray(ray_packet_t *packet, unsigned lane, const ray_ray_t *ray)
+{
+	packet->origin.x[lane] = ray->origin.x;
+	packet->origin.y[lane] = ray->origin.y;
+	packet->origin.z[lane] = ray->origin.z;
+	packet->direction.x[lane] = ray->direction.x;
+	packet->direction.y[lane] = ray->direction.y;
+	packet->direction.z[lane] = ray->direction.z;
+}
+
+#endif /* RAY_PACKET_SIZE */
+
+#endif
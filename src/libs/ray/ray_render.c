@@ -1,17 +1,26 @@
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 
 #include "til_fb.h"
+#include "til_util.h"
 
+#include "ray_bvh.h"
 #include "ray_camera.h"
 #include "ray_color.h"
 #include "ray_gamma.h"
+#include "ray_packet.h"
+#include "ray_render.h"
 #include "ray_render_object.h"
 #include "ray_ray.h"
 #include "ray_scene.h"
 
 #define MAX_RECURSION_DEPTH	4
 #define MIN_RELEVANCE		0.05f
+#define MAX_PACKET_LIGHTS	8	/* scenes with more lights trace shadows of primary rays individually */
+#define ADAPTIVE_STEP		8	/* coarsest adaptive sampling grid in pixels, a power of 2 */
+#define ADAPTIVE_THRESHOLD	.05f	/* samples differing by more than this in any channel get subdivided */
+#define PROGRESSIVE_CONVERGED	4	/* refinement level where progressive sampling is complete: log2(ADAPTIVE_STEP) + 1 */
 
 typedef struct ray_render_t {
 	const ray_scene_t	*scene;		/* scene being rendered */
@@ -20,28 +29,17 @@ typedef struct ray_render_t {
 	ray_color_t		ambient_light;
 	ray_camera_frame_t	frame;
 	ray_gamma_t		gamma;
+	ray_bvh_t		*bvh;		/* spatial index of objects */
+	unsigned		n_lights;
+	unsigned		frame_width, frame_height;
+
+	ray_render_sampling_t	sampling;
+	unsigned		refinement;	/* progressive refinement level, restarted by changes */
+	uint32_t		*converged;	/* progressively refined frame, reused once complete */
 
 	ray_render_object_t	objects[];
 } ray_render_t;
 
-/* Determine if the ray is obstructed by an object within the supplied distance, for shadows */
-static inline int ray_is_obstructed(ray_render_t *render, unsigned depth, ray_ray_t *ray, float distance)
-{
-	ray_render_object_t	*object;
-
-	for (object = render->objects; object->type; object++) {
-		float	ood;
-
-		if (ray_render_object_intersects_ray(object, depth, ray, &ood) &&
-		    ood < distance) {
-			return 1;
-		}
-	}
-
-	return 0;
-}
-
-
 /* shadow test */
 static inline int point_is_shadowed(ray_render_t *render, unsigned depth, ray_3f_t *light_direction, float distance, ray_3f_t *point)
 {
@@ -50,7 +48,7 @@ static inline int point_is_shadowed(ray_render_t *render, unsigned depth, ray_3f
 	shadow_ray.direction = *light_direction;
 	shadow_ray.origin = *point;
 
-	if (ray_is_obstructed(render, depth + 1, &shadow_ray, distance))
+	if (ray_bvh_is_obstructed(render->bvh, &shadow_ray, depth + 1, distance))
 		return 1;
 
 	return 0;
@@ -67,22 +65,25 @@ static inline float approx_powf(float x, float y)
 }
 
 
-/* Determine the color @ distance on ray on object viewed from origin */
-static inline ray_color_t shade_intersection(ray_render_t *render, ray_render_object_t *object, ray_ray_t *ray, ray_3f_t *intersection, ray_3f_t *normal, unsigned depth, float *res_reflectivity)
+/* Determine the color @ distance on ray on object viewed from origin.
+ * When shadowed is non-NULL it has the already determined shadowing per light.
+ */
+static inline ray_color_t shade_intersection(ray_render_t *render, ray_render_object_t *object, ray_ray_t *ray, ray_3f_t *intersection, ray_3f_t *normal, unsigned depth, const int *shadowed, float *res_reflectivity)
 {
 	ray_surface_t	surface = ray_render_object_surface(object, intersection);
 	ray_color_t	color = ray_3f_mult(&surface.color, &render->ambient_light);
 	ray_object_t	*light;
+	unsigned	i;
 
 	/* visit lights for shadows and illumination */
-	for (light = render->scene->lights; light->type; light++) {
+	for (i = 0, light = render->scene->lights; light->type; light++, i++) {
 		ray_3f_t	lvec = ray_3f_sub(&light->light.emitter.point.center, intersection);
 		float		ldist = ray_3f_length(&lvec);
 		float		lvec_normal_dot;
 
 		lvec = ray_3f_mult_scalar(&lvec, (1.0f / ldist)); /* normalize lvec */
 #if 1
-		if (point_is_shadowed(render, depth, &lvec, ldist, intersection))
+		if (shadowed ? shadowed[i] : point_is_shadowed(render, depth, &lvec, ldist, intersection))
 			continue;
 #endif
 		lvec_normal_dot = ray_3f_dot(normal, &lvec);
@@ -123,38 +124,10 @@ static inline ray_color_t shade_intersection(ray_render_t *render, ray_render_ob
 }
 
 
-static inline ray_render_object_t * find_nearest_intersection(ray_render_t *render, ray_render_object_t *reflector, ray_ray_t *ray, unsigned depth, float *res_distance)
-{
-	ray_render_object_t	*nearest_object = NULL;
-	float			nearest_object_distance = INFINITY;
-	ray_render_object_t	*object;
-
-	for (object = render->objects; object->type; object++) {
-		float		distance;
-
-		/* Don't bother checking if a reflected ray intersects the object reflecting it,
-		 * reflector = NULL for primary rays, which will never compare as true here. */
-		if (object == reflector)
-			continue;
-
-		/* Does this ray intersect object? */
-		if (ray_render_object_intersects_ray(object, depth, ray, &distance)) {
-			/* Is it the nearest intersection? */
-			if (distance < nearest_object_distance) {
-				nearest_object = object;
-				nearest_object_distance = distance;
-			}
-		}
-	}
-
-	if (nearest_object)
-		*res_distance = nearest_object_distance;
-
-	return nearest_object;
-}
-
-
-static inline ray_color_t trace_ray(ray_render_t *render, ray_ray_t *primary_ray)
+/* Trace primary_ray, whose nearest intersection has already been found by the caller (NULL nearest_object for none).
+ * When shadowed is non-NULL it has the shadowing per light at the nearest intersection, see shade_intersection().
+ */
+static inline ray_color_t trace_ray(ray_render_t *render, ray_ray_t *primary_ray, ray_render_object_t *nearest_object, float nearest_distance, const int *shadowed)
 {
 	ray_color_t		color = { .x = 0.0f, .y = 0.0f, .z = 0.0f };
 	ray_3f_t		intersection, normal;
@@ -164,22 +137,26 @@ static inline ray_color_t trace_ray(ray_render_t *render, ray_ray_t *primary_ray
 	ray_ray_t		reflected_ray, *ray = primary_ray;
 
 	do {
-		ray_render_object_t	*nearest_object;
-		float			nearest_distance;
-
 		if (reflector) {
 			float		dot = ray_3f_dot(&ray->direction, &normal);
 			ray_3f_t	new_direction = ray_3f_mult_scalar(&normal, dot * 2.0f);
 
 			new_direction = ray_3f_sub(&ray->direction, &new_direction);
 
+			/* the intersection tests assume unit directions, and the normals aren't precisely unit
+			 * length, so renormalize to keep the error from compounding with every reflection.
+			 */
+			new_direction = ray_3f_normalize(&new_direction);
+
 			reflected_ray.origin = intersection;
 			reflected_ray.direction = new_direction;
 
 			ray = &reflected_ray;
+
+			nearest_object = ray_bvh_nearest_intersection(render->bvh, reflector, ray, depth, &nearest_distance);
+			shadowed = NULL;
 		}
 
-		nearest_object = find_nearest_intersection(render, reflector, ray, depth, &nearest_distance);
 		if (nearest_object) {
 			ray_3f_t	more_color;
 			ray_3f_t	rvec;
@@ -188,7 +165,7 @@ static inline ray_color_t trace_ray(ray_render_t *render, ray_ray_t *primary_ray
 			intersection = ray_3f_add(&ray->origin, &rvec);
 			normal = ray_render_object_normal(nearest_object, &intersection);
 
-			more_color = shade_intersection(render, nearest_object, ray, &intersection, &normal, depth, &reflectivity);
+			more_color = shade_intersection(render, nearest_object, ray, &intersection, &normal, depth, shadowed, &reflectivity);
 			more_color = ray_3f_mult_scalar(&more_color, relevance);
 			color = ray_3f_add(&color, &more_color);
 		}
@@ -200,7 +177,85 @@ static inline ray_color_t trace_ray(ray_render_t *render, ray_ray_t *primary_ray
 }
 
 
-void ray_render_trace_fragment(ray_render_t *render, til_fb_fragment_t *fb_fragment)
+#if RAY_PACKET_SIZE
+/* Trace the first n_rays of rays as a packet, storing the resulting pixels in buf.
+ * The primary rays and their shadow rays are traced together, reflections are traced individually.
+ */
+static void trace_packet(ray_render_t *render, ray_ray_t *rays, unsigned n_rays, uint32_t *buf)
+{
+	ray_render_object_t	*nearest_objects[RAY_PACKET_SIZE];
+	int			shadowed[RAY_PACKET_SIZE][MAX_PACKET_LIGHTS];
+	ray_packet_f_t		nearest_distances;
+	ray_packet_mask_t	active = {};
+	ray_packet_t		packet;
+
+	for (unsigned i = 0; i < RAY_PACKET_SIZE; i++) {
+		ray_packet_set_ray(&packet, i, &rays[i < n_rays ? i : 0]);
+		active[i] = i < n_rays ? -1 : 0;
+	}
+
+	ray_bvh_nearest_intersection_packet(render->bvh, &packet, active, 0, nearest_objects, &nearest_distances);
+
+	if (render->n_lights <= MAX_PACKET_LIGHTS) {
+		ray_packet_t	shadow_packet = packet;	/* inactive lanes are left with harmless values */
+		ray_object_t	*light;
+		unsigned	l;
+
+		/* the shadow rays originate from the intersections, derived exactly as trace_ray() and shade_intersection() do */
+		for (unsigned i = 0; i < RAY_PACKET_SIZE; i++) {
+			ray_3f_t	rvec, intersection;
+
+			active[i] = nearest_objects[i] ? -1 : 0;
+			if (!nearest_objects[i])
+				continue;
+
+			rvec = ray_3f_mult_scalar(&rays[i].direction, nearest_distances[i]);
+			intersection = ray_3f_add(&rays[i].origin, &rvec);
+			shadow_packet.origin.x[i] = intersection.x;
+			shadow_packet.origin.y[i] = intersection.y;
+			shadow_packet.origin.z[i] = intersection.z;
+		}
+
+		for (l = 0, light = render->scene->lights; light->type; light++, l++) {
+			ray_packet_f_t		ldists = {};
+			ray_packet_mask_t	obstructed;
+
+			for (unsigned i = 0; i < RAY_PACKET_SIZE; i++) {
+				ray_3f_t	intersection, lvec;
+				float		ldist;
+
+				if (!active[i])
+					continue;
+
+				intersection = (ray_3f_t){ .x = shadow_packet.origin.x[i], .y = shadow_packet.origin.y[i], .z = shadow_packet.origin.z[i] };
+				lvec = ray_3f_sub(&light->light.emitter.point.center, &intersection);
+				ldist = ray_3f_length(&lvec);
+				lvec = ray_3f_mult_scalar(&lvec, (1.0f / ldist));
+
+				shadow_packet.direction.x[i] = lvec.x;
+				shadow_packet.direction.y[i] = lvec.y;
+				shadow_packet.direction.z[i] = lvec.z;
+				ldists[i] = ldist;
+			}
+
+			obstructed = ray_bvh_is_obstructed_packet(render->bvh, &shadow_packet, active, 1, ldists);
+			for (unsigned i = 0; i < RAY_PACKET_SIZE; i++)
+				shadowed[i][l] = !!obstructed[i];
+		}
+	}
+
+	for (unsigned i = 0; i < n_rays; i++) {
+		ray_color_t	color;
+
+		color = trace_ray(render, &rays[i], nearest_objects[i], nearest_distances[i], render->n_lights <= MAX_PACKET_LIGHTS ? shadowed[i] : NULL);
+		buf[i] = ray_gamma_color_to_uint32_rgb(&render->gamma, color);
+	}
+}
+#endif
+
+
+/* trace a ray through every pixel of the fragment */
+static void trace_fragment(ray_render_t *render, til_fb_fragment_t *fb_fragment)
 {
 	uint32_t		*buf = fb_fragment->buf;
 	ray_camera_fragment_t	fragment;
@@ -208,17 +263,283 @@ void ray_render_trace_fragment(ray_render_t *render, til_fb_fragment_t *fb_fragm
 
 	ray_camera_fragment_begin(&render->frame, fb_fragment, &ray, &fragment);
 	do {
+#if RAY_PACKET_SIZE
+		/* primary rays are coherent along the rows, so they're gathered into packets there */
+		ray_ray_t	rays[RAY_PACKET_SIZE];
+		unsigned	n_rays;
+		int		more;
+
+		do {
+			for (n_rays = 0, more = 1; n_rays < RAY_PACKET_SIZE && more;) {
+				rays[n_rays++] = ray;
+				more = ray_camera_fragment_x_step(&fragment);
+			}
+
+			trace_packet(render, rays, n_rays, buf);
+			buf += n_rays;
+		} while (more);
+#else
 		do {
-			*buf = ray_gamma_color_to_uint32_rgb(&render->gamma, trace_ray(render, &ray));
+			ray_render_object_t	*nearest_object;
+			float			nearest_distance;
+
+			nearest_object = ray_bvh_nearest_intersection(render->bvh, NULL, &ray, 0, &nearest_distance);
+			*buf = ray_gamma_color_to_uint32_rgb(&render->gamma, trace_ray(render, &ray, nearest_object, nearest_distance, NULL));
 			buf++;
 		} while (ray_camera_fragment_x_step(&fragment));
-
+#endif
 		buf += fb_fragment->stride;
 	} while (ray_camera_fragment_y_step(&fragment));
 }
 
 
-/* prepare the scene for rendering with camera, must be called whenever anything in the scene+camera pair has been changed. */
+/* trace the ray through frame coordinate x,y, returning its color clamped for display, and what it hit in res_object */
+static ray_color_t trace_sample(ray_render_t *render, float x, float y, ray_render_object_t **res_object)
+{
+	ray_render_object_t	*nearest_object;
+	float			nearest_distance;
+	ray_color_t		color;
+	ray_ray_t		ray;
+
+	ray_camera_frame_ray(&render->frame, x, y, &ray);
+	nearest_object = ray_bvh_nearest_intersection(render->bvh, NULL, &ray, 0, &nearest_distance);
+	color = trace_ray(render, &ray, nearest_object, nearest_distance, NULL);
+
+	*res_object = nearest_object;
+
+	return (ray_color_t){ .x = fminf(color.x, 1.0f), .y = fminf(color.y, 1.0f), .z = fminf(color.z, 1.0f) };
+}
+
+
+/* An ADAPTIVE_STEP-sized square block of a fragment being adaptively sampled.
+ * The samples lie on the block's pixels, plus the row and column beyond which are
+ * shared with the neighboring blocks, and are only traced when first needed.
+ */
+typedef struct adaptive_block_t {
+	ray_render_t		*render;
+	til_fb_fragment_t	*fb_fragment;
+	uint32_t		*converged;	/* also store the pixels here when non-NULL */
+	unsigned		x, y;		/* position of block within fb_fragment */
+	unsigned		min_step;	/* cells this size are interpolated even when their samples differ */
+	unsigned		supersample:1;	/* supersample single pixel cells whose samples differ */
+
+	uint8_t			traced[ADAPTIVE_STEP + 1][ADAPTIVE_STEP + 1];
+	ray_color_t		colors[ADAPTIVE_STEP + 1][ADAPTIVE_STEP + 1];
+	ray_render_object_t	*objects[ADAPTIVE_STEP + 1][ADAPTIVE_STEP + 1];
+} adaptive_block_t;
+
+
+static void adaptive_sample(adaptive_block_t *block, unsigned i, unsigned j)
+{
+	if (block->traced[j][i])
+		return;
+
+	block->colors[j][i] = trace_sample(block->render,
+					   (float)(block->fb_fragment->x + block->x + i),
+					   (float)(block->fb_fragment->y + block->y + j),
+					   &block->objects[j][i]);
+	block->traced[j][i] = 1;
+}
+
+
+/* determine if the corner samples of the cell at i,j sized s differ enough to subdivide it */
+static int adaptive_differ(adaptive_block_t *block, unsigned i, unsigned j, unsigned s)
+{
+	ray_color_t	*c = &block->colors[j][i], *corners[3] = { &block->colors[j][i + s], &block->colors[j + s][i], &block->colors[j + s][i + s] };
+	ray_color_t	min = *c, max = *c;
+
+	/* different objects meeting is always an edge, no matter how similar their colors */
+	if (block->objects[j][i] != block->objects[j][i + s] ||
+	    block->objects[j][i] != block->objects[j + s][i] ||
+	    block->objects[j][i] != block->objects[j + s][i + s])
+		return 1;
+
+	for (unsigned n = 0; n < 3; n++) {
+		min = (ray_color_t){ .x = fminf(min.x, corners[n]->x), .y = fminf(min.y, corners[n]->y), .z = fminf(min.z, corners[n]->z) };
+		max = (ray_color_t){ .x = fmaxf(max.x, corners[n]->x), .y = fmaxf(max.y, corners[n]->y), .z = fmaxf(max.z, corners[n]->z) };
+	}
+
+	return (max.x - min.x > ADAPTIVE_THRESHOLD || max.y - min.y > ADAPTIVE_THRESHOLD || max.z - min.z > ADAPTIVE_THRESHOLD);
+}
+
+
+static void adaptive_put(adaptive_block_t *block, unsigned i, unsigned j, ray_color_t color)
+{
+	til_fb_fragment_t	*fb_fragment = block->fb_fragment;
+	unsigned		x = block->x + i, y = block->y + j;
+	uint32_t		pixel;
+
+	pixel = ray_gamma_color_to_uint32_rgb(&block->render->gamma, color);
+	fb_fragment->buf[y * fb_fragment->pitch + x] = pixel;
+
+	if (block->converged)
+		block->converged[(fb_fragment->y + y) * block->render->frame_width + fb_fragment->x + x] = pixel;
+}
+
+
+/* fill the cell at i,j sized s by interpolating its corner samples */
+static void adaptive_fill(adaptive_block_t *block, unsigned i, unsigned j, unsigned s)
+{
+	unsigned	width = MIN(s, block->fb_fragment->width - (block->x + i));
+	unsigned	height = MIN(s, block->fb_fragment->height - (block->y + j));
+	float		inv_s = 1.0f / (float)s;
+
+	for (unsigned v = 0; v < height; v++) {
+		ray_color_t	w = ray_3f_lerp(&block->colors[j][i], &block->colors[j + s][i], (float)v * inv_s);
+		ray_color_t	e = ray_3f_lerp(&block->colors[j][i + s], &block->colors[j + s][i + s], (float)v * inv_s);
+
+		for (unsigned u = 0; u < width; u++)
+			adaptive_put(block, i + u, j + v, ray_3f_lerp(&w, &e, (float)u * inv_s));
+	}
+}
+
+
+/* average the sample of the pixel at i,j with four more rays within it */
+static void adaptive_supersample(adaptive_block_t *block, unsigned i, unsigned j)
+{
+	float			x = (float)(block->fb_fragment->x + block->x + i);
+	float			y = (float)(block->fb_fragment->y + block->y + j);
+	ray_color_t		color = block->colors[j][i];
+	ray_render_object_t	*object;
+
+	for (unsigned n = 0; n < 4; n++) {
+		ray_color_t	sample = trace_sample(block->render, x + (n & 1 ? .25f : -.25f), y + (n & 2 ? .25f : -.25f), &object);
+
+		color = ray_3f_add(&color, &sample);
+	}
+
+	adaptive_put(block, i, j, ray_3f_mult_scalar(&color, 1.0f / 5.0f));
+}
+
+
+/* render the cell at i,j sized s from its corner samples, recursively subdividing it where they differ */
+static void adaptive_cell(adaptive_block_t *block, unsigned i, unsigned j, unsigned s)
+{
+	/* blocks on the fragment's edges may be partially outside of it */
+	if (block->x + i >= block->fb_fragment->width || block->y + j >= block->fb_fragment->height)
+		return;
+
+	adaptive_sample(block, i, j);
+	adaptive_sample(block, i + s, j);
+	adaptive_sample(block, i, j + s);
+	adaptive_sample(block, i + s, j + s);
+
+	if ((s > block->min_step || (s == 1 && block->supersample)) && adaptive_differ(block, i, j, s)) {
+		unsigned	h = s >> 1;
+
+		if (!h) {
+			adaptive_supersample(block, i, j);
+
+			return;
+		}
+
+		adaptive_cell(block, i, j, h);
+		adaptive_cell(block, i + h, j, h);
+		adaptive_cell(block, i, j + h, h);
+		adaptive_cell(block, i + h, j + h, h);
+
+		return;
+	}
+
+	adaptive_fill(block, i, j, s);
+}
+
+
+/* Trace a coarse grid of rays through the fragment, subdividing cells where they differ down to min_step
+ * and interpolating the rest, which is much cheaper for the smooth regions typical of these scenes.
+ * When supersample is set, single pixels still on edges are anti-aliased with more rays.
+ */
+static void trace_fragment_adaptive(ray_render_t *render, til_fb_fragment_t *fb_fragment, unsigned min_step, unsigned supersample, uint32_t *converged)
+{
+	adaptive_block_t	block = {
+					.render = render,
+					.fb_fragment = fb_fragment,
+					.converged = converged,
+					.min_step = min_step,
+					.supersample = supersample,
+				};
+
+	for (block.y = 0; block.y < fb_fragment->height; block.y += ADAPTIVE_STEP) {
+		for (block.x = 0; block.x < fb_fragment->width; block.x += ADAPTIVE_STEP) {
+			memset(block.traced, 0, sizeof(block.traced));
+			adaptive_cell(&block, 0, 0, ADAPTIVE_STEP);
+		}
+	}
+}
+
+
+/* copy the fragment from the completely refined progressive frame */
+static void copy_converged(ray_render_t *render, til_fb_fragment_t *fb_fragment)
+{
+	for (unsigned y = 0; y < fb_fragment->height; y++)
+		memcpy(&fb_fragment->buf[y * fb_fragment->pitch],
+		       &render->converged[(fb_fragment->y + y) * render->frame_width + fb_fragment->x],
+		       fb_fragment->width * sizeof(uint32_t));
+}
+
+
+void ray_render_trace_fragment(ray_render_t *render, til_fb_fragment_t *fb_fragment)
+{
+	switch (render->sampling) {
+	case RAY_RENDER_SAMPLING_SINGLE:
+		trace_fragment(render, fb_fragment);
+		break;
+
+	case RAY_RENDER_SAMPLING_ADAPTIVE:
+		trace_fragment_adaptive(render, fb_fragment, 1, 1, NULL);
+		break;
+
+	case RAY_RENDER_SAMPLING_PROGRESSIVE:
+		if (render->refinement > PROGRESSIVE_CONVERGED) {
+			copy_converged(render, fb_fragment);
+			break;
+		}
+
+		/* every level halves the coarsest cells left uninterpolated, until finally supersampling the edges */
+		trace_fragment_adaptive(render, fb_fragment,
+					MAX(ADAPTIVE_STEP >> render->refinement, 1),
+					render->refinement == PROGRESSIVE_CONVERGED,
+					render->refinement == PROGRESSIVE_CONVERGED ? render->converged : NULL);
+		break;
+	}
+}
+
+
+/* (re)allocate the progressively refined frame, if progressive at all */
+static void ray_render_prepare_converged(ray_render_t *render)
+{
+	free(render->converged);
+	render->converged = NULL;
+
+	/* without it progressive sampling still works, but never stops refining the last level */
+	if (render->sampling == RAY_RENDER_SAMPLING_PROGRESSIVE)
+		render->converged = malloc(render->frame_width * render->frame_height * sizeof(uint32_t));
+}
+
+
+static void ray_render_prepare_objects(ray_render_t *render)
+{
+	ray_render_object_t	*prepared = render->objects;
+
+	for (ray_object_t *object = render->scene->objects; object->type; object++)
+		*prepared++ = ray_render_object_prepare(object, render->camera);
+}
+
+
+static void ray_render_prepare_lights(ray_render_t *render)
+{
+	const ray_scene_t	*scene = render->scene;
+
+	render->ambient_light = ray_3f_mult_scalar(&scene->ambient_color, scene->ambient_brightness);
+	ray_gamma_prepare(scene->gamma, &render->gamma);	/* only recomputes the table when gamma changed */
+
+	render->n_lights = 0;
+	for (ray_object_t *light = scene->lights; light->type; light++)
+		render->n_lights++;
+}
+
+
+/* prepare the scene for rendering with camera, the render is kept current with ray_render_update() as they change. */
 /* this is basically a time for the raytracer to precompute whatever it can which otherwise ends up occurring per-ray */
 /* the camera is included so primary rays which all have a common origin may be optimized for */
 ray_render_t * ray_render_new(const ray_scene_t *scene, const ray_camera_t *camera, unsigned frame_width, unsigned frame_height)
@@ -230,27 +551,78 @@ ray_render_t * ray_render_new(const ray_scene_t *scene, const ray_camera_t *came
 	for (i = 0, object = scene->objects; object->type; object++)
 		i++;
 
-	render = malloc(sizeof(ray_render_t) + (i + 1) * sizeof(ray_render_object_t));
+	render = calloc(1, sizeof(ray_render_t) + (i + 1) * sizeof(ray_render_object_t));
 	if (!render)
 		return NULL;
 
 	render->scene = scene;
 	render->camera = camera;
+	render->frame_width = frame_width;
+	render->frame_height = frame_height;
 
-	render->ambient_light = ray_3f_mult_scalar(&scene->ambient_color, scene->ambient_brightness);
-	ray_gamma_prepare(scene->gamma, &render->gamma);
+	ray_render_prepare_lights(render);
 	ray_camera_frame_prepare(camera, frame_width, frame_height, &render->frame);
+	ray_render_prepare_objects(render);
+	render->objects[i].type = RAY_OBJECT_TYPE_SENTINEL;
 
-	for (i = 0, object = scene->objects; object->type; object++)
-		render->objects[i++] = ray_render_object_prepare(object, camera);
+	render->bvh = ray_bvh_new(render->objects);
+	if (!render->bvh) {
+		free(render);
 
-	render->objects[i].type = RAY_OBJECT_TYPE_SENTINEL;
+		return NULL;
+	}
 
 	return render;
 }
 
 
+/* Bring render up to date with the changes made to its scene and camera since ray_render_new() or the last update.
+ * Only what changed is prepared again, and moved objects refit the bvh rather than rebuilding it, so this is
+ * cheap enough to call every frame.  Objects may move or otherwise change, but not be added or removed.
+ * This must be called every frame with progressive sampling, with no changes it advances the refinement.
+ */
+void ray_render_update(ray_render_t *render, ray_render_changes_t changes, unsigned frame_width, unsigned frame_height)
+{
+	if (frame_width != render->frame_width || frame_height != render->frame_height) {
+		render->frame_width = frame_width;
+		render->frame_height = frame_height;
+		changes |= RAY_RENDER_CHANGED_CAMERA;
+		ray_render_prepare_converged(render);
+	}
+
+	/* progressive sampling starts over with any changes, otherwise refines what's already there */
+	if (changes)
+		render->refinement = 0;
+	else if (render->refinement < PROGRESSIVE_CONVERGED + !!render->converged)
+		render->refinement++;
+
+	if (changes & RAY_RENDER_CHANGED_LIGHTS)
+		ray_render_prepare_lights(render);
+
+	if (changes & RAY_RENDER_CHANGED_CAMERA)
+		ray_camera_frame_prepare(render->camera, frame_width, frame_height, &render->frame);
+
+	/* the prepared objects cache camera-relative values, but their bounds are independent of the camera */
+	if (changes & (RAY_RENDER_CHANGED_CAMERA | RAY_RENDER_CHANGED_OBJECTS))
+		ray_render_prepare_objects(render);
+
+	if (changes & RAY_RENDER_CHANGED_OBJECTS)
+		ray_bvh_refit(render->bvh);
+}
+
+
+/* choose how pixels are sampled, the default being RAY_RENDER_SAMPLING_SINGLE */
+void ray_render_set_sampling(ray_render_t *render, ray_render_sampling_t sampling)
+{
+	render->sampling = sampling;
+	render->refinement = 0;
+	ray_render_prepare_converged(render);
+}
+
+
 void ray_render_free(ray_render_t *render)
 {
+	free(render->converged);
+	ray_bvh_free(render->bvh);
 	free(render);
 }
@@ -8,7 +8,23 @@
 
 typedef struct ray_render_t ray_render_t;
 
+/* what changed in the scene and camera being rendered, for ray_render_update() */
+typedef enum ray_render_changes_t {
+	RAY_RENDER_CHANGED_CAMERA	= 0x1,	/* camera position, orientation, or film */
+	RAY_RENDER_CHANGED_OBJECTS	= 0x2,	/* scene objects moved or resized */
+	RAY_RENDER_CHANGED_LIGHTS	= 0x4,	/* lights moved or changed, ambient light, or gamma */
+} ray_render_changes_t;
+
+/* how pixels are sampled, for ray_render_set_sampling() */
+typedef enum ray_render_sampling_t {
+	RAY_RENDER_SAMPLING_SINGLE,		/* a ray through every pixel */
+	RAY_RENDER_SAMPLING_ADAPTIVE,		/* a coarse grid of rays subdivided where they differ, supersampling edges */
+	RAY_RENDER_SAMPLING_PROGRESSIVE,	/* adaptive, starting coarse and refining over successive unchanged frames */
+} ray_render_sampling_t;
+
 ray_render_t * ray_render_new(const ray_scene_t *scene, const ray_camera_t *camera, unsigned frame_width, unsigned frame_height);
+void ray_render_update(ray_render_t *render, ray_render_changes_t changes, unsigned frame_width, unsigned frame_height);
+void ray_render_set_sampling(ray_render_t *render, ray_render_sampling_t sampling);
 void ray_render_free(ray_render_t *render);
 void ray_render_trace_fragment(ray_render_t *render, til_fb_fragment_t *fb_fragment);
 
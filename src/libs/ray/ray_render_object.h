@@ -6,6 +6,7 @@
 #include "ray_camera.h"
 #include "ray_object.h"
 #include "ray_object_type.h"
+#include "ray_packet.h"
 #include "ray_render_object_plane.h"
 #include "ray_render_object_point.h"
 #include "ray_render_object_sphere.h"
@@ -77,6 +78,54 @@ static inline int ray_render_object_intersects_ray(ray_render_object_t *object,
 }
 
 
+#if RAY_PACKET_SIZE
+/* Determine which rays of a packet intersect object, like ray_render_object_intersects_ray().
+ * The distances are stored in res_distance, only lanes set in the returned mask are meaningful.
+ */
+static inline ray_packet_mask_t ray_render_object_intersects_packet(ray_render_object_t *object, unsigned depth, ray_packet_t *packet, ray_packet_f_t *res_distance)
+{
+	switch (object->type) {
+	case RAY_OBJECT_TYPE_SPHERE:
+		return ray_render_object_sphere_intersects_packet(&object->sphere, depth, packet, res_distance);
+
+	case RAY_OBJECT_TYPE_POINT:
+		return ray_render_object_point_intersects_packet(&object->point, depth, packet, res_distance);
+
+	case RAY_OBJECT_TYPE_PLANE:
+		return ray_render_object_plane_intersects_packet(&object->plane, depth, packet, res_distance);
+
+	case RAY_OBJECT_TYPE_LIGHT:
+		/* TODO */
+	default:
+		assert(0);
+	}
+}
+#endif
+
+
+/* Determine the axis-aligned bounds of object, for spatial indexing.
+ * Returns 0 for unbounded objects like planes, leaving res_min and res_max untouched.
+ */
+static inline int ray_render_object_bounds(ray_render_object_t *object, ray_3f_t *res_min, ray_3f_t *res_max)
+{
+	switch (object->type) {
+	case RAY_OBJECT_TYPE_SPHERE:
+		return ray_render_object_sphere_bounds(&object->sphere, res_min, res_max);
+
+	case RAY_OBJECT_TYPE_POINT:
+		return ray_render_object_point_bounds(&object->point, res_min, res_max);
+
+	case RAY_OBJECT_TYPE_PLANE:
+		return ray_render_object_plane_bounds(&object->plane, res_min, res_max);
+
+	case RAY_OBJECT_TYPE_LIGHT:
+		/* TODO */
+	default:
+		assert(0);
+	}
+}
+
+
 /* Return the surface normal of object @ point */
 static inline ray_3f_t ray_render_object_normal(ray_render_object_t *object, ray_3f_t *point)
 {
@@ -5,6 +5,7 @@
 #include "ray_camera.h"
 #include "ray_object_plane.h"
 #include "ray_object_type.h"
+#include "ray_packet.h"
 #include "ray_ray.h"
 #include "ray_surface.h"
 
@@ -47,6 +48,36 @@ static inline int ray_render_object_plane_intersects_ray(ray_render_object_plane
 }
 
 
+#if RAY_PACKET_SIZE
+/* ray_render_object_plane_intersects_ray() for a packet of rays, returning the mask of intersecting lanes */
+static inline ray_packet_mask_t ray_render_object_plane_intersects_packet(ray_render_object_plane_t *plane, unsigned depth, ray_packet_t *packet, ray_packet_f_t *res_distance)
+{
+	ray_packet_3f_t		normal = ray_packet_3f(&plane->object.normal);
+	ray_packet_f_t		d = ray_packet_3f_dot(&normal, &packet->direction);
+	ray_packet_f_t		distance = ray_packet_f(plane->primary_dot_plus);
+	ray_packet_mask_t	hit = d < 0.0f;
+
+	if (!ray_packet_any(hit))
+		return hit;
+
+	if (depth)
+		distance = ray_packet_3f_dot(&normal, &packet->origin) + plane->object.distance;
+
+	distance /= -ray_packet_select(hit, d, ray_packet_f(-1.0f));
+	*res_distance = distance;
+
+	return hit & (distance > 0.0f);
+}
+#endif
+
+
+/* planes are infinite and have no bounds */
+static inline int ray_render_object_plane_bounds(ray_render_object_plane_t *plane, ray_3f_t *res_min, ray_3f_t *res_max)
+{
+	return 0;
+}
+
+
 static inline ray_3f_t ray_render_object_plane_normal(ray_render_object_plane_t *plane, ray_3f_t *point)
 {
 	return plane->object.normal;
@@ -5,6 +5,7 @@
 #include "ray_camera.h"
 #include "ray_object_point.h"
 #include "ray_object_type.h"
+#include "ray_packet.h"
 #include "ray_ray.h"
 #include "ray_surface.h"
 
@@ -29,6 +30,23 @@ static inline int ray_render_object_point_intersects_ray(ray_render_object_point
 }
 
 
+#if RAY_PACKET_SIZE
+static inline ray_packet_mask_t ray_render_object_point_intersects_packet(ray_render_object_point_t *point, unsigned depth, ray_packet_t *packet, ray_packet_f_t *res_distance)
+{
+	/* points aren't renderable, ray_render_object_point_intersects_ray() never hits either */
+	return (ray_packet_mask_t){};
+}
+#endif
+
+
+static inline int ray_render_object_point_bounds(ray_render_object_point_t *point, ray_3f_t *res_min, ray_3f_t *res_max)
+{
+	*res_min = *res_max = point->object.center;
+
+	return 1;
+}
+
+
 static inline ray_3f_t ray_render_object_point_normal(ray_render_object_point_t *point, ray_3f_t *_point)
 {
 	ray_3f_t	normal;
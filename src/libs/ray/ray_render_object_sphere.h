@@ -8,6 +8,7 @@
 #include "ray_color.h"
 #include "ray_object_sphere.h"
 #include "ray_object_type.h"
+#include "ray_packet.h"
 #include "ray_ray.h"
 #include "ray_surface.h"
 
@@ -68,6 +69,50 @@ static inline int ray_render_object_sphere_intersects_ray(ray_render_object_sphe
 }
 
 
+#if RAY_PACKET_SIZE
+/* ray_render_object_sphere_intersects_ray() for a packet of rays, returning the mask of intersecting lanes */
+static inline ray_packet_mask_t ray_render_object_sphere_intersects_packet(ray_render_object_sphere_t *sphere, unsigned depth, ray_packet_t *packet, ray_packet_f_t *res_distance)
+{
+	ray_packet_3f_t		v;
+	ray_packet_f_t		dot_vv, b, disc;
+	ray_packet_mask_t	hit;
+
+	if (!depth) {
+		v = ray_packet_3f(&sphere->primary_v);
+		dot_vv = ray_packet_f(sphere->primary_dot_vv);
+	} else {
+		ray_packet_3f_t	center = ray_packet_3f(&sphere->object.center);
+
+		v = ray_packet_3f_sub(&center, &packet->origin);
+		dot_vv = ray_packet_3f_dot(&v, &v);
+	}
+
+	b = ray_packet_3f_dot(&v, &packet->direction);
+	disc = sphere->r2 - (dot_vv - (b * b));
+	hit = disc > 0;
+	if (!ray_packet_any(hit))
+		return hit;
+
+	disc = ray_packet_sqrt(ray_packet_select(hit, disc, ray_packet_f(0.0f)));
+	*res_distance = b - disc;
+
+	return hit & (b + disc > 0) & (*res_distance > 0);
+}
+#endif
+
+
+/* return the axis-aligned bounds of the sphere */
+static inline int ray_render_object_sphere_bounds(ray_render_object_sphere_t *sphere, ray_3f_t *res_min, ray_3f_t *res_max)
+{
+	ray_3f_t	radius = { .x = sphere->object.radius, .y = sphere->object.radius, .z = sphere->object.radius };
+
+	*res_min = ray_3f_sub(&sphere->object.center, &radius);
+	*res_max = ray_3f_add(&sphere->object.center, &radius);
+
+	return 1;
+}
+
+
 /* return the normal of the surface at the specified point */
 static inline ray_3f_t ray_render_object_sphere_normal(ray_render_object_sphere_t *sphere, ray_3f_t *point)
 {
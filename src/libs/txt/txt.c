@@ -180,6 +180,7 @@ void txt_render_fragment(txt_t *txt, til_fb_fragment_t *fragment, uint32_t color
 		      fragment->width, fragment->height))
 		return;
 
+	til_fb_fragment_damage(fragment, jx, jy, txt->width, txt->height);
 
 	for (col = 0, row = 0, str = txt->str; *str; str++) {
 		switch (*str) {
@@ -14,10 +14,14 @@
 #include "til_args.h"
 #include "til_settings.h"
 #include "til_fb.h"
+#include "til_governor.h"
 #include "til_util.h"
 
+#include "bench.h"
+#include "microbench.h"
 #include "fps.h"
 #include "setup.h"
+#include "stats.h"
 
 /* Copyright (C) 2016 Vito Caputo <vcaputo@pengaru.com> */
 
@@ -27,13 +31,16 @@
  * another page so we can begin rendering another frame before vsync.  With
  * just two pages we end up twiddling thumbs until the vsync arrives.
  */
-#ifdef HAVE_SDL
+#if defined(HAVE_SDL)
 #define DEFAULT_VIDEO	"sdl"
-#else
+#elif defined(HAVE_DRM)
 #define DEFAULT_VIDEO	"drm"
+#else
+#define DEFAULT_VIDEO	"mem"
 #endif
 
 extern til_fb_ops_t	drm_fb_ops;
+extern til_fb_ops_t	mem_fb_ops;
 extern til_fb_ops_t	sdl_fb_ops;
 static til_fb_ops_t	*fb_ops;
 
@@ -44,6 +51,7 @@ typedef struct rototiller_t {
 	til_fb_t		*fb;
 	struct timeval		start_tv;
 	unsigned		ticks_offset;
+	stats_t			*stats;
 } rototiller_t;
 
 static rototiller_t		rototiller;
@@ -61,11 +69,107 @@ typedef struct setup_t {
  * subclass the video backend vs. renderer stuff.
  */
 
+/* setup the dynamic resolution scaling governor, common to all video backends */
+static int setup_governor(til_settings_t *settings, til_setting_t **res_setting, const til_setting_desc_t **res_desc)
+{
+	const char	*filter_values[] = {
+				"bilinear",
+				"nearest",
+				NULL
+			};
+	const char	*fps, *min_scale, *max_scale, *filter;
+	int		r;
+
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Target frame rate for dynamic resolution scaling",
+							.key = "fps",
+							.regex = "^(off|[1-9][0-9]*)",
+							.preferred = "off",
+							.values = NULL,
+							.annotations = NULL
+						},
+						&fps,
+						res_setting,
+						res_desc);
+	if (r || !strcasecmp(fps, "off"))
+		return r;
+
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Minimum resolution scale",
+							.key = "min_scale",
+							.regex = "^(0?\\.[0-9]+|1)",
+							.preferred = ".5",
+							.values = NULL,
+							.annotations = NULL
+						},
+						&min_scale,
+						res_setting,
+						res_desc);
+	if (r)
+		return r;
+
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Maximum resolution scale",
+							.key = "max_scale",
+							.regex = "^(0?\\.[0-9]+|1)",
+							.preferred = "1",
+							.values = NULL,
+							.annotations = NULL
+						},
+						&max_scale,
+						res_setting,
+						res_desc);
+	if (r)
+		return r;
+
+	return til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Upscaling filter",
+							.key = "upscale",
+							.regex = "^(bilinear|nearest)",
+							.preferred = filter_values[0],
+							.values = filter_values,
+							.annotations = NULL
+						},
+						&filter,
+						res_setting,
+						res_desc);
+}
+
+
+/* wrap *module_context in a governor if the video settings ask for one */
+static int create_governor(const til_settings_t *settings, til_module_context_t **module_context)
+{
+	const char	*fps, *min_scale, *max_scale, *filter;
+
+	fps = til_settings_get_value(settings, "fps", NULL);
+	if (!fps || !strcasecmp(fps, "off"))
+		return 0;
+
+	min_scale = til_settings_get_value(settings, "min_scale", NULL);
+	max_scale = til_settings_get_value(settings, "max_scale", NULL);
+	filter = til_settings_get_value(settings, "upscale", NULL);
+	if (!min_scale || !max_scale || !filter || atoi(fps) <= 0)
+		return -EINVAL;
+
+	return til_governor_create_context(*module_context,
+					atoi(fps),
+					strtof(min_scale, NULL),
+					strtof(max_scale, NULL),
+					strcasecmp(filter, "nearest") ? TIL_GOVERNOR_FILTER_BILINEAR : TIL_GOVERNOR_FILTER_NEAREST,
+					module_context);
+}
+
+
 /* select video backend if not yet selected, then setup the selected backend. */
 static int setup_video(til_settings_t *settings, til_setting_t **res_setting, const til_setting_desc_t **res_desc, til_setup_t **res_setup)
 {
 	til_setting_t	*setting;
 	const char	*video;
+	int		r;
 
 	video = til_settings_get_key(settings, 0, &setting);
 	if (!video || !setting->desc) {
@@ -74,12 +178,12 @@ static int setup_video(til_settings_t *settings, til_setting_t **res_setting, co
 #ifdef HAVE_DRM
 						"drm",
 #endif
+						"mem",
 #ifdef HAVE_SDL
 						"sdl",
 #endif
 						NULL,
 					};
-		int			r;
 
 		r = til_setting_desc_clone(&(til_setting_desc_t){
 						.name = "Video backend",
@@ -99,22 +203,25 @@ static int setup_video(til_settings_t *settings, til_setting_t **res_setting, co
 	}
 
 	/* XXX: this is kind of hacky for now */
+	fb_ops = NULL;
 #ifdef HAVE_DRM
-	if (!strcasecmp(video, "drm")) {
+	if (!strcasecmp(video, "drm"))
 		fb_ops = &drm_fb_ops;
-
-		return drm_fb_ops.setup(settings, res_setting, res_desc, res_setup);
-	}
 #endif
+	if (!strcasecmp(video, "mem"))
+		fb_ops = &mem_fb_ops;
 #ifdef HAVE_SDL
-	if (!strcasecmp(video, "sdl")) {
+	if (!strcasecmp(video, "sdl"))
 		fb_ops = &sdl_fb_ops;
-
-		return sdl_fb_ops.setup(settings, res_setting, res_desc, res_setup);
-	}
 #endif
+	if (!fb_ops)
+		return -EINVAL;
+
+	r = fb_ops->setup(settings, res_setting, res_desc, res_setup);
+	if (r)
+		return r;
 
-	return -EINVAL;
+	return setup_governor(settings, res_setting, res_desc);
 }
 
 
@@ -217,18 +324,32 @@ static void * rototiller_thread(void *_rt)
 	rototiller_t	*rt = _rt;
 	struct timeval	now;
 
+	til_fb_page_t	*pending = NULL;
+
 	for (;;) {
-		til_fb_page_t	*page;
-		unsigned	ticks;
+		til_fb_fragment_t	*finished;
+		til_fb_page_t		*page;
+		unsigned		ticks;
 
 		page = til_fb_page_get(rt->fb);
 
 		gettimeofday(&now, NULL);
 		ticks = get_ticks(&rt->start_tv, &now, rt->ticks_offset);
 
-		til_module_render(rt->module_context, ticks, &page->fragment);
+		/* pipelined modules return the previous page, rendered while preparing this one */
+		if (rt->stats)
+			finished = stats_render(rt->stats, rt->module_context, ticks, &page->fragment);
+		else
+			finished = til_module_render_pipelined(rt->module_context, ticks, &page->fragment, NULL);
 
-		til_fb_page_put(rt->fb, page);
+		if (finished == &page->fragment) {
+			til_fb_page_put(rt->fb, page);
+		} else {
+			if (finished)
+				til_fb_page_put(rt->fb, pending);
+
+			pending = page;
+		}
 	}
 
 	return NULL;
@@ -257,6 +378,24 @@ int main(int argc, const char *argv[])
 	if (args.help)
 		return print_help() < 0 ? EXIT_FAILURE : EXIT_SUCCESS;
 
+	if (args.bench) {
+		exit_if((r = bench_run(args.bench, NUM_FB_PAGES)) < 0,
+			"unable to run benchmark: %s", strerror(-r));
+
+		til_shutdown();
+
+		return EXIT_SUCCESS;
+	}
+
+	if (args.microbench) {
+		exit_if((r = microbench_run(args.microbench)) < 0,
+			"unable to run microbenchmark: %s", strerror(-r));
+
+		til_shutdown();
+
+		return EXIT_SUCCESS;
+	}
+
 	exit_if((r = setup_from_args(&args, &setup, &failed_desc)) < 0,
 		"unable to use args%s%s%s: %s",
 		failed_desc ? " for setting \"" : "",
@@ -276,6 +415,9 @@ int main(int argc, const char *argv[])
 	exit_if(!fps_setup(),
 		"unable to setup fps counter");
 
+	exit_if(args.stats && (r = stats_new(args.stats, &rototiller.stats)) < 0,
+		"unable to setup stats: %s", strerror(-r));
+
 	gettimeofday(&rototiller.start_tv, NULL);
 	exit_if((r = til_module_create_context(
 						rototiller.module, 0,
@@ -287,6 +429,9 @@ int main(int argc, const char *argv[])
 						&rototiller.module_context)) < 0,
 		"unable to create module context: %s", strerror(-r));
 
+	exit_if((r = create_governor(setup.video, &rototiller.module_context)) < 0,
+		"unable to create governor: %s", strerror(-r));
+
 	pexit_if(pthread_create(&rototiller.thread, NULL, rototiller_thread, &rototiller) != 0,
 		"unable to create dispatch thread");
 
@@ -294,13 +439,14 @@ int main(int argc, const char *argv[])
 		if (til_fb_flip(rototiller.fb) < 0)
 			break;
 
-		fps_print(rototiller.fb);
+		fps_print(rototiller.fb, rototiller.module_context);
 	}
 
 	pthread_cancel(rototiller.thread);
 	pthread_join(rototiller.thread, NULL);
 	til_shutdown();
 	til_module_context_free(rototiller.module_context);
+	stats_free(rototiller.stats);
 	til_fb_free(rototiller.fb);
 
 	return EXIT_SUCCESS;
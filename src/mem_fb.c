@@ -0,0 +1,157 @@
+#include <assert.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "til_fb.h"
+#include "til_settings.h"
+#include "til_util.h"
+
+/* mem fb backend, renders into plain memory without any display.
+ *
+ * This exists for headless use like benchmarking and CI, page flips never
+ * wait for a vsync so rendering proceeds as fast as the modules permit.
+ */
+
+#define MEM_FB_ALIGNMENT	64	/* pages and rows are cacheline-aligned */
+
+typedef struct mem_fb_t {
+	unsigned	width, height;
+	unsigned	pitch;		/* in pixels, rows are padded to MEM_FB_ALIGNMENT */
+} mem_fb_t;
+
+typedef struct mem_fb_page_t {
+	uint32_t	*buf;
+} mem_fb_page_t;
+
+
+static int mem_fb_setup(const til_settings_t *settings, til_setting_t **res_setting, const til_setting_desc_t **res_desc, til_setup_t **res_setup)
+{
+	const char	*size;
+	int		r;
+
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Memory framebuffer size",
+							.key = "size",
+							.regex = "[1-9][0-9]*[xX][1-9][0-9]*",
+							.preferred = "640x480",
+							.values = NULL,
+							.annotations = NULL
+						},
+						&size,
+						res_setting,
+						res_desc);
+	if (r)
+		return r;
+
+	return til_fb_setup_shadow(settings, res_setting, res_desc, 0);
+}
+
+
+static int mem_fb_init(const til_settings_t *settings, void **res_context)
+{
+	const char	*size;
+	mem_fb_t	*c;
+
+	assert(settings);
+	assert(res_context);
+
+	size = til_settings_get_value(settings, "size", NULL);
+	if (!size)
+		return -EINVAL;
+
+	c = calloc(1, sizeof(mem_fb_t));
+	if (!c)
+		return -ENOMEM;
+
+	if (sscanf(size, "%u%*[xX]%u", &c->width, &c->height) != 2 || !c->width || !c->height) {
+		free(c);
+
+		return -EINVAL;
+	}
+
+	c->pitch = (c->width + (MEM_FB_ALIGNMENT / 4 - 1)) & ~(MEM_FB_ALIGNMENT / 4 - 1);
+
+	*res_context = c;
+
+	return 0;
+}
+
+
+static void mem_fb_shutdown(til_fb_t *fb, void *context)
+{
+	free(context);
+}
+
+
+static int mem_fb_acquire(til_fb_t *fb, void *context, void *page)
+{
+	return 0;
+}
+
+
+static void mem_fb_release(til_fb_t *fb, void *context)
+{
+}
+
+
+static void * mem_fb_page_alloc(til_fb_t *fb, void *context, til_fb_page_t *res_page)
+{
+	mem_fb_t	*c = context;
+	mem_fb_page_t	*p;
+	size_t		size = (size_t)c->pitch * c->height * sizeof(uint32_t);
+
+	p = calloc(1, sizeof(mem_fb_page_t));
+	if (!p)
+		return NULL;
+
+	p->buf = til_aligned_alloc(MEM_FB_ALIGNMENT, size);
+	if (!p->buf) {
+		free(p);
+
+		return NULL;
+	}
+
+	*res_page =	(til_fb_page_t){
+				.fragment.buf = p->buf,
+				.fragment.width = c->width,
+				.fragment.frame_width = c->width,
+				.fragment.height = c->height,
+				.fragment.frame_height = c->height,
+				.fragment.pitch = c->pitch,
+				.fragment.stride = c->pitch - c->width,
+			};
+
+	return p;
+}
+
+
+static int mem_fb_page_free(til_fb_t *fb, void *context, void *page)
+{
+	mem_fb_page_t	*p = page;
+
+	til_aligned_free(p->buf);
+	free(p);
+
+	return 0;
+}
+
+
+static int mem_fb_page_flip(til_fb_t *fb, void *context, void *page)
+{
+	/* there's no display to wait on, the page is "visible" immediately */
+	return 0;
+}
+
+
+til_fb_ops_t mem_fb_ops = {
+	.setup = mem_fb_setup,
+	.init = mem_fb_init,
+	.shutdown = mem_fb_shutdown,
+	.acquire = mem_fb_acquire,
+	.release = mem_fb_release,
+	.page_alloc = mem_fb_page_alloc,
+	.page_free = mem_fb_page_free,
+	.page_flip = mem_fb_page_flip
+};
@@ -0,0 +1,473 @@
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "til_fb.h"
+#include "til_settings.h"
+#include "til_span.h"
+#include "til_util.h"
+
+#include "din/din.h"
+
+#include "microbench.h"
+
+/* Microbenchmarks of libtil's primitives, complementing the module benchmarks in bench.c.
+ *
+ * Each microbenchmark prints its own CSV to stdout, measuring every available
+ * implementation of what it benchmarks so their speedups are apparent.  Settings:
+ *
+ *   benches=name[:name...]	microbenchmarks to run (default all)
+ *   ms=N			minimum time measured per case (default 200)
+ */
+
+#define MICROBENCH_DEFAULT_MS	"200"
+#define MICROBENCH_SPAN_ROWS	64	/* spans are measured over this many rows, to stay in cache */
+#define MICROBENCH_PAGES_N_PAGES	3	/* like the frontend's default triple-buffering */
+#define MICROBENCH_DIN_N	1920	/* noise samples per batch, a 1080p row */
+
+extern til_fb_ops_t	mem_fb_ops;
+
+typedef struct microbench_t {
+	const char	*name;
+	int		(*run)(unsigned ms);
+} microbench_t;
+
+typedef enum microbench_span_op_t {
+	MICROBENCH_SPAN_FILL,
+	MICROBENCH_SPAN_COPY,
+	MICROBENCH_SPAN_STREAM,
+	MICROBENCH_SPAN_BLEND,
+	MICROBENCH_SPAN_ADD,
+	MICROBENCH_SPAN_CNT
+} microbench_span_op_t;
+
+static const char	*microbench_span_op_names[MICROBENCH_SPAN_CNT] = {
+				"fill",
+				"copy",
+				"stream",
+				"blend",
+				"add",
+			};
+
+
+static void microbench_span_rows(microbench_span_op_t op, uint32_t *dest, const uint32_t *src, unsigned width)
+{
+	for (unsigned y = 0; y < MICROBENCH_SPAN_ROWS; y++, dest += width, src += width) {
+		switch (op) {
+		case MICROBENCH_SPAN_FILL:
+			til_span_fill(dest, 0x00c0ffee, width);
+			break;
+
+		case MICROBENCH_SPAN_COPY:
+			til_span_copy(dest, src, width);
+			break;
+
+		case MICROBENCH_SPAN_STREAM:
+			til_span_stream(dest, src, width);
+			break;
+
+		case MICROBENCH_SPAN_BLEND:
+			til_span_blend(dest, src, width, 0x80);
+			break;
+
+		case MICROBENCH_SPAN_ADD:
+			til_span_add(dest, src, width);
+			break;
+
+		default:
+			break;
+		}
+	}
+}
+
+
+/* measure the pixels per ns of the current span ops' op at width */
+static double microbench_span_rate(microbench_span_op_t op, uint32_t *dest, const uint32_t *src, unsigned width, unsigned ms)
+{
+	uint64_t	start = til_get_ns(), elapsed;
+	uint64_t	n_pixels = 0;
+
+	do {
+		for (unsigned i = 0; i < 16; i++) {
+			microbench_span_rows(op, dest, src, width);
+			n_pixels += width * MICROBENCH_SPAN_ROWS;
+		}
+
+		elapsed = til_get_ns() - start;
+	} while (elapsed < ms * 1000000ULL);
+
+	return (double)n_pixels / (double)elapsed;
+}
+
+
+static void microbench_span_randomize(uint32_t *buf, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++)
+		buf[i] = ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+}
+
+
+static int microbench_spans(unsigned ms)
+{
+	static const unsigned	widths[] = { 15, 64, 640, 1920 };
+	const til_span_ops_t	**ops, *orig = til_span;
+	uint32_t		*src, *dest, *expected;
+	unsigned		n_ops, n = 1920 * MICROBENCH_SPAN_ROWS;
+	int			r = 0;
+
+	til_span_get_ops(&ops, &n_ops);
+
+	src = calloc(n * 3, sizeof(uint32_t));
+	if (!src)
+		return -ENOMEM;
+
+	dest = &src[n];
+	expected = &src[n * 2];
+
+	printf("bench,impl,op,width,mpixels_per_sec,speedup\n");
+
+	for (unsigned o = 0; o < MICROBENCH_SPAN_CNT; o++) {
+		for (unsigned w = 0; w < nelems(widths); w++) {
+			double	generic_rate = 0.0;
+
+			for (unsigned i = 0; i < n_ops; i++) {
+				double	rate;
+
+				if (!ops[i]->supported())
+					continue;
+
+				til_span = ops[i];
+
+				/* every implementation must produce what the generic one does */
+				srand(1);
+				microbench_span_randomize(src, n);
+				microbench_span_randomize(dest, n);
+				microbench_span_rows(o, dest, src, widths[w]);
+				if (!i) {
+					memcpy(expected, dest, n * sizeof(uint32_t));
+				} else if (memcmp(expected, dest, n * sizeof(uint32_t))) {
+					fprintf(stderr, "span ops \"%s\" %s differs from \"%s\"\n", ops[i]->name, microbench_span_op_names[o], ops[0]->name);
+					r = -EINVAL;
+					goto _out;
+				}
+
+				rate = microbench_span_rate(o, dest, src, widths[w], ms);
+				if (!i)
+					generic_rate = rate;
+
+				printf("spans,%s,%s,%u,%.1f,%.2f\n",
+					ops[i]->name,
+					microbench_span_op_names[o],
+					widths[w],
+					rate * 1000.0,
+					generic_rate > 0.0 ? rate / generic_rate : 0.0);
+				fflush(stdout);
+			}
+		}
+	}
+
+_out:
+	til_span = orig;
+	free(src);
+
+	return r;
+}
+
+
+typedef struct microbench_pages_flipper_t {
+	til_fb_t	*fb;
+	unsigned	n_flips;	/* set when the round-trips are done, to the total number of pages put */
+} microbench_pages_flipper_t;
+
+
+/* the flip thread's side of the page round-trips, like the frontend's main loop */
+static void * microbench_pages_flipper(void *arg)
+{
+	microbench_pages_flipper_t	*flipper = arg;
+	unsigned			n_flips = 0, n;
+
+	/* every page put must get flipped, or the final round-trip could starve */
+	do {
+		if (til_fb_flip(flipper->fb) < 0)
+			break;
+
+		n_flips++;
+		n = __atomic_load_n(&flipper->n_flips, __ATOMIC_ACQUIRE);
+	} while (!n || n_flips < n);
+
+	return NULL;
+}
+
+
+static int microbench_cmp_ns(const void *a, const void *b)
+{
+	uint64_t	A = *(const uint64_t *)a, B = *(const uint64_t *)b;
+
+	return A < B ? -1 : A > B;
+}
+
+
+/* measure the latency of til_fb_page_get() + til_fb_page_put() round-trips against a flipping thread */
+static int microbench_pages(unsigned ms)
+{
+	microbench_pages_flipper_t	flipper = {};
+	unsigned			n = 0, n_max = 1024;
+	uint64_t			*ns, start, total = 0;
+	til_settings_t			*settings;
+	pthread_t			thread;
+	int				r;
+
+	settings = til_settings_new("mem,size=64x64,shadow=off");
+	if (!settings)
+		return -ENOMEM;
+
+	r = til_fb_new(&mem_fb_ops, settings, MICROBENCH_PAGES_N_PAGES, &flipper.fb);
+	if (r < 0)
+		goto _out_settings;
+
+	ns = malloc(n_max * sizeof(*ns));
+	if (!ns) {
+		r = -ENOMEM;
+		goto _out_fb;
+	}
+
+	r = -pthread_create(&thread, NULL, microbench_pages_flipper, &flipper);
+	if (r < 0)
+		goto _out_ns;
+
+	start = til_get_ns();
+	do {
+		uint64_t	t0 = til_get_ns();
+
+		til_fb_page_put(flipper.fb, til_fb_page_get(flipper.fb));
+		ns[n] = til_get_ns() - t0;
+		total += ns[n];
+
+		if (++n == n_max) {
+			uint64_t	*new;
+
+			new = realloc(ns, n_max * 2 * sizeof(*ns));
+			if (!new)
+				break;
+
+			ns = new;
+			n_max *= 2;
+		}
+	} while (til_get_ns() - start < ms * 1000000ULL);
+
+	/* the flipper may already be waiting on another page, so put one more after telling it when to stop */
+	__atomic_store_n(&flipper.n_flips, n + 1, __ATOMIC_RELEASE);
+	til_fb_page_put(flipper.fb, til_fb_page_get(flipper.fb));
+	pthread_join(thread, NULL);
+
+	qsort(ns, n, sizeof(*ns), microbench_cmp_ns);
+
+	printf("bench,pages,round_trips,mean_ns,p50_ns,p99_ns,max_ns\n");
+	printf("pages,%u,%u,%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64"\n",
+		MICROBENCH_PAGES_N_PAGES,
+		n,
+		total / n,
+		ns[n / 2],
+		ns[(n * 99) / 100],
+		ns[n - 1]);
+	fflush(stdout);
+
+_out_ns:
+	free(ns);
+_out_fb:
+	til_fb_free(flipper.fb);
+_out_settings:
+	til_settings_free(settings);
+
+	return r;
+}
+
+
+typedef struct v3f_t {
+	float	x, y, z;
+} v3f_t;
+
+typedef enum microbench_din_layout_t {
+	MICROBENCH_DIN_ROW,		/* a row of a frame, like swab samples per pixel */
+	MICROBENCH_DIN_SCATTERED,	/* uniformly random, like meta2d samples per ball */
+	MICROBENCH_DIN_CNT
+} microbench_din_layout_t;
+
+static const char	*microbench_din_layout_names[MICROBENCH_DIN_CNT] = {
+				"row",
+				"scattered",
+			};
+
+
+/* evaluate the noise at the n coordinates, via din() per sample when batch is 0 or din_batch() otherwise */
+static void microbench_din_samples(din_t *noise, int batch, const float *xs, const float *ys, const float *zs, unsigned n, float *res)
+{
+	if (batch)
+		return din_batch(noise, xs, ys, zs, n, res);
+
+	for (unsigned i = 0; i < n; i++)
+		res[i] = din(noise, &(v3f_t){ .x = xs[i], .y = ys[i], .z = zs[i] });
+}
+
+
+/* measure the samples per ns of batch or not at the n coordinates */
+static double microbench_din_rate(din_t *noise, int batch, const float *xs, const float *ys, const float *zs, unsigned n, float *res, unsigned ms)
+{
+	uint64_t	start = til_get_ns(), elapsed;
+	uint64_t	n_samples = 0;
+
+	do {
+		for (unsigned i = 0; i < 16; i++) {
+			microbench_din_samples(noise, batch, xs, ys, zs, n, res);
+			n_samples += n;
+		}
+
+		elapsed = til_get_ns() - start;
+	} while (elapsed < ms * 1000000ULL);
+
+	return (double)n_samples / (double)elapsed;
+}
+
+
+/* measure din() per sample against din_batch(), the latter uses avx2 when supported */
+static int microbench_din(unsigned ms)
+{
+	static const char	*impl_names[] = { "din", "din_batch" };
+	float			*xs, *ys, *zs, *res, *expected;
+	unsigned		n = MICROBENCH_DIN_N;
+	din_t			*noise;
+	int			r = 0;
+
+	noise = din_new(12, 12, 100, 1);
+	if (!noise)
+		return -ENOMEM;
+
+	xs = calloc(n * 5, sizeof(float));
+	if (!xs) {
+		din_free(noise);
+		return -ENOMEM;
+	}
+
+	ys = &xs[n];
+	zs = &xs[n * 2];
+	res = &xs[n * 3];
+	expected = &xs[n * 4];
+
+	printf("bench,impl,layout,n,msamples_per_sec,speedup\n");
+
+	for (unsigned l = 0; l < MICROBENCH_DIN_CNT; l++) {
+		double	din_rate = 0.0;
+
+		srand(1);
+		for (unsigned i = 0; i < n; i++) {
+			switch (l) {
+			case MICROBENCH_DIN_ROW:
+				xs[i] = (float)i * (1.f / (float)n) * .7f;
+				ys[i] = .3f * .7f;
+				zs[i] = .5f;
+				break;
+
+			case MICROBENCH_DIN_SCATTERED:
+				xs[i] = (float)rand() / (float)RAND_MAX * 2.f - 1.f;
+				ys[i] = (float)rand() / (float)RAND_MAX * 2.f - 1.f;
+				zs[i] = (float)rand() / (float)RAND_MAX * 2.f - 1.f;
+				break;
+
+			default:
+				break;
+			}
+		}
+
+		for (unsigned b = 0; b < nelems(impl_names); b++) {
+			double	rate;
+
+			/* din_batch() must produce exactly what din() does */
+			microbench_din_samples(noise, b, xs, ys, zs, n, res);
+			if (!b) {
+				memcpy(expected, res, n * sizeof(float));
+			} else if (memcmp(expected, res, n * sizeof(float))) {
+				fprintf(stderr, "din \"%s\" %s differs from \"%s\"\n", impl_names[b], microbench_din_layout_names[l], impl_names[0]);
+				r = -EINVAL;
+				goto _out;
+			}
+
+			rate = microbench_din_rate(noise, b, xs, ys, zs, n, res, ms);
+			if (!b)
+				din_rate = rate;
+
+			printf("din,%s,%s,%u,%.1f,%.2f\n",
+				impl_names[b],
+				microbench_din_layout_names[l],
+				n,
+				rate * 1000.0,
+				din_rate > 0.0 ? rate / din_rate : 0.0);
+			fflush(stdout);
+		}
+	}
+
+_out:
+	free(xs);
+	din_free(noise);
+
+	return r;
+}
+
+
+static const microbench_t	microbenches[] = {
+	{ .name = "spans", .run = microbench_spans },
+	{ .name = "pages", .run = microbench_pages },
+	{ .name = "din", .run = microbench_din },
+};
+
+
+/* run the microbenchmarks described by settings, results are printed on stdout */
+int microbench_run(const char *settings_str)
+{
+	til_settings_t	*settings = NULL;
+	const char	*value = NULL;
+	unsigned	ms = atoi(MICROBENCH_DEFAULT_MS);
+	int		r = 0;
+
+	if (settings_str && *settings_str) {
+		settings = til_settings_new(settings_str);
+		if (!settings)
+			return -ENOMEM;
+
+		value = til_settings_get_value(settings, "ms", NULL);
+		if (value)
+			ms = atoi(value);
+
+		value = til_settings_get_value(settings, "benches", NULL);
+	}
+
+	for (unsigned i = 0; i < nelems(microbenches); i++) {
+		const char	*p = value;
+
+		/* the selected names are a ':'-separated list, just find an exact match within it */
+		if (p) {
+			size_t	len = strlen(microbenches[i].name);
+
+			while ((p = strstr(p, microbenches[i].name))) {
+				if ((p == value || p[-1] == ':') && (p[len] == ':' || !p[len]))
+					break;
+
+				p += len;
+			}
+
+			if (!p)
+				continue;
+		}
+
+		r = microbenches[i].run(ms);
+		if (r < 0)
+			break;
+	}
+
+	til_settings_free(settings);
+
+	return r;
+}
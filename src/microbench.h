@@ -0,0 +1,6 @@
+#ifndef _MICROBENCH_H
+#define _MICROBENCH_H
+
+int microbench_run(const char *settings);
+
+#endif
@@ -60,11 +60,7 @@ static inline void draw_blind_horizontal(til_fb_fragment_t *fragment, unsigned r
 	unsigned	row_height = fragment->frame_height / count;
 	unsigned	height = roundf(t * (float)row_height);
 
-/* XXX FIXME: use faster block style fill/copy if til_fb gets that */
-	for (unsigned y = 0; y < height; y++) {
-		for (unsigned x = 0; x < fragment->width; x++)
-			til_fb_fragment_put_pixel_checked(fragment, TIL_FB_DRAW_FLAG_TEXTURABLE, fragment->x + x, fragment->y + y + row * row_height, 0xffffffff); /* FIXME: use _unchecked() variant, but must not assume frame_height == height */
-	}
+	til_fb_fragment_fill_rect(fragment, TIL_FB_DRAW_FLAG_TEXTURABLE, fragment->x, fragment->y + row * row_height, fragment->width, height, 0xffffffff);
 }
 
 
@@ -74,11 +70,7 @@ static inline void draw_blind_vertical(til_fb_fragment_t *fragment, unsigned col
 	unsigned	column_width = fragment->frame_width / count;
 	unsigned	width = roundf(t * (float)column_width);
 
-/* XXX FIXME: use faster block style fill/copy if til_fb gets that */
-	for (unsigned y = 0; y < fragment->height; y++) {
-		for (unsigned x = 0; x < width; x++)
-			til_fb_fragment_put_pixel_checked(fragment, TIL_FB_DRAW_FLAG_TEXTURABLE, fragment->x + x + column * column_width, fragment->y + y, 0xffffffff); /* FIXME: use _unchecked() variant, but must not assume frame_width == width */
-	}
+	til_fb_fragment_fill_rect(fragment, TIL_FB_DRAW_FLAG_TEXTURABLE, fragment->x + column * column_width, fragment->y, width, fragment->height, 0xffffffff);
 }
 
 
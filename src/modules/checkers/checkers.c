@@ -21,6 +21,7 @@
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
+#include "til_rand.h"
 
 
 #define CHECKERS_DEFAULT_SIZE		32
@@ -90,7 +91,7 @@ static til_module_context_t * checkers_create_context(unsigned seed, unsigned ti
 	if (((checkers_setup_t *)setup)->fill_module)
 		size += sizeof(til_module_context_t *) * n_cpus;
 
-	ctxt = til_module_context_new(size, ticks, seed, n_cpus);
+	ctxt = til_module_context_new(size, seed, ticks, n_cpus);
 	if (!ctxt)
 		return NULL;
 
@@ -100,11 +101,13 @@ static til_module_context_t * checkers_create_context(unsigned seed, unsigned ti
 		const til_module_t	*module = ctxt->setup.fill_module;
 		til_setup_t		*module_setup = NULL;
 
-		(void) til_module_randomize_setup(module, &module_setup, NULL);
+		(void) til_module_randomize_setup(module, seed, &module_setup, NULL);
 
-		/* since checkers is already threaded, create an n_cpus=1 context per-cpu */
+		/* checkers renders a filled tile per cpu at a time, so create a context per-cpu.  They're
+		 * threaded themselves, rendered as nested jobs any threads out of tiles can help with.
+		 */
 		for (unsigned i = 0; i < n_cpus; i++) /* TODO: errors */
-			(void) til_module_create_context(module, seed, ticks, 1, module_setup, &ctxt->fill_module_contexts[i]);
+			(void) til_module_create_context(module, seed, ticks, 0, module_setup, &ctxt->fill_module_contexts[i]);
 
 		/* XXX: it would be interesting to support various patterns/layouts by varying the seed, but this will require
 		 * more complex context allocation strategies while also maintaining the per-cpu allocation.
@@ -145,8 +148,8 @@ static void checkers_prepare_frame(til_module_context_t *context, unsigned ticks
 	/* XXX: note cpu_affinity is required when fill_module is used, to ensure module_contexts
 	 * have a stable relationship to fragnum.  Otherwise the output would be unstable because the
 	 * module contexts would be randomly distributed across the filled checkers frame-to-frame.
-	 * This is unfortunate since cpu_affinity is likely to be slower than just letting the render
-	 * threads render fragments in whatever order (the preferred default).  fill_module here
+	 * This is unfortunate since cpu_affinity forgoes the load balancing of letting the render
+	 * threads steal eachothers' fragments (the preferred default).  fill_module here
 	 * is actually *the* reason til_frame_plan_t.cpu_affinity got implemented, before this there
 	 * wasn't even a til_frame_plan_t container; a bare til_fragmenter_t was returned.
 	 */
@@ -202,8 +205,13 @@ static void checkers_render_fragment(til_module_context_t *context, unsigned tic
 		break;
 	}
 
-	if (fill == CHECKERS_FILL_RANDOM || fill == CHECKERS_FILL_MIXED)
-		fill = rand() % CHECKERS_FILL_RANDOM; /* TODO: mixed should have a setting for controlling the ratios */
+	if (fill == CHECKERS_FILL_RANDOM || fill == CHECKERS_FILL_MIXED) {
+		til_rand_t	rand;
+
+		/* seeded per fragment of every frame, so the fills don't depend on which thread renders what */
+		til_rand_seed(&rand, ctxt->til_module_context.seed + ticks, fragment->number);
+		fill = til_rand(&rand) % CHECKERS_FILL_RANDOM; /* TODO: mixed should have a setting for controlling the ratios */
+	}
 
 	switch (ctxt->setup.fill) {
 	case CHECKERS_FILL_SAMPLED:
@@ -236,7 +244,7 @@ static void checkers_render_fragment(til_module_context_t *context, unsigned tic
 
 
 /* TODO: migrate to libtil */
-static char * checkers_random_color(void)
+static char * checkers_random_color(unsigned seed)
 {
 	/* til should probably have a common randomize color helper for this with a large collection of
 	 * reasonable colors, and maybe even have themed palettes one can choose from... */
@@ -250,7 +258,11 @@ static char * checkers_random_color(void)
 					"#ff00ff",
 				};
 
-	return strdup(colors[rand() % nelems(colors)]);
+	til_rand_t	rand;
+
+	til_rand_seed(&rand, seed, 0);
+
+	return strdup(colors[til_rand(&rand) % nelems(colors)]);
 }
 
 
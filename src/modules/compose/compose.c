@@ -5,6 +5,7 @@
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
+#include "til_rand.h"
 #include "til_settings.h"
 #include "til_util.h"
 
@@ -25,6 +26,12 @@
  *   from the ability to feed in settings to the underlying modules.
  */
 
+/* Interleaved layers are rendered into full-width tiles of about this size, small enough for every
+ * layer's output to stay in L2 while the tile is composed, yet with long enough rows for the
+ * layers' per-row setup to amortize and the hardware prefetchers to keep up.
+ */
+#define COMPOSE_TILE_BYTES	(64 * 1024)
+
 typedef struct compose_layer_t {
 	const til_module_t	*module;
 	til_module_context_t	*module_ctxt;
@@ -36,12 +43,15 @@ typedef struct compose_context_t {
 
 	til_fb_fragment_t	texture_fb;
 	compose_layer_t		texture;
+	unsigned		texture_tiled:1;	/* texture is rendered per-tile with the tiled layers */
+	size_t			tiled_first, tiled_last;/* layers [tiled_first, tiled_last) are rendered per-tile */
 	size_t			n_layers;
 	compose_layer_t		layers[];
 } compose_context_t;
 
 typedef struct compose_setup_t {
 	til_setup_t		til_setup;
+	unsigned		interleave:1;
 	char			*texture;
 	size_t			n_layers;
 	char			*layers[];
@@ -50,9 +60,12 @@ typedef struct compose_setup_t {
 static til_module_context_t * compose_create_context(unsigned seed, unsigned ticks, unsigned n_cpus, til_setup_t *setup);
 static void compose_destroy_context(til_module_context_t *context);
 static void compose_prepare_frame(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment, til_frame_plan_t *res_frame_plan);
+static void compose_render_fragment(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment);
+static void compose_finish_frame(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment);
 static int compose_setup(const til_settings_t *settings, til_setting_t **res_setting, const til_setting_desc_t **res_desc, til_setup_t **res_setup);
 
 static compose_setup_t compose_default_setup = {
+	.interleave = 1,
 	.layers = { "drizzle", "stars", "spiro", "plato", NULL },
 };
 
@@ -61,12 +74,44 @@ til_module_t	compose_module = {
 	.create_context = compose_create_context,
 	.destroy_context = compose_destroy_context,
 	.prepare_frame = compose_prepare_frame,
+	.render_fragment = compose_render_fragment,
+	.finish_frame = compose_finish_frame,
 	.name = "compose",
 	.description = "Layered modules compositor",
 	.setup = compose_setup,
 };
 
 
+static int compose_layer_tileable(const compose_layer_t *layer)
+{
+	return layer->module_ctxt && (layer->module->flags & TIL_MODULE_TILEABLE);
+}
+
+
+/* Find the first run of layers that can be rendered per-tile, so they're all drawn into each tile
+ * back-to-back while it's hot in the cache instead of streaming the whole frame through memory
+ * once per layer.  The texture is rendered per-tile too when no layer preceding the run samples it.
+ */
+static void compose_plan_tiles(compose_context_t *ctxt)
+{
+	size_t	first, last;
+
+	for (first = 0; first < ctxt->n_layers && !compose_layer_tileable(&ctxt->layers[first]); first++);
+	for (last = first; last < ctxt->n_layers && compose_layer_tileable(&ctxt->layers[last]); last++);
+
+	ctxt->texture_tiled = compose_layer_tileable(&ctxt->texture) && first <= 1;
+
+	/* nothing is gained by tiling a lone layer */
+	if (last - first + ctxt->texture_tiled < 2) {
+		ctxt->texture_tiled = 0;
+		return;
+	}
+
+	ctxt->tiled_first = first;
+	ctxt->tiled_last = last;
+}
+
+
 static til_module_context_t * compose_create_context(unsigned seed, unsigned ticks, unsigned n_cpus, til_setup_t *setup)
 {
 	compose_context_t	*ctxt;
@@ -86,7 +131,7 @@ static til_module_context_t * compose_create_context(unsigned seed, unsigned tic
 		til_setup_t		*layer_setup = NULL;
 
 		layer_module = til_lookup_module(((compose_setup_t *)setup)->layers[i]);
-		(void) til_module_randomize_setup(layer_module, &layer_setup, NULL);
+		(void) til_module_randomize_setup(layer_module, rand_r(&seed), &layer_setup, NULL);
 
 		ctxt->layers[i].module = layer_module;
 		(void) til_module_create_context(layer_module, rand_r(&seed), ticks, 0, layer_setup, &ctxt->layers[i].module_ctxt);
@@ -99,12 +144,16 @@ static til_module_context_t * compose_create_context(unsigned seed, unsigned tic
 		til_setup_t	*texture_setup = NULL;
 
 		ctxt->texture.module = til_lookup_module(((compose_setup_t *)setup)->texture);
-		(void) til_module_randomize_setup(ctxt->texture.module, &texture_setup, NULL);
+		(void) til_module_randomize_setup(ctxt->texture.module, rand_r(&seed), &texture_setup, NULL);
 
 		(void) til_module_create_context(ctxt->texture.module, rand_r(&seed), ticks, 0, texture_setup, &ctxt->texture.module_ctxt);
 		til_setup_free(texture_setup);
 	}
 
+	ctxt->tiled_first = ctxt->tiled_last = ctxt->n_layers;
+	if (((compose_setup_t *)setup)->interleave)
+		compose_plan_tiles(ctxt);
+
 	return &ctxt->til_module_context;
 }
 
@@ -125,9 +174,40 @@ static void compose_destroy_context(til_module_context_t *context)
 }
 
 
+/* layers past the first sample from the texture, when there is one */
+static til_fb_fragment_t * compose_layer_fragment(compose_context_t *ctxt, size_t layer, til_fb_fragment_t *fragment, til_fb_fragment_t *res_textured)
+{
+	if (!ctxt->texture.module || !layer)
+		return fragment;
+
+	*res_textured = *fragment;
+	res_textured->texture = &ctxt->texture_fb;
+
+	return res_textured;
+}
+
+
+static int compose_fragmenter(til_module_context_t *context, const til_fb_fragment_t *fragment, unsigned number, til_fb_fragment_t *res_fragment)
+{
+	compose_context_t	*ctxt = (compose_context_t *)context;
+	unsigned		rows;
+
+	/* without any tiled layers everything has already been rendered whole */
+	if (ctxt->tiled_first == ctxt->tiled_last)
+		return 0;
+
+	rows = MAX(1, COMPOSE_TILE_BYTES / (fragment->width * sizeof(uint32_t)));
+
+	return til_fb_fragment_slice_single(fragment, (fragment->height + rows - 1) / rows, number, res_fragment);
+}
+
+
 static void compose_prepare_frame(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment, til_frame_plan_t *res_frame_plan)
 {
 	compose_context_t	*ctxt = (compose_context_t *)context;
+	til_fb_fragment_t	textured, prepared;
+
+	*res_frame_plan = (til_frame_plan_t){ .fragmenter = compose_fragmenter };
 
 	if (ctxt->texture.module) {
 		if (!ctxt->texture_fb.buf ||
@@ -146,30 +226,78 @@ static void compose_prepare_frame(til_module_context_t *context, unsigned ticks,
 		}
 
 		ctxt->texture_fb.cleared = 0;
-		til_module_render(ctxt->texture.module_ctxt, ticks, &ctxt->texture_fb);
+		if (ctxt->texture_tiled)
+			til_module_render_begin(ctxt->texture.module_ctxt, ticks, &ctxt->texture_fb);
+		else
+			til_module_render(ctxt->texture.module_ctxt, ticks, &ctxt->texture_fb);
+	}
 
-		til_module_render(ctxt->layers[0].module_ctxt, ticks, fragment);
+	for (size_t i = 0; i < ctxt->tiled_first; i++)
+		til_module_render(ctxt->layers[i].module_ctxt, ticks, compose_layer_fragment(ctxt, i, fragment, &textured));
 
-		for (size_t i = 1; i < ctxt->n_layers; i++) {
-			til_fb_fragment_t	textured = *fragment;
+	/* the tiled layers only get prepared here, they're drawn tile by tile in compose_render_fragment(),
+	 * every layer but the first seeing the fragment as already cleared like when rendered whole.
+	 */
+	prepared = *fragment;
+	for (size_t i = ctxt->tiled_first; i < ctxt->tiled_last; i++) {
+		til_module_render_begin(ctxt->layers[i].module_ctxt, ticks, compose_layer_fragment(ctxt, i, &prepared, &textured));
+		prepared.cleared = 1;
+	}
+}
 
-			textured.texture = &ctxt->texture_fb;
 
-			til_module_render(ctxt->layers[i].module_ctxt, ticks, &textured);
-		}
-	} else {
-		for (size_t i = 0; i < ctxt->n_layers; i++)
-			til_module_render(ctxt->layers[i].module_ctxt, ticks, fragment);
+static void compose_render_fragment(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment)
+{
+	compose_context_t	*ctxt = (compose_context_t *)context;
+	til_fb_fragment_t	textured;
+
+	if (ctxt->texture_tiled) {
+		til_fb_fragment_t	texture_tile = {
+						.buf = ctxt->texture_fb.buf + fragment->y * ctxt->texture_fb.pitch + fragment->x,
+						.x = fragment->x,
+						.y = fragment->y,
+						.width = fragment->width,
+						.height = fragment->height,
+						.frame_width = ctxt->texture_fb.frame_width,
+						.frame_height = ctxt->texture_fb.frame_height,
+						.stride = ctxt->texture_fb.pitch - fragment->width,
+						.pitch = ctxt->texture_fb.pitch,
+						.number = fragment->number,
+					};
+
+		til_module_render_tile(ctxt->texture.module_ctxt, ticks, cpu, &texture_tile);
 	}
+
+	for (size_t i = ctxt->tiled_first; i < ctxt->tiled_last; i++) {
+		til_module_render_tile(ctxt->layers[i].module_ctxt, ticks, cpu, compose_layer_fragment(ctxt, i, fragment, &textured));
+		fragment->cleared = 1;
+	}
+}
+
+
+static void compose_finish_frame(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment)
+{
+	compose_context_t	*ctxt = (compose_context_t *)context;
+	til_fb_fragment_t	textured;
+
+	if (ctxt->texture_tiled)
+		til_module_render_end(ctxt->texture.module_ctxt, ticks, &ctxt->texture_fb);
+
+	for (size_t i = ctxt->tiled_first; i < ctxt->tiled_last; i++)
+		til_module_render_end(ctxt->layers[i].module_ctxt, ticks, compose_layer_fragment(ctxt, i, fragment, &textured));
+
+	for (size_t i = ctxt->tiled_last; i < ctxt->n_layers; i++)
+		til_module_render(ctxt->layers[i].module_ctxt, ticks, compose_layer_fragment(ctxt, i, fragment, &textured));
 }
 
 
 /* return a randomized valid layers= setting */
-static char * compose_random_layers_setting(void)
+static char * compose_random_layers_setting(unsigned seed)
 {
 	size_t			n_modules, n_rand_overlays, n_overlayable = 0, base_idx;
 	char			*layers = NULL;
 	const til_module_t	**modules;
+	til_rand_t		rand;
 
 	til_get_modules(&modules, &n_modules);
 
@@ -178,7 +306,9 @@ static char * compose_random_layers_setting(void)
 			n_overlayable++;
 	}
 
-	base_idx = rand() % (n_modules - n_overlayable);
+	til_rand_seed(&rand, seed, 0);
+
+	base_idx = til_rand(&rand) % (n_modules - n_overlayable);
 	for (size_t i = 0, j = 0; !layers && i < n_modules; i++) {
 		if (modules[i]->flags & TIL_MODULE_OVERLAYABLE)
 			continue;
@@ -192,9 +322,9 @@ static char * compose_random_layers_setting(void)
 	 * sometimes interesting.  Maybe another module flag is necessary for indicating
 	 * manifold-appropriate overlays.
 	 */
-	n_rand_overlays = 1 + (rand() % (n_overlayable - 1));
+	n_rand_overlays = 1 + (til_rand(&rand) % (n_overlayable - 1));
 	for (size_t n = 0; n < n_rand_overlays; n++) {
-		size_t	rand_idx = rand() % n_overlayable;
+		size_t	rand_idx = til_rand(&rand) % n_overlayable;
 
 		for (size_t i = 0, j = 0; i < n_modules; i++) {
 			if (!(modules[i]->flags & TIL_MODULE_OVERLAYABLE))
@@ -226,6 +356,12 @@ static int compose_setup(const til_settings_t *settings, til_setting_t **res_set
 {
 	const char	*layers;
 	const char	*texture;
+	const char	*interleave;
+	const char	*bool_values[] = {
+				"off",
+				"on",
+				NULL
+			};
 	const char	*texture_values[] = {
 				"none",
 				"blinds",
@@ -270,6 +406,21 @@ static int compose_setup(const til_settings_t *settings, til_setting_t **res_set
 	if (r)
 		return r;
 
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Render layers interleaved tile by tile where possible",
+							.key = "interleave",
+							.regex = "^(on|off)",
+							.preferred = bool_values[1],
+							.values = bool_values,
+							.annotations = NULL
+						},
+						&interleave,
+						res_setting,
+						res_desc);
+	if (r)
+		return r;
+
 	/* turn layers colon-separated list into a null-terminated array of strings */
 	if (res_setup) {
 		compose_setup_t		*setup;
@@ -332,6 +483,9 @@ static int compose_setup(const til_settings_t *settings, til_setting_t **res_set
 			setup = new;
 		} while ((layer = strtok(NULL, ":")));
 
+		if (!strcasecmp(interleave, "on"))
+			setup->interleave = 1;
+
 		if (strcasecmp(texture, "none")) {
 			const til_module_t	*texture_module;
 
@@ -21,11 +21,13 @@
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
+#include "til_rand.h"
 
 #include "puddle/puddle.h"
 
 #define PUDDLE_SIZE		512
 #define DRIZZLE_CNT		20
+#define DRIZZLE_TICK_SLICES	(PUDDLE_SIZE / 16)
 #define DEFAULT_VISCOSITY	.01
 
 typedef struct v3f_t {
@@ -44,6 +46,7 @@ typedef struct drizzle_setup_t {
 typedef struct drizzle_context_t {
 	til_module_context_t	til_module_context;
 	puddle_t		*puddle;
+	til_rand_t		rand;
 	drizzle_setup_t		setup;
 } drizzle_context_t;
 
@@ -91,6 +94,7 @@ static til_module_context_t * drizzle_create_context(unsigned seed, unsigned tic
 		return NULL;
 	}
 
+	til_rand_seed(&ctxt->rand, seed, 0);
 	ctxt->setup = *(drizzle_setup_t *)setup;
 
 	return &ctxt->til_module_context;
@@ -113,8 +117,8 @@ static void drizzle_prepare_frame(til_module_context_t *context, unsigned ticks,
 	*res_frame_plan = (til_frame_plan_t){ .fragmenter = til_fragmenter_slice_per_cpu };
 
 	for (int i = 0; i < DRIZZLE_CNT; i++) {
-		int	x = rand() % (PUDDLE_SIZE - 1);
-		int	y = rand() % (PUDDLE_SIZE - 1);
+		int	x = til_rand(&ctxt->rand) % (PUDDLE_SIZE - 1);
+		int	y = til_rand(&ctxt->rand) % (PUDDLE_SIZE - 1);
 
 		/* TODO: puddle should probably offer a normalized way of setting an
 		 * area to a value, so if PUDDLE_SIZE changes this automatically
@@ -125,8 +129,32 @@ static void drizzle_prepare_frame(til_module_context_t *context, unsigned ticks,
 		puddle_set(ctxt->puddle, x, y + 1, 1.f);
 		puddle_set(ctxt->puddle, x + 1, y + 1, 1.f);
 	}
+}
+
+
+static void drizzle_tick_pass(til_module_context_t *context, unsigned ticks, unsigned cpu, unsigned slice, unsigned n_slices)
+{
+	drizzle_context_t	*ctxt = (drizzle_context_t *)context;
+	int			row = PUDDLE_SIZE * slice / n_slices;
+
+	puddle_tick_rows(ctxt->puddle, ctxt->setup.viscosity, row, PUDDLE_SIZE * (slice + 1) / n_slices - row);
+}
+
+
+/* The puddle is ticked in horizontal slices, threaded */
+static int drizzle_prepare_pass(til_module_context_t *context, unsigned ticks, unsigned pass, til_pass_plan_t *res_pass_plan)
+{
+	drizzle_context_t	*ctxt = (drizzle_context_t *)context;
+
+	if (pass > 0) {
+		puddle_tick_finish(ctxt->puddle);
+
+		return 0;
+	}
+
+	*res_pass_plan = (til_pass_plan_t){ .func = drizzle_tick_pass, .n_slices = DRIZZLE_TICK_SLICES };
 
-	puddle_tick(ctxt->puddle, ctxt->setup.viscosity);
+	return 1;
 }
 
 
@@ -205,9 +233,11 @@ til_module_t	drizzle_module = {
 	.create_context = drizzle_create_context,
 	.destroy_context = drizzle_destroy_context,
 	.prepare_frame = drizzle_prepare_frame,
+	.prepare_pass = drizzle_prepare_pass,
 	.render_fragment = drizzle_render_fragment,
 	.name = "drizzle",
 	.description = "Classic 2D rain effect (threaded (poorly))",
 	.author = "Vito Caputo <vcaputo@pengaru.com>",
+	.flags = TIL_MODULE_TILEABLE,
 	.setup = drizzle_setup,
 };
@@ -3,11 +3,13 @@
 #include <inttypes.h>
 #include <math.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
 #include "til_settings.h"
+#include "til_util.h"
 
 
 /* This code is almost entirely taken from the paper:
@@ -16,161 +18,195 @@
  *
  * I take zero credit for it, I only wrote the rototiller integration.
  *   - Vito Caputo <vcaputo@pengaru.com> 10/13/2019
+ *
+ * The paper's serial Gauss-Seidel relaxation has since been replaced with a
+ * red-black ordering, and all the steps are performed in horizontal slices of
+ * rows, so the simulation can be spread across the rendering threads as
+ * passes.  See flui2d_prepare_pass().
  */
 
-#define ROOT		128	// Change this to vary the density field resolution
-#define SIZE		((ROOT + 2) * (ROOT + 2))
-#define IX(i, j)	((i) + (ROOT + 2) * (j))
-#define SWAP(x0, x)	{float *tmp = x0; x0 = x; x = tmp;}
+#define IX(i, j)		((i) + (N + 2) * (j))	/* expects the field resolution in N */
+#define FLUI2D_DT		.1f
+#define FLUI2D_ITERATIONS	20	/* relaxation iterations per linear solve */
+#define FLUI2D_SLICE_ROWS	8	/* approximate rows per slice of a pass */
 
 typedef struct flui2d_t {
-	float	u[SIZE], v[SIZE], u_prev[SIZE], v_prev[SIZE];
-	float	dens_r[SIZE], dens_prev_r[SIZE];
-	float	dens_g[SIZE], dens_prev_g[SIZE];
-	float	dens_b[SIZE], dens_prev_b[SIZE];
+	int	N;
+	float	*u, *v, *u_prev, *v_prev;
+	float	*dens_r, *dens_prev_r;
+	float	*dens_g, *dens_prev_g;
+	float	*dens_b, *dens_prev_b;
 	float	visc, diff, decay;
 } flui2d_t;
 
-static void set_bnd(int N, int b, float *x)
+
+/* set the boundaries for rows j0-j1 of x, which also sets the top and bottom
+ * boundaries when they're included, as they only depend on the adjacent rows.
+ */
+static void set_bnd_rows(int N, int b, float *x, int j0, int j1)
 {
-	for (int i = 1; i <= N; i++) {
-		x[IX(0, i)] = b == 1 ? -x[IX(1, i)] : x[IX(1, i)];
-		x[IX(N + 1, i)] = b == 1 ? -x[IX(N, i)] : x[IX(N, i)];
-		x[IX(i, 0)] = b == 2 ? -x[IX(i, 1)] : x[IX(i, 1)];
-		x[IX(i, N + 1)] = b == 2 ? -x[IX(i, N)] : x[IX(i, N)];
+	for (int j = j0; j <= j1; j++) {
+		x[IX(0, j)] = b == 1 ? -x[IX(1, j)] : x[IX(1, j)];
+		x[IX(N + 1, j)] = b == 1 ? -x[IX(N, j)] : x[IX(N, j)];
+	}
+
+	if (j0 == 1) {
+		for (int i = 1; i <= N; i++)
+			x[IX(i, 0)] = b == 2 ? -x[IX(i, 1)] : x[IX(i, 1)];
+
+		x[IX(0 , 0)] = 0.5f * (x[IX(1, 0)] + x[IX(0, 1)]);
+		x[IX(N + 1, 0)] = 0.5f * (x[IX(N, 0)] + x[IX(N + 1, 1)]);
 	}
 
-	x[IX(0 , 0)] = 0.5 * (x[IX(1, 0)] + x[IX(0, 1)]);
-	x[IX(0 , N + 1)] = 0.5 * (x[IX(1, N + 1)] + x[IX(0, N)]);
-	x[IX(N + 1, 0)] = 0.5 * (x[IX(N, 0)] + x[IX(N + 1, 1)]);
-	x[IX(N + 1, N + 1)] = 0.5 * (x[IX(N, N + 1)] + x[IX(N + 1, N)]);
+	if (j1 == N) {
+		for (int i = 1; i <= N; i++)
+			x[IX(i, N + 1)] = b == 2 ? -x[IX(i, N)] : x[IX(i, N)];
+
+		x[IX(0 , N + 1)] = 0.5f * (x[IX(1, N + 1)] + x[IX(0, N)]);
+		x[IX(N + 1, N + 1)] = 0.5f * (x[IX(N, N + 1)] + x[IX(N + 1, N)]);
+	}
 }
 
-static void add_source(int N, float *x, float *s, float dt)
-{
-	int	size = (N + 2) * (N + 2);
 
-	for (int i = 0; i < size; i++)
+static void add_source_rows(int N, float * restrict x, const float * restrict s, float dt, int j0, int j1)
+{
+	for (int i = IX(0, j0); i < IX(0, j1 + 1); i++)
 		x[i] += dt * s[i];
 }
 
-static void diffuse(int N, int b, float *x, float *x0, float diff, float decay, float dt)
+
+/* One half-sweep of the red-black Gauss-Seidel relaxation of rows j0-j1, updating only the cells
+ * of the parity color.  A color's cells only depend on the other color's, so the rows may be
+ * relaxed concurrently.  After the second half-sweep the iteration is complete, and the
+ * boundaries of the rows are updated.
+ */
+static void lin_solve_rows(int N, int b, float *x, const float *x0, float a, float c, int parity, int j0, int j1)
 {
-	float a = dt * diff * (float)N * (float)N;
-	int i, j, k;
-	float z = 1.f / (1.f + 4.f * a);
-
-	for (k = 0; k < 20; k++) {
-		for (i = 1; i <= N; i++) {
-			for (j = 1; j <= N; j++) {
-				x[IX(i, j)] = (x0[IX(i, j)] + a * (x[IX(i - 1, j)] + x[IX(i + 1, j)] + x[IX(i, j - 1)] + x[IX(i, j + 1)])) * z * (1.f - decay);
-			}
-		}
-		set_bnd(N, b, x);
+	for (int j = j0; j <= j1; j++) {
+		float		*xj = &x[IX(0, j)];
+		const float	*up = &x[IX(0, j - 1)], *down = &x[IX(0, j + 1)], *x0j = &x0[IX(0, j)];
+
+		for (int i = 1 + ((j + parity) & 1); i <= N; i += 2)
+			xj[i] = (x0j[i] + a * (xj[i - 1] + xj[i + 1] + up[i] + down[i])) * c;
 	}
+
+	if (parity)
+		set_bnd_rows(N, b, x, j0, j1);
 }
 
-static void advect(int N, int b, float *d, float *d0, float *u, float *v, float dt)
+
+static void diffuse_rows(int N, int b, float *x, const float *x0, float diff, float decay, float dt, int parity, int j0, int j1)
 {
-	float x, y, s0, t0, s1, t1, dt0;
-	int i, j, i0, j0, i1, j1;
+	float	a = dt * diff * (float)N * (float)N;
 
-	dt0 = dt * (float)N;
-	for (i = 1 ; i <= N ; i++) {
-		for (j = 1 ; j <= N; j++) {
-			x = (float)i - dt0 * u[IX(i, j)];
-			y = (float)j - dt0 * v[IX(i, j)];
+	lin_solve_rows(N, b, x, x0, a, 1.f / (1.f + 4.f * a) * (1.f - decay), parity, j0, j1);
+}
 
-			if (x < .5f)
-				x = .5f;
-			if (x > (float)N + .5f)
-				x = (float)N + .5f;
 
-			i0 = (int)x;
-			i1 = i0 + 1;
+static void advect_rows(int N, int b, float * restrict d, const float * restrict d0, const float * restrict u, const float * restrict v, float dt, int j0, int j1)
+{
+	float	dt0 = dt * (float)N;
 
-			if (y < .5f)
-				y = .5f;
-			if (y > (float)N + .5f)
-				y = (float)N + .5f;
+	for (int j = j0; j <= j1; j++) {
+		for (int i = 1; i <= N; i++) {
+			float	x, y, s0, t0, s1, t1;
+			int	x0, y0, x1, y1;
 
-			j0 = (int)y;
-			j1 = j0 + 1;
+			x = fminf(fmaxf((float)i - dt0 * u[IX(i, j)], .5f), (float)N + .5f);
+			y = fminf(fmaxf((float)j - dt0 * v[IX(i, j)], .5f), (float)N + .5f);
 
-			s1 = x - (float)i0;
+			x0 = (int)x;
+			x1 = x0 + 1;
+			y0 = (int)y;
+			y1 = y0 + 1;
+
+			s1 = x - (float)x0;
 			s0 = 1.f - s1;
-			t1 = y - (float)j0;
+			t1 = y - (float)y0;
 			t0 = 1.f - t1;
 
-			d[IX(i, j)] = s0 * (t0 * d0[IX(i0, j0)] + t1 * d0[IX(i0, j1)]) + s1 * (t0 * d0[IX(i1, j0)] + t1 * d0[IX(i1, j1)]);
+			d[IX(i, j)] = s0 * (t0 * d0[IX(x0, y0)] + t1 * d0[IX(x0, y1)]) + s1 * (t0 * d0[IX(x1, y0)] + t1 * d0[IX(x1, y1)]);
 		}
 	}
-	set_bnd(N, b, d);
+
+	set_bnd_rows(N, b, d, j0, j1);
 }
 
-static void project(int N, float *u, float *v, float *p, float *div)
+
+/* project() is split into computing the divergence, relaxing p via lin_solve_rows(), then
+ * subtracting the gradient.
+ */
+static void project_div_rows(int N, const float * restrict u, const float * restrict v, float * restrict p, float * restrict div, int j0, int j1)
 {
-	float h = 1.f / (float)N;
-	int i, j, k;
+	float	h = 1.f / (float)N;
 
-	for (i = 1; i <= N ; i++) {
-		for (j = 1; j <= N; j++) {
-			div[IX(i, j)] = -0.5 * h *(u[IX(i + 1, j)] - u[IX(i - 1, j)] + v[IX(i, j + 1)] - v[IX(i, j - 1)]);
+	for (int j = j0; j <= j1; j++) {
+		for (int i = 1; i <= N; i++) {
+			div[IX(i, j)] = -0.5f * h * (u[IX(i + 1, j)] - u[IX(i - 1, j)] + v[IX(i, j + 1)] - v[IX(i, j - 1)]);
 			p[IX(i, j)] = 0;
 		}
 	}
 
-	set_bnd(N, 0, div);
-	set_bnd(N, 0, p);
+	set_bnd_rows(N, 0, div, j0, j1);
+	set_bnd_rows(N, 0, p, j0, j1);
+}
 
-	for (k = 0; k < 20; k++) {
-		for (i = 1; i <= N; i++) {
-			for (j = 1; j <= N; j++) {
-				p[IX(i, j)] = (div[IX(i, j)] + p[IX(i - 1, j)] + p[IX(i + 1, j)] + p[IX(i, j - 1)] + p[IX(i, j + 1)]) * .25f;
-			}
-		}
-		set_bnd(N, 0, p);
-	}
 
-	for (i = 1; i <= N; i++) {
-		for (j = 1; j <= N; j++) {
-			u[IX(i, j)] -= 0.5 * (p[IX(i + 1, j)] - p[IX(i - 1, j)]) / h;
-			v[IX(i, j)] -= 0.5 * (p[IX(i, j + 1)] - p[IX(i, j - 1)]) / h;
+static void project_gradient_rows(int N, float * restrict u, float * restrict v, const float * restrict p, int j0, int j1)
+{
+	float	h = 1.f / (float)N;
+
+	for (int j = j0; j <= j1; j++) {
+		for (int i = 1; i <= N; i++) {
+			u[IX(i, j)] -= 0.5f * (p[IX(i + 1, j)] - p[IX(i - 1, j)]) / h;
+			v[IX(i, j)] -= 0.5f * (p[IX(i, j + 1)] - p[IX(i, j - 1)]) / h;
 		}
 	}
 
-	set_bnd(N, 1, u);
-	set_bnd(N, 2, v);
+	set_bnd_rows(N, 1, u, j0, j1);
+	set_bnd_rows(N, 2, v, j0, j1);
 }
 
-static void dens_step(int N, float *x, float *x0, float *u, float *v, float diff, float decay, float dt)
-{
-
-	/*
-	 * The paper includes this, but it blows up the simulation.
-	 * add_source(N, x, x0, dt);
-	 * SWAP(x0, x);
-	 */
-	diffuse(N, 0, x, x0, diff, decay, dt);
-	SWAP(x0, x);
-	advect(N, 0, x, x0, u, v, dt);
-}
 
-static void vel_step(int N, float *u, float *v, float *u0, float *v0, float visc, float dt)
-{
-	add_source(N, u, u0, dt);
-	add_source(N, v, v0, dt);
-	SWAP(u0, u);
-	diffuse(N, 1, u, u0, visc, 0.f, dt);
-	SWAP(v0, v);
-	diffuse(N, 2, v, v0, visc, 0.f, dt);
-	project(N, u, v, u0, v0);
-	SWAP(u0, u);
-	SWAP(v0, v);
-	advect(N, 1, u, u0, u0, v0, dt);
-	advect(N, 2, v, v0, u0, v0, dt);
-	project(N, u, v, u0, v0);
-}
+/* The simulation steps, each run as one or more passes over slices of rows, for one or more
+ * fields at a time.  vel_step() and dens_step() from the paper are the sequence of these:
+ *
+ * vel_step(): add_source(u, v), diffuse(u, v), project(), advect(u, v), project()
+ * dens_step(): diffuse(r, g, b), advect(r, g, b)
+ *
+ * Note the paper's add_source() in dens_step() blows up the simulation, so it's omitted.
+ */
+typedef enum flui2d_stage_t {
+	FLUI2D_STAGE_VEL_SOURCE,
+	FLUI2D_STAGE_VEL_DIFFUSE,
+	FLUI2D_STAGE_VEL_PROJECT_DIV,
+	FLUI2D_STAGE_VEL_PROJECT_SOLVE,
+	FLUI2D_STAGE_VEL_PROJECT_GRADIENT,
+	FLUI2D_STAGE_VEL_ADVECT,
+	FLUI2D_STAGE_VEL_REPROJECT_DIV,
+	FLUI2D_STAGE_VEL_REPROJECT_SOLVE,
+	FLUI2D_STAGE_VEL_REPROJECT_GRADIENT,
+	FLUI2D_STAGE_DENS_DIFFUSE,
+	FLUI2D_STAGE_DENS_ADVECT,
+	FLUI2D_STAGE_CNT
+} flui2d_stage_t;
+
+static const struct {
+	unsigned	n_fields;	/* fields processed concurrently, each in its own slices */
+	unsigned	n_passes;	/* relaxations take two passes (red, black) per iteration */
+} flui2d_stages[FLUI2D_STAGE_CNT] = {
+	[FLUI2D_STAGE_VEL_SOURCE] =		{ 2, 1 },
+	[FLUI2D_STAGE_VEL_DIFFUSE] =		{ 2, FLUI2D_ITERATIONS * 2 },
+	[FLUI2D_STAGE_VEL_PROJECT_DIV] =	{ 1, 1 },
+	[FLUI2D_STAGE_VEL_PROJECT_SOLVE] =	{ 1, FLUI2D_ITERATIONS * 2 },
+	[FLUI2D_STAGE_VEL_PROJECT_GRADIENT] =	{ 1, 1 },
+	[FLUI2D_STAGE_VEL_ADVECT] =		{ 2, 1 },
+	[FLUI2D_STAGE_VEL_REPROJECT_DIV] =	{ 1, 1 },
+	[FLUI2D_STAGE_VEL_REPROJECT_SOLVE] =	{ 1, FLUI2D_ITERATIONS * 2 },
+	[FLUI2D_STAGE_VEL_REPROJECT_GRADIENT] =	{ 1, 1 },
+	[FLUI2D_STAGE_DENS_DIFFUSE] =		{ 3, FLUI2D_ITERATIONS * 2 },
+	[FLUI2D_STAGE_DENS_ADVECT] =		{ 3, 1 },
+};
 
 typedef enum flui2d_emitters_t {
 	FLUI2D_EMITTERS_FIGURE8 = 0,	/* this is the original/classic figure eight */
@@ -179,6 +215,7 @@ typedef enum flui2d_emitters_t {
 
 typedef struct flui2d_setup_t {
 	til_setup_t		til_setup;
+	unsigned		size;
 	float			viscosity;
 	float			diffusion;
 	float			decay;
@@ -186,14 +223,26 @@ typedef struct flui2d_setup_t {
 	float			clockstep;
 } flui2d_setup_t;
 
+/* the simulation's output rendered by flui2d_render_fragment(), double-buffered for pipelining */
+typedef struct flui2d_frame_t {
+	float			*dens_r, *dens_g, *dens_b;
+	float			xf, yf;
+} flui2d_frame_t;
+
 typedef struct flui2d_context_t {
 	til_module_context_t	til_module_context;
 	flui2d_t		fluid;
 	flui2d_emitters_t	emitters;
 	float			clockstep;
-	float			xf, yf;
+	unsigned		frame;	/* index of frames[] being rendered */
+	flui2d_frame_t		frames[2];
+	flui2d_stage_t		stage;	/* stage of the simulation pass in progress */
+	unsigned		stage_pass;
+	unsigned		n_row_slices;
+	float			fields[];
 } flui2d_context_t;
 
+#define FLUI2D_DEFAULT_SIZE		128
 #define FLUI2D_DEFAULT_EMITTERS		FLUI2D_EMITTERS_FIGURE8
 #define FLUI2D_DEFAULT_CLOCKSTEP	.5
 
@@ -204,6 +253,7 @@ typedef struct flui2d_context_t {
 
 
 static flui2d_setup_t flui2d_default_setup = {
+	.size = FLUI2D_DEFAULT_SIZE,
 	.viscosity = FLUI2D_DEFAULT_VISCOSITY,
 	.diffusion = FLUI2D_DEFAULT_DIFFUSION,
 	.decay = FLUI2D_DEFAULT_DECAY,
@@ -249,11 +299,18 @@ static til_module_context_t * flui2d_create_context(unsigned seed, unsigned tick
 {
 	static int		initialized;
 	flui2d_context_t	*ctxt;
+	size_t			field_size;
+	float			*field;
+	int			N;
 
 	if (!setup)
 		setup = &flui2d_default_setup.til_setup;
 
-	ctxt = til_module_context_new(sizeof(flui2d_context_t), seed, ticks, n_cpus);
+	N = ((flui2d_setup_t *)setup)->size;
+	field_size = (N + 2) * (N + 2);
+
+	/* 10 simulation fields + 2 frames of 3 rendered fields */
+	ctxt = til_module_context_new(sizeof(flui2d_context_t) + sizeof(float) * field_size * 16, seed, ticks, n_cpus);
 	if (!ctxt)
 		return NULL;
 
@@ -262,72 +319,222 @@ static til_module_context_t * flui2d_create_context(unsigned seed, unsigned tick
 		gamma_init(1.4f);
 	}
 
+	field = ctxt->fields;
+	ctxt->fluid.u = field, field += field_size;
+	ctxt->fluid.v = field, field += field_size;
+	ctxt->fluid.u_prev = field, field += field_size;
+	ctxt->fluid.v_prev = field, field += field_size;
+	ctxt->fluid.dens_r = field, field += field_size;
+	ctxt->fluid.dens_prev_r = field, field += field_size;
+	ctxt->fluid.dens_g = field, field += field_size;
+	ctxt->fluid.dens_prev_g = field, field += field_size;
+	ctxt->fluid.dens_b = field, field += field_size;
+	ctxt->fluid.dens_prev_b = field, field += field_size;
+
+	for (int i = 0; i < nelems(ctxt->frames); i++) {
+		ctxt->frames[i].dens_r = field, field += field_size;
+		ctxt->frames[i].dens_g = field, field += field_size;
+		ctxt->frames[i].dens_b = field, field += field_size;
+	}
+
+	ctxt->fluid.N = N;
 	ctxt->fluid.visc = ((flui2d_setup_t *)setup)->viscosity;
 	ctxt->fluid.diff = ((flui2d_setup_t *)setup)->diffusion;
 	ctxt->fluid.decay = ((flui2d_setup_t *)setup)->decay;
 	ctxt->emitters = ((flui2d_setup_t *)setup)->emitters;
 	ctxt->clockstep = ((flui2d_setup_t *)setup)->clockstep;
+	ctxt->n_row_slices = N / FLUI2D_SLICE_ROWS;
 
 	return &ctxt->til_module_context;
 }
 
 
+/* emit densities and velocities into the prev fields at x,y, scaled to cover the same area at any field size */
+static void flui2d_emit(flui2d_t *fluid, int x, int y, float r, float g, float b, float u, float v)
+{
+	int	N = fluid->N, n = MAX(N / FLUI2D_DEFAULT_SIZE, 1);
+
+	for (int j = y; j < MIN(y + n, N + 1); j++) {
+		for (int i = x; i < MIN(x + n, N + 1); i++) {
+			fluid->dens_prev_r[IX(i, j)] = r;
+			fluid->dens_prev_g[IX(i, j)] = g;
+			fluid->dens_prev_b[IX(i, j)] = b;
+			fluid->u_prev[IX(i, j)] = u;
+			fluid->v_prev[IX(i, j)] = v;
+		}
+	}
+}
+
+
 /* Prepare a frame for concurrent drawing of fragment using multiple fragments */
 static void flui2d_prepare_frame(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment, til_frame_plan_t *res_frame_plan)
 {
 	flui2d_context_t	*ctxt = (flui2d_context_t *)context;
+	flui2d_frame_t		*back = &ctxt->frames[ctxt->frame ^ 1];
 	float			r = (ticks % (unsigned)(2 * M_PI * 1000)) * .001f;
+	int			N = ctxt->fluid.N;
 
 	*res_frame_plan = (til_frame_plan_t){ .fragmenter = til_fragmenter_tile64 };
 
 	switch (ctxt->emitters) {
 	case FLUI2D_EMITTERS_FIGURE8: {
-		int	x = (cos(r) * .4f + .5f) * (float)ROOT;	/* figure eight pattern for the added densities */
-		int	y = (sin(r * 2.f) * .4f + .5f) * (float)ROOT;
-
-		ctxt->fluid.dens_prev_r[IX(x, y)] = .5f + cos(r) * .5f;
-		ctxt->fluid.dens_prev_g[IX(x, y)] = .5f + sin(r) * .5f;
-		ctxt->fluid.dens_prev_b[IX(x, y)] = .5f + cos(r * 2.f) * .5f;
+		int	x = (cos(r) * .4f + .5f) * (float)N;	/* figure eight pattern for the added densities */
+		int	y = (sin(r * 2.f) * .4f + .5f) * (float)N;
 
 		/* This orientation for the added velocities at the added densities isn't trying to
 		 * emulate any sort of physical relationship to the movement - it's just creating a variety
 		 * of turbulence.  It'd be trivial to make it look like a rocket's jetstream or something.
 		 */
-		ctxt->fluid.u_prev[IX(x, y)] = cos(r * 3.f) * 10.f;
-		ctxt->fluid.v_prev[IX(x, y)] = sin(r * 3.f) * 10.f;
+		flui2d_emit(&ctxt->fluid, x, y,
+			    .5f + cos(r) * .5f,
+			    .5f + sin(r) * .5f,
+			    .5f + cos(r * 2.f) * .5f,
+			    cos(r * 3.f) * 10.f,
+			    sin(r * 3.f) * 10.f);
 		break;
 	}
 
 	case FLUI2D_EMITTERS_CLOCKGRID: {
-#define FLUI2D_CLOCKGRID_SIZE	(ROOT>>4)
-#define FLUI2D_CLOCKGRID_STEP	(ROOT/FLUI2D_CLOCKGRID_SIZE)
-		for (int y = FLUI2D_CLOCKGRID_STEP; y < ROOT; y += FLUI2D_CLOCKGRID_STEP) {
-			for (int x = FLUI2D_CLOCKGRID_STEP; x < ROOT; x += FLUI2D_CLOCKGRID_STEP, r += ctxt->clockstep * M_PI * 2) {
-
-				ctxt->fluid.dens_prev_r[IX(x, y)] = .5f + cos(r) * .5f;
-				ctxt->fluid.dens_prev_g[IX(x, y)] = .5f + sin(r) * .5f;
-				ctxt->fluid.dens_prev_b[IX(x, y)] = .5f + cos(r * 2.f) * .5f;
-
-				ctxt->fluid.u_prev[IX(x, y)] = cos(r * 3.f);
-				ctxt->fluid.v_prev[IX(x, y)] = sin(r * 3.f);
+#define FLUI2D_CLOCKGRID_SIZE	8
+#define FLUI2D_CLOCKGRID_STEP	(N/FLUI2D_CLOCKGRID_SIZE)
+		for (int y = FLUI2D_CLOCKGRID_STEP; y < N; y += FLUI2D_CLOCKGRID_STEP) {
+			for (int x = FLUI2D_CLOCKGRID_STEP; x < N; x += FLUI2D_CLOCKGRID_STEP, r += ctxt->clockstep * M_PI * 2) {
+				flui2d_emit(&ctxt->fluid, x, y,
+					    .5f + cos(r) * .5f,
+					    .5f + sin(r) * .5f,
+					    .5f + cos(r * 2.f) * .5f,
+					    cos(r * 3.f),
+					    sin(r * 3.f));
 			}
 		}
 		break;
 	}
 	}
 
-	/* These are the core of the simulation, and can't currently be threaded using the paper's implementation, so they
-	 * must occur serialized here in prepare_frame.  It would be interesting to try refactor the API and tweak the
-	 * implementation for threading, as it would really open up larger field sizes as well as map more naturally to
-	 * a GLSL implementation for a fragment shader.
-	 */
-	vel_step(ROOT, ctxt->fluid.u, ctxt->fluid.v, ctxt->fluid.u_prev, ctxt->fluid.v_prev, ctxt->fluid.visc, .1f);
-	dens_step(ROOT, ctxt->fluid.dens_r, ctxt->fluid.dens_prev_r, ctxt->fluid.u, ctxt->fluid.v, ctxt->fluid.diff, ctxt->fluid.decay, .1f);
-	dens_step(ROOT, ctxt->fluid.dens_g, ctxt->fluid.dens_prev_g, ctxt->fluid.u, ctxt->fluid.v, ctxt->fluid.diff, ctxt->fluid.decay, .1f);
-	dens_step(ROOT, ctxt->fluid.dens_b, ctxt->fluid.dens_prev_b, ctxt->fluid.u, ctxt->fluid.v, ctxt->fluid.diff, ctxt->fluid.decay, .1f);
-
-	ctxt->xf = 1.f / fragment->frame_width;
-	ctxt->yf = 1.f / fragment->frame_height;
+	/* the simulation itself is performed by the passes, see flui2d_prepare_pass() */
+	back->xf = 1.f / fragment->frame_width;
+	back->yf = 1.f / fragment->frame_height;
+}
+
+
+/* Perform a slice of the current simulation stage's pass */
+static void flui2d_sim_pass(til_module_context_t *context, unsigned ticks, unsigned cpu, unsigned slice, unsigned n_slices)
+{
+	flui2d_context_t	*ctxt = (flui2d_context_t *)context;
+	flui2d_t		*f = &ctxt->fluid;
+	int			N = f->N;
+	unsigned		field = slice / ctxt->n_row_slices, rows = slice % ctxt->n_row_slices;
+	int			j0 = 1 + N * rows / ctxt->n_row_slices;
+	int			j1 = N * (rows + 1) / ctxt->n_row_slices;
+	int			parity = ctxt->stage_pass & 1;
+	float			*dens[] = { f->dens_r, f->dens_g, f->dens_b };
+	float			*dens_prev[] = { f->dens_prev_r, f->dens_prev_g, f->dens_prev_b };
+
+	switch (ctxt->stage) {
+	case FLUI2D_STAGE_VEL_SOURCE:
+		if (!field)
+			add_source_rows(N, f->u, f->u_prev, FLUI2D_DT, j0, j1);
+		else
+			add_source_rows(N, f->v, f->v_prev, FLUI2D_DT, j0, j1);
+		break;
+
+	case FLUI2D_STAGE_VEL_DIFFUSE:
+		if (!field)
+			diffuse_rows(N, 1, f->u_prev, f->u, f->visc, 0.f, FLUI2D_DT, parity, j0, j1);
+		else
+			diffuse_rows(N, 2, f->v_prev, f->v, f->visc, 0.f, FLUI2D_DT, parity, j0, j1);
+		break;
+
+	case FLUI2D_STAGE_VEL_PROJECT_DIV:
+		project_div_rows(N, f->u_prev, f->v_prev, f->u, f->v, j0, j1);
+		break;
+
+	case FLUI2D_STAGE_VEL_PROJECT_SOLVE:
+		lin_solve_rows(N, 0, f->u, f->v, 1.f, .25f, parity, j0, j1);
+		break;
+
+	case FLUI2D_STAGE_VEL_PROJECT_GRADIENT:
+		project_gradient_rows(N, f->u_prev, f->v_prev, f->u, j0, j1);
+		break;
+
+	case FLUI2D_STAGE_VEL_ADVECT:
+		if (!field)
+			advect_rows(N, 1, f->u, f->u_prev, f->u_prev, f->v_prev, FLUI2D_DT, j0, j1);
+		else
+			advect_rows(N, 2, f->v, f->v_prev, f->u_prev, f->v_prev, FLUI2D_DT, j0, j1);
+		break;
+
+	case FLUI2D_STAGE_VEL_REPROJECT_DIV:
+		project_div_rows(N, f->u, f->v, f->u_prev, f->v_prev, j0, j1);
+		break;
+
+	case FLUI2D_STAGE_VEL_REPROJECT_SOLVE:
+		lin_solve_rows(N, 0, f->u_prev, f->v_prev, 1.f, .25f, parity, j0, j1);
+		break;
+
+	case FLUI2D_STAGE_VEL_REPROJECT_GRADIENT:
+		project_gradient_rows(N, f->u, f->v, f->u_prev, j0, j1);
+		break;
+
+	case FLUI2D_STAGE_DENS_DIFFUSE:
+		diffuse_rows(N, 0, dens[field], dens_prev[field], f->diff, f->decay, FLUI2D_DT, parity, j0, j1);
+		break;
+
+	case FLUI2D_STAGE_DENS_ADVECT: {
+		flui2d_frame_t	*back = &ctxt->frames[ctxt->frame ^ 1];
+		float		*res[] = { back->dens_r, back->dens_g, back->dens_b };
+
+		advect_rows(N, 0, dens_prev[field], dens[field], f->u, f->v, FLUI2D_DT, j0, j1);
+
+		/* the previous frame may still be rendering from the front buffer, see flui2d_swap_frame(),
+		 * and the boundary rows get sampled too so the edge slices include them.
+		 */
+		if (j0 == 1)
+			j0 = 0;
+		if (j1 == N)
+			j1 = N + 1;
+
+		memcpy(&res[field][IX(0, j0)], &dens[field][IX(0, j0)], sizeof(float) * (j1 - j0 + 1) * (N + 2));
+		break;
+	}
+
+	default:
+		break;
+	}
+}
+
+
+/* Every stage of the simulation is performed as passes over horizontal slices of rows of its fields */
+static int flui2d_prepare_pass(til_module_context_t *context, unsigned ticks, unsigned pass, til_pass_plan_t *res_pass_plan)
+{
+	flui2d_context_t	*ctxt = (flui2d_context_t *)context;
+
+	if (!pass) {
+		ctxt->stage = 0;
+		ctxt->stage_pass = 0;
+	} else if (++ctxt->stage_pass == flui2d_stages[ctxt->stage].n_passes) {
+		ctxt->stage++;
+		ctxt->stage_pass = 0;
+	}
+
+	if (ctxt->stage == FLUI2D_STAGE_CNT)
+		return 0;
+
+	*res_pass_plan = (til_pass_plan_t){
+				.func = flui2d_sim_pass,
+				.n_slices = flui2d_stages[ctxt->stage].n_fields * ctxt->n_row_slices,
+			};
+
+	return 1;
+}
+
+
+/* Make the densities simulated by the passes the ones rendered */
+static void flui2d_swap_frame(til_module_context_t *context)
+{
+	flui2d_context_t	*ctxt = (flui2d_context_t *)context;
+
+	ctxt->frame ^= 1;
 }
 
 
@@ -335,41 +542,43 @@ static void flui2d_prepare_frame(til_module_context_t *context, unsigned ticks,
 static void flui2d_render_fragment(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment)
 {
 	flui2d_context_t	*ctxt = (flui2d_context_t *)context;
+	flui2d_frame_t		*frame = &ctxt->frames[ctxt->frame];
+	int			N = ctxt->fluid.N;
 
 	for (int y = fragment->y; y < fragment->y + fragment->height; y++) {
 		int	y0, y1;
 		float	Y;
 
-		Y = (float)y * ctxt->yf * (float)ROOT;
+		Y = (float)y * frame->yf * (float)N;
 		y0 = (int)Y;
 		y1 = y0 + 1;
 
 		for (int x = fragment->x; x < fragment->x + fragment->width; x++) {
-			float		X, dens, dx0, dx1;
+			float		X, dx0, dx1;
 			int		x0, x1;
 			float		r, g, b;
 
-			X = (float)x * ctxt->xf * (float)ROOT;
+			X = (float)x * frame->xf * (float)N;
 			x0 = (int)X;
 			x1 = x0 + 1;
 
 			/* linear interpolation of density samples */
-			dx0 = ctxt->fluid.dens_r[(int)IX(x0, y0)] * (1.f - (X - x0));
-			dx0 += ctxt->fluid.dens_r[(int)IX(x1, y0)] * (X - x0);
-			dx1 = ctxt->fluid.dens_r[(int)IX(x0, y1)] * (1.f - (X - x0));
-			dx1 += ctxt->fluid.dens_r[(int)IX(x1, y1)] * (X - x0);
+			dx0 = frame->dens_r[(int)IX(x0, y0)] * (1.f - (X - x0));
+			dx0 += frame->dens_r[(int)IX(x1, y0)] * (X - x0);
+			dx1 = frame->dens_r[(int)IX(x0, y1)] * (1.f - (X - x0));
+			dx1 += frame->dens_r[(int)IX(x1, y1)] * (X - x0);
 			r = dx0 * (1.f - (Y - y0)) + dx1 * (Y - y0);
 
-			dx0 = ctxt->fluid.dens_g[(int)IX(x0, y0)] * (1.f - (X - x0));
-			dx0 += ctxt->fluid.dens_g[(int)IX(x1, y0)] * (X - x0);
-			dx1 = ctxt->fluid.dens_g[(int)IX(x0, y1)] * (1.f - (X - x0));
-			dx1 += ctxt->fluid.dens_g[(int)IX(x1, y1)] * (X - x0);
+			dx0 = frame->dens_g[(int)IX(x0, y0)] * (1.f - (X - x0));
+			dx0 += frame->dens_g[(int)IX(x1, y0)] * (X - x0);
+			dx1 = frame->dens_g[(int)IX(x0, y1)] * (1.f - (X - x0));
+			dx1 += frame->dens_g[(int)IX(x1, y1)] * (X - x0);
 			g = dx0 * (1.f - (Y - y0)) + dx1 * (Y - y0);
 
-			dx0 = ctxt->fluid.dens_b[(int)IX(x0, y0)] * (1.f - (X - x0));
-			dx0 += ctxt->fluid.dens_b[(int)IX(x1, y0)] * (X - x0);
-			dx1 = ctxt->fluid.dens_b[(int)IX(x0, y1)] * (1.f - (X - x0));
-			dx1 += ctxt->fluid.dens_b[(int)IX(x1, y1)] * (X - x0);
+			dx0 = frame->dens_b[(int)IX(x0, y0)] * (1.f - (X - x0));
+			dx0 += frame->dens_b[(int)IX(x1, y0)] * (X - x0);
+			dx1 = frame->dens_b[(int)IX(x0, y1)] * (1.f - (X - x0));
+			dx1 += frame->dens_b[(int)IX(x1, y1)] * (X - x0);
 			b = dx0 * (1.f - (Y - y0)) + dx1 * (Y - y0);
 
 			til_fb_fragment_put_pixel_unchecked(fragment, 0, x, y, gamma_color_to_uint32_rgb(r, g, b));
@@ -378,9 +587,16 @@ static void flui2d_render_fragment(til_module_context_t *context, unsigned ticks
 }
 
 
-/* Settings hooks for configurable variables */
 static int flui2d_setup(const til_settings_t *settings, til_setting_t **res_setting, const til_setting_desc_t **res_desc, til_setup_t **res_setup)
 {
+	const char	*size;
+	const char	*size_values[] = {
+				"128",
+				"256",
+				"512",
+				"1024",
+				NULL
+			};
 	const char	*viscosity;
 	const char	*diffusion;
 	const char	*values[] = {
@@ -423,6 +639,21 @@ static int flui2d_setup(const til_settings_t *settings, til_setting_t **res_sett
 			};
 	int		r;
 
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Fluid field size",
+							.key = "size",
+							.regex = "^(128|256|512|1024)$",
+							.preferred = TIL_SETTINGS_STR(FLUI2D_DEFAULT_SIZE),
+							.values = size_values,
+							.annotations = NULL
+						},
+						&size,
+						res_setting,
+						res_desc);
+	if (r)
+		return r;
+
 	r = til_settings_get_and_describe_value(settings,
 						&(til_setting_desc_t){
 							.name = "Fluid viscosity",
@@ -508,12 +739,14 @@ static int flui2d_setup(const til_settings_t *settings, til_setting_t **res_sett
 			return -ENOMEM;
 
 		/* TODO: return -EINVAL on parse errors? */
+		sscanf(size, "%u", &setup->size);
 		sscanf(viscosity, "%f", &setup->viscosity);
 		sscanf(diffusion, "%f", &setup->diffusion);
 		sscanf(decay, "%f", &setup->decay);
 
 		/* prevent overflow in case an explicit out of range setting is supplied */
-		if (setup->decay > 1.f || setup->decay < 0.f) {
+		if (setup->decay > 1.f || setup->decay < 0.f ||
+		    setup->size < FLUI2D_DEFAULT_SIZE || setup->size > 1024 || setup->size % FLUI2D_SLICE_ROWS) {
 			free(setup);
 			return -EINVAL;
 		}
@@ -539,9 +772,12 @@ static int flui2d_setup(const til_settings_t *settings, til_setting_t **res_sett
 til_module_t	flui2d_module = {
 	.create_context = flui2d_create_context,
 	.prepare_frame = flui2d_prepare_frame,
+	.prepare_pass = flui2d_prepare_pass,
 	.render_fragment = flui2d_render_fragment,
+	.swap_frame = flui2d_swap_frame,
 	.setup = flui2d_setup,
 	.name = "flui2d",
-	.description = "Fluid dynamics simulation in 2D (threaded (poorly))",
+	.description = "Fluid dynamics simulation in 2D (threaded)",
 	.author = "Vito Caputo <vcaputo@pengaru.com>",
+	.flags = TIL_MODULE_TILEABLE,
 };
@@ -1,11 +1,16 @@
+#include <errno.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <math.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
+#include "til_settings.h"
+#include "til_util.h"
 
 /* Copyright (C) 2017 Vito Caputo <vcaputo@pengaru.com> */
 
@@ -13,6 +18,22 @@
 
 /* TODO: explore using C99 complex.h and its types? */
 
+/* Pixels are iterated JULIA_LANES at a time, rows in chunks of JULIA_CHUNK. */
+#define JULIA_LANES			8
+#define JULIA_CHUNK			256
+#define JULIA_DEFAULT_ITERATIONS	39	/* the palette's size, the original fixed limit */
+#define JULIA_PERIODICITY_EPSILON	1e-5f
+
+typedef float	julia_lanes_t __attribute__((vector_size(JULIA_LANES * sizeof(float))));
+typedef int32_t	julia_mask_t __attribute__((vector_size(JULIA_LANES * sizeof(int32_t))));
+
+typedef struct julia_setup_t {
+	til_setup_t		til_setup;
+	unsigned		iterations;
+	unsigned		periodicity:1;
+	unsigned		smooth:1;
+} julia_setup_t;
+
 typedef struct julia_context_t {
 	til_module_context_t	til_module_context;
 	float			rr;
@@ -21,8 +42,15 @@ typedef struct julia_context_t {
 	float			creal;
 	float			cimag;
 	float			threshold;
+	float			inv_log_threshold;
+	julia_setup_t		setup;
 } julia_context_t;
 
+static julia_setup_t julia_default_setup = {
+	.iterations = JULIA_DEFAULT_ITERATIONS,
+	.periodicity = 1,
+};
+
 static uint32_t	colors[] = {
 			/* this palette is just something I slapped together, definitely needs improvement. TODO */
 			0x000000,
@@ -67,41 +95,141 @@ static uint32_t	colors[] = {
 		};
 
 
+static inline int julia_lanes_any(julia_mask_t mask)
+{
+	int32_t	any = 0;
+
+	for (unsigned i = 0; i < JULIA_LANES; i++)
+		any |= mask[i];
+
+	return any;
+}
+
+
+/* Iterate n (a multiple of JULIA_LANES) points of a row, storing the iteration
+ * each escaped at in res_iters, 0 for those which didn't, and the squared
+ * magnitude they escaped with in res_mags for smooth coloring.
+ *
+ * With periodicity checking a point is compared to the one saved at the last
+ * power of two iteration, returning within JULIA_PERIODICITY_EPSILON of it
+ * means it's caught in a cycle and taken to never escape, so it stops there
+ * with the same result of 0.
+ */
+static inline __attribute__((always_inline)) void julia_iter_lanes(const julia_context_t *ctxt, const float *reals, float imag, unsigned n, uint32_t *res_iters, float *res_mags)
+{
+	julia_lanes_t	creal = {}, cimag = {}, threshold = {}, epsilon = {};
+
+	epsilon += JULIA_PERIODICITY_EPSILON;
+	creal += ctxt->creal;
+	cimag += ctxt->cimag;
+	threshold += ctxt->threshold;
+
+	for (unsigned p = 0; p < n; p += JULIA_LANES) {
+		julia_lanes_t	real, imag_lanes = {}, saved_real, saved_imag, mags = {};
+		julia_mask_t	active = ~(julia_mask_t){}, iters = {};
+		unsigned	save_at = 8;
+
+		memcpy(&real, &reals[p], sizeof(real));
+		imag_lanes += imag;
+		saved_real = real;
+		saved_imag = imag_lanes;
+
+		for (int32_t i = 1; i < (int32_t)ctxt->setup.iterations; i++) {
+			julia_lanes_t	newr, newi, mag;
+			julia_mask_t	escaped;
+
+			newr = real * real - imag_lanes * imag_lanes;
+			newi = imag_lanes * real;
+			newi += newi;
+
+			newr += creal;
+			newi += cimag;
+
+			mag = newr * newr + newi * newi;
+			escaped = (mag > threshold) & active;
+			iters |= escaped & i;
+			mags = (julia_lanes_t)(((julia_mask_t)mag & escaped) | ((julia_mask_t)mags & ~escaped));
+			active &= ~escaped;
+
+			if (ctxt->setup.periodicity) {
+				julia_lanes_t	d = (julia_lanes_t)((julia_mask_t)(newr - saved_real) & 0x7fffffff) +
+						    (julia_lanes_t)((julia_mask_t)(newi - saved_imag) & 0x7fffffff);
+
+				active &= ~(d < epsilon);
+
+				if (i == save_at) {
+					saved_real = newr;
+					saved_imag = newi;
+					save_at <<= 1;
+				}
+			}
+
+			if (!julia_lanes_any(active))
+				break;
+
+			real = newr;
+			imag_lanes = newi;
+		}
+
+		memcpy(&res_iters[p], &iters, sizeof(iters));
+		memcpy(&res_mags[p], &mags, sizeof(mags));
+	}
+}
+
+
+static void julia_iter_generic(const julia_context_t *ctxt, const float *reals, float imag, unsigned n, uint32_t *res_iters, float *res_mags)
+{
+	julia_iter_lanes(ctxt, reals, imag, n, res_iters, res_mags);
+}
+
+
+#ifdef TIL_CPU_X86
+__attribute__((target("avx2")))
+static void julia_iter_avx2(const julia_context_t *ctxt, const float *reals, float imag, unsigned n, uint32_t *res_iters, float *res_mags)
+{
+	julia_iter_lanes(ctxt, reals, imag, n, res_iters, res_mags);
+}
+#endif
+
+TIL_CPU_DISPATCH(julia_iter, julia_iter_generic, julia_iter_avx2)
+
+
 static til_module_context_t * julia_create_context(unsigned seed, unsigned ticks, unsigned n_cpus, til_setup_t *setup)
 {
 	julia_context_t	*ctxt;
 
+	if (!setup)
+		setup = &julia_default_setup.til_setup;
+
 	ctxt = til_module_context_new(sizeof(julia_context_t), seed, ticks, n_cpus);
 	if (!ctxt)
 		return NULL;
 
 	ctxt->rr = ((float)rand_r(&seed)) / (float)RAND_MAX * 100.f;
+	ctxt->setup = *(julia_setup_t *)setup;
 
 	return &ctxt->til_module_context;
 }
 
 
-static inline unsigned julia_iter(float real, float imag, float creal, float cimag, unsigned max_iters, float threshold)
+/* palette color for escaping at iteration iter, wrapping around the palette past its end with 0 reserved for the set */
+static inline uint32_t julia_color(uint32_t iter)
 {
-	unsigned	i;
-	float		newr, newi;
+	if (!iter)
+		return colors[0];
 
-	for (i = 1; i < max_iters; i++) {
-		newr = real * real - imag * imag;
-		newi = imag * real;
-		newi += newi;
-
-		newr += creal;
-		newi += cimag;
+	return colors[1 + (iter - 1) % (nelems(colors) - 1)];
+}
 
-		if ((newr * newr + newi * newi) > threshold)
-			return i;
 
-		real = newr;
-		imag = newi;
-	}
+/* blend a towards b by t in [0, 1] per 8-bit channel */
+static inline uint32_t julia_blend(uint32_t a, uint32_t b, float t)
+{
+	unsigned	tb = t * 256.f, ta = 256 - tb;
+	uint32_t	rb = (((a & 0xff00ff) * ta + (b & 0xff00ff) * tb) >> 8) & 0xff00ff;
+	uint32_t	g = (((a & 0x00ff00) * ta + (b & 0x00ff00) * tb) >> 8) & 0x00ff00;
 
-	return 0;
+	return rb | g;
 }
 
 
@@ -129,6 +257,7 @@ static void julia_prepare_frame(til_module_context_t *context, unsigned ticks, t
 	ctxt->threshold *= ctxt->threshold * ctxt->threshold;
 	ctxt->threshold *= 35.f;
 	ctxt->threshold = powf(10.f, ctxt->threshold);
+	ctxt->inv_log_threshold = 1.f / logf(ctxt->threshold);
 }
 
 
@@ -141,19 +270,142 @@ static void julia_render_fragment(til_module_context_t *context, unsigned ticks,
 	uint32_t	*buf = fragment->buf;
 	float		real, imag;
 	float		realstep = 3.6f / (float)fragment->frame_width, imagstep = 3.6f / (float)fragment->frame_height;
+	float		reals[JULIA_CHUNK], mags[JULIA_CHUNK];
+	uint32_t	iters[JULIA_CHUNK];
+	int		smooth = ctxt->setup.smooth && ctxt->threshold > 4.f;
 
 
 	/* Complex plane confined to {-1.8 - 1.8} on both axis (slightly zoomed), no dynamic zooming is performed. */
 	for (imag = 1.8 + -(imagstep * (float)fragment->y), y = fragment->y; y < fragment->y + height; y++, imag += -imagstep) {
-		for (real = -1.8 + realstep * (float)fragment->x, x = fragment->x; x < fragment->x + width; x++, buf++, real += realstep) {
-			*buf = colors[julia_iter(real, imag, ctxt->creal, ctxt->cimag, sizeof(colors) / sizeof(*colors), ctxt->threshold)];
+		real = -1.8 + realstep * (float)fragment->x;
+
+		for (x = 0; x < width; x += JULIA_CHUNK) {
+			unsigned	n = MIN(width - x, JULIA_CHUNK), i;
+
+			/* the coordinates are accumulated exactly as before vectorizing, padding the last lanes with copies */
+			for (i = 0; i < n; i++, real += realstep)
+				reals[i] = real;
+			for (; i % JULIA_LANES; i++)
+				reals[i] = reals[n - 1];
+
+			julia_iter(ctxt, reals, imag, i, iters, mags);
+
+			if (!smooth) {
+				for (i = 0; i < n; i++)
+					buf[x + i] = julia_color(iters[i]);
+
+				continue;
+			}
+
+			/* smooth coloring blends towards the next iteration's color by how far past the threshold it escaped */
+			for (i = 0; i < n; i++) {
+				float	t;
+
+				if (!iters[i]) {
+					buf[x + i] = colors[0];
+					continue;
+				}
+
+				t = 1.f - log2f(logf(mags[i]) * ctxt->inv_log_threshold);
+				t = MAX(0.f, MIN(t, 1.f));
+				buf[x + i] = julia_blend(julia_color(iters[i]), julia_color(iters[i] + 1), t);
+			}
 		}
 
-		buf += fragment->stride;
+		buf += fragment->pitch;
 	}
 }
 
 
+static int julia_setup(const til_settings_t *settings, til_setting_t **res_setting, const til_setting_desc_t **res_desc, til_setup_t **res_setup)
+{
+	const char	*iterations;
+	const char	*periodicity;
+	const char	*smooth;
+	const char	*iterations_values[] = {
+				TIL_SETTINGS_STR(JULIA_DEFAULT_ITERATIONS),
+				"100",
+				"250",
+				"1000",
+				NULL
+			};
+	const char	*bool_values[] = {
+				"off",
+				"on",
+				NULL
+			};
+	int		r;
+
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Maximum iterations",
+							.key = "iterations",
+							.regex = "[0-9]+",
+							.preferred = iterations_values[0],
+							.values = iterations_values,
+							.annotations = NULL
+						},
+						&iterations,
+						res_setting,
+						res_desc);
+	if (r)
+		return r;
+
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Stop iterating points found cycling",
+							.key = "periodicity",
+							.regex = "^(on|off)",
+							.preferred = bool_values[1],
+							.values = bool_values,
+							.annotations = NULL
+						},
+						&periodicity,
+						res_setting,
+						res_desc);
+	if (r)
+		return r;
+
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Smooth fractional iteration coloring",
+							.key = "smooth",
+							.regex = "^(on|off)",
+							.preferred = bool_values[0],
+							.values = bool_values,
+							.annotations = NULL
+						},
+						&smooth,
+						res_setting,
+						res_desc);
+	if (r)
+		return r;
+
+	if (res_setup) {
+		julia_setup_t	*setup;
+
+		setup = til_setup_new(sizeof(*setup), (void(*)(til_setup_t *))free);
+		if (!setup)
+			return -ENOMEM;
+
+		if (sscanf(iterations, "%u", &setup->iterations) != 1 || !setup->iterations) {
+			free(setup);
+			return -EINVAL;
+		}
+
+		if (!strcasecmp(periodicity, "on"))
+			setup->periodicity = 1;
+
+		if (!strcasecmp(smooth, "on"))
+			setup->smooth = 1;
+
+		*res_setup = &setup->til_setup;
+	}
+
+	return 0;
+}
+
+
 til_module_t	julia_module = {
 	.create_context = julia_create_context,
 	.prepare_frame = julia_prepare_frame,
@@ -161,4 +413,6 @@ til_module_t	julia_module = {
 	.name = "julia",
 	.description = "Julia set fractal morpher (threaded)",
 	.author = "Vito Caputo <vcaputo@pengaru.com>",
+	.flags = TIL_MODULE_TILEABLE,
+	.setup = julia_setup,
 };
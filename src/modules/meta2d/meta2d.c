@@ -16,19 +16,45 @@
 
 /* https://en.wikipedia.org/wiki/Metaballs */
 
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
+#include "til_rand.h"
+#include "til_settings.h"
+#include "til_util.h"
 
 #include "din/din.h"
 
 #include "v2f.h"
 #include "v3f.h"
 
-#define	META2D_NUM_BALLS	10
+#define	META2D_NUM_BALLS	10	/* default number of balls, their sizes are scaled to keep the coverage of this many */
+#define META2D_RIBBON_MIN	.7f	/* these thresholds define the thickness of the ribbon */
+#define META2D_RIBBON_MAX	.8f
+#define META2D_CULL_SLACK	.01f	/* fraction of the thresholds bins are culled with to spare, absorbing rounding */
+
+/* The frame is divided into bins of META2D_BIN_SIZE pixels square, and every frame a threaded pass
+ * bins the balls:
+ *
+ * Bounds on the field over each bin are found from the balls' nearest and farthest distances, and
+ * bins the ribbon can't pass through are culled entirely.
+ *
+ * For the remaining bins, balls contributing at least META2D_NEAR somewhere in the bin are listed
+ * for evaluating per pixel.  The rest are far enough to be evaluated just once at the bin's center.
+ *
+ * The per-pixel field is then evaluated META2D_LANES pixels at a time.
+ */
+#define META2D_BIN_SIZE		64
+#define META2D_NEAR		.002f
+#define META2D_LANES		8
+
+typedef float	meta2d_lanes_t __attribute__((vector_size(META2D_LANES * sizeof(float))));
 
 typedef struct meta2d_ball_t {
 	v2f_t			position;
@@ -36,14 +62,36 @@ typedef struct meta2d_ball_t {
 	v3f_t			color;
 } meta2d_ball_t;
 
+typedef struct meta2d_bin_t {
+	unsigned		n_near;		/* number of balls evaluated per pixel, listed in bin_balls */
+	unsigned		culled:1;	/* the ribbon doesn't pass through the bin */
+	float			t;		/* the far balls' field at the bin's center */
+	v3f_t			color;		/* the far balls' color at the bin's center */
+} meta2d_bin_t;
+
+typedef struct meta2d_setup_t {
+	til_setup_t		til_setup;
+	unsigned		n_balls;
+} meta2d_setup_t;
+
 typedef struct meta2d_context_t {
 	til_module_context_t	til_module_context;
-	unsigned		n;
+	unsigned		n;		/* number of balls */
 	din_t			*din_a, *din_b;
 	float			din_t;
-	meta2d_ball_t		balls[META2D_NUM_BALLS];
+	float			*din_xs, *din_ys, *din_zs;	/* n per-ball coordinates sampled via din_batch() */
+	float			*din_as, *din_bs;		/* n per-ball samples of din_a and din_b */
+	unsigned		frame_width, frame_height;
+	unsigned		bins_width, bins_height;
+	meta2d_bin_t		*bins;		/* for frame_width x frame_height, NULL until allocated */
+	unsigned		*bin_balls;	/* n indices per bin of its near balls, allocated with bins */
+	meta2d_ball_t		balls[];
 } meta2d_context_t;
 
+static meta2d_setup_t meta2d_default_setup = {
+	.n_balls = META2D_NUM_BALLS,
+};
+
 
 /* convert a color into a packed, 32-bit rgb pixel value (taken from libs/ray/ray_color.h) */
 static inline uint32_t color_to_uint32(v3f_t color) {
@@ -70,22 +118,50 @@ static inline uint32_t color_to_uint32(v3f_t color) {
 static til_module_context_t * meta2d_create_context(unsigned seed, unsigned ticks, unsigned n_cpus, til_setup_t *setup)
 {
 	meta2d_context_t	*ctxt;
+	til_rand_t		rand;
+	unsigned		n;
+	float			scale;
 
-	ctxt = til_module_context_new(sizeof(meta2d_context_t), seed, ticks, n_cpus);
+	if (!setup)
+		setup = &meta2d_default_setup.til_setup;
+
+	n = ((meta2d_setup_t *)setup)->n_balls;
+	ctxt = til_module_context_new(sizeof(meta2d_context_t) + n * sizeof(meta2d_ball_t), seed, ticks, n_cpus);
 	if (!ctxt)
 		return NULL;
 
+	ctxt->n = n;
+
 	/* perlin noise is used for some organic-ish random movement of the balls */
-	ctxt->din_a = din_new(10, 10, META2D_NUM_BALLS + 2);
-	ctxt->din_b = din_new(10, 10, META2D_NUM_BALLS + 2);
+	til_rand_seed(&rand, seed, 0);
+	ctxt->din_a = din_new(10, 10, n + 2, til_rand(&rand));
+	ctxt->din_b = din_new(10, 10, n + 2, til_rand(&rand));
+	ctxt->din_xs = malloc(sizeof(float) * n * 5);
+	if (!ctxt->din_a || !ctxt->din_b || !ctxt->din_xs) {
+		din_free(ctxt->din_a);
+		din_free(ctxt->din_b);
+		free(ctxt->din_xs);
+		free(ctxt);
+		return NULL;
+	}
+
+	ctxt->din_ys = ctxt->din_xs + n;
+	ctxt->din_zs = ctxt->din_ys + n;
+	ctxt->din_as = ctxt->din_zs + n;
+	ctxt->din_bs = ctxt->din_as + n;
+
+	for (unsigned i = 0; i < n; i++)
+		ctxt->din_zs[i] = (float)i * (1.f / (float)n);
 
-	for (int i = 0; i < META2D_NUM_BALLS; i++) {
+	/* the field sums the squared radii, so scale them by the root to cover about as much with any number of balls */
+	scale = sqrtf((float)META2D_NUM_BALLS / (float)n);
+
+	for (unsigned i = 0; i < n; i++) {
 		meta2d_ball_t	*ball = &ctxt->balls[i];
 
-		/* TODO: add _r() variants of v[23]f_rand()? */
-		v2f_rand(&ball->position, &(v2f_t){-.7f, -.7f}, &(v2f_t){.7f, .7f});
-		ball->radius = rand_r(&seed) / (float)RAND_MAX * .2f + .05f;
-		v3f_rand(&ball->color, &(v3f_t){0.f, 0.f, 0.f}, &(v3f_t){1.f, 1.f, 1.f});
+		v2f_rand(&ball->position, &rand, &(v2f_t){-.7f, -.7f}, &(v2f_t){.7f, .7f});
+		ball->radius = til_rand_range(&rand, .05f, .25f) * scale;
+		v3f_rand(&ball->color, &rand, &(v3f_t){0.f, 0.f, 0.f}, &(v3f_t){1.f, 1.f, 1.f});
 	}
 
 	return &ctxt->til_module_context;
@@ -98,6 +174,8 @@ static void meta2d_destroy_context(til_module_context_t *context)
 
 	din_free(ctxt->din_a);
 	din_free(ctxt->din_b);
+	free(ctxt->din_xs);
+	free(ctxt->bins);
 	free(ctxt);
 }
 
@@ -106,10 +184,37 @@ static void meta2d_prepare_frame(til_module_context_t *context, unsigned ticks,
 {
 	meta2d_context_t	*ctxt = (meta2d_context_t *)context;
 
-	*res_frame_plan = (til_frame_plan_t){ .fragmenter = til_fragmenter_slice_per_cpu };
+	*res_frame_plan = (til_frame_plan_t){ .fragmenter = til_fragmenter_tile64 };
+
+	if (ctxt->frame_width != fragment->frame_width || ctxt->frame_height != fragment->frame_height) {
+		unsigned	bins_width = (fragment->frame_width + META2D_BIN_SIZE - 1) / META2D_BIN_SIZE;
+		unsigned	bins_height = (fragment->frame_height + META2D_BIN_SIZE - 1) / META2D_BIN_SIZE;
+		meta2d_bin_t	*bins;
+
+		/* on failure the old bins are kept, and render_fragment() clears the mismatched frames */
+		bins = malloc((sizeof(meta2d_bin_t) + sizeof(unsigned) * ctxt->n) * bins_width * bins_height);
+		if (bins) {
+			free(ctxt->bins);
+			ctxt->bins = bins;
+			ctxt->bin_balls = (unsigned *)&bins[bins_width * bins_height];
+			ctxt->bins_width = bins_width;
+			ctxt->bins_height = bins_height;
+			ctxt->frame_width = fragment->frame_width;
+			ctxt->frame_height = fragment->frame_height;
+		}
+	}
+
+	/* sample both noise fields for all the balls at once before any move */
+	for (unsigned i = 0; i < ctxt->n; i++) {
+		ctxt->din_xs[i] = ctxt->balls[i].position.x;
+		ctxt->din_ys[i] = ctxt->balls[i].position.y;
+	}
+
+	din_batch(ctxt->din_a, ctxt->din_xs, ctxt->din_ys, ctxt->din_zs, ctxt->n, ctxt->din_as);
+	din_batch(ctxt->din_b, ctxt->din_xs, ctxt->din_ys, ctxt->din_zs, ctxt->n, ctxt->din_bs);
 
 	/* move the balls around */
-	for (int i = 0; i < META2D_NUM_BALLS; i++) {
+	for (unsigned i = 0; i < ctxt->n; i++) {
 		meta2d_ball_t	*ball = &ctxt->balls[i];
 		float		rad;
 
@@ -132,17 +237,8 @@ static void meta2d_prepare_frame(til_module_context_t *context, unsigned ticks,
 		 */
 
 		/* ad-hoc lerp of the two dins */
-		rad = din(ctxt->din_a, &(v3f_t){
-			  .x = ball->position.x,
-			  .y = ball->position.y,
-			  .z = (float)i * (1.f / (float)META2D_NUM_BALLS)}
-			 ) * (1.f - ctxt->din_t);
-
-		rad += din(ctxt->din_b, &(v3f_t){
-			  .x = ball->position.x,
-			  .y = ball->position.y,
-			  .z = (float)i * (1.f / (float)META2D_NUM_BALLS)}
-			 ) * ctxt->din_t;
+		rad = ctxt->din_as[i] * (1.f - ctxt->din_t);
+		rad += ctxt->din_bs[i] * ctxt->din_t;
 
 		/* Perlin noise doesn't produce anything close to a uniform random distribution
 		 * of -1..+1, so it can't just be mapped directly to 2*PI with all angles getting
@@ -179,50 +275,251 @@ static void meta2d_prepare_frame(til_module_context_t *context, unsigned ticks,
 }
 
 
-static void meta2d_render_fragment(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment)
+/* coordinates of pixel x,y */
+static inline float meta2d_x(const meta2d_context_t *ctxt, unsigned x)
 {
-	meta2d_context_t	*ctxt = (meta2d_context_t *)context;
-	float			xf = 2.f / (float)fragment->frame_width;
-	float			yf = 2.f / (float)fragment->frame_height;
-	v2f_t			coord;
+	return 2.f / (float)ctxt->frame_width * (float)x - 1.f;
+}
 
-	for (int y = fragment->y; y < fragment->y + fragment->height; y++) {
-		coord.y = yf * (float)y - 1.f;
 
-		for (int x = fragment->x; x < fragment->x + fragment->width; x++) {
-			v3f_t		color = {};
-			uint32_t	pixel;
-			float		t = 0;
+static inline float meta2d_y(const meta2d_context_t *ctxt, unsigned y)
+{
+	return 2.f / (float)ctxt->frame_height * (float)y - 1.f;
+}
 
-			coord.x = xf * (float)x - 1.f;
 
-			for (int i = 0; i < META2D_NUM_BALLS; i++) {
-				meta2d_ball_t	*ball = &ctxt->balls[i];
+/* distance from v to the nearest and farthest of min..max on one axis */
+static inline void meta2d_axis_bounds(float v, float min, float max, float *res_near, float *res_far)
+{
+	*res_near = v < min ? min - v : (v > max ? v - max : 0.f);
+	*res_far = MAX(fabsf(v - min), fabsf(v - max));
+}
 
-				float	f;
 
-				f = ball->radius * ball->radius / v2f_distance_sq(&coord, &ball->position);
-				v3f_add(&color, &color, v3f_mult_scalar(&(v3f_t){}, &ball->color, f));
-				t += f;
+/* Bin the balls for the bins of row slice */
+static void meta2d_bin_pass(til_module_context_t *context, unsigned ticks, unsigned cpu, unsigned slice, unsigned n_slices)
+{
+	meta2d_context_t	*ctxt = (meta2d_context_t *)context;
+	unsigned		y0 = slice * META2D_BIN_SIZE, y1 = MIN(y0 + META2D_BIN_SIZE, ctxt->frame_height) - 1;
+	float			ymin = meta2d_y(ctxt, y0), ymax = meta2d_y(ctxt, y1);
+
+	for (unsigned bx = 0; bx < ctxt->bins_width; bx++) {
+		unsigned	x0 = bx * META2D_BIN_SIZE, x1 = MIN(x0 + META2D_BIN_SIZE, ctxt->frame_width) - 1;
+		float		xmin = meta2d_x(ctxt, x0), xmax = meta2d_x(ctxt, x1);
+		v2f_t		center = { .x = (xmin + xmax) * .5f, .y = (ymin + ymax) * .5f };
+		meta2d_bin_t	*bin = &ctxt->bins[slice * ctxt->bins_width + bx];
+		unsigned	*near = &ctxt->bin_balls[(slice * ctxt->bins_width + bx) * ctxt->n];
+		float		upper = 0.f, lower = 0.f;
+
+		*bin = (meta2d_bin_t){};
+
+		for (unsigned i = 0; i < ctxt->n; i++) {
+			meta2d_ball_t	*ball = &ctxt->balls[i];
+			float		r2 = ball->radius * ball->radius;
+			float		nx, ny, fx, fy, f;
+
+			meta2d_axis_bounds(ball->position.x, xmin, xmax, &nx, &fx);
+			meta2d_axis_bounds(ball->position.y, ymin, ymax, &ny, &fy);
+
+			f = r2 / (nx * nx + ny * ny);	/* the most it contributes within the bin, inf when inside */
+			upper += f;
+			lower += r2 / (fx * fx + fy * fy);
+
+			if (f >= META2D_NEAR) {
+				near[bin->n_near++] = i;
+			} else {
+				f = r2 / v2f_distance_sq(&center, &ball->position);
+				v3f_add(&bin->color, &bin->color, v3f_mult_scalar(&(v3f_t){}, &ball->color, f));
+				bin->t += f;
 			}
+		}
+
+		bin->culled = upper < META2D_RIBBON_MIN * (1.f - META2D_CULL_SLACK) ||
+			      lower > META2D_RIBBON_MAX * (1.f + META2D_CULL_SLACK);
+	}
+}
+
+
+/* The balls are binned in rows of bins, threaded */
+static int meta2d_prepare_pass(til_module_context_t *context, unsigned ticks, unsigned pass, til_pass_plan_t *res_pass_plan)
+{
+	meta2d_context_t	*ctxt = (meta2d_context_t *)context;
+
+	if (pass > 0 || !ctxt->bins)
+		return 0;
+
+	*res_pass_plan = (til_pass_plan_t){ .func = meta2d_bin_pass, .n_slices = ctxt->bins_height };
+
+	return 1;
+}
 
-			/* these thresholds define the thickness of the ribbon */
-			if (t < .7f || t > .8f)
-				color = (v3f_t){};
 
-			pixel = color_to_uint32(color);
-			til_fb_fragment_put_pixel_unchecked(fragment, 0, x, y, pixel);
+/* Evaluate the field and its color for n (a multiple of META2D_LANES) pixels at xs,y within bin */
+static inline __attribute__((always_inline)) void meta2d_field_lanes(const meta2d_context_t *ctxt, const meta2d_bin_t *bin, const unsigned *near, const float *xs, float y, unsigned n, float *res_t, v3f_t *res_color)
+{
+	for (unsigned p = 0; p < n; p += META2D_LANES) {
+		meta2d_lanes_t	x, t = {}, r = {}, g = {}, b = {};
+
+		memcpy(&x, &xs[p], sizeof(x));
+		t += bin->t;
+		r += bin->color.x;
+		g += bin->color.y;
+		b += bin->color.z;
+
+		for (unsigned i = 0; i < bin->n_near; i++) {
+			const meta2d_ball_t	*ball = &ctxt->balls[near[i]];
+			meta2d_lanes_t		dx = x - ball->position.x, f;
+			float			dy = y - ball->position.y;
+
+			f = ball->radius * ball->radius / (dx * dx + dy * dy);
+			r += ball->color.x * f;
+			g += ball->color.y * f;
+			b += ball->color.z * f;
+			t += f;
+		}
+
+		for (unsigned i = 0; i < META2D_LANES; i++) {
+			res_t[p + i] = t[i];
+			res_color[p + i] = (v3f_t){ .x = r[i], .y = g[i], .z = b[i] };
+		}
+	}
+}
+
+
+static void meta2d_field_generic(const meta2d_context_t *ctxt, const meta2d_bin_t *bin, const unsigned *near, const float *xs, float y, unsigned n, float *res_t, v3f_t *res_color)
+{
+	meta2d_field_lanes(ctxt, bin, near, xs, y, n, res_t, res_color);
+}
+
+
+#ifdef TIL_CPU_X86
+__attribute__((target("avx2")))
+static void meta2d_field_avx2(const meta2d_context_t *ctxt, const meta2d_bin_t *bin, const unsigned *near, const float *xs, float y, unsigned n, float *res_t, v3f_t *res_color)
+{
+	meta2d_field_lanes(ctxt, bin, near, xs, y, n, res_t, res_color);
+}
+#endif
+
+TIL_CPU_DISPATCH(meta2d_field, meta2d_field_generic, meta2d_field_avx2)
+
+
+/* Draw the part x0,y0-x1,y1 (exclusive) of fragment covered by bin bx,by */
+static void meta2d_render_bin(const meta2d_context_t *ctxt, til_fb_fragment_t *fragment, unsigned bx, unsigned by, unsigned x0, unsigned y0, unsigned x1, unsigned y1)
+{
+	const meta2d_bin_t	*bin = &ctxt->bins[by * ctxt->bins_width + bx];
+	const unsigned		*near = &ctxt->bin_balls[(by * ctxt->bins_width + bx) * ctxt->n];
+	float			xs[META2D_BIN_SIZE], ts[META2D_BIN_SIZE];
+	v3f_t			colors[META2D_BIN_SIZE];
+	unsigned		n = x1 - x0, i;
+
+	for (unsigned y = y0; y < y1; y++) {
+		uint32_t	*buf = fragment->buf + (y - fragment->y) * fragment->pitch + (x0 - fragment->x);
+
+		if (bin->culled) {
+			memset(buf, 0, n * sizeof(uint32_t));
+			continue;
+		}
+
+		if (y == y0) {
+			for (i = 0; i < n; i++)
+				xs[i] = meta2d_x(ctxt, x0 + i);
+			for (; i % META2D_LANES; i++)
+				xs[i] = xs[n - 1];
+		}
+
+		meta2d_field(ctxt, bin, near, xs, meta2d_y(ctxt, y), (n + META2D_LANES - 1) / META2D_LANES * META2D_LANES, ts, colors);
+
+		for (i = 0; i < n; i++) {
+			if (ts[i] < META2D_RIBBON_MIN || ts[i] > META2D_RIBBON_MAX)
+				buf[i] = 0;
+			else
+				buf[i] = color_to_uint32(colors[i]);
 		}
 	}
 }
 
 
+static void meta2d_render_fragment(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment)
+{
+	meta2d_context_t	*ctxt = (meta2d_context_t *)context;
+
+	if (!ctxt->bins || ctxt->frame_width != fragment->frame_width || ctxt->frame_height != fragment->frame_height) {
+		til_fb_fragment_clear(fragment);
+
+		return;
+	}
+
+	/* fragments needn't be aligned to the bins, draw whatever part of each bin they cover */
+	for (unsigned by = fragment->y / META2D_BIN_SIZE; by * META2D_BIN_SIZE < fragment->y + fragment->height; by++) {
+		unsigned	y0 = MAX(fragment->y, by * META2D_BIN_SIZE);
+		unsigned	y1 = MIN(fragment->y + fragment->height, (by + 1) * META2D_BIN_SIZE);
+
+		for (unsigned bx = fragment->x / META2D_BIN_SIZE; bx * META2D_BIN_SIZE < fragment->x + fragment->width; bx++) {
+			unsigned	x0 = MAX(fragment->x, bx * META2D_BIN_SIZE);
+			unsigned	x1 = MIN(fragment->x + fragment->width, (bx + 1) * META2D_BIN_SIZE);
+
+			meta2d_render_bin(ctxt, fragment, bx, by, x0, y0, x1, y1);
+		}
+	}
+}
+
+
+static int meta2d_setup(const til_settings_t *settings, til_setting_t **res_setting, const til_setting_desc_t **res_desc, til_setup_t **res_setup)
+{
+	const char	*balls;
+	const char	*values[] = {
+				TIL_SETTINGS_STR(META2D_NUM_BALLS),
+				"50",
+				"100",
+				"250",
+				"500",
+				NULL
+			};
+	int		r;
+
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Number of balls",
+							.key = "balls",
+							.regex = "[0-9]+",
+							.preferred = values[0],
+							.values = values,
+							.annotations = NULL
+						},
+						&balls,
+						res_setting,
+						res_desc);
+	if (r)
+		return r;
+
+	if (res_setup) {
+		meta2d_setup_t	*setup;
+
+		setup = til_setup_new(sizeof(*setup), (void(*)(til_setup_t *))free);
+		if (!setup)
+			return -ENOMEM;
+
+		if (sscanf(balls, "%u", &setup->n_balls) != 1 || !setup->n_balls) {
+			free(setup);
+			return -EINVAL;
+		}
+
+		*res_setup = &setup->til_setup;
+	}
+
+	return 0;
+}
+
+
 til_module_t	meta2d_module = {
 	.create_context = meta2d_create_context,
 	.destroy_context = meta2d_destroy_context,
 	.prepare_frame = meta2d_prepare_frame,
+	.prepare_pass = meta2d_prepare_pass,
 	.render_fragment = meta2d_render_fragment,
 	.name = "meta2d",
 	.description = "Classic 2D metaballs (threaded)",
 	.author = "Vito Caputo <vcaputo@pengaru.com>",
+	.flags = TIL_MODULE_TILEABLE,
+	.setup = meta2d_setup,
 };
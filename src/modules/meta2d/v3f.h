@@ -55,6 +55,8 @@
 #include <math.h>
 #include <stdlib.h>
 
+#include "til_rand.h"
+
 
 typedef struct v3f_t {
 	float	x, y, z;
@@ -297,20 +299,20 @@ static inline v3f_t * v3f_cross(v3f_t *res, const v3f_t *a, const v3f_t *b)
 }
 
 
-static inline v3f_t _v3f_rand(const v3f_t *min, const v3f_t *max)
+static inline v3f_t _v3f_rand(til_rand_t *rand, const v3f_t *min, const v3f_t *max)
 {
 	return (v3f_t){
-		.x = min->x + (float)rand() * (1.f/RAND_MAX) * (max->x - min->x),
-		.y = min->y + (float)rand() * (1.f/RAND_MAX) * (max->y - min->y),
-		.z = min->z + (float)rand() * (1.f/RAND_MAX) * (max->z - min->z),
+		.x = til_rand_range(rand, min->x, max->x),
+		.y = til_rand_range(rand, min->y, max->y),
+		.z = til_rand_range(rand, min->z, max->z),
 	};
 }
 
 
-static inline v3f_t * v3f_rand(v3f_t *res, const v3f_t *min, const v3f_t *max)
+static inline v3f_t * v3f_rand(v3f_t *res, til_rand_t *rand, const v3f_t *min, const v3f_t *max)
 {
 	if (_v3f_allocated(&res))
-		*res = _v3f_rand(min, max);
+		*res = _v3f_rand(rand, min, max);
 
 	return res;
 }
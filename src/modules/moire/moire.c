@@ -169,5 +169,5 @@ til_module_t	moire_module = {
 	.name = "moire",
 	.description = "2D Moire interference patterns (threaded)",
 	.author = "Vito Caputo <vcaputo@pengaru.com>",
-	.flags = TIL_MODULE_OVERLAYABLE,
+	.flags = TIL_MODULE_OVERLAYABLE | TIL_MODULE_TILEABLE,
 };
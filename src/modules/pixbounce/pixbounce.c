@@ -4,6 +4,7 @@
 
 #include "til.h"
 #include "til_module_context.h"
+#include "til_rand.h"
 #include "draw.h"
 
 /* Copyright (C) 2018-22 Philip J. Freeman <elektron@halo.nu> */
@@ -233,11 +234,12 @@ typedef struct pixbounce_context_t {
 	uint32_t		color;
 	float			pixmap_size_factor;
 	int			multiplier;
+	til_rand_t		rand;
 } pixbounce_context_t;
 
-static uint32_t pick_color()
+static uint32_t pick_color(til_rand_t *rand)
 {
-	return makergb(rand()%256, rand()%256, rand()%256, 1);
+	return makergb(til_rand(rand)%256, til_rand(rand)%256, til_rand(rand)%256, 1);
 }
 
 static til_module_context_t * pixbounce_create_context(unsigned seed, unsigned ticks, unsigned n_cpus, til_setup_t *setup)
@@ -252,8 +254,9 @@ static til_module_context_t * pixbounce_create_context(unsigned seed, unsigned t
 	ctxt->y = -1;
 	ctxt->x_dir = 0;
 	ctxt->y_dir = 0;
+	til_rand_seed(&ctxt->rand, seed, 0);
 	ctxt->pix = &pixbounce_pixmap[((pixbounce_setup_t *)setup)->pixmap];
-	ctxt->color = pick_color();
+	ctxt->color = pick_color(&ctxt->rand);
 	ctxt->pixmap_size_factor = ((((pixbounce_setup_t *)setup)->pixmap_size)*55 + 22 )/ 100;
 	ctxt->multiplier = 1;
 
@@ -284,10 +287,10 @@ static void pixbounce_render_fragment(til_module_context_t *context, unsigned ti
 		}
 
 		/* randomly initialize location and direction of pixmap */
-		ctxt->x = rand() % (width - ctxt->pix->width * ctxt->multiplier) + 1;
-		ctxt->y = rand() % (height - ctxt->pix->height * ctxt->multiplier) + 1;
-		ctxt->x_dir = (rand() % 7) - 3;
-		ctxt->y_dir = (rand() % 7) - 3;
+		ctxt->x = til_rand(&ctxt->rand) % (width - ctxt->pix->width * ctxt->multiplier) + 1;
+		ctxt->y = til_rand(&ctxt->rand) % (height - ctxt->pix->height * ctxt->multiplier) + 1;
+		ctxt->x_dir = (int)(til_rand(&ctxt->rand) % 7) - 3;
+		ctxt->y_dir = (int)(til_rand(&ctxt->rand) % 7) - 3;
 
 	}
 
@@ -309,11 +312,11 @@ static void pixbounce_render_fragment(til_module_context_t *context, unsigned ti
 	/* update pixmap location */
 	if(ctxt->x+ctxt->x_dir < 0 || ctxt->x+ctxt->pix->width*ctxt->multiplier+ctxt->x_dir > width) {
 		ctxt->x_dir = ctxt->x_dir * -1;
-		ctxt->color = pick_color();
+		ctxt->color = pick_color(&ctxt->rand);
 	}
 	if(ctxt->y+ctxt->y_dir < 0 || ctxt->y+ctxt->pix->height*ctxt->multiplier+ctxt->y_dir > height) {
 		ctxt->y_dir = ctxt->y_dir * -1;
-		ctxt->color = pick_color();
+		ctxt->color = pick_color(&ctxt->rand);
 	}
 	ctxt->x = ctxt->x+ctxt->x_dir;
 	ctxt->y = ctxt->y+ctxt->y_dir;
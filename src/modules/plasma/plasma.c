@@ -6,6 +6,11 @@
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
+#include "til_util.h"
+
+#ifdef TIL_CPU_X86
+#include <immintrin.h>
+#endif
 
 /* Copyright (C) 2017 Vito Caputo <vcaputo@pengaru.com> */
 
@@ -29,11 +34,25 @@ typedef struct color_t {
 	int	r, g, b;
 } color_t;
 
+/* Everything plasma_render_fragment() varies along a single row, handed to the row kernels.
+ * Only the radial term varies per pixel, the rest depend on just x or y.
+ */
+typedef struct plasma_row_t {
+	const int32_t	*xr, *xg, *xb;	/* per-column terms from the frame's columns, starting at the row's first pixel */
+	int32_t		yr, yg, yb;	/* per-row terms */
+	int		x, xstep;	/* plasma x of the row's first pixel, and per pixel */
+	int		cx, dy2;	/* radial center x, and the row's squared distance from the center y */
+	unsigned	rr8, rr12, rr6;
+	color_t		cscale;
+} plasma_row_t;
+
 static int32_t	costab[FIXED_TRIG_LUT_SIZE], sintab[FIXED_TRIG_LUT_SIZE];
 
 typedef struct plasma_context_t {
 	til_module_context_t	til_module_context;
 	unsigned		rr;
+	unsigned		n_columns;
+	int32_t			*columns;	/* per-column terms of the frame, n_columns each of r, g, b */
 } plasma_context_t;
 
 
@@ -53,6 +72,127 @@ static void init_plasma(int32_t *costab, int32_t *sintab)
 }
 
 
+#define S	4
+
+/* compute the terms depending only on x for n columns, starting at plasma x */
+static void plasma_columns(unsigned rr, int x, int xstep, unsigned n, int32_t *xr, int32_t *xg, int32_t *xb)
+{
+	unsigned	rr6 = rr * 6, rr16 = rr * 16, rr12 = rr * 12;
+
+	for (unsigned i = 0; i < n; i++, x += xstep) {
+		xr[i] = FIXED_SIN(-rr16 + ((x << 2) >> S));
+		xg[i] = FIXED_COS(rr6 + ((x << 1) >> S));
+		xb[i] = FIXED_COS(-rr12 + ((x * 5) >> S));
+	}
+}
+
+
+static void plasma_row_generic(const plasma_row_t *row, uint32_t *buf, unsigned n)
+{
+	int	x = row->x;
+
+	for (unsigned i = 0; i < n; i++, x += row->xstep) {
+		color_t	c;
+		int	v;
+		int	hyp;
+
+		hyp = ((row->cx - x) * (row->cx - x) + row->dy2) >> 13;	/* XXX: technically this should be a sqrt(), but >> 10 is a whole lot faster. */
+
+		v = FIXED_MULT(FIXED_COS(row->rr8 + ((hyp * 5) >> S)) + row->xr[i] + row->yr, FIXED_EXP / 3);	/* XXX: note these '/ 3' get optimized out. */
+		c.r = FIXED_MULT(v, row->cscale.r) + row->cscale.r;
+
+		v = FIXED_MULT(FIXED_COS(row->rr12 + ((hyp << 2) >> S)) + row->xg[i] + row->yg, FIXED_EXP / 3);
+		c.g = FIXED_MULT(v, row->cscale.g) + row->cscale.g;
+
+		v = FIXED_MULT(FIXED_SIN(row->rr6 + ((hyp * 6) >> S)) + row->xb[i] + row->yb, FIXED_EXP / 3);
+		c.b = FIXED_MULT(v, row->cscale.b) + row->cscale.b;
+
+		buf[i] = color2pixel(&c);
+	}
+}
+
+
+#ifdef TIL_CPU_X86
+__attribute__((target("avx2")))
+static inline __m256i plasma_channel_avx2(__m256i v, __m256i cscale)
+{
+	v = _mm256_srai_epi32(_mm256_mullo_epi32(v, _mm256_set1_epi32(FIXED_EXP / 3)), FIXED_BITS);
+	v = _mm256_add_epi32(_mm256_srai_epi32(_mm256_mullo_epi32(v, cscale), FIXED_BITS), cscale);
+
+	return _mm256_srai_epi32(v, FIXED_BITS);
+}
+
+
+/* same as plasma_row_generic(), eight pixels at a time gathering the radial terms from the LUTs */
+__attribute__((target("avx2")))
+static void plasma_row_avx2(const plasma_row_t *row, uint32_t *buf, unsigned n)
+{
+	__m256i		mask = _mm256_set1_epi32(FIXED_TRIG_LUT_SIZE - 1);
+	__m256i		cx = _mm256_set1_epi32(row->cx), dy2 = _mm256_set1_epi32(row->dy2);
+	__m256i		yr = _mm256_set1_epi32(row->yr), yg = _mm256_set1_epi32(row->yg), yb = _mm256_set1_epi32(row->yb);
+	__m256i		rr8 = _mm256_set1_epi32(row->rr8), rr12 = _mm256_set1_epi32(row->rr12), rr6 = _mm256_set1_epi32(row->rr6);
+	__m256i		sr = _mm256_set1_epi32(row->cscale.r), sg = _mm256_set1_epi32(row->cscale.g), sb = _mm256_set1_epi32(row->cscale.b);
+	__m256i		x, xinc = _mm256_set1_epi32(row->xstep * 8);
+	plasma_row_t	tail;
+	unsigned	i = 0;
+
+	x = _mm256_add_epi32(_mm256_set1_epi32(row->x), _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7), _mm256_set1_epi32(row->xstep)));
+
+	for (; i + 8 <= n; i += 8, x = _mm256_add_epi32(x, xinc)) {
+		__m256i	dx = _mm256_sub_epi32(cx, x);
+		__m256i	hyp = _mm256_srai_epi32(_mm256_add_epi32(_mm256_mullo_epi32(dx, dx), dy2), 13);
+		__m256i	r, g, b, idx;
+
+		idx = _mm256_and_si256(_mm256_add_epi32(rr8, _mm256_srai_epi32(_mm256_add_epi32(_mm256_slli_epi32(hyp, 2), hyp), S)), mask);
+		r = _mm256_add_epi32(_mm256_i32gather_epi32(costab, idx, sizeof(int32_t)), _mm256_loadu_si256((const __m256i *)&row->xr[i]));
+		r = plasma_channel_avx2(_mm256_add_epi32(r, yr), sr);
+
+		idx = _mm256_and_si256(_mm256_add_epi32(rr12, _mm256_srai_epi32(_mm256_slli_epi32(hyp, 2), S)), mask);
+		g = _mm256_add_epi32(_mm256_i32gather_epi32(costab, idx, sizeof(int32_t)), _mm256_loadu_si256((const __m256i *)&row->xg[i]));
+		g = plasma_channel_avx2(_mm256_add_epi32(g, yg), sg);
+
+		idx = _mm256_and_si256(_mm256_add_epi32(rr6, _mm256_srai_epi32(_mm256_mullo_epi32(hyp, _mm256_set1_epi32(6)), S)), mask);
+		b = _mm256_add_epi32(_mm256_i32gather_epi32(sintab, idx, sizeof(int32_t)), _mm256_loadu_si256((const __m256i *)&row->xb[i]));
+		b = plasma_channel_avx2(_mm256_add_epi32(b, yb), sb);
+
+		_mm256_storeu_si256((__m256i *)&buf[i],
+				    _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(r, 16), _mm256_slli_epi32(g, 8)), b));
+	}
+
+	tail = *row;
+	tail.xr += i;
+	tail.xg += i;
+	tail.xb += i;
+	tail.x += i * row->xstep;
+
+	TIL_AVX_TAIL(plasma_row_generic(&tail, &buf[i], n - i));
+}
+#endif
+
+TIL_CPU_DISPATCH(plasma_row, plasma_row_generic, plasma_row_avx2)
+
+
+#define PLASMA_UNCACHED_COLUMNS	64
+
+/* plasma_row() without the frame's cached columns, computing them for the row as it goes */
+static void plasma_row_uncached(plasma_row_t row, unsigned rr, uint32_t *buf, unsigned n)
+{
+	int32_t	xr[PLASMA_UNCACHED_COLUMNS], xg[PLASMA_UNCACHED_COLUMNS], xb[PLASMA_UNCACHED_COLUMNS];
+
+	row.xr = xr;
+	row.xg = xg;
+	row.xb = xb;
+
+	for (unsigned i = 0; i < n; i += PLASMA_UNCACHED_COLUMNS) {
+		unsigned	n_columns = MIN(n - i, PLASMA_UNCACHED_COLUMNS);
+
+		plasma_columns(rr, row.x, row.xstep, n_columns, xr, xg, xb);
+		plasma_row(&row, &buf[i], n_columns);
+		row.x += n_columns * row.xstep;
+	}
+}
+
+
 static til_module_context_t * plasma_create_context(unsigned seed, unsigned ticks, unsigned n_cpus, til_setup_t *setup)
 {
 	static int		initialized;
@@ -74,13 +214,38 @@ static til_module_context_t * plasma_create_context(unsigned seed, unsigned tick
 }
 
 
+static void plasma_destroy_context(til_module_context_t *context)
+{
+	plasma_context_t	*ctxt = (plasma_context_t *)context;
+
+	free(ctxt->columns);
+	free(ctxt);
+}
+
+
 /* Prepare a frame for concurrent drawing of fragment using multiple fragments */
 static void plasma_prepare_frame(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment, til_frame_plan_t *res_frame_plan)
 {
 	plasma_context_t	*ctxt = (plasma_context_t *)context;
+	int			xstep = PLASMA_WIDTH / fragment->frame_width;
 
 	*res_frame_plan = (til_frame_plan_t){ .fragmenter = til_fragmenter_slice_per_cpu };
 	ctxt->rr += 3;
+
+	if (ctxt->n_columns != fragment->frame_width) {
+		free(ctxt->columns);
+		ctxt->n_columns = fragment->frame_width;
+		ctxt->columns = malloc(sizeof(int32_t) * 3 * ctxt->n_columns);
+		if (!ctxt->columns)	/* render_fragment() computes the columns itself, try again next frame */
+			ctxt->n_columns = 0;
+	}
+
+	if (!ctxt->columns)
+		return;
+
+	/* the terms depending only on x are the same for every row of the frame, compute them once for all the fragments */
+	plasma_columns(ctxt->rr, 0, xstep, ctxt->n_columns,
+		       ctxt->columns, &ctxt->columns[ctxt->n_columns], &ctxt->columns[ctxt->n_columns * 2]);
 }
 
 
@@ -92,70 +257,57 @@ static void plasma_render_fragment(til_module_context_t *context, unsigned ticks
 	int			ystep = PLASMA_HEIGHT / fragment->frame_height;
 	unsigned		width = fragment->width * xstep, height = fragment->height * ystep;
 	int			fw2 = FIXED_NEW(width / 2), fh2 = FIXED_NEW(height / 2);
-	int			x, y, cx, cy, dx2, dy2;
+	int			y, cy;
 	uint32_t		*buf = fragment->buf;
-	color_t			c = { .r = 0, .g = 0, .b = 0 }, cscale;
-	unsigned		rr2, rr6, rr8, rr16, rr20, rr12;
+	plasma_row_t		row;
+	unsigned		rr2, rr6, rr16, rr20;
 
 	rr2 = ctxt->rr * 2;
 	rr6 = ctxt->rr * 6;
-	rr8 = ctxt->rr * 8;
 	rr16 = ctxt->rr * 16;
 	rr20 = ctxt->rr * 20;
-	rr12 = ctxt->rr * 12;
+
+	if (ctxt->columns) {
+		row.xr = &ctxt->columns[fragment->x];
+		row.xg = &ctxt->columns[ctxt->n_columns + fragment->x];
+		row.xb = &ctxt->columns[ctxt->n_columns * 2 + fragment->x];
+	}
+	row.x = fragment->x * xstep;
+	row.xstep = xstep;
+	row.rr8 = ctxt->rr * 8;
+	row.rr12 = ctxt->rr * 12;
+	row.rr6 = rr6;
 
 	/* vary the color channel intensities */
-	cscale.r = FIXED_MULT(FIXED_COS(ctxt->rr / 2), FIXED_NEW(64)) + FIXED_NEW(64);
-	cscale.g = FIXED_MULT(FIXED_COS(ctxt->rr / 5), FIXED_NEW(64)) + FIXED_NEW(64);
-	cscale.b = FIXED_MULT(FIXED_COS(ctxt->rr / 7), FIXED_NEW(64)) + FIXED_NEW(64);
+	row.cscale.r = FIXED_MULT(FIXED_COS(ctxt->rr / 2), FIXED_NEW(64)) + FIXED_NEW(64);
+	row.cscale.g = FIXED_MULT(FIXED_COS(ctxt->rr / 5), FIXED_NEW(64)) + FIXED_NEW(64);
+	row.cscale.b = FIXED_MULT(FIXED_COS(ctxt->rr / 7), FIXED_NEW(64)) + FIXED_NEW(64);
 
-	cx = FIXED_TO_INT(FIXED_MULT(FIXED_COS(ctxt->rr), fw2) + fw2);
+	row.cx = FIXED_TO_INT(FIXED_MULT(FIXED_COS(ctxt->rr), fw2) + fw2);
 	cy = FIXED_TO_INT(FIXED_MULT(FIXED_SIN(rr2), fh2) + fh2);
 
 	for (y = fragment->y * ystep; y < fragment->y * ystep + height; y += ystep) {
 		int	y2 = y << 1;
 		int	y4 = y << 2;
 
-		dy2 = cy - y;
-		dy2 *= dy2;
-
-		for (x = fragment->x * xstep; x < fragment->x * xstep + width; x += xstep, buf++) {
-			int	v;
-			int	hyp;
+		row.dy2 = (cy - y) * (cy - y);
+		row.yr = FIXED_COS(rr20 + (y4 >> S));
+		row.yg = FIXED_SIN(rr16 + (y2 >> S));
+		row.yb = FIXED_SIN(-rr6 + (y2 >> S));
 
-			dx2 = cx - x;
-			dx2 *= dx2;
+		if (ctxt->columns)
+			plasma_row(&row, buf, fragment->width);
+		else
+			plasma_row_uncached(row, ctxt->rr, buf, fragment->width);
 
-			hyp = (dx2 + dy2) >> 13;	/* XXX: technically this should be a sqrt(), but >> 10 is a whole lot faster. */
-#define S	4
-			v = FIXED_MULT(	((FIXED_COS(rr8 + ((hyp * 5) >> S))) +
-					(FIXED_SIN(-rr16 + ((x << 2) >> S))) +
-					(FIXED_COS(rr20 + (y4 >> S)))),
-					FIXED_EXP / 3);	/* XXX: note these '/ 3' get optimized out. */
-			c.r = FIXED_MULT(v, cscale.r) + cscale.r;
-
-			v = FIXED_MULT(	((FIXED_COS(rr12 + ((hyp << 2) >> S))) +
-					(FIXED_COS(rr6 + ((x << 1) >> S))) +
-					(FIXED_SIN(rr16 + (y2 >> S)))),
-					FIXED_EXP / 3);
-			c.g = FIXED_MULT(v, cscale.g) + cscale.g;
-
-			v = FIXED_MULT(	((FIXED_SIN(rr6 + ((hyp * 6) >> S))) +
-					(FIXED_COS(-rr12 + ((x * 5) >> S))) +
-					(FIXED_SIN(-rr6 + (y2 >> S)))),
-					FIXED_EXP / 3);
-			c.b = FIXED_MULT(v, cscale.b) + cscale.b;
-
-			*buf = color2pixel(&c);
-		}
-
-		buf += fragment->stride;
+		buf += fragment->pitch;
 	}
 }
 
 
 til_module_t	plasma_module = {
 	.create_context = plasma_create_context,
+	.destroy_context = plasma_destroy_context,
 	.prepare_frame = plasma_prepare_frame,
 	.render_fragment = plasma_render_fragment,
 	.name = "plasma",
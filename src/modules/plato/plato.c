@@ -557,6 +557,8 @@ static void draw_line(til_fb_fragment_t *fragment, int x1, int y1, int x2, int y
 	x_delta = abs(x_delta);
 	y_delta = abs(y_delta);
 
+	til_fb_fragment_damage(fragment, MIN(x1, x2), MIN(y1, y2), x_delta + 1, y_delta + 1);
+
 	if (x_delta >= y_delta) {
 		/* X-major */
 		for (int minor = 0, x = 0; x <= x_delta; x++, x1 += sdx, minor += y_delta) {
@@ -665,5 +667,5 @@ til_module_t	plato_module = {
 	.name = "plato",
 	.description = "Platonic solids rendered in 3D",
 	.author = "Vito Caputo <vcaputo@pengaru.com>",
-	.flags = TIL_MODULE_OVERLAYABLE,
+	.flags = TIL_MODULE_OVERLAYABLE | TIL_MODULE_DAMAGE,
 };
@@ -1,10 +1,14 @@
+#include <errno.h>
 #include <stdint.h>
 #include <inttypes.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
 
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
+#include "til_settings.h"
 #include "til_util.h"
 
 #include "ray/ray_camera.h"
@@ -125,54 +129,157 @@ static ray_scene_t	scene = {
 
 static float	r;
 
+#define RAY_DEFAULT_SCENE	RAY_SCENE_CLASSIC
+#define RAY_DEFAULT_SPHERES	1000
+#define RAY_DEFAULT_SAMPLING	RAY_RENDER_SAMPLING_SINGLE
+
+typedef enum ray_scene_type_t {
+	RAY_SCENE_CLASSIC,	/* the original hand-placed spheres */
+	RAY_SCENE_SPHERES,	/* randomly generated spheres for stressing the renderer */
+} ray_scene_type_t;
+
+typedef struct ray_setup_t {
+	til_setup_t		til_setup;
+	ray_scene_type_t	scene;
+	unsigned		n_spheres;
+	ray_render_sampling_t	sampling;
+	unsigned		still:1;	/* camera and light stay put, for progressive refinement */
+} ray_setup_t;
 
 typedef struct ray_context_t {
 	til_module_context_t	til_module_context;
+	ray_setup_t		setup;
+	ray_scene_t		scene;
 	ray_render_t		*render;
+	ray_object_t		objects[];	/* generated scene objects, when not classic */
 } ray_context_t;
 
+static ray_setup_t ray_default_setup = {
+	.scene = RAY_DEFAULT_SCENE,
+	.n_spheres = RAY_DEFAULT_SPHERES,
+	.sampling = RAY_DEFAULT_SAMPLING,
+};
+
+
+/* generate a floor with n_spheres randomly sized and colored spheres scattered above it around the origin */
+static void ray_generate_spheres(unsigned seed, unsigned n_spheres, ray_object_t *res_objects)
+{
+	/* keep the same sphere density regardless of how many there are, but stay clear of the camera's path */
+	float	extent = MIN(cbrtf((float)n_spheres) * .4f, 3.5f);
+	float	radius = MIN(.3f, extent / cbrtf((float)n_spheres) * .4f);
+
+	res_objects[0] = objects[0];	/* the floor */
+
+	for (unsigned i = 1; i <= n_spheres; i++) {
+		ray_3f_t	center;
+		float		rr = radius * (.5f + (float)rand_r(&seed) / (float)RAND_MAX * .5f);
+
+		do {
+			center.x = ((float)rand_r(&seed) / (float)RAND_MAX * 2.f - 1.f) * extent;
+			center.y = ((float)rand_r(&seed) / (float)RAND_MAX * 2.f - 1.f) * extent;
+			center.z = ((float)rand_r(&seed) / (float)RAND_MAX * 2.f - 1.f) * extent;
+		} while (ray_3f_length(&center) > extent || center.y - rr < -objects[0].plane.distance);
+
+		res_objects[i].sphere = (ray_object_sphere_t){
+			.type = RAY_OBJECT_TYPE_SPHERE,
+			.surface = {
+				.color = {
+					.x = (float)rand_r(&seed) / (float)RAND_MAX,
+					.y = (float)rand_r(&seed) / (float)RAND_MAX,
+					.z = (float)rand_r(&seed) / (float)RAND_MAX,
+				},
+				.diffuse = .9f,
+				.specular = (float)rand_r(&seed) / (float)RAND_MAX * .6f,
+				.highlight_exponent = 20.0f,
+			},
+			.center = center,
+			.radius = rr,
+		};
+	}
+
+	res_objects[n_spheres + 1].type = RAY_OBJECT_TYPE_SENTINEL;
+}
+
 
 static til_module_context_t * ray_create_context(unsigned seed, unsigned ticks, unsigned n_cpus, til_setup_t *setup)
 {
+	ray_setup_t	*s = (ray_setup_t *)setup;
 	ray_context_t	*ctxt;
+	unsigned	n_objects = 0;
+
+	if (!s)
+		s = &ray_default_setup;
+
+	if (s->scene == RAY_SCENE_SPHERES)
+		n_objects = s->n_spheres + 2;	/* floor + spheres + sentinel */
 
-	ctxt = til_module_context_new(sizeof(ray_context_t), seed, ticks, n_cpus);
+	ctxt = til_module_context_new(sizeof(ray_context_t) + n_objects * sizeof(ray_object_t), seed, ticks, n_cpus);
 	if (!ctxt)
 		return NULL;
 
+	ctxt->setup = *s;
+	ctxt->scene = scene;
+	if (s->scene == RAY_SCENE_SPHERES) {
+		ray_generate_spheres(seed, s->n_spheres, ctxt->objects);
+		ctxt->scene.objects = ctxt->objects;
+	}
+
 	return &ctxt->til_module_context;
 }
 
 
+static void ray_destroy_context(til_module_context_t *context)
+{
+	ray_context_t	*ctxt = (ray_context_t *)context;
+
+	if (ctxt->render)
+		ray_render_free(ctxt->render);
+
+	free(ctxt);
+}
+
+
 /* prepare a frame for concurrent rendering */
 static void ray_prepare_frame(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment, til_frame_plan_t *res_frame_plan)
 {
 	ray_context_t	*ctxt = (ray_context_t *)context;
 
 	*res_frame_plan = (til_frame_plan_t){ .fragmenter = til_fragmenter_tile64 };
-#if 1
-	/* animated point light source */
 
-	r += -.02;
+	/* a still camera is only placed for the first frame, leaving it still for progressive refinement */
+	if (!ctxt->setup.still || !ctxt->render) {
+		/* animated point light source */
+
+		r += -.02;
 
-	scene.lights[0].light.emitter.point.center.x = cosf(r) * 4.5f;
-	scene.lights[0].light.emitter.point.center.z = sinf(r * 3.0f) * 4.5f;
+		scene.lights[0].light.emitter.point.center.x = cosf(r) * 4.5f;
+		scene.lights[0].light.emitter.point.center.z = sinf(r * 3.0f) * 4.5f;
 
-	/* move the camera in a circle */
-	camera.position.x = sinf(r) * (cosf(r) * 2.0f + 5.0f);
-	camera.position.z = cosf(r) * (cosf(r) * 2.0f + 5.0f);
+		/* move the camera in a circle */
+		camera.position.x = sinf(r) * (cosf(r) * 2.0f + 5.0f);
+		camera.position.z = cosf(r) * (cosf(r) * 2.0f + 5.0f);
 
-	/* also move up and down */
-	camera.position.y = cosf(r * 1.3f) * 4.0f + 2.08f;
+		/* also move up and down */
+		camera.position.y = cosf(r * 1.3f) * 4.0f + 2.08f;
 
-	/* keep camera facing the origin */
-	camera.orientation.yaw = r + RAY_EULER_DEGREES(180.0f);
+		/* keep camera facing the origin */
+		camera.orientation.yaw = r + RAY_EULER_DEGREES(180.0f);
 
 
-	/* tilt camera pitch in time with up and down movements, phase shifted appreciably */
-	camera.orientation.pitch = -(sinf((M_PI * 1.5f) + r * 1.3f) * .6f + -.35f);
-#endif
-	ctxt->render = ray_render_new(&scene, &camera, fragment->frame_width, fragment->frame_height);
+		/* tilt camera pitch in time with up and down movements, phase shifted appreciably */
+		camera.orientation.pitch = -(sinf((M_PI * 1.5f) + r * 1.3f) * .6f + -.35f);
+	}
+
+	/* the render persists across frames, only the moving camera and lights need updating */
+	if (!ctxt->render) {
+		ctxt->render = ray_render_new(&ctxt->scene, &camera, fragment->frame_width, fragment->frame_height);
+		if (ctxt->render)
+			ray_render_set_sampling(ctxt->render, ctxt->setup.sampling);
+	} else {
+		ray_render_update(ctxt->render,
+				  ctxt->setup.still ? 0 : (RAY_RENDER_CHANGED_CAMERA | RAY_RENDER_CHANGED_LIGHTS),
+				  fragment->frame_width, fragment->frame_height);
+	}
 }
 
 
@@ -185,20 +292,138 @@ static void ray_render_fragment(til_module_context_t *context, unsigned ticks, u
 }
 
 
-static void ray_finish_frame(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment)
+static int ray_setup(const til_settings_t *settings, til_setting_t **res_setting, const til_setting_desc_t **res_desc, til_setup_t **res_setup)
 {
-	ray_context_t	*ctxt = (ray_context_t *)context;
+	const char	*scene_type;
+	const char	*scene_values[] = {
+				"classic",
+				"spheres",
+				NULL
+			};
+	const char	*sampling;
+	const char	*sampling_values[] = {
+				"single",
+				"adaptive",
+				"progressive",
+				NULL
+			};
+	const char	*camera_motion;
+	const char	*camera_values[] = {
+				"orbit",
+				"still",
+				NULL
+			};
+	const char	*spheres;
+	const char	*spheres_values[] = {
+				"10",
+				"100",
+				"1000",
+				"10000",
+				NULL
+			};
+	int		r;
+
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Scene",
+							.key = "scene",
+							.regex = "^(classic|spheres)",
+							.preferred = scene_values[RAY_DEFAULT_SCENE],
+							.values = scene_values,
+							.annotations = NULL
+						},
+						&scene_type,
+						res_setting,
+						res_desc);
+	if (r)
+		return r;
+
+	if (!strcasecmp(scene_type, "spheres")) {
+		r = til_settings_get_and_describe_value(settings,
+							&(til_setting_desc_t){
+								.name = "Number of spheres",
+								.key = "spheres",
+								.regex = "[0-9]+",
+								.preferred = TIL_SETTINGS_STR(RAY_DEFAULT_SPHERES),
+								.values = spheres_values,
+								.annotations = NULL
+							},
+							&spheres,
+							res_setting,
+							res_desc);
+		if (r)
+			return r;
+	}
+
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Pixel sampling",
+							.key = "sampling",
+							.regex = "^(single|adaptive|progressive)",
+							.preferred = sampling_values[RAY_DEFAULT_SAMPLING],
+							.values = sampling_values,
+							.annotations = NULL
+						},
+						&sampling,
+						res_setting,
+						res_desc);
+	if (r)
+		return r;
+
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Camera motion",
+							.key = "camera",
+							.regex = "^(orbit|still)",
+							.preferred = camera_values[0],
+							.values = camera_values,
+							.annotations = NULL
+						},
+						&camera_motion,
+						res_setting,
+						res_desc);
+	if (r)
+		return r;
+
+	if (res_setup) {
+		ray_setup_t	*setup;
+
+		setup = til_setup_new(sizeof(*setup), (void(*)(til_setup_t *))free);
+		if (!setup)
+			return -ENOMEM;
+
+		if (!strcasecmp(scene_type, "spheres")) {
+			setup->scene = RAY_SCENE_SPHERES;
+			if (sscanf(spheres, "%u", &setup->n_spheres) != 1 || !setup->n_spheres) {
+				free(setup);
+
+				return -EINVAL;
+			}
+		}
+
+		for (unsigned i = 0; sampling_values[i]; i++) {
+			if (!strcasecmp(sampling, sampling_values[i]))
+				setup->sampling = i;
+		}
+
+		if (!strcasecmp(camera_motion, "still"))
+			setup->still = 1;
+
+		*res_setup = &setup->til_setup;
+	}
 
-	ray_render_free(ctxt->render);
+	return 0;
 }
 
 
 til_module_t	ray_module = {
 	.create_context = ray_create_context,
+	.destroy_context = ray_destroy_context,
 	.prepare_frame = ray_prepare_frame,
 	.render_fragment = ray_render_fragment,
-	.finish_frame = ray_finish_frame,
+	.setup = ray_setup,
 	.name = "ray",
 	.description = "Ray tracer (threaded)",
 	.author = "Vito Caputo <vcaputo@pengaru.com>",
+	.flags = TIL_MODULE_TILEABLE,
 };
@@ -6,6 +6,11 @@
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
+#include "til_util.h"
+
+#ifdef TIL_CPU_X86
+#include <immintrin.h>
+#endif
 
 /* Copyright (C) 2016 Vito Caputo <vcaputo@pengaru.com> */
 
@@ -20,6 +25,16 @@
 #define FIXED_NEW(_i)		((_i) << FIXED_BITS)
 #define FIXED_TO_INT(_f)	((_f) >> FIXED_BITS)
 
+#define ROTO_ALPHA_BITS		8			/* bits of the fractional texel position used in bilinear sampling */
+#define ROTO_RAMP_SIZE		256			/* number of colors the palette is expanded to */
+
+/* The texture is stored as 4x4 tiles of texels, each tile filling a 64-byte cache line, so
+ * rotated traversals walking it diagonally don't touch a new line with every step.  Every texel
+ * is packed with its east, south and south-east neighbors as the bytes of a uint32_t, so the
+ * 2x2 texels sampled bilinearly are a single load.
+ */
+#define ROTO_TEXEL(_x, _y)	((((_y) >> 2) << 10) | (((_x) >> 2) << 4) | (((_y) & 3) << 2) | ((_x) & 3))
+
 typedef struct color_t {
 	int	r, g, b;
 } color_t;
@@ -28,10 +43,11 @@ typedef struct roto_context_t {
 	til_module_context_t	til_module_context;
 	unsigned		r, rr;
 	color_t			palette[2];
+	uint32_t		ramp[ROTO_RAMP_SIZE];	/* palette expanded to pixels, indexed by texel values */
 } roto_context_t;
 
 static int32_t	costab[FIXED_TRIG_LUT_SIZE], sintab[FIXED_TRIG_LUT_SIZE];
-static uint8_t	texture[256][256];
+static uint32_t	texture[256 * 256];
 
 static til_module_context_t * roto_create_context(unsigned seed, unsigned ticks, unsigned n_cpus, til_setup_t *setup)
 {
@@ -67,102 +83,108 @@ static inline color_t lerp_color(color_t *a, color_t *b, int alpha)
 }
 
 
-/* Return the bilinearly interpolated color palette[texture[ty][tx]] (Anti-Aliasing) */
-/* tx, ty are fixed-point for fractions, palette colors are also in fixed-point format. */
-static uint32_t bilerp_color(uint8_t texture[256][256], color_t *palette, int tx, int ty)
+/* Return the bilinearly interpolated color ramp[texture(tx, ty)] (Anti-Aliasing) */
+/* tx, ty are fixed-point for fractions. */
+static inline uint32_t bilerp_color(const uint32_t *texture, const uint32_t *ramp, int tx, int ty)
 {
-	uint8_t	itx = FIXED_TO_INT(tx), ity = FIXED_TO_INT(ty);
-	color_t	n_color, s_color, color;
-	int	x_alpha, y_alpha;
-	uint8_t	nw, ne, sw, se;
-
-	/* We need the 4 texels constituting a 2x2 square pattern to interpolate.
-	 * A point tx,ty can only intersect one texel; one corner of the 2x2 square.
-	 * Where relative to the corner's center the intersection occurs determines which corner has been intersected,
-	 * and the other corner texels may then be addressed relative to that corner.
-	 * Alpha values must also be determined for both axis, these values describe the position between
-	 * the 2x2 texel centers the intersection occurred, aka the weight or bias.
-	 * Once the two alpha values are known, linear interpolation between the texel colors is trivial.
+	/* Offsetting by half a texel puts tx,ty between the centers of the 2x2 texels constituting
+	 * the square they're interpolated from, the integer parts then address its north-west
+	 * texel and the fractions are the weights of the others, without any branching.
 	 */
+	unsigned	u = tx - (FIXED_EXP >> 1), v = ty - (FIXED_EXP >> 1);
+	uint32_t	quad = texture[ROTO_TEXEL((u >> FIXED_BITS) & 0xff, (v >> FIXED_BITS) & 0xff)];
+	int		x_alpha = (u & FIXED_MASK) >> (FIXED_BITS - ROTO_ALPHA_BITS);
+	int		y_alpha = (v & FIXED_MASK) >> (FIXED_BITS - ROTO_ALPHA_BITS);
+	int		nw = quad & 0xff, ne = (quad >> 8) & 0xff, sw = (quad >> 16) & 0xff, se = quad >> 24;
+	int		n, s;
 
-	if ((ty & FIXED_MASK) > (FIXED_EXP >> 1)) {
-		y_alpha = ty & (FIXED_MASK >> 1);
+	n = (nw << ROTO_ALPHA_BITS) + (ne - nw) * x_alpha;
+	s = (sw << ROTO_ALPHA_BITS) + (se - sw) * x_alpha;
 
-		if ((tx & (FIXED_MASK)) > (FIXED_EXP >> 1)) {
-			nw = texture[ity][itx];
-			ne = texture[ity][(uint8_t)(itx + 1)];
-			sw = texture[(uint8_t)(ity + 1)][itx];
-			se = texture[(uint8_t)(ity + 1)][(uint8_t)(itx + 1)];
-
-			x_alpha = tx & (FIXED_MASK >> 1);
-		} else {
-			ne = texture[ity][itx];
-			nw = texture[ity][(uint8_t)(itx - 1)];
-			se = texture[(uint8_t)(ity + 1)][itx];
-			sw = texture[(uint8_t)(ity + 1)][(uint8_t)(itx - 1)];
+	return ramp[((n << ROTO_ALPHA_BITS) + (s - n) * y_alpha) >> (ROTO_ALPHA_BITS * 2)];
+}
 
-			x_alpha = (FIXED_EXP >> 1) + (tx & (FIXED_MASK >> 1));
-		}
-	} else {
-		y_alpha = (FIXED_EXP >> 1) + (ty & (FIXED_MASK >> 1));
-
-		if ((tx & (FIXED_MASK)) > (FIXED_EXP >> 1)) {
-			sw = texture[ity][itx];
-			se = texture[ity][(uint8_t)(itx + 1)];
-			nw = texture[(uint8_t)(ity - 1)][itx];
-			ne = texture[(uint8_t)(ity - 1)][(uint8_t)(itx + 1)];
-
-			x_alpha = tx & (FIXED_MASK >> 1);
-		} else {
-			se = texture[ity][itx];
-			sw = texture[ity][(uint8_t)(itx - 1)];
-			ne = texture[(uint8_t)(ity - 1)][itx];
-			nw = texture[(uint8_t)(ity - 1)][(uint8_t)(itx - 1)];
-
-			x_alpha = (FIXED_EXP >> 1) + (tx & (FIXED_MASK >> 1));
-		}
-	}
 
-	/* Skip interpolation of same colors, a substantial optimization with plain textures like the checker pattern */
-	if (nw == ne) {
-		if (ne == sw && sw == se)
-			return (FIXED_TO_INT(palette[sw].r) << 16) | (FIXED_TO_INT(palette[sw].g) << 8) | FIXED_TO_INT(palette[sw].b);
+/* draw n pixels of a row starting at texture position tx,ty, stepping dtx,dty per pixel */
+static void roto_row_generic(const uint32_t *ramp, int tx, int ty, int dtx, int dty, uint32_t *buf, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++, tx += dtx, ty += dty)
+		buf[i] = bilerp_color(texture, ramp, tx, ty);
+}
 
-		n_color = palette[nw];
-	} else {
-		n_color = lerp_color(&palette[nw], &palette[ne], x_alpha);
-	}
 
-	if (sw == se) {
-		s_color = palette[sw];
-	} else {
-		s_color = lerp_color(&palette[sw], &palette[se], x_alpha);
+#ifdef TIL_CPU_X86
+/* same as roto_row_generic(), eight pixels at a time gathering the texel quads and ramp colors */
+__attribute__((target("avx2")))
+static void roto_row_avx2(const uint32_t *ramp, int tx, int ty, int dtx, int dty, uint32_t *buf, unsigned n)
+{
+	__m256i		lanes = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+	__m256i		u = _mm256_add_epi32(_mm256_set1_epi32(tx - (FIXED_EXP >> 1)), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(dtx)));
+	__m256i		v = _mm256_add_epi32(_mm256_set1_epi32(ty - (FIXED_EXP >> 1)), _mm256_mullo_epi32(lanes, _mm256_set1_epi32(dty)));
+	__m256i		du = _mm256_set1_epi32(dtx * 8), dv = _mm256_set1_epi32(dty * 8);
+	__m256i		byte = _mm256_set1_epi32(0xff), three = _mm256_set1_epi32(3), alpha = _mm256_set1_epi32(FIXED_MASK);
+	unsigned	i = 0;
+
+	for (; i + 8 <= n; i += 8, u = _mm256_add_epi32(u, du), v = _mm256_add_epi32(v, dv)) {
+		__m256i	x = _mm256_and_si256(_mm256_srli_epi32(u, FIXED_BITS), byte);
+		__m256i	y = _mm256_and_si256(_mm256_srli_epi32(v, FIXED_BITS), byte);
+		__m256i	x_alpha = _mm256_srli_epi32(_mm256_and_si256(u, alpha), FIXED_BITS - ROTO_ALPHA_BITS);
+		__m256i	y_alpha = _mm256_srli_epi32(_mm256_and_si256(v, alpha), FIXED_BITS - ROTO_ALPHA_BITS);
+		__m256i	idx, quad, nw, ne, sw, se, n, s;
+
+		idx = _mm256_or_si256(_mm256_or_si256(_mm256_slli_epi32(_mm256_srli_epi32(y, 2), 10), _mm256_slli_epi32(_mm256_srli_epi32(x, 2), 4)),
+				      _mm256_or_si256(_mm256_slli_epi32(_mm256_and_si256(y, three), 2), _mm256_and_si256(x, three)));
+		quad = _mm256_i32gather_epi32((const int *)texture, idx, sizeof(uint32_t));
+
+		nw = _mm256_and_si256(quad, byte);
+		ne = _mm256_and_si256(_mm256_srli_epi32(quad, 8), byte);
+		sw = _mm256_and_si256(_mm256_srli_epi32(quad, 16), byte);
+		se = _mm256_srli_epi32(quad, 24);
+
+		n = _mm256_add_epi32(_mm256_slli_epi32(nw, ROTO_ALPHA_BITS), _mm256_mullo_epi32(_mm256_sub_epi32(ne, nw), x_alpha));
+		s = _mm256_add_epi32(_mm256_slli_epi32(sw, ROTO_ALPHA_BITS), _mm256_mullo_epi32(_mm256_sub_epi32(se, sw), x_alpha));
+		idx = _mm256_srli_epi32(_mm256_add_epi32(_mm256_slli_epi32(n, ROTO_ALPHA_BITS), _mm256_mullo_epi32(_mm256_sub_epi32(s, n), y_alpha)), ROTO_ALPHA_BITS * 2);
+
+		_mm256_storeu_si256((__m256i *)&buf[i], _mm256_i32gather_epi32((const int *)ramp, idx, sizeof(uint32_t)));
 	}
 
-	color = lerp_color(&n_color, &s_color, y_alpha);
-
-	return (FIXED_TO_INT(color.r) << 16) | (FIXED_TO_INT(color.g) << 8) | FIXED_TO_INT(color.b);
+	TIL_AVX_TAIL(roto_row_generic(ramp, tx + i * dtx, ty + i * dty, dtx, dty, &buf[i], n - i));
 }
+#endif
+
+TIL_CPU_DISPATCH(roto_row, roto_row_generic, roto_row_avx2)
 
 
-static void init_roto(uint8_t texture[256][256], int32_t *costab, int32_t *sintab)
+static void init_roto(uint32_t *texture, int32_t *costab, int32_t *sintab)
 {
-	int	x, y, i;
+	static uint8_t	texels[256][256];
+	int		x, y, i;
 
 	/* Generate simple checker pattern texture, nothing clever, feel free to play! */
 	/* If you modify texture on every frame instead of only @ initialization you can
-	 * produce some neat output.  These values are indexed into palette[] below. */
+	 * produce some neat output.  These values are positions in the ramp between palette[0]
+	 * and palette[1], so anything in between works too. */
 	for (y = 0; y < 128; y++) {
 		for (x = 0; x < 128; x++)
-			texture[y][x] = 1;
+			texels[y][x] = 255;
 		for (; x < 256; x++)
-			texture[y][x] = 0;
+			texels[y][x] = 0;
 	}
 	for (; y < 256; y++) {
 		for (x = 0; x < 128; x++)
-			texture[y][x] = 0;
+			texels[y][x] = 0;
 		for (; x < 256; x++)
-			texture[y][x] = 1;
+			texels[y][x] = 255;
+	}
+
+	/* Pack the texels into their quads in the tiled layout. */
+	for (y = 0; y < 256; y++) {
+		for (x = 0; x < 256; x++) {
+			texture[ROTO_TEXEL(x, y)] =	texels[y][x] |
+							texels[y][(uint8_t)(x + 1)] << 8 |
+							texels[(uint8_t)(y + 1)][x] << 16 |
+							(uint32_t)texels[(uint8_t)(y + 1)][(uint8_t)(x + 1)] << 24;
+		}
 	}
 
 	/* Generate fixed-point cos & sin LUTs. */
@@ -201,6 +223,13 @@ static void roto_prepare_frame(til_module_context_t *context, unsigned ticks, ti
 		ctxt->palette[1].g = (FIXED_MULT(FIXED_COS(ctxt->rr / 2), FIXED_NEW(127)) + FIXED_NEW(128));
 		ctxt->palette[1].b = (FIXED_MULT(FIXED_SIN(ctxt->rr), FIXED_NEW(127)) + FIXED_NEW(128));
 
+		/* Expand the palette into pixels once per frame rather than lerping colors per pixel. */
+		for (int i = 0; i < ROTO_RAMP_SIZE; i++) {
+			color_t	c = lerp_color(&ctxt->palette[0], &ctxt->palette[1], i * FIXED_EXP / (ROTO_RAMP_SIZE - 1));
+
+			ctxt->ramp[i] = (FIXED_TO_INT(c.r) << 16) | (FIXED_TO_INT(c.g) << 8) | FIXED_TO_INT(c.b);
+		}
+
 		context->ticks = ticks;
 	}
 }
@@ -210,8 +239,8 @@ static void roto_prepare_frame(til_module_context_t *context, unsigned ticks, ti
 static void roto_render_fragment(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment)
 {
 	roto_context_t	*ctxt = (roto_context_t *)context;
-	int		x, y, frame_width = fragment->frame_width, frame_height = fragment->frame_height;
-	int		y_cos_r, y_sin_r, x_cos_r, x_sin_r, x_cos_r_init, x_sin_r_init, cos_r, sin_r;
+	int		y, frame_width = fragment->frame_width, frame_height = fragment->frame_height;
+	int		y_cos_r, y_sin_r, x_cos_r_init, x_sin_r_init, cos_r, sin_r;
 	uint32_t	*buf = fragment->buf;
 
 	/* This is all done using fixed-point in the hopes of being faster, and yes assumptions
@@ -228,18 +257,9 @@ static void roto_render_fragment(til_module_context_t *context, unsigned ticks,
 	y_sin_r = FIXED_MULT(-FIXED_NEW(frame_height / 2) + FIXED_NEW(fragment->y), sin_r);
 
 	for (y = fragment->y; y < fragment->y + fragment->height; y++) {
+		roto_row(ctxt->ramp, x_sin_r_init - y_cos_r, y_sin_r + x_cos_r_init, sin_r, cos_r, buf, fragment->width);
 
-		x_cos_r = x_cos_r_init;
-		x_sin_r = x_sin_r_init;
-
-		for (x = fragment->x; x < fragment->x + fragment->width; x++, buf++) {
-			*buf = bilerp_color(texture, ctxt->palette, x_sin_r - y_cos_r, y_sin_r + x_cos_r);
-
-			x_cos_r += cos_r;
-			x_sin_r += sin_r;
-		}
-
-		buf += fragment->stride;
+		buf += fragment->pitch;
 		y_cos_r += cos_r;
 		y_sin_r += sin_r;
 	}
@@ -253,4 +273,5 @@ til_module_t	roto_module = {
 	.name = "roto",
 	.description = "Anti-aliased tiled texture rotation (threaded)",
 	.author = "Vito Caputo <vcaputo@pengaru.com>",
+	.flags = TIL_MODULE_TILEABLE,
 };
@@ -1,9 +1,11 @@
+#include <pthread.h>
 #include <stdlib.h>
 #include <time.h>
 
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
+#include "til_rand.h"
 #include "til_settings.h"
 #include "til_util.h"
 
@@ -13,14 +15,20 @@
 
 /* This implements an MTV-inspired random slideshow of rototiller modules.
  *
- * Some TODO items:
- * - optionally persist module contexts so they resume rather than restart
+ * The next channel is prepared by a loader thread while the current one is
+ * on the air, so creating expensive contexts doesn't stall the switches.
+ *
+ * Channels leaving the air keep their contexts to resume where they left off
+ * until they've been on for context_duration, or forever with a
+ * context_duration of 0.  The contexts kept by idle channels are bounded by
+ * context_budget, evicting the least recently watched beyond it.
  */
 
 #define RTV_SNOW_DURATION_SECS		0
 #define RTV_DURATION_SECS		4
 #define RTV_CONTEXT_DURATION_SECS	4
 #define RTV_CAPTION_DURATION_SECS	2
+#define RTV_CONTEXT_BUDGET_MIB		256
 #define RTV_DEFAULT_SNOW_MODULE		"none"
 
 typedef struct rtv_channel_t {
@@ -36,13 +44,25 @@ typedef struct rtv_channel_t {
 typedef struct rtv_context_t {
 	til_module_context_t	til_module_context;
 	time_t			next_switch, next_hide_caption;
-	rtv_channel_t		*channel, *last_channel;
+	rtv_channel_t		*channel, *next_channel;
 	txt_t			*caption;
 
 	unsigned		duration;
 	unsigned		context_duration;
 	unsigned		snow_duration;
 	unsigned		caption_duration;
+	size_t			context_budget;
+
+	til_rand_t		rand;		/* for the lineup and channels prepared by rtv itself */
+	til_rand_t		loader_rand;	/* for the channels prepared by the loader */
+
+	pthread_t		loader;
+	pthread_mutex_t		loader_mutex;
+	pthread_cond_t		loader_cond;
+	rtv_channel_t		*loading;	/* channel being prepared by the loader, NULL when idle */
+	unsigned		loading_ticks;
+	unsigned		loader_running:1;
+	unsigned		loader_quit:1;
 
 	rtv_channel_t		snow_channel;
 
@@ -56,6 +76,7 @@ typedef struct rtv_setup_t {
 	unsigned		context_duration;
 	unsigned		snow_duration;
 	unsigned		caption_duration;
+	unsigned		context_budget;
 	char			*snow_module;
 	char			*channels[];
 } rtv_setup_t;
@@ -72,6 +93,7 @@ static rtv_setup_t rtv_default_setup = {
 	.context_duration = RTV_CONTEXT_DURATION_SECS,
 	.snow_duration = RTV_SNOW_DURATION_SECS,
 	.caption_duration = RTV_CAPTION_DURATION_SECS,
+	.context_budget = RTV_CONTEXT_BUDGET_MIB,
 	.snow_module = RTV_DEFAULT_SNOW_MODULE,
 	.channels = { NULL }, /* NULL == "all" */
 };
@@ -86,45 +108,156 @@ til_module_t	rtv_module = {
 	.name = "rtv",
 	.description = "Rototiller TV",
 	.setup = rtv_setup,
+	.flags = TIL_MODULE_DAMAGE,	/* the channels declare their own, and the captions are declared by txt */
 };
 
 
-static int cmp_channels(const void *p1, const void *p2)
+static void randomize_channels(rtv_context_t *ctxt)
 {
-	const rtv_channel_t	*c1 = p1, *c2 = p2;
+	for (size_t i = 0; i < ctxt->n_channels; i++)
+		ctxt->channels[i].order = til_rand(&ctxt->rand);
+}
 
-	if (c1->order < c2->order)
-		return -1;
 
-	if (c1->order > c2->order)
-		return 1;
+/* return the channel following channel in the lineup, reshuffling the lineup past its end */
+static rtv_channel_t * lineup_next_channel(rtv_context_t *ctxt, const rtv_channel_t *channel)
+{
+	rtv_channel_t	*next = NULL;
 
-	return 0;
+	for (size_t i = 0; i < ctxt->n_channels; i++) {
+		if (channel && ctxt->channels[i].order <= channel->order)
+			continue;
+
+		if (!next || ctxt->channels[i].order < next->order)
+			next = &ctxt->channels[i];
+	}
+
+	if (!next && channel) {
+		randomize_channels(ctxt);
+
+		return lineup_next_channel(ctxt, NULL);
+	}
+
+	return next;
 }
 
 
-static void randomize_channels(rtv_context_t *ctxt)
+static void cleanup_channel(rtv_context_t *ctxt, rtv_channel_t *channel)
 {
-	for (size_t i = 0; i < ctxt->n_channels; i++)
-		ctxt->channels[i].order = rand();
+	channel->cumulative_time = 0;
+
+	channel->module_ctxt = til_module_context_free(channel->module_ctxt);
+	channel->module_setup = til_setup_free(channel->module_setup);
+
+	free(channel->settings_as_arg);
+	channel->settings_as_arg = NULL;
+
+	if (ctxt->caption == channel->caption)
+		ctxt->caption = NULL;
+
+	channel->caption = txt_free(channel->caption);
+}
+
+
+/* randomize the channel's settings and create its context, unless it already has them */
+static void prepare_channel(rtv_channel_t *channel, til_rand_t *rand, unsigned ticks)
+{
+	if (!channel->settings_as_arg) {
+		char	*settings_as_arg = NULL;
+
+		(void) til_module_randomize_setup(channel->module, til_rand(rand), &channel->module_setup, &settings_as_arg);
+		channel->caption = txt_newf("Title: %s%s%s\nDescription: %s%s%s",
+					    channel->module->name,
+					    channel->module->author ? "\nAuthor: " : "",
+					    channel->module->author ? : "",
+					    channel->module->description,
+					    settings_as_arg ? "\nSettings: " : "",
+					    settings_as_arg ? settings_as_arg : "");
+
+		channel->settings_as_arg = settings_as_arg ? settings_as_arg : strdup("");
+	}
+
+	if (!channel->module_ctxt)
+		(void) til_module_create_context(channel->module, til_rand(rand), ticks, 0, channel->module_setup, &channel->module_ctxt);
+}
+
+
+/* The loader thread prepares the channels handed to it by load_channel(), only ever
+ * touching that channel, which must be left alone until wait_loader() returns.
+ */
+static void * loader_thread(void *arg)
+{
+	rtv_context_t	*ctxt = arg;
+
+	pthread_mutex_lock(&ctxt->loader_mutex);
+	while (!ctxt->loader_quit) {
+		if (!ctxt->loading) {
+			pthread_cond_wait(&ctxt->loader_cond, &ctxt->loader_mutex);
+			continue;
+		}
+
+		pthread_mutex_unlock(&ctxt->loader_mutex);
+		prepare_channel(ctxt->loading, &ctxt->loader_rand, ctxt->loading_ticks);
+		pthread_mutex_lock(&ctxt->loader_mutex);
+
+		ctxt->loading = NULL;
+		pthread_cond_broadcast(&ctxt->loader_cond);
+	}
+	pthread_mutex_unlock(&ctxt->loader_mutex);
+
+	return NULL;
+}
+
+
+/* without a loader thread, channels get prepared synchronously when switched to */
+static void load_channel(rtv_context_t *ctxt, rtv_channel_t *channel, unsigned ticks)
+{
+	if (!ctxt->loader_running)
+		return;
 
-	qsort(ctxt->channels, ctxt->n_channels, sizeof(rtv_channel_t), cmp_channels);
+	pthread_mutex_lock(&ctxt->loader_mutex);
+	ctxt->loading = channel;
+	ctxt->loading_ticks = ticks;
+	pthread_cond_broadcast(&ctxt->loader_cond);
+	pthread_mutex_unlock(&ctxt->loader_mutex);
 }
 
 
-static void cleanup_channel(rtv_context_t *ctxt)
+static void wait_loader(rtv_context_t *ctxt)
 {
-	if (!ctxt->channel)
+	if (!ctxt->loader_running)
 		return;
 
-	ctxt->channel->cumulative_time = 0;
+	pthread_mutex_lock(&ctxt->loader_mutex);
+	while (ctxt->loading)
+		pthread_cond_wait(&ctxt->loader_cond, &ctxt->loader_mutex);
+	pthread_mutex_unlock(&ctxt->loader_mutex);
+}
+
 
-	ctxt->channel->module_ctxt = til_module_context_free(ctxt->channel->module_ctxt);
+/* cleanup the least recently watched idle channels until their contexts fit the budget */
+static void evict_channels(rtv_context_t *ctxt)
+{
+	for (;;) {
+		rtv_channel_t	*lru = NULL;
+		size_t		total = 0;
+
+		for (size_t i = 0; i < ctxt->n_channels; i++) {
+			rtv_channel_t	*channel = &ctxt->channels[i];
 
-	free(ctxt->channel->settings_as_arg);
-	ctxt->channel->settings_as_arg = NULL;
+			if (!channel->module_ctxt || channel == ctxt->channel || channel == ctxt->next_channel)
+				continue;
 
-	ctxt->caption = ctxt->channel->caption = txt_free(ctxt->channel->caption);
+			total += channel->module_ctxt->size;
+			if (!lru || channel->last_on_time < lru->last_on_time)
+				lru = channel;
+		}
+
+		if (total <= ctxt->context_budget)
+			return;
+
+		cleanup_channel(ctxt, lru);
+	}
 }
 
 
@@ -137,58 +270,39 @@ static void setup_next_channel(rtv_context_t *ctxt, unsigned ticks)
 	 */
 	if (ctxt->channel) {
 		ctxt->channel->cumulative_time += now - ctxt->channel->last_on_time;
-		if (ctxt->channel->cumulative_time >= ctxt->context_duration)
-			cleanup_channel(ctxt);
+		if (ctxt->context_duration && ctxt->channel->cumulative_time >= ctxt->context_duration) {
+			/* a lone channel is its own next channel, possibly still being loaded */
+			if (ctxt->channel == ctxt->next_channel)
+				wait_loader(ctxt);
+
+			cleanup_channel(ctxt, ctxt->channel);
+		}
 	}
 
 	if (!ctxt->n_channels ||
 	    (ctxt->channel != &ctxt->snow_channel && ctxt->snow_channel.module != &rtv_none_module)) {
 
-		ctxt->last_channel = ctxt->channel;
 		ctxt->channel = &ctxt->snow_channel;
 		ctxt->caption = NULL;
 		ctxt->next_switch = now + ctxt->snow_duration;
 	} else {
-		size_t	i;
+		wait_loader(ctxt);
 
-		for (i = 0; i < ctxt->n_channels; i++) {
-			if (&ctxt->channels[i] == ctxt->last_channel) {
-				i++;
-				break;
-			}
-		}
-
-		if (i >= ctxt->n_channels) {
-			randomize_channels(ctxt);
-			ctxt->last_channel = NULL;
-			i = 0;
-		}
-
-		ctxt->channel = &ctxt->channels[i];
-
-		if (!ctxt->channel->settings_as_arg) {
-			char	*settings_as_arg = NULL;
-			txt_t	*caption;
-
-			(void) til_module_randomize_setup(ctxt->channel->module, &ctxt->channel->module_setup, &settings_as_arg);
-			caption = txt_newf("Title: %s%s%s\nDescription: %s%s%s",
-						 ctxt->channel->module->name,
-						 ctxt->channel->module->author ? "\nAuthor: " : "",
-						 ctxt->channel->module->author ? : "",
-						 ctxt->channel->module->description,
-						 settings_as_arg ? "\nSettings: " : "",
-						 settings_as_arg ? settings_as_arg : "");
-
-			ctxt->caption = ctxt->channel->caption = caption;
-			ctxt->channel->settings_as_arg = settings_as_arg ? settings_as_arg : strdup("");
-		}
+		ctxt->channel = ctxt->next_channel;
+		prepare_channel(ctxt->channel, &ctxt->rand, ticks);
 
+		/* only freshly setup channels get captioned, resumed ones continue as they were */
+		ctxt->caption = ctxt->channel->cumulative_time ? NULL : ctxt->channel->caption;
 		ctxt->next_switch = now + ctxt->duration;
 		ctxt->next_hide_caption = now + ctxt->caption_duration;
+
+		ctxt->next_channel = lineup_next_channel(ctxt, ctxt->channel);
+		evict_channels(ctxt);
+		load_channel(ctxt, ctxt->next_channel, ticks);
 	}
 
 	if (!ctxt->channel->module_ctxt)
-		(void) til_module_create_context(ctxt->channel->module, rand(), ticks, 0, ctxt->channel->module_setup, &ctxt->channel->module_ctxt);
+		(void) til_module_create_context(ctxt->channel->module, til_rand(&ctxt->rand), ticks, 0, ctxt->channel->module_setup, &ctxt->channel->module_ctxt);
 
 	ctxt->channel->last_on_time = now;
 }
@@ -240,18 +354,35 @@ static til_module_context_t * rtv_create_context(unsigned seed, unsigned ticks,
 	ctxt->context_duration = ((rtv_setup_t *)setup)->context_duration;
 	ctxt->snow_duration = ((rtv_setup_t *)setup)->snow_duration;
 	ctxt->caption_duration = ((rtv_setup_t *)setup)->caption_duration;
+	ctxt->context_budget = (size_t)((rtv_setup_t *)setup)->context_budget * 1024 * 1024;
+
+	til_rand_seed(&ctxt->rand, seed, 0);
+	til_rand_seed(&ctxt->loader_rand, seed, 1);
 
 	ctxt->snow_channel.module = &rtv_none_module;
 	if (((rtv_setup_t *)setup)->snow_module) {
 		ctxt->snow_channel.module = til_lookup_module(((rtv_setup_t *)setup)->snow_module);
-		(void) til_module_create_context(ctxt->snow_channel.module, rand_r(&seed), ticks, 0, NULL, &ctxt->snow_channel.module_ctxt);
+		(void) til_module_create_context(ctxt->snow_channel.module, til_rand(&ctxt->rand), ticks, 0, NULL, &ctxt->snow_channel.module_ctxt);
 	}
 
+	/* the first pass through the lineup is in module order, it's shuffled from then on */
 	for (size_t i = 0; i < n_modules; i++) {
-		if (!rtv_should_skip_module((rtv_setup_t *)setup, modules[i]))
+		if (!rtv_should_skip_module((rtv_setup_t *)setup, modules[i])) {
+			ctxt->channels[ctxt->n_channels].order = ctxt->n_channels;
 			ctxt->channels[ctxt->n_channels++].module = modules[i];
+		}
 	}
 
+	pthread_mutex_init(&ctxt->loader_mutex, NULL);
+	pthread_cond_init(&ctxt->loader_cond, NULL);
+	ctxt->loader_running = 1;
+	if (pthread_create(&ctxt->loader, NULL, loader_thread, ctxt))
+		ctxt->loader_running = 0;
+
+	ctxt->next_channel = lineup_next_channel(ctxt, NULL);
+	if (ctxt->next_channel)
+		load_channel(ctxt, ctxt->next_channel, ticks);
+
 	setup_next_channel(ctxt, ticks);
 
 	return &ctxt->til_module_context;
@@ -262,8 +393,23 @@ static void rtv_destroy_context(til_module_context_t *context)
 {
 	rtv_context_t	*ctxt = (rtv_context_t *)context;
 
-	/* TODO FIXME: cleanup better, snow module etc */
-	cleanup_channel(ctxt);
+	if (ctxt->loader_running) {
+		pthread_mutex_lock(&ctxt->loader_mutex);
+		ctxt->loader_quit = 1;
+		pthread_cond_broadcast(&ctxt->loader_cond);
+		pthread_mutex_unlock(&ctxt->loader_mutex);
+
+		pthread_join(ctxt->loader, NULL);
+	}
+
+	pthread_cond_destroy(&ctxt->loader_cond);
+	pthread_mutex_destroy(&ctxt->loader_mutex);
+
+	for (size_t i = 0; i < ctxt->n_channels; i++)
+		cleanup_channel(ctxt, &ctxt->channels[i]);
+
+	til_module_context_free(ctxt->snow_channel.module_ctxt);
+
 	free(context);
 }
 
@@ -310,6 +456,7 @@ static int rtv_setup(const til_settings_t *settings, til_setting_t **res_setting
 	const char	*channels;
 	const char	*duration;
 	const char	*context_duration;
+	const char	*context_budget;
 	const char	*caption_duration;
 	const char	*snow_duration;
 	const char	*snow_module;
@@ -344,7 +491,7 @@ static int rtv_setup(const til_settings_t *settings, til_setting_t **res_setting
 
 	r = til_settings_get_and_describe_value(settings,
 						&(til_setting_desc_t){
-							.name = "Context duration, in seconds",
+							.name = "Context duration, in seconds (0 to persist until evicted)",
 							.key = "context_duration",
 							.regex = "\\.[0-9]+",
 							.preferred = TIL_SETTINGS_STR(RTV_CONTEXT_DURATION_SECS),
@@ -356,6 +503,20 @@ static int rtv_setup(const til_settings_t *settings, til_setting_t **res_setting
 	if (r)
 		return r;
 
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Memory budget for contexts kept by idle channels, in MiB",
+							.key = "context_budget",
+							.regex = "\\.[0-9]+",
+							.preferred = TIL_SETTINGS_STR(RTV_CONTEXT_BUDGET_MIB),
+							.annotations = NULL
+						},
+						&context_budget,
+						res_setting,
+						res_desc);
+	if (r)
+		return r;
+
 	r = til_settings_get_and_describe_value(settings,
 						&(til_setting_desc_t){
 							.name = "Caption duration, in seconds",
@@ -458,6 +619,7 @@ static int rtv_setup(const til_settings_t *settings, til_setting_t **res_setting
 		/* TODO FIXME: parse errors */
 		sscanf(duration, "%u", &setup->duration);
 		sscanf(context_duration, "%u", &setup->context_duration);
+		sscanf(context_budget, "%u", &setup->context_budget);
 		sscanf(caption_duration, "%u", &setup->caption_duration);
 		sscanf(snow_duration, "%u", &setup->snow_duration);
 
@@ -5,20 +5,19 @@
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
+#include "til_rand.h"
+#include "til_util.h"
 
 /* Copyright (C) 2019 - Vito Caputo <vcaputo@pengaru.com> */
 
-/* This implements white noise / snow just using rand() */
+/* This implements white noise / snow using til_rand */
 
-typedef union snow_seed_t {
-	char			__padding[256];		/* prevent seeds sharing a cache-line */
-	unsigned		seed;
-} snow_seed_t;
+/* random bytes are generated in chunks of this many, one per pixel */
+#define SNOW_CHUNK	1024
 
 typedef struct snow_context_t {
 	til_module_context_t	til_module_context;
-	unsigned		unused;
-	snow_seed_t		seeds[];
+	unsigned		frame;
 } snow_context_t;
 
 
@@ -26,37 +25,43 @@ static til_module_context_t * snow_create_context(unsigned seed, unsigned ticks,
 {
 	snow_context_t	*ctxt;
 
-	ctxt = til_module_context_new(sizeof(snow_context_t) + n_cpus * sizeof(snow_seed_t), seed, ticks, n_cpus);
+	ctxt = til_module_context_new(sizeof(snow_context_t), seed, ticks, n_cpus);
 	if (!ctxt)
 		return NULL;
 
-	for (unsigned i = 0; i < n_cpus; i++)
-		ctxt->seeds[i].seed = rand_r(&seed);
-
 	return &ctxt->til_module_context;
 }
 
 
 static void snow_prepare_frame(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment, til_frame_plan_t *res_frame_plan)
 {
+	snow_context_t	*ctxt = (snow_context_t *)context;
+
 	*res_frame_plan = (til_frame_plan_t){ .fragmenter = til_fragmenter_slice_per_cpu };
+
+	ctxt->frame++;
 }
 
 
 static void snow_render_fragment(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment)
 {
 	snow_context_t	*ctxt = (snow_context_t *)context;
-	unsigned	*seed = &ctxt->seeds[cpu].seed;
+	uint32_t	bits[SNOW_CHUNK / sizeof(uint32_t)];
+	const uint8_t	*bytes = (const uint8_t *)bits;
+	til_rand_t	rand;
+
+	/* seeded per fragment of every frame, so the output doesn't depend on which thread renders what */
+	til_rand_seed(&rand, ctxt->til_module_context.seed + ctxt->frame, fragment->number);
+
+	for (unsigned y = 0; y < fragment->height; y++) {
+		uint32_t	*row = fragment->buf + y * fragment->pitch;
 
-	for (unsigned y = fragment->y; y < fragment->y + fragment->height; y++) {
-		for (unsigned x = fragment->x; x < fragment->x + fragment->width; x++) {
-#ifdef __WIN32__
-			uint32_t	pixel = rand();
-#else
-			uint32_t	pixel = rand_r(seed) % 256;
-#endif
+		for (unsigned x = 0; x < fragment->width; x += SNOW_CHUNK) {
+			unsigned	n = MIN(fragment->width - x, SNOW_CHUNK);
 
-			til_fb_fragment_put_pixel_unchecked(fragment, 0, x, y, pixel << 16 | pixel << 8 | pixel);
+			til_rand_fill(&rand, bits, (n + 3) / 4);
+			for (unsigned i = 0; i < n; i++)
+				row[x + i] = bytes[i] * 0x00010101u;
 		}
 	}
 }
@@ -69,4 +74,5 @@ til_module_t	snow_module = {
 	.name = "snow",
 	.description = "TV snow / white noise (threaded)",
 	.author = "Vito Caputo <vcaputo@pengaru.com>",
+	.flags = TIL_MODULE_TILEABLE,
 };
@@ -8,6 +8,7 @@
 #include <time.h>
 
 #include "til_fb.h"
+#include "til_rand.h"
 
 #include "chunker.h"
 #include "container.h"
@@ -41,6 +42,7 @@ struct particles_t {
 	list_head_t		active;		/* top-level active list of particles heirarchy */
 	bsp_t			*bsp;		/* bsp spatial index of the particles */
 	particles_conf_t	conf;
+	til_rand_t		rand;		/* the particles' random numbers, seeded from conf.seed */
 };
 
 
@@ -69,6 +71,8 @@ particles_t * particles_new(const particles_conf_t *conf)
 	if (conf)
 		particles->conf = *conf;
 
+	til_rand_seed(&particles->rand, particles->conf.seed, 0);
+
 	return particles;
 }
 
@@ -221,6 +225,15 @@ bsp_t * particles_bsp(particles_t *particles)
 }
 
 
+/* return the particles' random number generator, only for use from the particles' init and sim ops */
+til_rand_t * particles_rand(particles_t *particles)
+{
+	assert(particles);
+
+	return &particles->rand;
+}
+
+
 static inline void _particles_draw(particles_t *particles, list_head_t *list, til_fb_fragment_t *fragment)
 {
 	float		w2 = fragment->frame_width * .5f, h2 = fragment->frame_height * .5f;
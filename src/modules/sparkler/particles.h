@@ -12,6 +12,7 @@ typedef struct particles_conf_t {
 	unsigned	show_bsp_matches:1;
 	unsigned	show_bsp_matches_affected_only:1;
 	unsigned	show_bsp_leafs_min_depth;
+	unsigned	seed;
 } particles_conf_t;
 
 typedef struct particles_t particles_t;
@@ -26,6 +27,7 @@ int particles_add_particle(particles_t *particles, particle_props_t *props, part
 void particles_spawn_particle(particles_t *particles, particle_t *parent, particle_props_t *props, particle_ops_t *ops);
 void particles_add_particles(particles_t *particles, particle_props_t *props, particle_ops_t *ops, int num);
 bsp_t * particles_bsp(particles_t *particles);
+til_rand_t * particles_rand(particles_t *particles);
 void particles_draw_line(particles_t *particles, const v3f_t *a, const v3f_t *b, til_fb_fragment_t *fragment);
 
 #endif
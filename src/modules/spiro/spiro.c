@@ -77,6 +77,9 @@ static void spiro_render_fragment(til_module_context_t *context, unsigned ticks,
 	/* blank the fragment */
 	til_fb_fragment_clear(fragment);
 
+	/* everything plotted stays within the fixed outer circle */
+	til_fb_fragment_damage(fragment, display_origin_x-display_R, display_origin_y-display_R, display_R*2+1, display_R*2+1);
+
 	/* plot one spirograph run */
 	float l=ctxt->p/ctxt->r;
 	float k=ctxt->r;
@@ -143,5 +146,5 @@ til_module_t	spiro_module = {
 	.name = "spiro",
 	.description = "Spirograph emulator",
 	.author = "Philip J Freeman <elektron@halo.nu>",
-	.flags = TIL_MODULE_OVERLAYABLE,
+	.flags = TIL_MODULE_OVERLAYABLE | TIL_MODULE_DAMAGE,
 };
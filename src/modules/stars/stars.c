@@ -161,6 +161,10 @@ static void stars_render_fragment(til_module_context_t *context, unsigned ticks,
 		else
 			opacity = 1;
 
+		til_fb_fragment_damage(fragment, floorf(pos_x-max_radius), floorf(pos_y-max_radius),
+			(int)ceilf(pos_x+max_radius)-(int)floorf(pos_x-max_radius)+1,
+			(int)ceilf(pos_y+max_radius)-(int)floorf(pos_y-max_radius)+1);
+
 		if (pos_x>0 && pos_x<width && pos_y>0 && pos_y<height)
 			til_fb_fragment_put_pixel_unchecked(fragment, TIL_FB_DRAW_FLAG_TEXTURABLE, pos_x, pos_y,
 				makergb(0xFF, 0xFF, 0xFF, opacity));
@@ -267,5 +271,5 @@ til_module_t	stars_module = {
 	.name = "stars",
 	.description = "Basic starfield",
 	.author = "Philip J Freeman <elektron@halo.nu>",
-	.flags = TIL_MODULE_OVERLAYABLE,
+	.flags = TIL_MODULE_OVERLAYABLE | TIL_MODULE_DAMAGE,
 };
@@ -23,6 +23,7 @@
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
+#include "til_rand.h"
 #include "til_settings.h"
 #include "til_util.h"
 
@@ -55,6 +56,7 @@ typedef struct submit_context_t {
 	grid_player_t		*players[NUM_PLAYERS];
 	uint32_t		seq;
 	uint32_t		game_winner;
+	til_rand_t		rand;
 	unsigned		bilerp:1;
 	uint8_t			cells[GRID_SIZE * GRID_SIZE];
 } submit_context_t;
@@ -279,6 +281,7 @@ static til_module_context_t * submit_create_context(unsigned seed, unsigned tick
 		return NULL;
 
 	ctxt->bilerp = ((submit_setup_t *)setup)->bilerp;
+	til_rand_seed(&ctxt->rand, seed, 0);
 	setup_grid(ctxt);
 
 	return &ctxt->til_module_context;
@@ -304,10 +307,10 @@ static void submit_prepare_frame(til_module_context_t *context, unsigned ticks,
 		setup_grid(ctxt);
 
 	for (int i = 0; i < NUM_PLAYERS; i++) {
-		int	moves = rand() % TICKS_PER_FRAME;
+		int	moves = til_rand(&ctxt->rand) % TICKS_PER_FRAME;
 
 		for (int j = 0; j < moves; j++)
-			grid_player_plan(ctxt->players[i], ctxt->seq++, rand() % GRID_SIZE, rand() % GRID_SIZE);
+			grid_player_plan(ctxt->players[i], ctxt->seq++, til_rand(&ctxt->rand) % GRID_SIZE, til_rand(&ctxt->rand) % GRID_SIZE);
 	}
 
 	for (int j = 0; j < TICKS_PER_FRAME; j++)
@@ -376,5 +379,6 @@ til_module_t	submit_module = {
 	.name = "submit",
 	.description = "Cellular automata conquest game sim (threaded (poorly))",
 	.author = "Vito Caputo <vcaputo@pengaru.com>",
+	.flags = TIL_MODULE_TILEABLE,
 	.setup = submit_setup,
 };
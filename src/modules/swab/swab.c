@@ -74,7 +74,7 @@ static til_module_context_t * swab_create_context(unsigned seed, unsigned ticks,
 	if (!ctxt)
 		return NULL;
 
-	ctxt->din = din_new(12, 12, 100);
+	ctxt->din = din_new(12, 12, 100, seed);
 	if (!ctxt->din) {
 		free(ctxt);
 		return NULL;
@@ -103,33 +103,70 @@ static void swab_prepare_frame(til_module_context_t *context, unsigned ticks, ti
 }
 
 
+/* rows are evaluated SWAB_CHUNK pixels at a time via din_batch(), a tile64 fragment's full width */
+#define SWAB_CHUNK	64
+
+/* the four noise fields composing the output, each a scale of the frame and a z coordinate */
+enum {
+	SWAB_T,
+	SWAB_R,
+	SWAB_G,
+	SWAB_B,
+	SWAB_N
+};
+
+
 static void swab_render_fragment(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment)
 {
-	swab_context_t	*ctxt = (swab_context_t *)context;
-	float		cos_r = cos(ctxt->r);
-	float		sin_r = sin(ctxt->r);
-	float		z1 = cos_r;
-	float		z2 = sin_r;
-	float		xscale = 1.f / (float)fragment->frame_width;
-	float		yscale = 1.f / (float)fragment->frame_height;
+	static const float	scales[SWAB_N] = { .5f, .7f, .93f, .81f };
+	swab_context_t		*ctxt = (swab_context_t *)context;
+	float			cos_r = cos(ctxt->r);
+	float			sin_r = sin(ctxt->r);
+	float			z1 = cos_r;
+	float			z2 = sin_r;
+	float			xscale = 1.f / (float)fragment->frame_width;
+	float			yscale = 1.f / (float)fragment->frame_height;
+	float			zs[SWAB_N][SWAB_CHUNK], ys[SWAB_N][SWAB_CHUNK];
+	float			xs[SWAB_N][SWAB_CHUNK], res[SWAB_N][SWAB_CHUNK];
+
+	for (int i = 0; i < SWAB_CHUNK; i++) {
+		zs[SWAB_T][i] = -z2;
+		zs[SWAB_R][i] = z1;
+		zs[SWAB_G][i] = -z1;
+		zs[SWAB_B][i] = z2;
+	}
 
 	for (int y = fragment->y; y < fragment->y + fragment->height; y++) {
-		float	yscaled = (float)y * yscale;
+		float		yscaled = (float)y * yscale;
+		uint32_t	*row = fragment->buf + (y - fragment->y) * fragment->pitch;
+
+		for (int n = 0; n < SWAB_N; n++) {
+			for (int i = 0; i < SWAB_CHUNK; i++)
+				ys[n][i] = yscaled * scales[n];
+		}
+
+		for (int x = fragment->x; x < fragment->x + fragment->width; x += SWAB_CHUNK) {
+			int	w = MIN(SWAB_CHUNK, fragment->x + fragment->width - x);
+
+			for (int n = 0; n < SWAB_N; n++) {
+				for (int i = 0; i < w; i++)
+					xs[n][i] = (float)(x + i) * xscale * scales[n];
+
+				din_batch(ctxt->din, xs[n], ys[n], zs[n], w, res[n]);
+			}
 
-		for (int x = fragment->x; x < fragment->x + fragment->width; x++) {
-			float		xscaled = (float)x * xscale;
-			color_t		color;
-			uint32_t	pixel;
-			float		t;
+			for (int i = 0; i < w; i++) {
+				color_t	color;
+				float	t;
 
-			t = din(ctxt->din, &(v3f_t){ .x = xscaled * .5f, .y = yscaled * .5f, .z = -z2 }) * 33.f;
+				t = res[SWAB_T][i] * 33.f;
 
-			color.r = din(ctxt->din, &(v3f_t){ .x = xscaled * .7f, .y = yscaled * .7f, .z = z1 }) * t;
-			color.g = din(ctxt->din, &(v3f_t){ .x = xscaled * .93f, .y = yscaled * .93f, .z = -z1 }) * t;
-			color.b = din(ctxt->din, &(v3f_t){ .x = xscaled * .81f, .y = yscaled * .81f, .z = z2 }) * t;
+				color.r = res[SWAB_R][i] * t;
+				color.g = res[SWAB_G][i] * t;
+				color.b = res[SWAB_B][i] * t;
 
-			pixel = color_to_uint32(color);
-			til_fb_fragment_put_pixel_unchecked(fragment, 0, x, y, pixel);
+				row[x - fragment->x + i] = color_to_uint32(color);
+			}
 		}
 	}
 }
@@ -143,4 +180,5 @@ til_module_t	swab_module = {
 	.name = "swab",
 	.description = "Colorful perlin-noise visualization (threaded)",
 	.author = "Vito Caputo <vcaputo@pengaru.com>",
+	.flags = TIL_MODULE_TILEABLE,
 };
@@ -28,6 +28,8 @@
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
+#include "til_rand.h"
+#include "til_util.h"
 
 typedef struct v3f_t {
 	float	x, y, z;
@@ -53,15 +55,27 @@ typedef struct swarm_setup_t {
 	swarm_draw_style_t	draw_style;
 } swarm_setup_t;
 
+#define SWARM_SIZE		(32 * 1024)
+#define SWARM_SLICES		64	/* the swarm is updated in this many slices of boids, threaded */
+
+/* per-slice partial sums characterizing the swarm, only written once per slice per frame */
+typedef struct swarm_sums_t {
+	v3f_t			center;
+	v3f_t			direction;
+	float			velocity;
+} swarm_sums_t;
+
 typedef struct swarm_context_t {
 	til_module_context_t	til_module_context;
 	v3f_t			color;
 	float			ztweak;
 	swarm_setup_t		setup;
+	v3f_t			avg_direction, avg_center;
+	float			wleader, wcenter, wdirection;
+	swarm_sums_t		sums[SWARM_SLICES];
 	boid_t			boids[];
 } swarm_context_t;
 
-#define SWARM_SIZE		(32 * 1024)
 #define SWARM_ZCONST		4.f
 #define SWARM_DEFAULT_STYLE	SWARM_DRAW_STYLE_LINES
 
@@ -70,17 +84,11 @@ static swarm_setup_t swarm_default_setup = {
 };
 
 
-static inline float randf(float min, float max)
-{
-	return ((float)rand() / (float)RAND_MAX) * (max - min) + min;
-}
-
-
-static inline void v3f_rand(v3f_t *v, float min, float max)
+static inline void v3f_rand(v3f_t *v, til_rand_t *rand, float min, float max)
 {
-	v->x = randf(min, max);
-	v->y = randf(min, max);
-	v->z = randf(min, max);
+	v->x = til_rand_range(rand, min, max);
+	v->y = til_rand_range(rand, min, max);
+	v->z = til_rand_range(rand, min, max);
 }
 
 
@@ -150,12 +158,12 @@ static v3f_t v3f_lerp(v3f_t a, v3f_t b, float t)
 }
 
 
-static void boid_randomize(boid_t *boid)
+static void boid_randomize(boid_t *boid, til_rand_t *rand)
 {
-	v3f_rand(&boid->position, -1.f, 1.f);
-	v3f_rand(&boid->direction, -1.f, 1.f);
+	v3f_rand(&boid->position, rand, -1.f, 1.f);
+	v3f_rand(&boid->direction, rand, -1.f, 1.f);
 	v3f_normalize(&boid->direction);
-	boid->velocity = randf(.05f, .2f);
+	boid->velocity = til_rand_range(rand, .05f, .2f);
 }
 
 
@@ -184,6 +192,7 @@ static inline uint32_t color_to_uint32(v3f_t color) {
 static til_module_context_t * swarm_create_context(unsigned seed, unsigned ticks, unsigned n_cpus, til_setup_t *setup)
 {
 	swarm_context_t	*ctxt;
+	til_rand_t	rand;
 
 	if (!setup)
 		setup = &swarm_default_setup.til_setup;
@@ -194,95 +203,146 @@ static til_module_context_t * swarm_create_context(unsigned seed, unsigned ticks
 
 	ctxt->setup = *(swarm_setup_t *)setup;
 
+	til_rand_seed(&rand, seed, 0);
 	for (unsigned i = 0; i < SWARM_SIZE; i++)
-		boid_randomize(&ctxt->boids[i]);
+		boid_randomize(&ctxt->boids[i], &rand);
 
 	return &ctxt->til_module_context;
 }
 
 
-static void swarm_update(swarm_context_t *ctxt, unsigned ticks)
+static void swarm_update_leader(swarm_context_t *ctxt, unsigned ticks)
 {
-	v3f_t	avg_direction = {};
-	float	avg_velocity = 0.f;
-	v3f_t	avg_center = {};
-	float	wleader, wcenter, wdirection;
-
-	{ /* [0] = leader */
-		float	r = M_PI * 2 * ((cosf((float)ticks * .001f) * .5f + .5f));
-		v3f_t	newpos = {
-				.x = cosf(r),
-				.y = sinf(r),
-				.z = cosf(r * 2.f),
-			};
-		boid_t	*b = &ctxt->boids[0];
-
-		if (newpos.x != b->position.x ||
-		    newpos.y != b->position.y ||
-		    newpos.z != b->position.z) {
-
-			/* XXX: this must be conditional on position changing otherwise
-			 * it could produce a zero direction vector, making normalize
-			 * spit out NaN, and things fall apart.
-			 */
+	float	r = M_PI * 2 * ((cosf((float)ticks * .001f) * .5f + .5f));
+	v3f_t	newpos = {
+			.x = cosf(r),
+			.y = sinf(r),
+			.z = cosf(r * 2.f),
+		};
+	boid_t	*b = &ctxt->boids[0];
+
+	if (newpos.x != b->position.x ||
+	    newpos.y != b->position.y ||
+	    newpos.z != b->position.z) {
+
+		/* XXX: this must be conditional on position changing otherwise
+		 * it could produce a zero direction vector, making normalize
+		 * spit out NaN, and things fall apart.
+		 */
 
-			b->direction = v3f_sub(b->position, newpos);
-			b->velocity = v3f_len(b->direction);
-			v3f_normalize(&b->direction);
-			b->position = newpos;
+		b->direction = v3f_sub(b->position, newpos);
+		b->velocity = v3f_len(b->direction);
+		v3f_normalize(&b->direction);
+		b->position = newpos;
 
-		}
+	}
 #if 0
-		printf("pos={%f,%f,%f},dir={%f,%f,%f},v=%f\n",
-			b->position.x, b->position.y, b->position.z,
-			b->direction.x, b->direction.y, b->direction.z,
-			b->velocity);
+	printf("pos={%f,%f,%f},dir={%f,%f,%f},v=%f\n",
+		b->position.x, b->position.y, b->position.z,
+		b->direction.x, b->direction.y, b->direction.z,
+		b->velocity);
 #endif
-	}
+}
 
-	/* characterize the current swarm */
-	for (unsigned i = 0; i < SWARM_SIZE; i++) {
+
+/* characterize a slice of the current swarm */
+static void swarm_sum_pass(til_module_context_t *context, unsigned ticks, unsigned cpu, unsigned slice, unsigned n_slices)
+{
+	swarm_context_t	*ctxt = (swarm_context_t *)context;
+	swarm_sums_t	*sums = &ctxt->sums[slice];
+
+	*sums = (swarm_sums_t){};
+
+	for (unsigned i = SWARM_SIZE * slice / n_slices; i < SWARM_SIZE * (slice + 1) / n_slices; i++) {
 		boid_t	*b = &ctxt->boids[i];
 
-		avg_center = v3f_add(avg_center, b->position);
-		avg_direction = v3f_add(avg_direction, b->direction);
-		avg_velocity += b->velocity;
+		sums->center = v3f_add(sums->center, b->position);
+		sums->direction = v3f_add(sums->direction, b->direction);
+		sums->velocity += b->velocity;
+	}
+}
+
+
+static void swarm_characterize(swarm_context_t *ctxt, unsigned ticks)
+{
+	v3f_t	avg_direction = {};
+	float	avg_velocity = 0.f;
+	v3f_t	avg_center = {};
+
+	for (unsigned i = 0; i < SWARM_SLICES; i++) {
+		avg_center = v3f_add(avg_center, ctxt->sums[i].center);
+		avg_direction = v3f_add(avg_direction, ctxt->sums[i].direction);
+		avg_velocity += ctxt->sums[i].velocity;
 	}
 
 	avg_velocity *= (1.f / (float)SWARM_SIZE);
-	avg_center = v3f_mult_scalar(avg_center, (1.f / (float)SWARM_SIZE));
-	avg_direction = v3f_mult_scalar(avg_direction, (1.f / (float)SWARM_SIZE));
-	v3f_normalize(&avg_direction);
+	ctxt->avg_center = v3f_mult_scalar(avg_center, (1.f / (float)SWARM_SIZE));
+	ctxt->avg_direction = v3f_mult_scalar(avg_direction, (1.f / (float)SWARM_SIZE));
+	v3f_normalize(&ctxt->avg_direction);
 
 	/* vary weights */
-	wleader = cosf((float)ticks * .001f) * .5f + .5f;
-	wcenter = cosf((float)ticks * .0005f) * .5f + .5f;
-	wdirection = sinf((float)ticks * .003f) * .5f + .5f;
+	ctxt->wleader = cosf((float)ticks * .001f) * .5f + .5f;
+	ctxt->wcenter = cosf((float)ticks * .0005f) * .5f + .5f;
+	ctxt->wdirection = sinf((float)ticks * .003f) * .5f + .5f;
+}
+
+
+/* update a slice of the followers in relation to leader and swarm itself */
+static void swarm_follow_pass(til_module_context_t *context, unsigned ticks, unsigned cpu, unsigned slice, unsigned n_slices)
+{
+	swarm_context_t	*ctxt = (swarm_context_t *)context;
 
-	/* update the followers in relation to leader and swarm itself */
-	for (unsigned i = 1; i < SWARM_SIZE; i++) {
+	for (unsigned i = MAX(SWARM_SIZE * slice / n_slices, 1); i < SWARM_SIZE * (slice + 1) / n_slices; i++) {
 		boid_t	*b = &ctxt->boids[i];
 		v3f_t	to_leader = v3f_sub(ctxt->boids[0].position, b->position);
-		v3f_t	to_center = v3f_sub(avg_center, b->position);
+		v3f_t	to_center = v3f_sub(ctxt->avg_center, b->position);
 
 		v3f_normalize(&to_leader);
-		b->direction = v3f_lerp(b->direction, to_leader, wleader * .1f);
+		b->direction = v3f_lerp(b->direction, to_leader, ctxt->wleader * .1f);
 		v3f_normalize(&b->direction);
-		b->direction = v3f_lerp(b->direction, to_center, wcenter * .1f);
+		b->direction = v3f_lerp(b->direction, to_center, ctxt->wcenter * .1f);
 		v3f_normalize(&b->direction);
-		b->direction = v3f_lerp(b->direction, avg_direction, wdirection * .05f);
+		b->direction = v3f_lerp(b->direction, ctxt->avg_direction, ctxt->wdirection * .05f);
 		v3f_normalize(&b->direction);
 
 		b->position = v3f_add(b->position, v3f_mult_scalar(b->direction, b->velocity));
 	}
+}
+
+
+/* The swarm update is split into passes over slices of the boids:
+ * 0. move the leader, then sum up the swarm's characteristics per slice
+ * 1. average the sums, then update the followers
+ * 2. derive the colors and zoom from the weights
+ */
+static int swarm_prepare_pass(til_module_context_t *context, unsigned ticks, unsigned pass, til_pass_plan_t *res_pass_plan)
+{
+	swarm_context_t	*ctxt = (swarm_context_t *)context;
+
+	switch (pass) {
+	case 0:
+		swarm_update_leader(ctxt, ticks);
+		*res_pass_plan = (til_pass_plan_t){ .func = swarm_sum_pass, .n_slices = SWARM_SLICES };
 
-	/* color the swarm according to the current weights */
-	ctxt->color.x = wleader;
-	ctxt->color.y = wcenter;
-	ctxt->color.z = wdirection;
+		return 1;
 
-	/* this zooms out a bit when the swarm loosens up, gauged by low weights */
-	ctxt->ztweak = (1.8f - v3f_len(ctxt->color)) * 4.f;
+	case 1:
+		swarm_characterize(ctxt, ticks);
+		*res_pass_plan = (til_pass_plan_t){ .func = swarm_follow_pass, .n_slices = SWARM_SLICES };
+
+		return 1;
+
+	default:
+		/* color the swarm according to the current weights */
+		ctxt->color.x = ctxt->wleader;
+		ctxt->color.y = ctxt->wcenter;
+		ctxt->color.z = ctxt->wdirection;
+
+		/* this zooms out a bit when the swarm loosens up, gauged by low weights */
+		ctxt->ztweak = (1.8f - v3f_len(ctxt->color)) * 4.f;
+
+		return 0;
+	}
 }
 
 
@@ -405,8 +465,6 @@ static void swarm_render_fragment(til_module_context_t *context, unsigned ticks,
 {
 	swarm_context_t	*ctxt = (swarm_context_t *)context;
 
-	swarm_update(ctxt, ticks);
-
 	til_fb_fragment_clear(fragment);
 
 	switch (ctxt->setup.draw_style) {
@@ -463,6 +521,7 @@ static int swarm_setup(const til_settings_t *settings, til_setting_t **res_setti
 
 til_module_t	swarm_module = {
 	.create_context = swarm_create_context,
+	.prepare_pass = swarm_prepare_pass,
 	.render_fragment = swarm_render_fragment,
 	.setup = swarm_setup,
 	.name = "swarm",
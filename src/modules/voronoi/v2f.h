@@ -55,6 +55,8 @@
 #include <math.h>
 #include <stdlib.h>
 
+#include "til_rand.h"
+
 
 typedef struct v2f_t {
 	float	x, y;
@@ -278,19 +280,19 @@ static inline v2f_t * v2f_trilerp(v2f_t *res, const v2f_t *aaa, const v2f_t *aba
 }
 
 
-static inline v2f_t _v2f_rand(const v2f_t *min, const v2f_t *max)
+static inline v2f_t _v2f_rand(til_rand_t *rand, const v2f_t *min, const v2f_t *max)
 {
 	return (v2f_t){
-		.x = min->x + (float)rand() * (1.f/RAND_MAX) * (max->x - min->x),
-		.y = min->y + (float)rand() * (1.f/RAND_MAX) * (max->y - min->y),
+		.x = til_rand_range(rand, min->x, max->x),
+		.y = til_rand_range(rand, min->y, max->y),
 	};
 }
 
 
-static inline v2f_t * v2f_rand(v2f_t *res, const v2f_t *min, const v2f_t *max)
+static inline v2f_t * v2f_rand(v2f_t *res, til_rand_t *rand, const v2f_t *min, const v2f_t *max)
 {
 	if (_v2f_allocated(&res))
-		*res = _v2f_rand(min, max);
+		*res = _v2f_rand(rand, min, max);
 
 	return res;
 }
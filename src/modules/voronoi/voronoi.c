@@ -6,6 +6,7 @@
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
+#include "til_rand.h"
 #include "til_util.h"
 
 #include "v2f.h"
@@ -42,11 +43,22 @@ typedef struct voronoi_distances_t {
 	voronoi_distance_t	*buf;
 } voronoi_distances_t;
 
+/* everything rendered is double-buffered for pipelining, see voronoi_swap_frame() */
+typedef struct voronoi_frame_t {
+	voronoi_distances_t	distances;
+	voronoi_cell_t		*cells;
+} voronoi_frame_t;
+
 typedef struct voronoi_context_t {
 	til_module_context_t	til_module_context;
-	unsigned		seed;
+	til_rand_t		rand;
 	voronoi_setup_t		setup;
-	voronoi_distances_t	distances;
+	unsigned		frame;	/* index of frames[] being rendered */
+	voronoi_frame_t		frames[2];
+	voronoi_frame_t		*calculating;	/* frame having its distances calculated by the passes, or NULL */
+	voronoi_distance_t	*scratch;	/* the jump flooding passes ping-pong between this and calculating's distances */
+	size_t			scratch_size;
+	size_t			step;		/* step of the jump flooding pass in progress */
 	voronoi_cell_t		cells[];
 } voronoi_context_t;
 
@@ -55,6 +67,8 @@ typedef struct voronoi_context_t {
 #define VORONOI_DEFAULT_DIRTY		0
 #define VORONOI_DEFAULT_RANDOMIZE	0
 
+#define VORONOI_JUMPFILL_SLICES		64
+
 
 static voronoi_setup_t voronoi_default_setup = {
 	.n_cells = VORONOI_DEFAULT_N_CELLS,
@@ -63,19 +77,13 @@ static voronoi_setup_t voronoi_default_setup = {
 };
 
 
-static void voronoi_randomize(voronoi_context_t *ctxt)
+static void voronoi_randomize(voronoi_context_t *ctxt, voronoi_cell_t *cells)
 {
-	float	inv_rand_max= 1.f / (float)RAND_MAX;
-
 	for (size_t i = 0; i < ctxt->setup.n_cells; i++) {
-		voronoi_cell_t	*p = &ctxt->cells[i];
-
-		p->origin.x = ((float)rand_r(&ctxt->seed) * inv_rand_max) * 2.f - 1.f;
-		p->origin.y = ((float)rand_r(&ctxt->seed) * inv_rand_max) * 2.f - 1.f;
+		voronoi_cell_t	*p = &cells[i];
 
-		p->color = ((uint32_t)(rand_r(&ctxt->seed) % 256)) << 16;
-		p->color |= ((uint32_t)(rand_r(&ctxt->seed) % 256)) << 8;
-		p->color |= ((uint32_t)(rand_r(&ctxt->seed) % 256));
+		v2f_rand(&p->origin, &ctxt->rand, &(v2f_t){ -1.f, -1.f }, &(v2f_t){ 1.f, 1.f });
+		p->color = til_rand(&ctxt->rand) & 0xffffff;
 	}
 }
 
@@ -87,14 +95,17 @@ static til_module_context_t * voronoi_create_context(unsigned seed, unsigned tic
 	if (!setup)
 		setup = &voronoi_default_setup.til_setup;
 
-	ctxt = til_module_context_new(sizeof(voronoi_context_t) + ((voronoi_setup_t *)setup)->n_cells * sizeof(voronoi_cell_t), seed, ticks, n_cpus);
+	ctxt = til_module_context_new(sizeof(voronoi_context_t) + ((voronoi_setup_t *)setup)->n_cells * sizeof(voronoi_cell_t) * 2, seed, ticks, n_cpus);
 	if (!ctxt)
 		return NULL;
 
 	ctxt->setup = *(voronoi_setup_t *)setup;
-	ctxt->seed = seed;
+	til_rand_seed(&ctxt->rand, seed, 0);
+	ctxt->frames[0].cells = ctxt->cells;
+	ctxt->frames[1].cells = ctxt->cells + ctxt->setup.n_cells;
 
-	voronoi_randomize(ctxt);
+	voronoi_randomize(ctxt, ctxt->frames[0].cells);
+	memcpy(ctxt->frames[1].cells, ctxt->frames[0].cells, ctxt->setup.n_cells * sizeof(voronoi_cell_t));
 
 	return &ctxt->til_module_context;
 }
@@ -104,34 +115,50 @@ static void voronoi_destroy_context(til_module_context_t *context)
 {
 	voronoi_context_t	*ctxt = (voronoi_context_t *)context;
 
-	free(ctxt->distances.buf);
+	free(ctxt->frames[0].distances.buf);
+	free(ctxt->frames[1].distances.buf);
+	free(ctxt->scratch);
 	free(ctxt);
 }
 
 
-static inline size_t voronoi_cell_origin_to_distance_idx(const voronoi_context_t *ctxt, const voronoi_cell_t *cell)
+static inline size_t voronoi_cell_origin_to_distance_idx(const voronoi_distances_t *distances, const voronoi_cell_t *cell)
 {
 	size_t	x, y;
 
-	x = (cell->origin.x * .5f + .5f) * (float)(ctxt->distances.width - 1);
-	y = (cell->origin.y * .5f + .5f) * (float)(ctxt->distances.height - 1);
+	x = (cell->origin.x * .5f + .5f) * (float)(distances->width - 1);
+	y = (cell->origin.y * .5f + .5f) * (float)(distances->height - 1);
 
-	return y * ctxt->distances.width + x;
+	return y * distances->width + x;
 }
 
 
-static void voronoi_jumpfill_pass(voronoi_context_t *ctxt, v2f_t *ds, size_t step)
+/* One jump flooding pass over a horizontal slice of the distances, reading the results of the
+ * previous pass from the frame's distances and writing to the scratch buffer.  Only reading the
+ * previous pass's results makes the rows independent of eachother, so they may run concurrently.
+ */
+static void voronoi_jumpfill_pass(til_module_context_t *context, unsigned ticks, unsigned cpu, unsigned slice, unsigned n_slices)
 {
-	voronoi_distance_t	*d = ctxt->distances.buf;
-	v2f_t			dp = {};
-
-	dp.y = -1.f;
-	for (int y = 0; y < ctxt->distances.height; y++, dp.y += ds->y) {
+	voronoi_context_t	*ctxt = (voronoi_context_t *)context;
+	voronoi_frame_t		*frame = ctxt->calculating;
+	int			row = frame->distances.height * slice / n_slices;
+	int			end = frame->distances.height * (slice + 1) / n_slices;
+	voronoi_distance_t	*s = frame->distances.buf + row * frame->distances.width;
+	voronoi_distance_t	*d = ctxt->scratch + row * frame->distances.width;
+	size_t			step = ctxt->step;
+	v2f_t			dp = {}, ds = {
+					.x = 2.f / frame->distances.width,
+					.y = 2.f / frame->distances.height,
+				};
+
+	dp.y = -1.f + ds.y * row;
+	for (int y = row; y < end; y++, dp.y += ds.y) {
 
 		dp.x = -1.f;
-		for (int x = 0; x < ctxt->distances.width; x++, dp.x += ds->x, d++) {
+		for (int x = 0; x < frame->distances.width; x++, dp.x += ds.x, d++, s++) {
 			voronoi_distance_t	*dq;
 
+			*d = *s;
 			if (d->cell && d->distance_sq == 0)
 				continue;
 
@@ -150,42 +177,42 @@ static void voronoi_jumpfill_pass(voronoi_context_t *ctxt, v2f_t *ds, size_t ste
 
 			if (x >= step) {
 				/* can sample to the left */
-				dq = d - step;
+				dq = s - step;
 
 				VORONOI_JUMPFILL;
 
 				if (y >= step) {
 					/* can sample above and to the left */
-					dq = d - step * ctxt->distances.width - step;
+					dq = s - step * frame->distances.width - step;
 
 					VORONOI_JUMPFILL;
 				}
 
-				if (ctxt->distances.height - y > step) {
+				if (frame->distances.height - y > step) {
 					/* can sample below and to the left */
-					dq = d + step * ctxt->distances.width - step;
+					dq = s + step * frame->distances.width - step;
 
 					VORONOI_JUMPFILL;
 				}
 
 			}
 
-			if (ctxt->distances.width - x > step) {
+			if (frame->distances.width - x > step) {
 				/* can sample to the right */
-				dq = d + step;
+				dq = s + step;
 
 				VORONOI_JUMPFILL;
 
 				if (y >= step) {
 					/* can sample above and to the right */
-					dq = d - step * ctxt->distances.width + step;
+					dq = s - step * frame->distances.width + step;
 
 					VORONOI_JUMPFILL;
 				}
 
-				if (ctxt->distances.height - y > step) {
+				if (frame->distances.height - y > step) {
 					/* can sample below */
-					dq = d + step * ctxt->distances.width + step;
+					dq = s + step * frame->distances.width + step;
 
 					VORONOI_JUMPFILL;
 				}
@@ -193,14 +220,14 @@ static void voronoi_jumpfill_pass(voronoi_context_t *ctxt, v2f_t *ds, size_t ste
 
 			if (y >= step) {
 				/* can sample above */
-				dq = d - step * ctxt->distances.width;
+				dq = s - step * frame->distances.width;
 
 				VORONOI_JUMPFILL;
 			}
 
-			if (ctxt->distances.height - y > step) {
+			if (frame->distances.height - y > step) {
 				/* can sample below */
-				dq = d + step * ctxt->distances.width;
+				dq = s + step * frame->distances.width;
 
 				VORONOI_JUMPFILL;
 			}
@@ -209,68 +236,40 @@ static void voronoi_jumpfill_pass(voronoi_context_t *ctxt, v2f_t *ds, size_t ste
 }
 
 
-static void voronoi_calculate_distances(voronoi_context_t *ctxt)
+/* Start calculating the distances of frame, which the passes will complete */
+static void voronoi_calculate_distances(voronoi_context_t *ctxt, voronoi_frame_t *frame)
 {
-	v2f_t	ds = (v2f_t){
-			.x = 2.f / ctxt->distances.width,
-			.y = 2.f / ctxt->distances.height,
-		};
-
-	memset(ctxt->distances.buf, 0, ctxt->distances.size * sizeof(*ctxt->distances.buf));
-
-#if 0
-	/* naive inefficient brute-force but correct algorithm */
-	for (size_t i = 0; i < ctxt->setup.n_cells; i++) {
-		voronoi_distance_t	*d = ctxt->distances.buf;
-		v2f_t			dp = {};
-
-		dp.y = -1.f;
-		for (int y = 0; y < ctxt->distances.height; y++, dp.y += ds.y) {
+	if (ctxt->scratch_size != frame->distances.size) {
+		free(ctxt->scratch);
+		ctxt->scratch_size = frame->distances.size;
+		ctxt->scratch = malloc(sizeof(voronoi_distance_t) * ctxt->scratch_size);
+	}
 
-			dp.x = -1.f;
-			for (int x = 0; x < ctxt->distances.width; x++, dp.x += ds.x, d++) {
-				float	dist_sq;
+	memset(frame->distances.buf, 0, frame->distances.size * sizeof(*frame->distances.buf));
 
-				dist_sq = v2f_distance_sq(&ctxt->cells[i].origin, &dp);
-				if (!d->cell || dist_sq < d->distance_sq) {
-					d->cell = &ctxt->cells[i];
-					d->distance_sq = dist_sq;
-				}
-			}
-		}
-	}
-#else
 	/* An attempt at implementing https://en.wikipedia.org/wiki/Jump_flooding_algorithm */
 
-	/* first assign the obvious zero-distance cell origins */
+	/* first assign the obvious zero-distance cell origins, the passes then sample neighbors */
 	for (size_t i = 0; i < ctxt->setup.n_cells; i++) {
-		voronoi_cell_t		*c = &ctxt->cells[i];
+		voronoi_cell_t		*c = &frame->cells[i];
 		size_t			idx;
 		voronoi_distance_t	*d;
 
-		idx = voronoi_cell_origin_to_distance_idx(ctxt, c);
-		d = &ctxt->distances.buf[idx];
+		idx = voronoi_cell_origin_to_distance_idx(&frame->distances, c);
+		d = &frame->distances.buf[idx];
 
 		d->cell = c;
 		d->distance_sq = 0.f;
 	}
 
-	/* now for every distance sample neighbors */
-	if (ctxt->setup.dirty) {
-		for (size_t step = 2; step <= MAX(ctxt->distances.width, ctxt->distances.height); step *= 2)
-			voronoi_jumpfill_pass(ctxt, &ds, step);
-	} else {
-		for (size_t step = MAX(ctxt->distances.width, ctxt->distances.height) / 2; step > 0; step >>= 1)
-			voronoi_jumpfill_pass(ctxt, &ds, step);
-	}
-#endif
+	ctxt->calculating = frame;
 }
 
 
-static void voronoi_sample_colors(voronoi_context_t *ctxt, til_fb_fragment_t *fragment)
+static void voronoi_sample_colors(voronoi_context_t *ctxt, voronoi_cell_t *cells, til_fb_fragment_t *fragment)
 {
 	for (size_t i = 0; i < ctxt->setup.n_cells; i++) {
-		voronoi_cell_t	*p = &ctxt->cells[i];
+		voronoi_cell_t	*p = &cells[i];
 		int		x, y;
 
 		x = (p->origin.x * .5f + .5f) * (fragment->frame_width - 1);
@@ -284,43 +283,94 @@ static void voronoi_sample_colors(voronoi_context_t *ctxt, til_fb_fragment_t *fr
 static void voronoi_prepare_frame(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment, til_frame_plan_t *res_frame_plan)
 {
 	voronoi_context_t	*ctxt = (voronoi_context_t *)context;
+	voronoi_frame_t		*back = &ctxt->frames[ctxt->frame ^ 1];
 
 	*res_frame_plan = (til_frame_plan_t){ .fragmenter = til_fragmenter_tile64 };
 
-	if (!ctxt->distances.buf ||
-	    ctxt->distances.width != fragment->frame_width ||
-	    ctxt->distances.height != fragment->frame_height) {
+	/* the previous frame may still be rendering from the front buffer, so only the back is touched */
+	if (!back->distances.buf ||
+	    back->distances.width != fragment->frame_width ||
+	    back->distances.height != fragment->frame_height) {
 
-		free(ctxt->distances.buf);
-		ctxt->distances.width = fragment->frame_width;
-		ctxt->distances.height = fragment->frame_height;
-		ctxt->distances.size = fragment->frame_width * fragment->frame_height;
-		ctxt->distances.buf = malloc(sizeof(voronoi_distance_t) * ctxt->distances.size);
+		free(back->distances.buf);
+		back->distances.width = fragment->frame_width;
+		back->distances.height = fragment->frame_height;
+		back->distances.size = fragment->frame_width * fragment->frame_height;
+		back->distances.buf = malloc(sizeof(voronoi_distance_t) * back->distances.size);
 
 		if (!ctxt->setup.randomize)
-			voronoi_calculate_distances(ctxt);
+			voronoi_calculate_distances(ctxt, back);
 	}
 
 	/* TODO: explore moving voronoi_calculate_distances() into render_fragment (threaded) */
 
 	if (ctxt->setup.randomize) {
-		voronoi_randomize(ctxt);
-		voronoi_calculate_distances(ctxt);
+		voronoi_randomize(ctxt, back->cells);
+		voronoi_calculate_distances(ctxt, back);
 	}
 
 	/* if the fragment comes in already cleared/initialized, use it for the colors, producing a mosaic */
 	if (fragment->cleared)
-		voronoi_sample_colors(ctxt, fragment);
+		voronoi_sample_colors(ctxt, back->cells, fragment);
+}
+
+
+/* Every jump flooding step is a pass, threaded in horizontal slices */
+static int voronoi_prepare_pass(til_module_context_t *context, unsigned ticks, unsigned pass, til_pass_plan_t *res_pass_plan)
+{
+	voronoi_context_t	*ctxt = (voronoi_context_t *)context;
+	voronoi_frame_t		*frame = ctxt->calculating;
+	size_t			max;
+
+	if (!frame)
+		return 0;
+
+	max = MAX(frame->distances.width, frame->distances.height);
+
+	if (!pass) {
+		ctxt->step = ctxt->setup.dirty ? 2 : max / 2;
+	} else {
+		voronoi_distance_t	*tmp = frame->distances.buf;
+
+		/* the previous pass's output is the next pass's input */
+		frame->distances.buf = ctxt->scratch;
+		ctxt->scratch = tmp;
+
+		if (ctxt->setup.dirty)
+			ctxt->step *= 2;
+		else
+			ctxt->step >>= 1;
+	}
+
+	if (!ctxt->step || ctxt->step > max) {
+		ctxt->calculating = NULL;
+
+		return 0;
+	}
+
+	*res_pass_plan = (til_pass_plan_t){ .func = voronoi_jumpfill_pass, .n_slices = VORONOI_JUMPFILL_SLICES };
+
+	return 1;
+}
+
+
+/* Make the frame prepared by voronoi_prepare_frame() the one rendered */
+static void voronoi_swap_frame(til_module_context_t *context)
+{
+	voronoi_context_t	*ctxt = (voronoi_context_t *)context;
+
+	ctxt->frame ^= 1;
 }
 
 
 static void voronoi_render_fragment(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment)
 {
 	voronoi_context_t	*ctxt = (voronoi_context_t *)context;
+	voronoi_distances_t	*distances = &ctxt->frames[ctxt->frame].distances;
 
 	for (int y = 0; y < fragment->height; y++) {
 		for (int x = 0; x < fragment->width; x++) {
-			fragment->buf[y * fragment->pitch + x] = ctxt->distances.buf[(y + fragment->y) * ctxt->distances.width + (fragment->x + x)].cell->color;
+			fragment->buf[y * fragment->pitch + x] = distances->buf[(y + fragment->y) * distances->width + (fragment->x + x)].cell->color;
 		}
 	}
 }
@@ -418,7 +468,9 @@ til_module_t	voronoi_module = {
 	.create_context = voronoi_create_context,
 	.destroy_context = voronoi_destroy_context,
 	.prepare_frame = voronoi_prepare_frame,
+	.prepare_pass = voronoi_prepare_pass,
 	.render_fragment = voronoi_render_fragment,
+	.swap_frame = voronoi_swap_frame,
 	.setup = voronoi_setup,
 	.name = "voronoi",
 	.description = "Voronoi diagram",
@@ -8,11 +8,21 @@
 #include "til_settings.h"
 
 
-/* sdl fb backend, everything sdl-specific in rototiller resides here. */
+/* sdl fb backend, everything sdl-specific in rototiller resides here.
+ *
+ * By default ("zerocopy=on") every page is its own streaming texture, which
+ * is rendered into directly while locked and unlocked when flipped, leaving
+ * SDL to upload it however the renderer does best.  Since a locked texture's
+ * memory is only valid until it's unlocked, pages get relocked via
+ * page_reclaim once they're no longer displayed.  With "zerocopy=off" pages
+ * are plain surfaces copied into a single texture with SDL_UpdateTexture()
+ * every flip instead.
+ */
 
 typedef struct sdl_fb_t {
 	unsigned	width, height;
 	Uint32		flags;
+	unsigned	zerocopy:1;
 
 	SDL_Window	*window;
 	SDL_Renderer	*renderer;
@@ -22,7 +32,11 @@ typedef struct sdl_fb_t {
 typedef struct sdl_fb_page_t sdl_fb_page_t;
 
 struct sdl_fb_page_t {
-	SDL_Surface	*surface;
+	SDL_Surface	*surface;	/* !zerocopy */
+	SDL_Texture	*texture;	/* zerocopy */
+	unsigned	locked:1;
+	void		*pixels;	/* surface or locked texture memory */
+	int		pitch;
 };
 
 
@@ -33,7 +47,12 @@ static int sdl_fb_setup(const til_settings_t *settings, til_setting_t **res_sett
 				"on",
 				NULL
 			};
-	const char	*fullscreen;
+	const char	*zerocopy_values[] = {
+				"off",
+				"on",
+				NULL
+			};
+	const char	*fullscreen, *zerocopy;
 	int		r;
 
 	r = til_settings_get_and_describe_value(settings,
@@ -70,7 +89,22 @@ static int sdl_fb_setup(const til_settings_t *settings, til_setting_t **res_sett
 			return r;
 	}
 
-	return 0;
+	r = til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "SDL render directly into locked textures",
+							.key = "zerocopy",
+							.regex = NULL,
+							.preferred = zerocopy_values[1],
+							.values = zerocopy_values,
+							.annotations = NULL
+						},
+						&zerocopy,
+						res_setting,
+						res_desc);
+	if (r)
+		return r;
+
+	return til_fb_setup_shadow(settings, res_setting, res_desc, 0);
 }
 
 static int sdl_err_to_errno(int err)
@@ -91,7 +125,7 @@ static int sdl_err_to_errno(int err)
 
 static int sdl_fb_init(const til_settings_t *settings, void **res_context)
 {
-	const char	*fullscreen;
+	const char	*fullscreen, *zerocopy;
 	const char	*size;
 	sdl_fb_t	*c;
 	int		r;
@@ -121,6 +155,10 @@ static int sdl_fb_init(const til_settings_t *settings, void **res_context)
 	if (size) /* TODO: errors */
 		sscanf(size, "%u%*[xX]%u", &c->width, &c->height);
 
+	zerocopy = til_settings_get_value(settings, "zerocopy", NULL);
+	if (!zerocopy || !strcasecmp(zerocopy, "on"))
+		c->zerocopy = 1;
+
 	SDL_SetMainReady();
 	r = SDL_Init(SDL_INIT_VIDEO);
 	if (r < 0) {
@@ -142,6 +180,22 @@ static int sdl_fb_init(const til_settings_t *settings, void **res_context)
 		c->height = mode.h;
 	}
 
+	/* the renderer is needed before acquire when the pages are textures, so it's created here */
+	c->window = SDL_CreateWindow("rototiller", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, c->width, c->height, c->flags);
+	if (!c->window) {
+		SDL_Quit();
+		free(c);
+		return -EINVAL;
+	}
+
+	c->renderer = SDL_CreateRenderer(c->window, -1, SDL_RENDERER_PRESENTVSYNC);
+	if (!c->renderer) {
+		SDL_DestroyWindow(c->window);
+		SDL_Quit();
+		free(c);
+		return -EINVAL;
+	}
+
 	*res_context = c;
 
 	return 0;
@@ -152,6 +206,8 @@ static void sdl_fb_shutdown(til_fb_t *fb, void *context)
 {
 	sdl_fb_t	*c = context;
 
+	SDL_DestroyRenderer(c->renderer);
+	SDL_DestroyWindow(c->window);
 	SDL_Quit();
 	free(c);
 }
@@ -160,15 +216,10 @@ static void sdl_fb_shutdown(til_fb_t *fb, void *context)
 static int sdl_fb_acquire(til_fb_t *fb, void *context, void *page)
 {
 	sdl_fb_t	*c = context;
-	sdl_fb_page_t	*p = page;
 
-	c->window = SDL_CreateWindow("rototiller", SDL_WINDOWPOS_UNDEFINED, SDL_WINDOWPOS_UNDEFINED, c->width, c->height, c->flags);
-	if (!c->window)
-		return -1;
-
-	c->renderer = SDL_CreateRenderer(c->window, -1, SDL_RENDERER_PRESENTVSYNC);
-	if (!c->renderer)
-		return -1;
+	/* zerocopy pages are their own textures */
+	if (c->zerocopy)
+		return 0;
 
 	c->texture = SDL_CreateTexture(c->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, c->width, c->height);
 	if (!c->texture)
@@ -182,46 +233,87 @@ static void sdl_fb_release(til_fb_t *fb, void *context)
 {
 	sdl_fb_t	*c = context;
 
-	SDL_DestroyTexture(c->texture);
-	SDL_DestroyRenderer(c->renderer);
-	SDL_DestroyWindow(c->window);
+	if (c->texture)
+		SDL_DestroyTexture(c->texture);
+
+	c->texture = NULL;
 }
 
 
-static void * sdl_fb_page_alloc(til_fb_t *fb, void *context, til_fb_page_t *res_page)
+/* describe page's pixels in res_page, locking its texture first if zerocopy */
+static int sdl_fb_page_describe(sdl_fb_t *c, sdl_fb_page_t *p, til_fb_page_t *res_page)
 {
-	sdl_fb_t	*c = context;
-	sdl_fb_page_t	*p;
-
-	p = calloc(1, sizeof(sdl_fb_page_t));
-	if (!p)
-		return NULL;
+	if (p->texture && !p->locked) {
+		if (SDL_LockTexture(p->texture, NULL, &p->pixels, &p->pitch) < 0)
+			return -EINVAL;
 
-	p->surface = SDL_CreateRGBSurface(0, c->width, c->height, 32, 0, 0, 0, 0);
+		p->locked = 1;
+	}
 
 	/* rototiller wants to assume all pixels to be 32-bit aligned, so prevent unaligning pitches */
-	assert(!(p->surface->pitch & 0x3));
+	assert(!(p->pitch & 0x3));
 
 	*res_page =	(til_fb_page_t){
-				.fragment.buf = p->surface->pixels,
+				.fragment.buf = p->pixels,
 				.fragment.width = c->width,
 				.fragment.frame_width = c->width,
 				.fragment.height = c->height,
 				.fragment.frame_height = c->height,
-				.fragment.pitch = p->surface->pitch >> 2,
-				.fragment.stride = (p->surface->pitch >> 2) - c->width,
+				.fragment.pitch = p->pitch >> 2,
+				.fragment.stride = (p->pitch >> 2) - c->width,
 			};
 
+	return 0;
+}
+
+
+static void * sdl_fb_page_alloc(til_fb_t *fb, void *context, til_fb_page_t *res_page)
+{
+	sdl_fb_t	*c = context;
+	sdl_fb_page_t	*p;
+
+	p = calloc(1, sizeof(sdl_fb_page_t));
+	if (!p)
+		return NULL;
+
+	if (c->zerocopy) {
+		p->texture = SDL_CreateTexture(c->renderer, SDL_PIXELFORMAT_ARGB8888, SDL_TEXTUREACCESS_STREAMING, c->width, c->height);
+		if (!p->texture) {
+			free(p);
+
+			return NULL;
+		}
+	} else {
+		p->surface = SDL_CreateRGBSurface(0, c->width, c->height, 32, 0, 0, 0, 0);
+		if (!p->surface) {
+			free(p);
+
+			return NULL;
+		}
+
+		p->pixels = p->surface->pixels;
+		p->pitch = p->surface->pitch;
+	}
+
+	if (sdl_fb_page_describe(c, p, res_page) < 0) {
+		SDL_DestroyTexture(p->texture);
+		free(p);
+
+		return NULL;
+	}
+
 	return p;
 }
 
 
 static int sdl_fb_page_free(til_fb_t *fb, void *context, void *page)
 {
-	sdl_fb_t	*c = context;
 	sdl_fb_page_t	*p = page;
 
-	SDL_FreeSurface(p->surface);
+	if (p->texture)
+		SDL_DestroyTexture(p->texture);
+	else
+		SDL_FreeSurface(p->surface);
 	free(p);
 
 	return 0;
@@ -254,13 +346,33 @@ static int sdl_fb_page_flip(til_fb_t *fb, void *context, void *page)
 	if (r < 0)
 		return r;
 
-	if (SDL_UpdateTexture(c->texture, NULL, p->surface->pixels, p->surface->pitch) < 0)
-		return -1;
+	if (c->zerocopy) {
+		/* unlocking is what hands the rendered pixels to SDL, there's nothing to copy */
+		SDL_UnlockTexture(p->texture);
+		p->locked = 0;
+	} else {
+		const til_fb_rect_t	*rects;
+		unsigned		n_rects;
+
+		/* only upload what changed, the texture still holds the rest from previous flips */
+		n_rects = til_fb_flip_damage(fb, &rects);
+		for (unsigned i = 0; i < n_rects; i++) {
+			SDL_Rect	rect = {
+						.x = rects[i].x,
+						.y = rects[i].y,
+						.w = rects[i].width,
+						.h = rects[i].height,
+					};
+
+			if (SDL_UpdateTexture(c->texture, &rect, (uint8_t *)p->surface->pixels + rect.y * p->surface->pitch + rect.x * 4, p->surface->pitch) < 0)
+				return -1;
+		}
+	}
 
 	if (SDL_RenderClear(c->renderer) < 0)
 		return -1;
 
-	if (SDL_RenderCopy(c->renderer, c->texture, NULL, NULL) < 0)
+	if (SDL_RenderCopy(c->renderer, c->zerocopy ? p->texture : c->texture, NULL, NULL) < 0)
 		return -1;
 
 	SDL_RenderPresent(c->renderer);
@@ -269,6 +381,13 @@ static int sdl_fb_page_flip(til_fb_t *fb, void *context, void *page)
 }
 
 
+/* zerocopy pages are unlocked while displayed, relock them for rendering into again */
+static int sdl_fb_page_reclaim(til_fb_t *fb, void *context, void *page, til_fb_page_t *res_page)
+{
+	return sdl_fb_page_describe(context, page, res_page);
+}
+
+
 til_fb_ops_t sdl_fb_ops = {
 	.setup = sdl_fb_setup,
 	.init = sdl_fb_init,
@@ -277,5 +396,6 @@ til_fb_ops_t sdl_fb_ops = {
 	.release = sdl_fb_release,
 	.page_alloc = sdl_fb_page_alloc,
 	.page_free = sdl_fb_page_free,
-	.page_flip = sdl_fb_page_flip
+	.page_flip = sdl_fb_page_flip,
+	.page_reclaim = sdl_fb_page_reclaim,
 };
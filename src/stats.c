@@ -0,0 +1,200 @@
+#include <assert.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "til.h"
+#include "til_fb.h"
+#include "til_settings.h"
+#include "til_util.h"
+
+#include "txt/txt.h"
+
+#include "stats.h"
+
+/* Per-frame rendering stats for the rototiller frontend.
+ *
+ * Enabled via --stats=[overlay=on][,csv=path], where overlay draws a
+ * per-thread breakdown of the last frame over the rendered output, and csv
+ * appends a row per frame to path ("-" for stdout).  This is intended for
+ * spotting load imbalance across the rendering threads.
+ */
+
+struct stats_t {
+	FILE			*csv;
+	unsigned		overlay:1;
+	unsigned		frame;
+	til_frame_stats_t	frame_stats;
+	til_thread_stats_t	thread_stats[];
+};
+
+
+static double stats_ms(uint64_t ns)
+{
+	return (double)ns / 1000000.0;
+}
+
+
+static void stats_csv_header(stats_t *stats)
+{
+	fprintf(stats->csv, "frame,ticks,prepare_ns,simulate_ns,render_ns,finish_ns,wait_ns");
+
+	for (unsigned i = 0; i < stats->frame_stats.n_threads; i++)
+		fprintf(stats->csv, ",cpu%u_busy_ns,cpu%u_fragments,cpu%u_max_fragment_ns,cpu%u_stolen", i, i, i, i);
+
+	fputc('\n', stats->csv);
+}
+
+
+static void stats_csv_frame(stats_t *stats)
+{
+	til_frame_stats_t	*fs = &stats->frame_stats;
+
+	fprintf(stats->csv, "%u,%u,%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64",%"PRIu64,
+		stats->frame, fs->ticks,
+		fs->prepare_ns, fs->simulate_ns, fs->render_ns, fs->finish_ns, fs->wait_ns);
+
+	for (unsigned i = 0; i < fs->n_threads; i++) {
+		til_thread_stats_t	*ts = &fs->threads[i];
+
+		fprintf(stats->csv, ",%"PRIu64",%u,%"PRIu64",%u",
+			ts->busy_ns, ts->n_fragments, ts->max_fragment_ns, ts->n_stolen);
+	}
+
+	fputc('\n', stats->csv);
+}
+
+
+static void stats_overlay_frame(stats_t *stats, til_fb_fragment_t *fragment)
+{
+	til_frame_stats_t	*fs = &stats->frame_stats;
+	char			buf[1024];
+	int			len;
+	txt_t			*txt;
+
+	len = snprintf(buf, sizeof(buf), "prepare %.2fms simulate %.2fms render %.2fms finish %.2fms wait %.2fms\n",
+			stats_ms(fs->prepare_ns), stats_ms(fs->simulate_ns), stats_ms(fs->render_ns),
+			stats_ms(fs->finish_ns), stats_ms(fs->wait_ns));
+
+	for (unsigned i = 0; i < fs->n_threads && len < sizeof(buf); i++) {
+		til_thread_stats_t	*ts = &fs->threads[i];
+
+		len += snprintf(buf + len, sizeof(buf) - len, "cpu%-2u %3u%% %4u frags %4u stolen max %.2fms\n",
+				i,
+				fs->render_ns ? (unsigned)(ts->busy_ns * 100 / fs->render_ns) : 0,
+				ts->n_fragments,
+				ts->n_stolen,
+				stats_ms(ts->max_fragment_ns));
+	}
+
+	txt = txt_new(buf);
+	if (!txt)
+		return;
+
+	txt_render_fragment(txt, fragment, 0x00000000,
+			    1, 1,
+			    (txt_align_t){
+				.horiz = TXT_HALIGN_LEFT,
+				.vert = TXT_VALIGN_TOP
+			    });
+	txt_render_fragment(txt, fragment, 0xffffffff,
+			    0, 0,
+			    (txt_align_t){
+				.horiz = TXT_HALIGN_LEFT,
+				.vert = TXT_VALIGN_TOP
+			    });
+	txt_free(txt);
+}
+
+
+/* render a frame of context into fragment, recording stats as configured.
+ * this renders pipelined, returning the completed fragment like til_module_render_pipelined().
+ */
+til_fb_fragment_t * stats_render(stats_t *stats, til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment)
+{
+	til_fb_fragment_t	*finished;
+
+	assert(stats);
+
+	finished = til_module_render_pipelined(context, ticks, fragment, &stats->frame_stats);
+	if (!finished)
+		return NULL;
+
+	if (stats->csv)
+		stats_csv_frame(stats);
+
+	if (stats->overlay)
+		stats_overlay_frame(stats, finished);
+
+	stats->frame++;
+
+	return finished;
+}
+
+
+/* create stats from settings, the number of rendering threads must not change afterwards */
+int stats_new(const char *settings_str, stats_t **res_stats)
+{
+	til_settings_t	*settings;
+	const char	*value;
+	unsigned	n_threads = til_get_n_threads();
+	stats_t		*stats;
+	int		r = 0;
+
+	assert(res_stats);
+
+	settings = til_settings_new(settings_str);
+	if (!settings)
+		return -ENOMEM;
+
+	stats = calloc(1, sizeof(stats_t) + n_threads * sizeof(til_thread_stats_t));
+	if (!stats) {
+		r = -ENOMEM;
+		goto _out;
+	}
+
+	stats->frame_stats.threads = stats->thread_stats;
+	stats->frame_stats.n_threads = n_threads;
+
+	value = til_settings_get_value(settings, "overlay", NULL);
+	if (value && !strcasecmp(value, "on"))
+		stats->overlay = 1;
+
+	value = til_settings_get_value(settings, "csv", NULL);
+	if (value) {
+		if (!strcmp(value, "-"))
+			stats->csv = stdout;
+		else
+			stats->csv = fopen(value, "w");
+
+		if (!stats->csv) {
+			r = -errno;
+			free(stats);
+			goto _out;
+		}
+
+		stats_csv_header(stats);
+	}
+
+	*res_stats = stats;
+
+_out:
+	til_settings_free(settings);
+
+	return r;
+}
+
+
+stats_t * stats_free(stats_t *stats)
+{
+	if (stats) {
+		if (stats->csv && stats->csv != stdout)
+			fclose(stats->csv);
+
+		free(stats);
+	}
+
+	return NULL;
+}
@@ -0,0 +1,13 @@
+#ifndef _STATS_H
+#define _STATS_H
+
+#include "til.h"
+#include "til_fb.h"
+
+typedef struct stats_t stats_t;
+
+int stats_new(const char *settings, stats_t **res_stats);
+stats_t * stats_free(stats_t *stats);
+til_fb_fragment_t * stats_render(stats_t *stats, til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment);
+
+#endif
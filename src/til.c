@@ -14,7 +14,9 @@
 #include "til.h"
 #include "til_fb.h"
 #include "til_module_context.h"
+#include "til_rand.h"
 #include "til_settings.h"
+#include "til_span.h"
 #include "til_threads.h"
 #include "til_util.h"
 
@@ -81,20 +83,46 @@ static const til_module_t	*modules[] = {
 int til_init(void)
 {
 	/* Various modules seed srand(), just do it here so they don't need to.
-	 * At some point in the future this might become undesirable, if reproducible
-	 * pseudo-randomized output is actually desirable.  But that should probably be
-	 * achieved using rand_r() anyways, since modules can't prevent others from playing
-	 * with srand().
+	 * Modules wanting reproducible pseudo-randomized output use til_rand seeded from
+	 * their context's seed instead, since they can't prevent others from playing with
+	 * srand().
 	 */
 	srand(time(NULL) + getpid());
 
-	if (!(til_threads = til_threads_create()))
+	til_span_init();
+
+	if (!(til_threads = til_threads_create(0)))
 		return -errno;
 
 	return 0;
 }
 
 
+/* replace the rendering threads with n_threads threads, or a thread per cpu if n_threads is 0.
+ * This must only be called while no module contexts exist, since contexts size their per-cpu
+ * state from the number of threads at creation time.
+ */
+int til_set_n_threads(unsigned n_threads)
+{
+	til_threads_t	*threads;
+
+	if (!(threads = til_threads_create(n_threads)))
+		return -errno;
+
+	til_threads_destroy(til_threads);
+	til_threads = threads;
+
+	return 0;
+}
+
+
+/* return the number of rendering threads, for sizing til_frame_stats_t.threads[] */
+unsigned til_get_n_threads(void)
+{
+	return til_threads_num_threads(til_threads);
+}
+
+
 /* wait for all threads to be idle */
 void til_quiesce(void)
 {
@@ -170,9 +198,36 @@ void til_get_modules(const til_module_t ***res_modules, size_t *res_n_modules)
 }
 
 
-static void module_render_fragment(til_module_context_t *context, til_threads_t *threads, unsigned ticks, til_fb_fragment_t *fragment)
+/* Run the module's simulation passes, if any.  Every pass's slices are spread across the threads
+ * when context is threaded, and all complete before the next pass is prepared.
+ */
+static void module_simulate(til_module_context_t *context, til_threads_t *threads, unsigned ticks)
+{
+	const til_module_t	*module = context->module;
+	til_pass_plan_t		pass_plan;
+
+	if (!module->prepare_pass)
+		return;
+
+	for (unsigned pass = 0; pass_plan = (til_pass_plan_t){}, module->prepare_pass(context, ticks, pass, &pass_plan); pass++) {
+		if (!pass_plan.n_slices)
+			continue;
+
+		if (context->n_cpus > 1 && pass_plan.n_slices > 1) {
+			til_threads_pass_run(threads, &pass_plan, context, ticks);
+		} else {
+			for (unsigned slice = 0; slice < pass_plan.n_slices; slice++)
+				pass_plan.func(context, ticks, 0, slice, pass_plan.n_slices);
+		}
+	}
+}
+
+
+static void module_render_fragment(til_module_context_t *context, til_threads_t *threads, unsigned ticks, til_fb_fragment_t *fragment, til_frame_stats_t *res_stats)
 {
 	const til_module_t	*module;
+	til_frame_plan_t	frame_plan = {};
+	uint64_t		t0 = 0, t1 = 0, t2 = 0, t3 = 0;
 
 	assert(context);
 	assert(context->module);
@@ -181,40 +236,274 @@ static void module_render_fragment(til_module_context_t *context, til_threads_t
 
 	module = context->module;
 
-	if (context->n_cpus > 1 && module->prepare_frame) {
-		til_frame_plan_t	frame_plan = {};
+	/* modules not declaring what they draw leave the page's damage unknown */
+	if (!(module->flags & TIL_MODULE_DAMAGE))
+		til_fb_fragment_damage_all(fragment);
+
+	if (res_stats) {
+		til_threads_stats_reset(threads);
+		t0 = til_get_ns();
+	}
 
+	if (module->prepare_frame)
 		module->prepare_frame(context, ticks, fragment, &frame_plan);
 
-		if (module->render_fragment) {
-			til_threads_frame_submit(threads, fragment, &frame_plan, module->render_fragment, context, ticks);
-			til_threads_wait_idle(threads);
-		}
-	} else if (module->prepare_frame) {
-		til_frame_plan_t	frame_plan = {};
-		unsigned		fragnum = 0;
-		til_fb_fragment_t	frag;
+	if (res_stats)
+		t1 = til_get_ns();
 
-		module->prepare_frame(context, ticks, fragment, &frame_plan);
+	module_simulate(context, threads, ticks);
+
+	if (module->swap_frame)
+		module->swap_frame(context);
+
+	if (res_stats)
+		t2 = til_get_ns();
+
+	if (module->render_fragment) {
+		if (!module->prepare_frame) {
+			module->render_fragment(context, ticks, 0, fragment);
+		} else if (context->n_cpus > 1) {
+			til_threads_frame_run(threads, fragment, &frame_plan, module->render_fragment, context, ticks);
+		} else {
+			unsigned		fragnum = 0;
+			til_fb_fragment_t	frag;
 
-		while (frame_plan.fragmenter(context, fragment, fragnum++, &frag))
-			module->render_fragment(context, ticks, 0, &frag);
-	} else if (module->render_fragment)
-		module->render_fragment(context, ticks, 0, fragment);
+			while (frame_plan.fragmenter(context, fragment, fragnum++, &frag))
+				module->render_fragment(context, ticks, 0, &frag);
+		}
+	}
+
+	if (res_stats)
+		t3 = til_get_ns();
 
 	if (module->finish_frame)
 		module->finish_frame(context, ticks, fragment);
 
 	fragment->cleared = 1;
+
+	if (res_stats) {
+		res_stats->ticks = ticks;
+		res_stats->prepare_ns = t1 - t0;
+		res_stats->simulate_ns = t2 - t1;
+		res_stats->render_ns = t3 - t2;
+		res_stats->finish_ns = til_get_ns() - t3;
+		res_stats->n_threads = til_threads_stats_get(threads, &res_stats->wait_ns, res_stats->threads);
+	}
 }
 
 
 /* This is a public interface to the threaded module rendering intended for use by
- * modules that wish to get the output of other modules for their own use.
+ * modules that wish to get the output of other modules for their own use.  This may
+ * be called from render_fragment(), where the rendering becomes a job nested within
+ * the current frame, see til_threads.c.
  */
 void til_module_render(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment)
 {
-	module_render_fragment(context, til_threads, ticks, fragment);
+	module_render_fragment(context, til_threads, ticks, fragment, NULL);
+}
+
+
+/* Same as til_module_render(), but also measures the time spent in the frame's phases into
+ * *res_stats.  This is intended for frontends, not for modules rendering nested modules.
+ *
+ * When res_stats->threads is non-NULL it must have room for til_get_n_threads() entries, and
+ * will be populated with the per-thread stats accumulated over the whole frame, including any
+ * nested til_module_render() calls the module made.
+ */
+void til_module_render_timed(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment, til_frame_stats_t *res_stats)
+{
+	assert(res_stats);
+
+	module_render_fragment(context, til_threads, ticks, fragment, res_stats);
+}
+
+
+/* Tiled rendering for modules flagged TIL_MODULE_TILEABLE, intended for meta-modules like compose
+ * rendering several modules into the same tiles back-to-back while the tiles are hot in the cache.
+ *
+ * til_module_render_begin() prepares and simulates context's frame for fragment without rendering
+ * any of it, the module's frame plan is ignored.  til_module_render_tile() may then be called from
+ * any rendering thread for any sub-fragments of fragment, concurrently for disjoint ones, with cpu
+ * being the calling thread's number.  Once every tile has been rendered, til_module_render_end()
+ * finishes the frame.
+ */
+void til_module_render_begin(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment)
+{
+	const til_module_t	*module;
+	til_frame_plan_t	frame_plan = {};
+
+	assert(context);
+	assert(context->module);
+	assert(context->module->flags & TIL_MODULE_TILEABLE);
+	assert(fragment);
+
+	module = context->module;
+
+	if (!(module->flags & TIL_MODULE_DAMAGE))
+		til_fb_fragment_damage_all(fragment);
+
+	if (module->prepare_frame)
+		module->prepare_frame(context, ticks, fragment, &frame_plan);
+
+	assert(!frame_plan.cpu_affinity);
+
+	module_simulate(context, til_threads, ticks);
+
+	if (module->swap_frame)
+		module->swap_frame(context);
+}
+
+
+void til_module_render_tile(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *tile)
+{
+	assert(context);
+	assert(tile);
+
+	context->module->render_fragment(context, ticks, cpu, tile);
+}
+
+
+void til_module_render_end(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment)
+{
+	const til_module_t	*module;
+
+	assert(context);
+	assert(fragment);
+
+	module = context->module;
+
+	if (module->finish_frame)
+		module->finish_frame(context, ticks, fragment);
+
+	fragment->cleared = 1;
+}
+
+
+/* wait for the pending frame's rendering to complete and finish it, returning its fragment */
+static til_fb_fragment_t * module_finish_pending(til_module_context_t *context, til_threads_t *threads, til_frame_stats_t *res_stats)
+{
+	const til_module_t	*module = context->module;
+	til_fb_fragment_t	*fragment = context->pending_fragment;
+	uint64_t		t0 = 0, t1 = 0;
+
+	if (res_stats)
+		t0 = til_get_ns();
+
+	til_threads_wait_idle(threads);
+
+	if (res_stats)
+		t1 = til_get_ns();
+
+	if (module->finish_frame)
+		module->finish_frame(context, context->pending_ticks, fragment);
+
+	fragment->cleared = 1;
+	context->pending_fragment = NULL;
+
+	if (res_stats) {
+		res_stats->ticks = context->pending_ticks;
+		res_stats->render_ns = t1 - t0;
+		res_stats->finish_ns = til_get_ns() - t1;
+		res_stats->n_threads = til_threads_stats_get(threads, &res_stats->wait_ns, res_stats->threads);
+	}
+
+	return fragment;
+}
+
+
+/* Pipelined variant of til_module_render() for frontends, where the module's prepare_frame()
+ * for fragment runs while the threads are still rendering the previous call's fragment.
+ *
+ * Returns the fragment whose frame has been completed by this call, which for pipelined modules
+ * is the fragment supplied in the previous call (NULL on the first call), and for all others is
+ * fragment itself as they're simply rendered synchronously.  A fragment must not be displayed or
+ * reused until it has been returned.  Use til_module_render_flush() to complete the frame
+ * still in flight before freeing the context or switching to til_module_render().
+ *
+ * Modules opt into pipelining by implementing swap_frame(), which promises that prepare_frame()
+ * only writes to a back buffer of the state rendered by render_fragment() and finish_frame(),
+ * and is safe to run concurrently with them.  swap_frame() is called when no rendering is in flight
+ * to make the back buffer prepared by the preceding prepare_frame() current.  It's called in the
+ * non-pipelined paths too, so modules don't have to care how they're being rendered.  Note that
+ * pipelined modules can't use til_module_render() from prepare_frame(), as the threads are busy.
+ *
+ * When res_stats is non-NULL, it's populated as in til_module_render_timed() for the completed
+ * frame, except prepare_ns and simulate_ns cover the newly prepared frame, and render_ns only the
+ * time spent waiting for the completed frame's rendering beyond what was overlapped with
+ * prepare_frame().  Simulation passes need the threads, so only prepare_frame() is overlapped.
+ */
+til_fb_fragment_t * til_module_render_pipelined(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment, til_frame_stats_t *res_stats)
+{
+	const til_module_t	*module;
+	til_frame_plan_t	frame_plan = {};
+	til_fb_fragment_t	*finished = NULL;
+	uint64_t		t0 = 0;
+
+	assert(context);
+	assert(context->module);
+	assert(fragment);
+
+	module = context->module;
+
+	if (context->n_cpus <= 1 ||
+	    !module->swap_frame ||
+	    !module->prepare_frame ||
+	    !module->render_fragment) {
+		assert(!context->pending_fragment);
+		module_render_fragment(context, til_threads, ticks, fragment, res_stats);
+
+		return fragment;
+	}
+
+	if (!(module->flags & TIL_MODULE_DAMAGE))
+		til_fb_fragment_damage_all(fragment);
+
+	if (res_stats)
+		t0 = til_get_ns();
+
+	module->prepare_frame(context, ticks, fragment, &frame_plan);
+
+	if (res_stats)
+		res_stats->prepare_ns = til_get_ns() - t0;
+
+	if (context->pending_fragment)
+		finished = module_finish_pending(context, til_threads, res_stats);
+	else if (res_stats)
+		*res_stats = (til_frame_stats_t){ .prepare_ns = res_stats->prepare_ns, .threads = res_stats->threads };
+
+	/* simulation passes need the threads, so they can't overlap the previous frame */
+	if (res_stats)
+		t0 = til_get_ns();
+
+	module_simulate(context, til_threads, ticks);
+
+	if (res_stats)
+		res_stats->simulate_ns = til_get_ns() - t0;
+
+	module->swap_frame(context);
+
+	if (res_stats)
+		til_threads_stats_reset(til_threads);
+
+	til_threads_frame_submit(til_threads, fragment, &frame_plan, module->render_fragment, context, ticks);
+	context->pending_fragment = fragment;
+	context->pending_ticks = ticks;
+
+	return finished;
+}
+
+
+/* Complete the frame left in flight by til_module_render_pipelined(), returning its fragment,
+ * or NULL if there's none.  res_stats is optional, prepare_ns is left untouched when populated.
+ */
+til_fb_fragment_t * til_module_render_flush(til_module_context_t *context, til_frame_stats_t *res_stats)
+{
+	assert(context);
+
+	if (!context->pending_fragment)
+		return NULL;
+
+	return module_finish_pending(context, til_threads, res_stats);
 }
 
 
@@ -296,13 +585,15 @@ int til_module_setup(til_settings_t *settings, til_setting_t **res_setting, cons
 
 
 /* originally taken from rtv, this randomizes a module's setup @res_setup, args @res_arg
+ * the same seed always produces the same setup.
  * returns 0 on no setup, 1 on setup successful with results stored @res_*, -errno on error.
  */
-int til_module_randomize_setup(const til_module_t *module, til_setup_t **res_setup, char **res_arg)
+int til_module_randomize_setup(const til_module_t *module, unsigned seed, til_setup_t **res_setup, char **res_arg)
 {
 	til_settings_t			*settings;
 	til_setting_t			*setting;
 	const til_setting_desc_t	*desc;
+	til_rand_t			rand;
 	int				r = 1;
 
 	assert(module);
@@ -314,11 +605,13 @@ int til_module_randomize_setup(const til_module_t *module, til_setup_t **res_set
 	if (!settings)
 		return -ENOMEM;
 
+	til_rand_seed(&rand, seed, 0);
+
 	while (module->setup(settings, &setting, &desc, res_setup) > 0) {
 		if (desc->random) {
 			char	*value;
 
-			value = desc->random();
+			value = desc->random(til_rand(&rand));
 			til_settings_add_value(settings, desc->key, value, desc);
 			free(value);
 		} else if (desc->values) {
@@ -326,7 +619,7 @@ int til_module_randomize_setup(const til_module_t *module, til_setup_t **res_set
 
 			for (n = 0; desc->values[n]; n++);
 
-			n = rand() % n;
+			n = til_rand(&rand) % n;
 
 			til_settings_add_value(settings, desc->key, desc->values[n], desc);
 		} else {
@@ -11,22 +11,55 @@ typedef int (*til_fragmenter_t)(til_module_context_t *context, const til_fb_frag
 
 /* til_frame_plan_t is what til_module_t.prepare_frame() populates to return a fragmenter and any flags/rules */
 typedef struct til_frame_plan_t {
-	unsigned		cpu_affinity:1;	/* maintain a stable fragnum:cpu/thread mapping? (slower) */
+	unsigned		cpu_affinity:1;	/* maintain a stable fragnum:cpu/thread mapping? (no load balancing) */
 	til_fragmenter_t	fragmenter;	/* fragmenter to use in rendering the frame */
 } til_frame_plan_t;
 
+/* til_pass_func_t performs slice number slice of n_slices of a simulation pass, cpu is the calling thread's number */
+typedef void (*til_pass_func_t)(til_module_context_t *context, unsigned ticks, unsigned cpu, unsigned slice, unsigned n_slices);
+
+/* til_pass_plan_t is what til_module_t.prepare_pass() populates to describe a data-parallel simulation pass */
+typedef struct til_pass_plan_t {
+	til_pass_func_t		func;		/* function to call for every slice of the pass */
+	unsigned		n_slices;	/* number of independent slices the pass is divided into, may be 0 */
+} til_pass_plan_t;
+
+/* til_thread_stats_t describes how a single rendering thread spent a frame */
+typedef struct til_thread_stats_t {
+	uint64_t		busy_ns;	/* time spent in render_fragment() */
+	uint64_t		max_fragment_ns;/* time spent rendering the slowest fragment */
+	unsigned		n_fragments;	/* number of fragments rendered */
+	unsigned		n_stolen;	/* number of fragments stolen from other threads' queues */
+} til_thread_stats_t;
+
+/* til_frame_stats_t is populated by til_module_render_timed() with where the frame's time went */
+typedef struct til_frame_stats_t {
+	unsigned		ticks;		/* ticks of the frame described */
+	uint64_t		prepare_ns;	/* time spent in module->prepare_frame() */
+	uint64_t		simulate_ns;	/* time spent running the module's simulation passes */
+	uint64_t		render_ns;	/* time spent rendering fragments, including waiting on the threads */
+	uint64_t		finish_ns;	/* time spent in module->finish_frame() */
+	uint64_t		wait_ns;	/* time spent in til_threads_wait_idle() waiting on the threads */
+	unsigned		n_threads;	/* number of rendering threads, entries populated in threads[] */
+	til_thread_stats_t	*threads;	/* optional caller-supplied array of til_get_n_threads() entries */
+} til_frame_stats_t;
+
 typedef struct til_settings_t settings;
 typedef struct til_setting_desc_t til_setting_desc_t;
 typedef struct til_knob_t til_knob_t;
 
 #define TIL_MODULE_OVERLAYABLE	1u
+#define TIL_MODULE_DAMAGE	2u	/* module declares all it draws, see til_fb_damage_t */
+#define TIL_MODULE_TILEABLE	4u	/* render_fragment() renders any sub-fragment of the prepared frame, see til_module_render_tile() */
 
 typedef struct til_module_t {
 	til_module_context_t *	(*create_context)(unsigned seed, unsigned ticks, unsigned n_cpus, til_setup_t *setup);
 	void			(*destroy_context)(til_module_context_t *context);
 	void			(*prepare_frame)(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment, til_frame_plan_t *res_frame_plan);
+	int			(*prepare_pass)(til_module_context_t *context, unsigned ticks, unsigned pass, til_pass_plan_t *res_pass_plan);
 	void			(*render_fragment)(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment);
 	void			(*finish_frame)(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment);
+	void			(*swap_frame)(til_module_context_t *context);	/* opt-in pipelining, see til_module_render_pipelined() */
 	int			(*setup)(const til_settings_t *settings, til_setting_t **res_setting, const til_setting_desc_t **res_desc, til_setup_t **res_setup);
 	size_t			(*knobs)(til_module_context_t *context, til_knob_t **res_knobs);
 	char			*name;
@@ -36,15 +69,23 @@ typedef struct til_module_t {
 } til_module_t;
 
 int til_init(void);
+int til_set_n_threads(unsigned n_threads);
+unsigned til_get_n_threads(void);
 void til_quiesce(void);
 void til_shutdown(void);
 const til_module_t * til_lookup_module(const char *name);
 void til_get_modules(const til_module_t ***res_modules, size_t *res_n_modules);
 void til_module_render(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment);
+void til_module_render_timed(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment, til_frame_stats_t *res_stats);
+void til_module_render_begin(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment);
+void til_module_render_tile(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *tile);
+void til_module_render_end(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment);
+til_fb_fragment_t * til_module_render_pipelined(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment, til_frame_stats_t *res_stats);
+til_fb_fragment_t * til_module_render_flush(til_module_context_t *context, til_frame_stats_t *res_stats);
 int til_module_create_context(const til_module_t *module, unsigned seed, unsigned ticks, unsigned n_cpus, til_setup_t *setup, til_module_context_t **res_context);
 til_module_context_t * til_module_destroy_context(til_module_context_t *context);
 int til_module_setup(til_settings_t *settings, til_setting_t **res_setting, const til_setting_desc_t **res_desc, til_setup_t **res_setup);
-int til_module_randomize_setup(const til_module_t *module, til_setup_t **res_setup, char **res_arg);
+int til_module_randomize_setup(const til_module_t *module, unsigned seed, til_setup_t **res_setup, char **res_arg);
 int til_fragmenter_slice_per_cpu(til_module_context_t *context, const til_fb_fragment_t *fragment, unsigned number, til_fb_fragment_t *res_fragment);
 int til_fragmenter_tile64(til_module_context_t *context, const til_fb_fragment_t *fragment, unsigned number, til_fb_fragment_t *res_fragment);
 
@@ -10,6 +10,9 @@
  * ./rototiller --video=sdl,size=640x480
  * ./rototiller --module=roto,foo=bar,module=settings
  * ./rototiller --defaults
+ * ./rototiller --stats=overlay=on,csv=stats.csv
+ * ./rototiller --bench=frames=100,sizes=640x480:1920x1080,threads=1:4,modules=roto:plasma
+ * ./rototiller --microbench=benches=spans,ms=500
  *
  * unrecognized arguments trigger an -EINVAL error, unless res_{argc,argv} are non-NULL
  * where a new argv will be allocated and populated with the otherwise invalid arguments
@@ -44,6 +47,16 @@ static int args_parse(int argc, const char *argv[], til_args_t *res_args, int *r
 			res_args->video = &argv[i][8];
 		} else if (!strncasecmp("--module=", argv[i], 9)) {
 			res_args->module = &argv[i][9];
+		} else if (!strncasecmp("--bench=", argv[i], 8)) {
+			res_args->bench = &argv[i][8];
+		} else if (!strcasecmp("--bench", argv[i])) {
+			res_args->bench = "";
+		} else if (!strncasecmp("--microbench=", argv[i], 13)) {
+			res_args->microbench = &argv[i][13];
+		} else if (!strcasecmp("--microbench", argv[i])) {
+			res_args->microbench = "";
+		} else if (!strncasecmp("--stats=", argv[i], 8)) {
+			res_args->stats = &argv[i][8];
 		} else if (!strcasecmp("--defaults", argv[i])) {
 			res_args->use_defaults = 1;
 		} else if (!strcasecmp("--help", argv[i])) {
@@ -80,10 +93,13 @@ int til_args_parse(int argc, const char *argv[], til_args_t *res_args)
 int til_args_help(FILE *out)
 {
 	return fprintf(out,
+		"  --bench[=]	benchmark modules headless and print CSV results\n"
 		"  --defaults	use defaults for unspecified settings\n"
 		"  --go		start rendering immediately upon fulfilling all required settings\n"
 		"  --help	this help\n"
+		"  --microbench[=]	benchmark libtil primitives and print CSV results\n"
 		"  --module=	module settings\n"
+		"  --stats=	per-frame stats: overlay=on,csv=path\n"
 		"  --video=	video settings\n"
 		);
 }
@@ -6,6 +6,9 @@
 typedef struct til_args_t {
 	const char	*module;
 	const char	*video;
+	const char	*bench;
+	const char	*microbench;
+	const char	*stats;
 
 	unsigned	use_defaults:1;
 	unsigned	help:1;
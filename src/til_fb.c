@@ -3,9 +3,17 @@
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdint.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
 
 #include "til_fb.h"
 #include "til_settings.h"
+#include "til_span.h"
 #include "til_util.h"
 
 /* Copyright (C) 2016-2017 Vito Caputo <vcaputo@pengaru.com> */
@@ -48,8 +56,48 @@
  * expected to call this repeatedly, turning it effectively into the flipper
  * thread.  This required rototiller to move what was previously the main
  * thread's duties - page rendering dispatch, to a separate thread.
+ *
+ *
+ * Backends like drm hand out pages mapped directly from the scanout buffers,
+ * which are uncached or write-combined memory.  Writing to those sequentially
+ * is fine, but modules reading back what they've drawn or drawing in any
+ * scattered fashion crawl.  With the "shadow" setting on, the pages
+ * rendered into are instead allocated from ordinary cached memory, and
+ * published to their scanout buffers by til_fb_page_put() using non-temporal
+ * stores.  The publishing is split into bands across a pool of publisher
+ * threads, and happens asynchronously, the page becoming ready for flipping
+ * once all its bands have been published.  Pages are published in the order
+ * they're put.
+ *
+ *
+ * Pages circulate between the renderer and the flipper through two bounded
+ * single-producer single-consumer rings: ready pages from til_fb_page_put() to
+ * til_fb_flip(), and inactive pages from til_fb_flip() back to
+ * til_fb_page_get().  Every page is in at most one ring at a time so they can
+ * never fill up, and the only synchronization is on the rings' head and tail
+ * indices, with consumers only sleeping on a futex when their ring is empty.
+ * This does require there be a single thread at a time putting and getting
+ * pages, and a single thread at a time flipping, which is how rototiller uses
+ * til_fb anyways.  When shadowing, the publisher finishing a page produces it
+ * on the ready ring in place of til_fb_page_put(), serialized by publish_mutex.
+ *
+ *
+ * Every page tracks its damage as described in til_fb.h.  When a page is
+ * gotten for rendering, what it had drawn into it last time becomes its stale
+ * tiles, which are all til_fb_fragment_clear() has to clear.  When it's put,
+ * any stale tiles left not entirely cleared are added to its drawn tiles, which
+ * then describe everything possibly not zero in the page.  Flipping from one
+ * page to another changes at most the union of their drawn tiles, described to
+ * backends by til_fb_flip_damage(), and publishing a shadowed page only has to
+ * stream its stale and drawn tiles.  Pages whose memory was (re)allocated or
+ * reclaimed are considered entirely drawn.
  */
 
+#define TIL_FB_SHADOW_ALIGNMENT		64	/* shadow pages and their rows are cacheline-aligned */
+#define TIL_FB_PUBLISH_BANDS_PER_THREAD	4
+#define TIL_FB_CACHELINE		64
+#define TIL_FB_FLIP_RECTS_MAX		64	/* flip damage beyond this many rects is reduced to their bounds */
+
 
 /* Most of til_fb_page_t is kept private, the public part is
  * just an til_fb_fragment_t describing the whole page.
@@ -57,32 +105,50 @@
 typedef struct _til_fb_page_t _til_fb_page_t;
 struct _til_fb_page_t {
 	void		*ops_page;
+	uint32_t	*shadow_buf;		/* cached memory rendered into when shadowing, published to scanout */
+	til_fb_fragment_t	scanout;		/* the backend's page when shadowing */
 
-	_til_fb_page_t	*next, *previous;
+	_til_fb_page_t	*next;			/* publish queue linkage */
+	til_fb_damage_t	damage;
 	til_fb_page_t	public_page;
 };
 
+typedef struct til_fb_ring_t {
+	uint32_t	head __attribute__((aligned(TIL_FB_CACHELINE)));	/* next slot to consume, only advanced by the consumer */
+	uint32_t	waiting;		/* consumer is (about to be) sleeping on tail */
+	uint32_t	tail __attribute__((aligned(TIL_FB_CACHELINE)));	/* next slot to produce, only advanced by the producer */
+	uint32_t	mask;
+	_til_fb_page_t	**pages;
+} til_fb_ring_t;
+
 typedef struct til_fb_t {
 	const til_fb_ops_t	*ops;
 	void		*ops_context;
 	int		n_pages;
 
-	pthread_mutex_t	rebuild_mutex;
-	int		rebuild_pages;		/* counter of pages needing a rebuild */
+	int		rebuild_pages;		/* atomic counter of pages needing a rebuild */
 
 	_til_fb_page_t	*active_page;		/* page currently displayed */
 
-	pthread_mutex_t	ready_mutex;
-	pthread_cond_t	ready_cond;
-	_til_fb_page_t	*ready_pages_head;	/* next pages to flip to */
-	_til_fb_page_t	*ready_pages_tail;
+	til_fb_ring_t	ready;			/* next pages to flip to */
+	til_fb_ring_t	inactive;		/* finished pages available for (re)use */
 
-	pthread_mutex_t	inactive_mutex;
-	pthread_cond_t	inactive_cond;
-	_til_fb_page_t	*inactive_pages_head;	/* finished pages available for (re)use */
-	_til_fb_page_t	*inactive_pages_tail;
+	til_fb_rect_t	flip_rects[TIL_FB_FLIP_RECTS_MAX];	/* what changed with the flip in progress */
+	unsigned	n_flip_rects;
 
 	unsigned	put_pages_count;
+
+	unsigned	shadow:1;		/* rendering into shadow pages, published to the backend's pages */
+	unsigned	publish_exit:1;
+	pthread_mutex_t	publish_mutex;
+	pthread_cond_t	publish_cond;
+	_til_fb_page_t	*publish_pages_head;	/* pages to publish, the head is being published */
+	_til_fb_page_t	*publish_pages_tail;
+	unsigned	publish_band;		/* next band of the head page to publish */
+	unsigned	publish_bands_done;	/* bands of the head page published */
+	unsigned	n_publish_bands;
+	unsigned	n_publishers;
+	pthread_t	*publishers;
 } til_fb_t;
 
 #ifndef container_of
@@ -91,64 +157,409 @@ typedef struct til_fb_t {
 #endif
 
 
+#ifdef __linux__
+static void til_fb_futex_wait(uint32_t *word, uint32_t val)
+{
+	syscall(SYS_futex, word, FUTEX_WAIT_PRIVATE, val, NULL, NULL, 0);
+}
+
+
+static void til_fb_futex_wake(uint32_t *word)
+{
+	syscall(SYS_futex, word, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+}
+#else
+/* without futexes, fall back on a condvar shared by all the rings, it's only used when one runs empty */
+static pthread_mutex_t	til_fb_futex_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t	til_fb_futex_cond = PTHREAD_COND_INITIALIZER;
+
+static void til_fb_futex_wait(uint32_t *word, uint32_t val)
+{
+	pthread_mutex_lock(&til_fb_futex_mutex);
+	if (__atomic_load_n(word, __ATOMIC_SEQ_CST) == val)
+		pthread_cond_wait(&til_fb_futex_cond, &til_fb_futex_mutex);
+	pthread_mutex_unlock(&til_fb_futex_mutex);
+}
+
+
+static void til_fb_futex_wake(uint32_t *word)
+{
+	pthread_mutex_lock(&til_fb_futex_mutex);
+	pthread_cond_broadcast(&til_fb_futex_cond);
+	pthread_mutex_unlock(&til_fb_futex_mutex);
+}
+#endif
+
+
+/* size ring for holding n_pages pages */
+static int til_fb_ring_init(til_fb_ring_t *ring, unsigned n_pages)
+{
+	unsigned	size = 1;
+
+	while (size < n_pages)
+		size <<= 1;
+
+	ring->pages = calloc(size, sizeof(*ring->pages));
+	if (!ring->pages)
+		return -ENOMEM;
+
+	ring->mask = size - 1;
+
+	return 0;
+}
+
+
+static void til_fb_ring_push(til_fb_ring_t *ring, _til_fb_page_t *page)
+{
+	uint32_t	tail = __atomic_load_n(&ring->tail, __ATOMIC_RELAXED);
+
+	assert(tail - __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) <= ring->mask);
+
+	ring->pages[tail & ring->mask] = page;
+	__atomic_store_n(&ring->tail, tail + 1, __ATOMIC_SEQ_CST);
+
+	/* pairs with the consumer setting waiting before rechecking tail, one of us sees the other */
+	if (__atomic_load_n(&ring->waiting, __ATOMIC_SEQ_CST))
+		til_fb_futex_wake(&ring->tail);
+}
+
+
+static _til_fb_page_t * til_fb_ring_pop(til_fb_ring_t *ring)
+{
+	uint32_t	head = __atomic_load_n(&ring->head, __ATOMIC_RELAXED);
+	_til_fb_page_t	*page;
+
+	while (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == head) {
+		__atomic_store_n(&ring->waiting, 1, __ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&ring->tail, __ATOMIC_SEQ_CST) == head)
+			til_fb_futex_wait(&ring->tail, head);
+		__atomic_store_n(&ring->waiting, 0, __ATOMIC_RELAXED);
+	}
+
+	page = ring->pages[head & ring->mask];
+	__atomic_store_n(&ring->head, head + 1, __ATOMIC_RELEASE);
+
+	return page;
+}
+
+
+static inline int til_fb_damage_test(const uint32_t *bitmap, unsigned tile)
+{
+	return !!(bitmap[tile >> 5] & (1u << (tile & 31)));
+}
+
+
+static inline unsigned til_fb_damage_n_words(const til_fb_damage_t *damage)
+{
+	return (damage->tiles_width * damage->tiles_height + 31) >> 5;
+}
+
+
+/* size damage for tracking a width x height page, the page is considered entirely drawn */
+static void til_fb_damage_init(til_fb_damage_t *damage, unsigned width, unsigned height)
+{
+	*damage = (til_fb_damage_t){
+			.width = width,
+			.height = height,
+			.tiles_width = (width + TIL_FB_DAMAGE_TILE_SIZE - 1) >> TIL_FB_DAMAGE_TILE_SHIFT,
+			.tiles_height = (height + TIL_FB_DAMAGE_TILE_SIZE - 1) >> TIL_FB_DAMAGE_TILE_SHIFT,
+		};
+
+	damage->drawn = calloc(til_fb_damage_n_words(damage), sizeof(uint32_t));
+	damage->stale = calloc(til_fb_damage_n_words(damage), sizeof(uint32_t));
+	damage->cleared = calloc(damage->tiles_width * damage->tiles_height, sizeof(uint16_t));
+	assert(damage->drawn && damage->stale && damage->cleared);
+
+	memset(damage->drawn, 0xff, til_fb_damage_n_words(damage) * sizeof(uint32_t));
+}
+
+
+static void til_fb_damage_fini(til_fb_damage_t *damage)
+{
+	free(damage->drawn);
+	free(damage->stale);
+	free(damage->cleared);
+}
+
+
+/* start a frame, what was drawn last time is now stale */
+static void til_fb_damage_begin(til_fb_damage_t *damage)
+{
+	uint32_t	*stale = damage->stale;
+
+	damage->stale = damage->drawn;
+	damage->drawn = stale;
+	memset(damage->drawn, 0, til_fb_damage_n_words(damage) * sizeof(uint32_t));
+	memset(damage->cleared, 0, damage->tiles_width * damage->tiles_height * sizeof(uint16_t));
+	damage->unknown = 0;
+}
+
+
+/* finish a frame, adding to drawn what's possibly been left in the page from before */
+static void til_fb_damage_end(til_fb_damage_t *damage)
+{
+	if (damage->unknown) {
+		memset(damage->drawn, 0xff, til_fb_damage_n_words(damage) * sizeof(uint32_t));
+
+		return;
+	}
+
+	for (unsigned ty = 0, tile = 0; ty < damage->tiles_height; ty++) {
+		unsigned	h = MIN(TIL_FB_DAMAGE_TILE_SIZE, damage->height - (ty << TIL_FB_DAMAGE_TILE_SHIFT));
+
+		for (unsigned tx = 0; tx < damage->tiles_width; tx++, tile++) {
+			unsigned	w = MIN(TIL_FB_DAMAGE_TILE_SIZE, damage->width - (tx << TIL_FB_DAMAGE_TILE_SHIFT));
+
+			if (til_fb_damage_test(damage->stale, tile) && damage->cleared[tile] < w * h)
+				damage->drawn[tile >> 5] |= 1u << (tile & 31);
+		}
+	}
+}
+
+
+/* add the flip damage rect, merging it with an identical rect from the previous tile row if any */
+static void til_fb_flip_damage_add(til_fb_t *fb, unsigned x, unsigned y, unsigned width, unsigned height)
+{
+	for (unsigned i = 0; i < fb->n_flip_rects; i++) {
+		til_fb_rect_t	*r = &fb->flip_rects[i];
+
+		if (r->x == x && r->width == width && r->y + r->height == y) {
+			r->height += height;
+
+			return;
+		}
+	}
+
+	if (fb->n_flip_rects < TIL_FB_FLIP_RECTS_MAX) {
+		fb->flip_rects[fb->n_flip_rects++] = (til_fb_rect_t){ .x = x, .y = y, .width = width, .height = height };
+
+		return;
+	}
+
+	/* out of rects, reduce them all and this one to their bounds */
+	for (unsigned i = 0; i < fb->n_flip_rects; i++) {
+		til_fb_rect_t	*r = &fb->flip_rects[i];
+		unsigned	x2 = MAX(x + width, r->x + r->width), y2 = MAX(y + height, r->y + r->height);
+
+		x = MIN(x, r->x);
+		y = MIN(y, r->y);
+		width = x2 - x;
+		height = y2 - y;
+	}
+
+	fb->flip_rects[0] = (til_fb_rect_t){ .x = x, .y = y, .width = width, .height = height };
+	fb->n_flip_rects = 1;
+}
+
+
+/* describe what differs between the displayed page and next as rects of their combined drawn tiles */
+static void til_fb_flip_damage_prepare(til_fb_t *fb, _til_fb_page_t *next)
+{
+	const til_fb_damage_t	*a = &fb->active_page->damage, *b = &next->damage;
+
+	fb->n_flip_rects = 0;
+
+	if (a->width != b->width || a->height != b->height) {
+		fb->flip_rects[fb->n_flip_rects++] = (til_fb_rect_t){ .width = b->width, .height = b->height };
+
+		return;
+	}
+
+	for (unsigned ty = 0; ty < b->tiles_height; ty++) {
+		unsigned	row = ty * b->tiles_width, y = ty << TIL_FB_DAMAGE_TILE_SHIFT;
+		unsigned	h = MIN(TIL_FB_DAMAGE_TILE_SIZE, b->height - y);
+
+		/* runs of changed tiles become rects, the extra iteration closes the row's last run */
+		for (unsigned tx = 0, run = 0; tx <= b->tiles_width; tx++) {
+			unsigned	x;
+
+			if (tx < b->tiles_width && (til_fb_damage_test(a->drawn, row + tx) || til_fb_damage_test(b->drawn, row + tx))) {
+				run++;
+				continue;
+			}
+
+			if (!run)
+				continue;
+
+			x = (tx - run) << TIL_FB_DAMAGE_TILE_SHIFT;
+			til_fb_flip_damage_add(fb, x, y, MIN(run << TIL_FB_DAMAGE_TILE_SHIFT, b->width - x), h);
+			run = 0;
+		}
+	}
+}
+
+
+/* allocate the backend's page for page, and its shadow when shadowing */
+static void til_fb_page_alloc_ops(til_fb_t *fb, _til_fb_page_t *page)
+{
+	til_fb_fragment_t	*fragment = &page->public_page.fragment;
+	unsigned		pitch;
+
+	page->ops_page = fb->ops->page_alloc(fb, fb->ops_context, &page->public_page);
+	til_fb_damage_init(&page->damage, fragment->width, fragment->height);
+	fragment->damage = &page->damage;
+	if (!fb->shadow)
+		return;
+
+	page->scanout = *fragment;
+
+	pitch = (fragment->width + (TIL_FB_SHADOW_ALIGNMENT / 4 - 1)) & ~(TIL_FB_SHADOW_ALIGNMENT / 4 - 1);
+	page->shadow_buf = til_aligned_alloc(TIL_FB_SHADOW_ALIGNMENT, (size_t)pitch * fragment->height * sizeof(uint32_t));
+	assert(page->shadow_buf);
+
+	fragment->buf = page->shadow_buf;
+	fragment->pitch = pitch;
+	fragment->stride = pitch - fragment->width;
+}
+
+
+static void til_fb_page_free_ops(til_fb_t *fb, _til_fb_page_t *page)
+{
+	fb->ops->page_free(fb, fb->ops_context, page->ops_page);
+	til_fb_damage_fini(&page->damage);
+
+	til_aligned_free(page->shadow_buf);
+	page->shadow_buf = NULL;
+}
+
+
+/* Backends whose pages' memory is only valid between flips, like locked textures,
+ * get to remap the page when it stops being displayed, before rendering reuses it.
+ */
+static int til_fb_page_reclaim_ops(til_fb_t *fb, _til_fb_page_t *page)
+{
+	til_fb_page_t	remapped;
+	int		r;
+
+	if (!fb->ops->page_reclaim)
+		return 0;
+
+	r = fb->ops->page_reclaim(fb, fb->ops_context, page->ops_page, &remapped);
+	if (r < 0)
+		return r;
+
+	if (fb->shadow) {
+		page->scanout = remapped.fragment;
+	} else {
+		page->public_page = remapped;
+		page->public_page.fragment.damage = &page->damage;
+	}
+
+	/* there's no telling what the remapped memory contains */
+	memset(page->damage.drawn, 0xff, til_fb_damage_n_words(&page->damage) * sizeof(uint32_t));
+
+	return 0;
+}
+
+
 /* Consumes ready pages queued via til_fb_page_put(), submits them to drm to flip
  * on vsync.  Produces inactive pages from those replaced, making them
  * available to til_fb_page_get(). */
 int til_fb_flip(til_fb_t *fb)
 {
 	_til_fb_page_t	*next_active_page;
-	int		r;
+	int		rebuild, r;
 
 	/* wait for a flip req, submit the req page for flip on vsync, wait for it to flip before making the
 	 * active page inactive/available, repeat.
 	 */
-	pthread_mutex_lock(&fb->ready_mutex);
-	while (!fb->ready_pages_head)
-		pthread_cond_wait(&fb->ready_cond, &fb->ready_mutex);
-
-	next_active_page = fb->ready_pages_head;
-	fb->ready_pages_head = next_active_page->next;
-	if (!fb->ready_pages_head)
-		fb->ready_pages_tail = NULL;
-	pthread_mutex_unlock(&fb->ready_mutex);
+	next_active_page = til_fb_ring_pop(&fb->ready);
+	til_fb_flip_damage_prepare(fb, next_active_page);
 
 	/* submit the next active page for page flip on vsync, and wait for it. */
 	r = fb->ops->page_flip(fb, fb->ops_context, next_active_page->ops_page);
 	if (r < 0)	/* TODO: vet this: what happens to this page? */
 		return r;
 
-	/* now that we're displaying a new page, make the previously active one inactive so rendering can reuse it */
-	pthread_mutex_lock(&fb->inactive_mutex);
-	fb->active_page->next = fb->inactive_pages_head;
-	fb->inactive_pages_head = fb->active_page;
-	fb->inactive_pages_head->previous = NULL;
-	if (fb->inactive_pages_head->next)
-		fb->inactive_pages_head->next->previous = fb->inactive_pages_head;
-	else
-		fb->inactive_pages_tail = fb->inactive_pages_head;
-
-	/* before setting the renderer loose, check if there's more page rebuilding needed,
-	 * and if there is do as much as possible here in the inactive set.  Note it's important
-	 * that the renderer take pages from the tail, and we always replenish inactive at the
-	 * head, as well as rebuild pages from the head.
+	/* before setting the renderer loose on the previously active page, check if it needs rebuilding.
+	 * Pages cycle through the display in order, so rebuilding the next n_pages to become inactive
+	 * rebuilds them all.  The counter is claimed before rebuilding, so a til_fb_rebuild() racing
+	 * with this one restarts the count rather than being lost.
 	 */
-	pthread_mutex_lock(&fb->rebuild_mutex);
-	for (_til_fb_page_t *p = fb->inactive_pages_head; p && fb->rebuild_pages > 0; p = p->next) {
-		fb->ops->page_free(fb, fb->ops_context, p->ops_page);
-		p->ops_page = fb->ops->page_alloc(fb, fb->ops_context, &p->public_page);
-		fb->rebuild_pages--;
+	rebuild = __atomic_load_n(&fb->rebuild_pages, __ATOMIC_RELAXED);
+	while (rebuild > 0 && !__atomic_compare_exchange_n(&fb->rebuild_pages, &rebuild, rebuild - 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED));
+
+	if (rebuild > 0) {
+		til_fb_page_free_ops(fb, fb->active_page);
+		til_fb_page_alloc_ops(fb, fb->active_page);
+	} else {
+		r = til_fb_page_reclaim_ops(fb, fb->active_page);
+		if (r < 0)
+			return r;
 	}
-	pthread_mutex_unlock(&fb->rebuild_mutex);
-
-	pthread_cond_signal(&fb->inactive_cond);
-	pthread_mutex_unlock(&fb->inactive_mutex);
 
+	/* now that we're displaying a new page, make the previously active one inactive so rendering can reuse it */
+	til_fb_ring_push(&fb->inactive, fb->active_page);
 	fb->active_page = next_active_page;
 
 	return 0;
 }
 
 
+/* For backends' page_flip(), describe what changed in the page being flipped to relative to the page
+ * being replaced, returning the number of rects stored in *res_rects.  No rects means nothing changed.
+ */
+unsigned til_fb_flip_damage(til_fb_t *fb, const til_fb_rect_t **res_rects)
+{
+	assert(fb);
+	assert(res_rects);
+
+	*res_rects = fb->flip_rects;
+
+	return fb->n_flip_rects;
+}
+
+
+/* mark the tiles overlapping the x,y,width,height rectangle as drawn, the rectangle must be within the page,
+ * use til_fb_fragment_damage() instead which takes care of that.
+ */
+void til_fb_damage_rect(til_fb_damage_t *damage, unsigned x, unsigned y, unsigned width, unsigned height)
+{
+	unsigned	tx1 = (x + width - 1) >> TIL_FB_DAMAGE_TILE_SHIFT, ty1 = (y + height - 1) >> TIL_FB_DAMAGE_TILE_SHIFT;
+
+	for (unsigned ty = y >> TIL_FB_DAMAGE_TILE_SHIFT; ty <= ty1; ty++) {
+		for (unsigned tx = x >> TIL_FB_DAMAGE_TILE_SHIFT; tx <= tx1; tx++) {
+			unsigned	tile = ty * damage->tiles_width + tx;
+			uint32_t	bit = 1u << (tile & 31);
+
+			/* tiles get declared repeatedly, avoid the atomic when it's already done */
+			if (!(__atomic_load_n(&damage->drawn[tile >> 5], __ATOMIC_RELAXED) & bit))
+				__atomic_fetch_or(&damage->drawn[tile >> 5], bit, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+
+/* clear the stale tiles within fragment, which are all that could be non-zero in its page */
+void til_fb_fragment_clear_stale(til_fb_fragment_t *fragment)
+{
+	til_fb_damage_t	*damage = fragment->damage;
+	unsigned	x1 = fragment->x + fragment->width, y1 = fragment->y + fragment->height;
+
+	assert(damage);
+
+	for (unsigned ty = fragment->y >> TIL_FB_DAMAGE_TILE_SHIFT; ty < damage->tiles_height && (ty << TIL_FB_DAMAGE_TILE_SHIFT) < y1; ty++) {
+		unsigned	Y = MAX(ty << TIL_FB_DAMAGE_TILE_SHIFT, fragment->y);
+		unsigned	H = MIN((ty + 1) << TIL_FB_DAMAGE_TILE_SHIFT, y1) - Y;
+
+		for (unsigned tx = fragment->x >> TIL_FB_DAMAGE_TILE_SHIFT; tx < damage->tiles_width && (tx << TIL_FB_DAMAGE_TILE_SHIFT) < x1; tx++) {
+			unsigned	tile = ty * damage->tiles_width + tx;
+			unsigned	X = MAX(tx << TIL_FB_DAMAGE_TILE_SHIFT, fragment->x);
+			unsigned	W = MIN((tx + 1) << TIL_FB_DAMAGE_TILE_SHIFT, x1) - X;
+
+			if (!til_fb_damage_test(damage->stale, tile))
+				continue;
+
+			for (unsigned v = 0; v < H; v++)
+				til_span_fill(til_fb_fragment_get_pixel_ptr_unchecked(fragment, X, Y + v), 0, W);
+
+			/* fragments of a frame don't overlap, so once the counts cover a tile it's all clear */
+			__atomic_fetch_add(&damage->cleared[tile], W * H, __ATOMIC_RELAXED);
+		}
+	}
+}
+
+
 /* acquire the fb, making page the visible page */
 static int til_fb_acquire(til_fb_t *fb, _til_fb_page_t *page)
 {
@@ -169,17 +580,7 @@ static void til_fb_release(til_fb_t *fb)
 {
 	fb->ops->release(fb, fb->ops_context);
 
-	/* XXX: this is getting silly, either add a doubly linked list header or
-	 * at least use some functions for this local to this file.
-	 */
-	fb->active_page->next = fb->inactive_pages_head;
-	fb->inactive_pages_head = fb->active_page;
-	fb->inactive_pages_head->previous = NULL;
-	if (fb->inactive_pages_head->next)
-		fb->inactive_pages_head->next->previous = fb->inactive_pages_head;
-	else
-		fb->inactive_pages_tail = fb->inactive_pages_head;
-
+	til_fb_ring_push(&fb->inactive, fb->active_page);
 	fb->active_page = NULL;
 }
 
@@ -192,28 +593,30 @@ static void til_fb_page_new(til_fb_t *fb)
 	page = calloc(1, sizeof(_til_fb_page_t));
 	assert(page);
 
-	page->ops_page = fb->ops->page_alloc(fb, fb->ops_context, &page->public_page);
-
-	pthread_mutex_lock(&fb->inactive_mutex);
-	page->next = fb->inactive_pages_head;
-	fb->inactive_pages_head = page;
-	if (fb->inactive_pages_head->next)
-		fb->inactive_pages_head->next->previous = fb->inactive_pages_head;
-	else
-		fb->inactive_pages_tail = fb->inactive_pages_head;
-	pthread_mutex_unlock(&fb->inactive_mutex);
-
+	til_fb_page_alloc_ops(fb, page);
+	til_fb_ring_push(&fb->inactive, page);
 }
 
 
 static void _til_fb_page_free(til_fb_t *fb, _til_fb_page_t *page)
 {
-	fb->ops->page_free(fb, fb->ops_context, page->ops_page);
+	til_fb_page_free_ops(fb, page);
 
 	free(page);
 }
 
 
+/* free all the pages on ring, which must not be in use by any other thread */
+static void til_fb_ring_free_pages(til_fb_t *fb, til_fb_ring_t *ring)
+{
+	if (!ring->pages)
+		return;
+
+	for (; ring->head != ring->tail; ring->head++)
+		_til_fb_page_free(fb, ring->pages[ring->head & ring->mask]);
+}
+
+
 /* get the next inactive page from the fb, waiting if necessary. */
 static inline _til_fb_page_t * _til_fb_page_get(til_fb_t *fb)
 {
@@ -222,18 +625,11 @@ static inline _til_fb_page_t * _til_fb_page_get(til_fb_t *fb)
 	/* As long as n_pages is >= 3 this won't block unless we're submitting
 	 * pages faster than vhz.
 	 */
-	pthread_mutex_lock(&fb->inactive_mutex);
-	while (!(page = fb->inactive_pages_tail))
-		pthread_cond_wait(&fb->inactive_cond, &fb->inactive_mutex);
-	fb->inactive_pages_tail = page->previous;
-	if (fb->inactive_pages_tail)
-		fb->inactive_pages_tail->next = NULL;
-	else
-		fb->inactive_pages_head = NULL;
-	pthread_mutex_unlock(&fb->inactive_mutex);
+	page = til_fb_ring_pop(&fb->inactive);
 
-	page->next = page->previous = NULL;
+	page->next = NULL;
 	page->public_page.fragment.cleared = 0;
+	til_fb_damage_begin(&page->damage);
 
 	return page;
 }
@@ -249,15 +645,127 @@ til_fb_page_t * til_fb_page_get(til_fb_t *fb)
 /* put a page into the fb, queueing for display */
 static inline void _til_fb_page_put(til_fb_t *fb, _til_fb_page_t *page)
 {
-	pthread_mutex_lock(&fb->ready_mutex);
-	if (fb->ready_pages_tail)
-		fb->ready_pages_tail->next = page;
-	else
-		fb->ready_pages_head = page;
+	til_fb_ring_push(&fb->ready, page);
+}
 
-	fb->ready_pages_tail = page;
-	pthread_cond_signal(&fb->ready_cond);
-	pthread_mutex_unlock(&fb->ready_mutex);
+
+/* publish band number band of the shadowed page to its scanout buffer */
+static void til_fb_page_publish_band(til_fb_t *fb, _til_fb_page_t *page, unsigned band)
+{
+	til_fb_fragment_t	*shadow = &page->public_page.fragment, *scanout = &page->scanout;
+	til_fb_damage_t		*damage = &page->damage;
+	unsigned		y0 = shadow->height * band / fb->n_publish_bands;
+	unsigned		y1 = shadow->height * (band + 1) / fb->n_publish_bands;
+
+	/* the scanout page still has what the shadow had the last time, only the stale and drawn tiles changed */
+	for (unsigned y = y0; y < y1; y++) {
+		unsigned	row = (y >> TIL_FB_DAMAGE_TILE_SHIFT) * damage->tiles_width;
+
+		for (unsigned tx = 0, run = 0; tx <= damage->tiles_width; tx++) {
+			unsigned	x;
+
+			if (tx < damage->tiles_width &&
+			    (til_fb_damage_test(damage->drawn, row + tx) || til_fb_damage_test(damage->stale, row + tx))) {
+				run++;
+				continue;
+			}
+
+			if (!run)
+				continue;
+
+			x = (tx - run) << TIL_FB_DAMAGE_TILE_SHIFT;
+			til_span_stream(&scanout->buf[y * scanout->pitch + x],
+					&shadow->buf[y * shadow->pitch + x],
+					MIN(run << TIL_FB_DAMAGE_TILE_SHIFT, shadow->width - x));
+			run = 0;
+		}
+	}
+}
+
+
+/* publisher threads take bands of the page at the head of the publish queue until it's
+ * fully published, the thread finishing the last band queues the page for flipping.
+ */
+static void * til_fb_publisher(void *arg)
+{
+	til_fb_t	*fb = arg;
+
+	pthread_mutex_lock(&fb->publish_mutex);
+	for (;;) {
+		_til_fb_page_t	*page;
+		unsigned	band;
+
+		/* pages already put get published even when exiting, so they're all back on the lists to be freed */
+		while (fb->publish_pages_head ? fb->publish_band >= fb->n_publish_bands : !fb->publish_exit)
+			pthread_cond_wait(&fb->publish_cond, &fb->publish_mutex);
+
+		if (!fb->publish_pages_head)
+			break;
+
+		page = fb->publish_pages_head;
+		band = fb->publish_band++;
+		pthread_mutex_unlock(&fb->publish_mutex);
+
+		til_fb_page_publish_band(fb, page, band);
+
+		pthread_mutex_lock(&fb->publish_mutex);
+		if (++fb->publish_bands_done < fb->n_publish_bands)
+			continue;
+
+		fb->publish_pages_head = page->next;
+		if (!fb->publish_pages_head)
+			fb->publish_pages_tail = NULL;
+
+		fb->publish_band = fb->publish_bands_done = 0;
+		pthread_cond_broadcast(&fb->publish_cond);
+
+		page->next = NULL;
+		_til_fb_page_put(fb, page);
+	}
+	pthread_mutex_unlock(&fb->publish_mutex);
+
+	return NULL;
+}
+
+
+static void til_fb_publishers_stop(til_fb_t *fb)
+{
+	pthread_mutex_lock(&fb->publish_mutex);
+	fb->publish_exit = 1;
+	pthread_cond_broadcast(&fb->publish_cond);
+	pthread_mutex_unlock(&fb->publish_mutex);
+
+	for (unsigned i = 0; i < fb->n_publishers; i++)
+		pthread_join(fb->publishers[i], NULL);
+
+	free(fb->publishers);
+	fb->publishers = NULL;
+	fb->n_publishers = 0;
+}
+
+
+static int til_fb_publishers_start(til_fb_t *fb)
+{
+	unsigned	n_publishers = til_get_ncpus();
+
+	fb->publishers = calloc(n_publishers, sizeof(pthread_t));
+	if (!fb->publishers)
+		return -ENOMEM;
+
+	fb->n_publish_bands = n_publishers * TIL_FB_PUBLISH_BANDS_PER_THREAD;
+
+	for (; fb->n_publishers < n_publishers; fb->n_publishers++) {
+		int	r;
+
+		r = pthread_create(&fb->publishers[fb->n_publishers], NULL, til_fb_publisher, fb);
+		if (r) {
+			til_fb_publishers_stop(fb);
+
+			return -r;
+		}
+	}
+
+	return 0;
 }
 
 
@@ -266,9 +774,27 @@ static inline void _til_fb_page_put(til_fb_t *fb, _til_fb_page_t *page)
 /* put a page into the fb, queueing for display */
 void til_fb_page_put(til_fb_t *fb, til_fb_page_t *page)
 {
+	_til_fb_page_t	*_page = container_of(page, _til_fb_page_t, public_page);
+
 	fb->put_pages_count++;
+	til_fb_damage_end(&_page->damage);
+
+	if (!fb->shadow) {
+		_til_fb_page_put(fb, _page);
 
-	_til_fb_page_put(fb, container_of(page, _til_fb_page_t, public_page));
+		return;
+	}
+
+	/* shadowed pages only become ready once published */
+	pthread_mutex_lock(&fb->publish_mutex);
+	if (fb->publish_pages_tail)
+		fb->publish_pages_tail->next = _page;
+	else
+		fb->publish_pages_head = _page;
+
+	fb->publish_pages_tail = _page;
+	pthread_cond_broadcast(&fb->publish_cond);
+	pthread_mutex_unlock(&fb->publish_mutex);
 }
 
 
@@ -284,18 +810,23 @@ void til_fb_get_put_pages_count(til_fb_t *fb, unsigned *count)
 til_fb_t * til_fb_free(til_fb_t *fb)
 {
 	if (fb) {
+		if (fb->publishers)
+			til_fb_publishers_stop(fb);
+
 		if (fb->active_page)
 			til_fb_release(fb);
 
-		/* TODO: free all the pages */
+		/* with the publishers stopped and the active page released, every page not held by a caller is on a ring */
+		til_fb_ring_free_pages(fb, &fb->ready);
+		til_fb_ring_free_pages(fb, &fb->inactive);
 
 		if (fb->ops->shutdown && fb->ops_context)
 			fb->ops->shutdown(fb, fb->ops_context);
 
-		pthread_mutex_destroy(&fb->ready_mutex);
-		pthread_cond_destroy(&fb->ready_cond);
-		pthread_mutex_destroy(&fb->inactive_mutex);
-		pthread_cond_destroy(&fb->inactive_cond);
+		free(fb->ready.pages);
+		free(fb->inactive.pages);
+		pthread_mutex_destroy(&fb->publish_mutex);
+		pthread_cond_destroy(&fb->publish_cond);
 
 		free(fb);
 	}
@@ -308,6 +839,7 @@ til_fb_t * til_fb_free(til_fb_t *fb)
 int til_fb_new(const til_fb_ops_t *ops, til_settings_t *settings, int n_pages, til_fb_t **res_fb)
 {
 	_til_fb_page_t	*page;
+	const char	*shadow;
 	til_fb_t		*fb;
 	int		r;
 
@@ -326,30 +858,48 @@ int til_fb_new(const til_fb_ops_t *ops, til_settings_t *settings, int n_pages, t
 	if (!fb)
 		return -ENOMEM;
 
+	pthread_mutex_init(&fb->publish_mutex, NULL);
+	pthread_cond_init(&fb->publish_cond, NULL);
+
 	fb->ops = ops;
+
+	r = til_fb_ring_init(&fb->ready, n_pages);
+	if (r < 0)
+		goto fail;
+
+	r = til_fb_ring_init(&fb->inactive, n_pages);
+	if (r < 0)
+		goto fail;
+
 	if (ops->init) {
 		r = ops->init(settings, &fb->ops_context);
 		if (r < 0)
 			goto fail;
 	}
 
+	shadow = til_settings_get_value(settings, "shadow", NULL);
+	fb->shadow = shadow ? !strcasecmp(shadow, "on") : !!ops->shadow;
+	if (fb->shadow) {
+		r = til_fb_publishers_start(fb);
+		if (r < 0)
+			goto fail;
+	}
+
 	for (int i = 0; i < n_pages; i++)
 		til_fb_page_new(fb);
 
 	fb->n_pages = n_pages;
 
-	pthread_mutex_init(&fb->ready_mutex, NULL);
-	pthread_cond_init(&fb->ready_cond, NULL);
-	pthread_mutex_init(&fb->inactive_mutex, NULL);
-	pthread_cond_init(&fb->inactive_cond, NULL);
-	pthread_mutex_init(&fb->rebuild_mutex, NULL);
-
 	page = _til_fb_page_get(fb);
 	if (!page) {
 		r = -ENOMEM;
 		goto fail;
 	}
 
+	/* the initially displayed page never gets put, but its contents are unknown all the same */
+	page->damage.unknown = 1;
+	til_fb_damage_end(&page->damage);
+
 	r = til_fb_acquire(fb, page);
 	if (r < 0)
 		goto fail;
@@ -374,10 +924,32 @@ void til_fb_rebuild(til_fb_t *fb)
 {
 	assert(fb);
 
-	/* TODO: this could easily be an atomic counter since we have no need for waiting */
-	pthread_mutex_lock(&fb->rebuild_mutex);
-	fb->rebuild_pages = fb->n_pages;
-	pthread_mutex_unlock(&fb->rebuild_mutex);
+	__atomic_store_n(&fb->rebuild_pages, fb->n_pages, __ATOMIC_RELEASE);
+}
+
+
+/* Describe the "shadow" setting for fb backends' setup functions, preferred being the backend's til_fb_ops_t.shadow */
+int til_fb_setup_shadow(const til_settings_t *settings, til_setting_t **res_setting, const til_setting_desc_t **res_desc, int preferred)
+{
+	const char	*values[] = {
+				"off",
+				"on",
+				NULL
+			};
+	const char	*shadow;
+
+	return til_settings_get_and_describe_value(settings,
+						&(til_setting_desc_t){
+							.name = "Render into cached shadow pages",
+							.key = "shadow",
+							.regex = "^(on|off)",
+							.preferred = values[!!preferred],
+							.values = values,
+							.annotations = NULL
+						},
+						&shadow,
+						res_setting,
+						res_desc);
 }
 
 
@@ -402,6 +974,7 @@ int til_fb_fragment_slice_single(const til_fb_fragment_t *fragment, unsigned n_f
 	*res_fragment = (til_fb_fragment_t){
 				.texture = fragment->texture,
 				.buf = fragment->buf + yoff * fragment->pitch,
+				.damage = fragment->damage,
 				.x = fragment->x,
 				.y = yoff,
 				.width = fragment->width,
@@ -441,6 +1014,7 @@ int til_fb_fragment_tile_single(const til_fb_fragment_t *fragment, unsigned tile
 	*res_fragment = (til_fb_fragment_t){
 				.texture = fragment->texture,
 				.buf = fragment->buf + (yoff * fragment->pitch) + (xoff),
+				.damage = fragment->damage,
 				.x = fragment->x + xoff,
 				.y = fragment->y + yoff,
 				.width = MIN(fragment->width - xoff, tile_size),
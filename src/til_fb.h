@@ -7,12 +7,37 @@
 
 #include "til_settings.h"
 #include "til_setup.h"
+#include "til_span.h"
 #include "til_util.h"
 
 typedef struct til_fb_fragment_t til_fb_fragment_t;
 
 #define TIL_FB_DRAW_FLAG_TEXTURABLE	0x1
 
+#define TIL_FB_DAMAGE_TILE_SHIFT	5	/* damage is tracked in 32x32 tiles */
+#define TIL_FB_DAMAGE_TILE_SIZE		(1u << TIL_FB_DAMAGE_TILE_SHIFT)
+
+/* Pages track which of their tiles may contain anything but zeroes, their
+ * "damage", so clearing a page only has to clear what was drawn into it the
+ * last time it was rendered, and backends only have to update what differs
+ * between the pages they flip.  Modules opt in with TIL_MODULE_DAMAGE,
+ * declaring everything they draw outside of the til_fb_fragment_*() drawing
+ * helpers with til_fb_fragment_damage().  Rendering any module lacking the flag
+ * leaves the page's damage unknown for that frame, as if it were all drawn.
+ */
+typedef struct til_fb_damage_t {
+	unsigned	width, height;		/* dimensions of the page in pixels */
+	unsigned	tiles_width, tiles_height;
+	unsigned	unknown;		/* set when something drew without declaring it */
+	uint32_t	*drawn;			/* bitmap of tiles drawn this frame, when finished also those left uncleared */
+	uint32_t	*stale;			/* bitmap of tiles possibly not zero when this frame started */
+	uint16_t	*cleared;		/* number of pixels cleared per tile this frame */
+} til_fb_damage_t;
+
+typedef struct til_fb_rect_t {
+	unsigned	x, y, width, height;
+} til_fb_rect_t;
+
 /* All renderers should target fb_fragment_t, which may or may not represent
  * a full-screen mmap.  Helpers are provided for subdividing fragments for
  * concurrent renderers.
@@ -20,6 +45,7 @@ typedef struct til_fb_fragment_t til_fb_fragment_t;
 typedef struct til_fb_fragment_t {
 	til_fb_fragment_t	*texture;	/* optional source texture when drawing to this fragment */
 	uint32_t		*buf;		/* pointer to the first pixel in the fragment */
+	til_fb_damage_t		*damage;	/* damage tracking of the page this fragment is part of, if any */
 	unsigned		x, y;		/* absolute coordinates of the upper left corner of this fragment */
 	unsigned		width, height;	/* width and height of this fragment */
 	unsigned		frame_width;	/* width of the frame this fragment is part of */
@@ -51,6 +77,8 @@ typedef struct til_fb_ops_t {
 	void *	(*page_alloc)(til_fb_t *fb, void *context, til_fb_page_t *res_page);
 	int	(*page_free)(til_fb_t *fb, void *context, void *page);
 	int	(*page_flip)(til_fb_t *fb, void *context, void *page);
+	int	(*page_reclaim)(til_fb_t *fb, void *context, void *page, til_fb_page_t *res_page);	/* optional, remap a page no longer displayed for rendering into */
+	int	shadow;		/* default for the "shadow" setting, set for backends whose pages are slow to read like scanout buffers */
 } til_fb_ops_t;
 
 til_fb_page_t * til_fb_page_get(til_fb_t *fb);
@@ -59,13 +87,45 @@ til_fb_t * til_fb_free(til_fb_t *fb);
 void til_fb_get_put_pages_count(til_fb_t *fb, unsigned *count);
 int til_fb_new(const til_fb_ops_t *ops, til_settings_t *settings, int n_pages, til_fb_t **res_fb);
 void til_fb_rebuild(til_fb_t *fb);
+int til_fb_setup_shadow(const til_settings_t *settings, til_setting_t **res_setting, const til_setting_desc_t **res_desc, int preferred);
 void * til_fb_context(til_fb_t *fb);
 int til_fb_flip(til_fb_t *fb);
+unsigned til_fb_flip_damage(til_fb_t *fb, const til_fb_rect_t **res_rects);
+void til_fb_damage_rect(til_fb_damage_t *damage, unsigned x, unsigned y, unsigned width, unsigned height);
+void til_fb_fragment_clear_stale(til_fb_fragment_t *fragment);
 void til_fb_fragment_divide(til_fb_fragment_t *fragment, unsigned n_fragments, til_fb_fragment_t fragments[]);
 int til_fb_fragment_slice_single(const til_fb_fragment_t *fragment, unsigned n_fragments, unsigned num, til_fb_fragment_t *res_fragment);
 int til_fb_fragment_tile_single(const til_fb_fragment_t *fragment, unsigned tile_size, unsigned num, til_fb_fragment_t *res_fragment);
 
 
+/* declare the rectangle x,y,width,height in absolute coordinates of fragment's frame as drawn to */
+static inline void til_fb_fragment_damage(til_fb_fragment_t *fragment, int x, int y, int width, int height)
+{
+	til_fb_damage_t	*damage = fragment->damage;
+	int		X, Y, W, H;
+
+	if (!damage || __atomic_load_n(&damage->unknown, __ATOMIC_RELAXED))
+		return;
+
+	X = MAX(x, 0);
+	Y = MAX(y, 0);
+	W = MIN(x + width, (int)damage->width) - X;
+	H = MIN(y + height, (int)damage->height) - Y;
+	if (W <= 0 || H <= 0)
+		return;
+
+	til_fb_damage_rect(damage, X, Y, W, H);
+}
+
+
+/* declare fragment's page as drawn to without saying where, everything is assumed drawn */
+static inline void til_fb_fragment_damage_all(til_fb_fragment_t *fragment)
+{
+	if (fragment->damage)
+		__atomic_store_n(&fragment->damage->unknown, 1, __ATOMIC_RELAXED);
+}
+
+
 /* checks if a coordinate is contained within a fragment */
 static inline int til_fb_fragment_contains(til_fb_fragment_t *fragment, int x, int y)
 {
@@ -106,6 +166,13 @@ static inline int til_fb_fragment_put_pixel_checked(til_fb_fragment_t *fragment,
 }
 
 
+/* get a pointer to the pixel at absolute coordinates x,y of fragment, no bounds checking is performed. */
+static inline uint32_t * til_fb_fragment_get_pixel_ptr_unchecked(til_fb_fragment_t *fragment, int x, int y)
+{
+	return &fragment->buf[(y - fragment->y) * fragment->pitch + x - fragment->x];
+}
+
+
 /* copy a fragment, x,y,width,height are absolute coordinates within the frames, and will be clipped to the overlapping fragment areas */
 static inline void til_fb_fragment_copy(til_fb_fragment_t *dest, uint32_t flags, int x, int y, int width, int height, til_fb_fragment_t *src)
 {
@@ -116,17 +183,14 @@ static inline void til_fb_fragment_copy(til_fb_fragment_t *dest, uint32_t flags,
 
 	assert(W >= 0 && H >= 0);
 
-	/* XXX FIXME TODO */
-	/* XXX FIXME TODO */
-	/* XXX FIXME TODO */
-	/* this is PoC fast and nasty code, optimize this to at least bulk copy rows of pixels */
-	/* XXX FIXME TODO */
-	/* XXX FIXME TODO */
-	/* XXX FIXME TODO */
-	for (int v = 0; v < H; v++) {
-		for (int u = 0; u < W; u++)
-			til_fb_fragment_put_pixel_unchecked(dest, flags, X + u, Y + v, til_fb_fragment_get_pixel_unchecked(src, X + u, Y + v));
-	}
+	/* like put_pixel, a texture on dest replaces the source pixels */
+	if (dest->texture && (flags & TIL_FB_DRAW_FLAG_TEXTURABLE))
+		src = dest->texture;
+
+	for (int v = 0; v < H; v++)
+		til_span_copy(til_fb_fragment_get_pixel_ptr_unchecked(dest, X, Y + v), til_fb_fragment_get_pixel_ptr_unchecked(src, X, Y + v), W);
+
+	til_fb_fragment_damage(dest, X, Y, W, H);
 }
 
 
@@ -134,33 +198,68 @@ static inline void _til_fb_fragment_fill(til_fb_fragment_t *fragment, uint32_t p
 {
 	uint32_t	*buf = fragment->buf;
 
-	/* TODO: there should be a fast-path for non-divided fragments where there's no stride to skip */
-	for (int y = 0; y < fragment->height; y++, buf += fragment->pitch) {
-		/* TODO: this should use something memset-like for perf */
-		for (int x = 0; x < fragment->width; x++)
-			buf[x] = pixel;
+	/* undivided fragments are filled as one contiguous span */
+	if (!fragment->stride) {
+		til_span_fill(buf, pixel, fragment->pitch * fragment->height);
+
+		return;
 	}
+
+	for (int y = 0; y < fragment->height; y++, buf += fragment->pitch)
+		til_span_fill(buf, pixel, fragment->width);
 }
 
 
 /* fill a fragment with an arbitrary pixel */
 static inline void til_fb_fragment_fill(til_fb_fragment_t *fragment, uint32_t flags, uint32_t pixel)
 {
-	if (!(fragment->texture && (flags & TIL_FB_DRAW_FLAG_TEXTURABLE)))
-		return _til_fb_fragment_fill(fragment, pixel);
+	if (!(fragment->texture && (flags & TIL_FB_DRAW_FLAG_TEXTURABLE))) {
+		_til_fb_fragment_fill(fragment, pixel);
+		til_fb_fragment_damage(fragment, fragment->x, fragment->y, fragment->width, fragment->height);
+
+		return;
+	}
 
 	/* when a texture is present, pixel is ignored and instead sourced from fragment->texture->buf[y*pitch+x] */
 	til_fb_fragment_copy(fragment, flags, fragment->x, fragment->y, fragment->width, fragment->height, fragment->texture);
 }
 
 
+/* fill a rectangle of fragment with pixel, x,y,width,height are absolute coordinates clipped to the fragment */
+static inline void til_fb_fragment_fill_rect(til_fb_fragment_t *fragment, uint32_t flags, int x, int y, int width, int height, uint32_t pixel)
+{
+	int	X = MAX(x, (int)fragment->x);
+	int	Y = MAX(y, (int)fragment->y);
+	int	W = MIN(x + width, (int)(fragment->x + fragment->width)) - X;
+	int	H = MIN(y + height, (int)(fragment->y + fragment->height)) - Y;
+
+	if (W <= 0 || H <= 0)
+		return;
+
+	for (int v = 0; v < H; v++) {
+		uint32_t	*dest = til_fb_fragment_get_pixel_ptr_unchecked(fragment, X, Y + v);
+
+		if (fragment->texture && (flags & TIL_FB_DRAW_FLAG_TEXTURABLE))
+			til_span_copy(dest, til_fb_fragment_get_pixel_ptr_unchecked(fragment->texture, X, Y + v), W);
+		else
+			til_span_fill(dest, pixel, W);
+	}
+
+	til_fb_fragment_damage(fragment, X, Y, W, H);
+}
+
+
 /* clear a fragment */
 static inline void til_fb_fragment_clear(til_fb_fragment_t *fragment)
 {
 	if (fragment->cleared)
 		return;
 
-	_til_fb_fragment_fill(fragment, 0);
+	/* pages tracking damage only need what's been drawn into them cleared */
+	if (fragment->damage)
+		til_fb_fragment_clear_stale(fragment);
+	else
+		_til_fb_fragment_fill(fragment, 0);
 
 	fragment->cleared = 1;
 }
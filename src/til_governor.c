@@ -0,0 +1,403 @@
+#include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "til.h"
+#include "til_fb.h"
+#include "til_governor.h"
+#include "til_module_context.h"
+#include "til_span.h"
+#include "til_util.h"
+
+/* Dynamic resolution scaling.
+ *
+ * The governor wraps a module's context in one of its own, which renders the
+ * governed module into a reduced-size fragment and upscales that into the page
+ * on the rendering threads.  The scale is chosen by a feedback controller on
+ * the measured frame times, aiming to render frames within 1 / target_fps.
+ *
+ * Rendering costs are assumed to be roughly proportional to the number of
+ * pixels, so the controller shrinks the scale by the square root of how far
+ * over budget the smoothed frame time is.  Growing is done a step at a time,
+ * and only when the frame time predicted for the next step leaves some headroom,
+ * which keeps it from oscillating between two scales.  Scales are quantized to
+ * steps, since many modules reallocate their state whenever the frame's
+ * dimensions change, and the frame times of a new scale are only measured once
+ * that's settled.
+ *
+ * At the full scale the governed module simply renders into the page.
+ */
+
+#define TIL_GOVERNOR_SCALE_STEPS	20	/* scales are quantized to multiples of 1 / TIL_GOVERNOR_SCALE_STEPS */
+#define TIL_GOVERNOR_SETTLE_FRAMES	2	/* frames ignored after changing scales */
+#define TIL_GOVERNOR_HEADROOM		.9	/* fraction of the target the next step up must be predicted to fit in */
+
+typedef struct til_governor_context_t {
+	til_module_context_t	til_module_context;
+	til_module_context_t	*module_context;	/* the governed module's context, owned by the governor */
+	til_governor_filter_t	filter;
+	double			target_ns;
+	unsigned		min_step, max_step;
+	unsigned		step;			/* current scale in TIL_GOVERNOR_SCALE_STEPS */
+
+	uint64_t		frame_start_ns;
+	double			frame_ns;		/* smoothed frame time at the current scale, 0 when not yet measured */
+	unsigned		n_frames;		/* frames rendered at the current scale */
+
+	til_fb_fragment_t	reduced;		/* what the governed module renders into when scaled down */
+	size_t			reduced_size;		/* pixels allocated @ reduced.buf */
+	unsigned		direct:1;		/* the current frame was rendered directly into the page */
+
+	/* the source row/column and the weight of the next one for every destination row/column,
+	 * packed as (source << 8 | weight), valid for the dimensions they were computed for.
+	 */
+	uint32_t		*xmap, *ymap;
+	unsigned		map_width, map_height;
+	unsigned		map_src_width, map_src_height;
+
+	/* pairs of horizontally scaled source rows per thread, for bilinear filtering */
+	uint32_t		*scratch;
+	int			*scratch_ys;		/* source row held in every scratch row, -1 for none */
+	unsigned		scratch_width;
+	unsigned		n_scratch;
+} til_governor_context_t;
+
+static til_module_t	til_governor_module;
+
+
+static void governor_destroy_context(til_module_context_t *context)
+{
+	til_governor_context_t	*ctxt = (til_governor_context_t *)context;
+
+	til_module_context_free(ctxt->module_context);
+	free(ctxt->reduced.buf);
+	free(ctxt->xmap);
+	free(ctxt->scratch);
+	free(ctxt->scratch_ys);
+	free(ctxt);
+}
+
+
+/* map n destination rows/columns onto src_n source ones, with pixel centers aligned */
+static void governor_map(uint32_t *map, unsigned n, unsigned src_n, til_governor_filter_t filter)
+{
+	uint32_t	step = ((uint64_t)src_n << 16) / n;
+
+	for (unsigned i = 0; i < n; i++) {
+		int64_t		s;
+		unsigned	is, fs = 0;
+
+		if (filter == TIL_GOVERNOR_FILTER_BILINEAR) {
+			s = (int64_t)i * step + step / 2 - 0x8000;
+			if (s < 0)
+				s = 0;
+
+			is = s >> 16;
+			fs = (s >> 8) & 0xff;
+		} else {
+			is = ((uint64_t)(i * 2 + 1) * step) >> 17;
+		}
+
+		if (is >= src_n - 1) {
+			is = src_n - 1;
+			fs = 0;
+		}
+
+		map[i] = is << 8 | fs;
+	}
+}
+
+
+/* size everything for upscaling the reduced fragment into a width x height frame, returns -errno on failure */
+static int governor_prepare_upscale(til_governor_context_t *ctxt, unsigned width, unsigned height)
+{
+	unsigned	src_width = ctxt->reduced.frame_width, src_height = ctxt->reduced.frame_height;
+
+	if (width != ctxt->map_width || height != ctxt->map_height) {
+		uint32_t	*map;
+
+		map = realloc(ctxt->xmap, (width + height) * sizeof(uint32_t));
+		if (!map)
+			return -ENOMEM;
+
+		ctxt->xmap = map;
+		ctxt->ymap = &map[width];
+		ctxt->map_width = width;
+		ctxt->map_height = height;
+		ctxt->map_src_width = ctxt->map_src_height = 0;
+	}
+
+	if (src_width != ctxt->map_src_width) {
+		governor_map(ctxt->xmap, width, src_width, ctxt->filter);
+		ctxt->map_src_width = src_width;
+	}
+
+	if (src_height != ctxt->map_src_height) {
+		governor_map(ctxt->ymap, height, src_height, ctxt->filter);
+		ctxt->map_src_height = src_height;
+	}
+
+	if (ctxt->filter != TIL_GOVERNOR_FILTER_BILINEAR)
+		return 0;
+
+	if (width != ctxt->scratch_width) {
+		uint32_t	*scratch;
+
+		scratch = realloc(ctxt->scratch, ctxt->n_scratch * width * sizeof(uint32_t));
+		if (!scratch)
+			return -ENOMEM;
+
+		ctxt->scratch = scratch;
+		ctxt->scratch_width = width;
+	}
+
+	/* the reduced fragment has been rerendered, nothing held in scratch is current */
+	for (unsigned i = 0; i < ctxt->n_scratch; i++)
+		ctxt->scratch_ys[i] = -1;
+
+	return 0;
+}
+
+
+/* size the reduced fragment for width x height, returns -errno on failure */
+static int governor_prepare_reduced(til_governor_context_t *ctxt, unsigned width, unsigned height)
+{
+	if ((size_t)width * height > ctxt->reduced_size) {
+		uint32_t	*buf;
+
+		buf = realloc(ctxt->reduced.buf, (size_t)width * height * sizeof(uint32_t));
+		if (!buf)
+			return -ENOMEM;
+
+		ctxt->reduced.buf = buf;
+		ctxt->reduced_size = (size_t)width * height;
+	}
+
+	ctxt->reduced.frame_width = ctxt->reduced.width = ctxt->reduced.pitch = width;
+	ctxt->reduced.frame_height = ctxt->reduced.height = height;
+	ctxt->reduced.cleared = 0;
+
+	return 0;
+}
+
+
+static unsigned governor_scale(unsigned n, unsigned step)
+{
+	return MAX(1, (n * step + TIL_GOVERNOR_SCALE_STEPS / 2) / TIL_GOVERNOR_SCALE_STEPS);
+}
+
+
+/* nothing is left to upscale after frames rendered directly into the page */
+static int governor_fragmenter(til_module_context_t *context, const til_fb_fragment_t *fragment, unsigned number, til_fb_fragment_t *res_fragment)
+{
+	til_governor_context_t	*ctxt = (til_governor_context_t *)context;
+
+	if (ctxt->direct)
+		return 0;
+
+	return til_fragmenter_slice_per_cpu(context, fragment, number, res_fragment);
+}
+
+
+static void governor_prepare_frame(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment, til_frame_plan_t *res_frame_plan)
+{
+	til_governor_context_t	*ctxt = (til_governor_context_t *)context;
+
+	*res_frame_plan = (til_frame_plan_t){ .fragmenter = governor_fragmenter };
+
+	ctxt->frame_start_ns = til_get_ns();
+	ctxt->direct = 1;
+
+	if (ctxt->step < TIL_GOVERNOR_SCALE_STEPS &&
+	    governor_prepare_reduced(ctxt, governor_scale(fragment->frame_width, ctxt->step), governor_scale(fragment->frame_height, ctxt->step)) == 0 &&
+	    governor_prepare_upscale(ctxt, fragment->frame_width, fragment->frame_height) == 0)
+		ctxt->direct = 0;
+
+	til_module_render(ctxt->module_context, ticks, ctxt->direct ? fragment : &ctxt->reduced);
+}
+
+
+/* scale n pixels of a source row horizontally into dest according to xmap */
+static void governor_scale_row(uint32_t *dest, const uint32_t *src, const uint32_t *xmap, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++) {
+		const uint32_t	*s = &src[xmap[i] >> 8];
+		uint32_t	a = xmap[i] & 0xff, ia = 256 - a;
+		uint32_t	rb, ag;
+
+		if (!a) {
+			dest[i] = s[0];
+			continue;
+		}
+
+		/* two channels at a time like til_span_blend(), the weights sum to 256 so they can't carry */
+		rb = (((s[1] & 0x00ff00ff) * a + (s[0] & 0x00ff00ff) * ia) >> 8) & 0x00ff00ff;
+		ag = (((s[1] >> 8) & 0x00ff00ff) * a + ((s[0] >> 8) & 0x00ff00ff) * ia) & 0xff00ff00;
+
+		dest[i] = rb | ag;
+	}
+}
+
+
+/* return source row y of the reduced fragment horizontally scaled for fragment, from cpu's scratch rows */
+static const uint32_t * governor_scratch_row(til_governor_context_t *ctxt, unsigned cpu, const til_fb_fragment_t *fragment, int y)
+{
+	int		*ys = &ctxt->scratch_ys[cpu * 2];
+	uint32_t	*rows = &ctxt->scratch[cpu * 2 * ctxt->scratch_width];
+	unsigned	i;
+
+	if (ys[0] == y)
+		return rows;
+
+	if (ys[1] == y)
+		return &rows[ctxt->scratch_width];
+
+	/* rows are visited top to bottom, so the lower row of the pair is the one to replace */
+	i = ys[0] <= ys[1] ? 0 : 1;
+	rows = &rows[i * ctxt->scratch_width];
+	ys[i] = y;
+
+	governor_scale_row(rows, ctxt->reduced.buf + y * ctxt->reduced.pitch, &ctxt->xmap[fragment->x], fragment->width);
+
+	return rows;
+}
+
+
+/* upscale the reduced fragment into fragment */
+static void governor_render_fragment(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment)
+{
+	til_governor_context_t	*ctxt = (til_governor_context_t *)context;
+	const uint32_t		*xmap = &ctxt->xmap[fragment->x];
+	unsigned		prev_y = ~0U;
+
+	for (unsigned y = 0; y < fragment->height; y++) {
+		uint32_t	*dest = fragment->buf + y * fragment->pitch;
+		unsigned	sy = ctxt->ymap[fragment->y + y] >> 8, a = ctxt->ymap[fragment->y + y] & 0xff;
+
+		if (ctxt->filter != TIL_GOVERNOR_FILTER_BILINEAR) {
+			/* repeated rows are just copies of the previous one */
+			if (sy == prev_y)
+				til_span_copy(dest, dest - fragment->pitch, fragment->width);
+			else
+				governor_scale_row(dest, ctxt->reduced.buf + sy * ctxt->reduced.pitch, xmap, fragment->width);
+
+			prev_y = sy;
+			continue;
+		}
+
+		til_span_copy(dest, governor_scratch_row(ctxt, cpu, fragment, sy), fragment->width);
+		if (a)
+			til_span_blend(dest, governor_scratch_row(ctxt, cpu, fragment, sy + 1), fragment->width, a);
+	}
+}
+
+
+static void governor_finish_frame(til_module_context_t *context, unsigned ticks, til_fb_fragment_t *fragment)
+{
+	til_governor_context_t	*ctxt = (til_governor_context_t *)context;
+	double			ns = til_get_ns() - ctxt->frame_start_ns;
+	unsigned		step = ctxt->step;
+
+	/* the first frames of a new scale tend to include reallocations by the governed module */
+	if (ctxt->n_frames++ < TIL_GOVERNOR_SETTLE_FRAMES)
+		return;
+
+	if (!ctxt->frame_ns)
+		ctxt->frame_ns = ns;
+	else
+		ctxt->frame_ns += (ns - ctxt->frame_ns) * .25;
+
+	if (ctxt->frame_ns > ctxt->target_ns) {
+		step = MIN(step - 1, (unsigned)(step * sqrt(ctxt->target_ns / ctxt->frame_ns)));
+		step = MAX(step, ctxt->min_step);
+	} else if (step < ctxt->max_step) {
+		double	next = (double)(step + 1) / step;
+
+		if (ctxt->frame_ns * next * next < ctxt->target_ns * TIL_GOVERNOR_HEADROOM)
+			step++;
+	}
+
+	if (step != ctxt->step) {
+		ctxt->step = step;
+		ctxt->frame_ns = 0;
+		ctxt->n_frames = 0;
+	}
+}
+
+
+static til_module_t	til_governor_module = {
+	.destroy_context = governor_destroy_context,
+	.prepare_frame = governor_prepare_frame,
+	.render_fragment = governor_render_fragment,
+	.finish_frame = governor_finish_frame,
+	.name = "governor",
+	.description = "Dynamic resolution scaling",
+};
+
+
+static unsigned governor_step(float scale)
+{
+	return MIN(TIL_GOVERNOR_SCALE_STEPS, MAX(1, (unsigned)(scale * TIL_GOVERNOR_SCALE_STEPS + .5f)));
+}
+
+
+/* Wrap module_context in a governor scaling its rendering to hold target_fps, within min_scale
+ * to max_scale of the page's dimensions.  The governor takes ownership of module_context, which
+ * is freed along with the governor's context on success.  Rendering starts at max_scale.
+ */
+int til_governor_create_context(til_module_context_t *module_context, unsigned target_fps, float min_scale, float max_scale, til_governor_filter_t filter, til_module_context_t **res_context)
+{
+	til_governor_context_t	*ctxt;
+
+	assert(module_context);
+	assert(target_fps);
+	assert(res_context);
+
+	ctxt = til_module_context_new(sizeof(til_governor_context_t), module_context->seed, module_context->ticks, module_context->n_cpus);
+	if (!ctxt)
+		return -ENOMEM;
+
+	/* the render threads pass their own number as the cpu, which may exceed n_cpus */
+	ctxt->n_scratch = MAX(module_context->n_cpus, til_get_n_threads()) * 2;
+	ctxt->scratch_ys = calloc(ctxt->n_scratch, sizeof(int));
+	if (!ctxt->scratch_ys) {
+		free(ctxt);
+
+		return -ENOMEM;
+	}
+
+	ctxt->til_module_context.module = &til_governor_module;
+	ctxt->module_context = module_context;
+	ctxt->filter = filter;
+	ctxt->target_ns = 1000000000.0 / target_fps;
+	ctxt->min_step = governor_step(min_scale);
+	ctxt->max_step = MAX(ctxt->min_step, governor_step(max_scale));
+	ctxt->step = ctxt->max_step;
+
+	*res_context = &ctxt->til_module_context;
+
+	return 0;
+}
+
+
+/* return whether context is a governor's, created by til_governor_create_context() */
+int til_governor_is_context(const til_module_context_t *context)
+{
+	assert(context);
+
+	return context->module == &til_governor_module;
+}
+
+
+/* return the scale context is currently rendering its governed module at */
+float til_governor_get_scale(til_module_context_t *context)
+{
+	til_governor_context_t	*ctxt = (til_governor_context_t *)context;
+
+	assert(context);
+	assert(context->module == &til_governor_module);
+
+	return (float)ctxt->step / TIL_GOVERNOR_SCALE_STEPS;
+}
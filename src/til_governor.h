@@ -0,0 +1,17 @@
+#ifndef _TIL_GOVERNOR_H
+#define _TIL_GOVERNOR_H
+
+#include "til_module_context.h"
+
+/* Dynamic resolution scaling, see til_governor.c */
+
+typedef enum til_governor_filter_t {
+	TIL_GOVERNOR_FILTER_NEAREST,
+	TIL_GOVERNOR_FILTER_BILINEAR,
+} til_governor_filter_t;
+
+int til_governor_create_context(til_module_context_t *module_context, unsigned target_fps, float min_scale, float max_scale, til_governor_filter_t filter, til_module_context_t **res_context);
+int til_governor_is_context(const til_module_context_t *context);
+float til_governor_get_scale(til_module_context_t *context);
+
+#endif
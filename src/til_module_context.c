@@ -37,6 +37,7 @@ void * til_module_context_new(size_t size, unsigned seed, unsigned ticks, unsign
 	module_context->seed = seed;
 	module_context->ticks = ticks;
 	module_context->n_cpus = n_cpus;
+	module_context->size = size;
 
 	return module_context;
 }
@@ -1,14 +1,22 @@
 #ifndef _TIL_MODULE_CONTEXT_H
 #define _TIL_MODULE_CONTEXT_H
 
+#include <stddef.h>
+
 typedef struct til_module_context_t til_module_context_t;
 typedef struct til_module_t til_module_t;
+typedef struct til_fb_fragment_t til_fb_fragment_t;
 
 struct til_module_context_t {
 	const til_module_t	*module;
 	unsigned		seed;
 	unsigned		ticks;
 	unsigned		n_cpus;
+	size_t			size;	/* size of the context's allocation, for callers keeping contexts cached */
+
+	/* frame in flight on the threads via til_module_render_pipelined(), not yet finished */
+	til_fb_fragment_t	*pending_fragment;
+	unsigned		pending_ticks;
 };
 
 void * til_module_context_new(size_t size, unsigned seed, unsigned ticks, unsigned n_cpus);
@@ -0,0 +1,106 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "til_rand.h"
+#include "til_util.h"
+
+/* Pseudo-random numbers, see til_rand.h.
+ *
+ * This is xoshiro128** (Blackman & Vigna), TIL_RAND_LANES independently seeded
+ * generators stored lane-interleaved so til_rand_fill() can step all of them at
+ * once in vector registers.
+ */
+
+typedef uint32_t rand_lanes_t __attribute__((vector_size(TIL_RAND_LANES * sizeof(uint32_t))));
+
+#define rand_lanes_rotl(_x, _k) \
+	(((_x) << (_k)) | ((_x) >> (32 - (_k))))
+
+
+static uint64_t rand_splitmix64(uint64_t *state)
+{
+	uint64_t	z = (*state += 0x9e3779b97f4a7c15ull);
+
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+
+	return z ^ (z >> 31);
+}
+
+
+/* seed rand from seed, with distinct streams giving unrelated sequences for the same seed,
+ * e.g. a cpu or fragment number for per-thread or per-fragment generators.
+ */
+void til_rand_seed(til_rand_t *rand, unsigned seed, unsigned stream)
+{
+	uint64_t	state = (uint64_t)stream << 32 | seed;
+
+	for (unsigned i = 0; i < TIL_RAND_LANES; i++) {
+		uint64_t	a = rand_splitmix64(&state), b = rand_splitmix64(&state);
+
+		rand->s[0][i] = a;
+		rand->s[1][i] = a >> 32;
+		rand->s[2][i] = b;
+		rand->s[3][i] = (b >> 32) | 1;	/* xoshiro's state must never be all zeros */
+	}
+}
+
+
+static inline __attribute__((always_inline)) void rand_fill(til_rand_t *rand, uint32_t *dest, unsigned n)
+{
+	rand_lanes_t	s0, s1, s2, s3;
+	unsigned	i;
+
+	memcpy(&s0, rand->s[0], sizeof(s0));
+	memcpy(&s1, rand->s[1], sizeof(s1));
+	memcpy(&s2, rand->s[2], sizeof(s2));
+	memcpy(&s3, rand->s[3], sizeof(s3));
+
+	for (i = 0; i + TIL_RAND_LANES <= n; i += TIL_RAND_LANES) {
+		rand_lanes_t	r = (s1 << 2) + s1, t = s1 << 9;
+
+		r = rand_lanes_rotl(r, 7);
+		r = (r << 3) + r;
+		memcpy(&dest[i], &r, sizeof(r));
+
+		s2 ^= s0;
+		s3 ^= s1;
+		s1 ^= s2;
+		s0 ^= s3;
+		s2 ^= t;
+		s3 = rand_lanes_rotl(s3, 11);
+	}
+
+	memcpy(rand->s[0], &s0, sizeof(s0));
+	memcpy(rand->s[1], &s1, sizeof(s1));
+	memcpy(rand->s[2], &s2, sizeof(s2));
+	memcpy(rand->s[3], &s3, sizeof(s3));
+
+	for (; i < n; i++)
+		dest[i] = til_rand(rand);
+}
+
+
+static void rand_fill_generic(til_rand_t *rand, uint32_t *dest, unsigned n)
+{
+	rand_fill(rand, dest, n);
+}
+
+
+#ifdef TIL_CPU_X86
+__attribute__((target("avx2")))
+static void rand_fill_avx2(til_rand_t *rand, uint32_t *dest, unsigned n)
+{
+	rand_fill(rand, dest, n);
+}
+#endif
+
+
+TIL_CPU_DISPATCH(rand_fill_func, rand_fill_generic, rand_fill_avx2)
+
+
+/* fill dest with n random 32-bit values, stepping all of rand's lanes at once */
+void til_rand_fill(til_rand_t *rand, uint32_t *dest, unsigned n)
+{
+	rand_fill_func(rand, dest, n);
+}
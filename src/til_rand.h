@@ -0,0 +1,61 @@
+#ifndef _TIL_RAND_H
+#define _TIL_RAND_H
+
+#include <stdint.h>
+
+/* Fast pseudo-random numbers for modules, see til_rand.c.
+ *
+ * Unlike rand() there's no hidden global state or locking, every til_rand_t is
+ * an independent generator owned by whoever embeds it, be it a context used from
+ * prepare_frame(), one per thread, or one seeded on the stack per fragment.  The
+ * output only depends on the seed, so seeding from the context's seed makes a
+ * module's output reproducible.
+ */
+
+#define TIL_RAND_LANES	8
+
+typedef struct til_rand_t {
+	uint32_t	s[4][TIL_RAND_LANES];	/* xoshiro128** state per lane, til_rand() uses lane 0 */
+} til_rand_t;
+
+void til_rand_seed(til_rand_t *rand, unsigned seed, unsigned stream);
+void til_rand_fill(til_rand_t *rand, uint32_t *dest, unsigned n);
+
+
+static inline uint32_t til_rand_rotl(uint32_t x, int k)
+{
+	return (x << k) | (x >> (32 - k));
+}
+
+
+/* return the next 32 random bits */
+static inline uint32_t til_rand(til_rand_t *rand)
+{
+	uint32_t	s1 = rand->s[1][0];
+	uint32_t	r = til_rand_rotl(s1 * 5, 7) * 9;
+
+	rand->s[2][0] ^= rand->s[0][0];
+	rand->s[3][0] ^= s1;
+	rand->s[1][0] ^= rand->s[2][0];
+	rand->s[0][0] ^= rand->s[3][0];
+	rand->s[2][0] ^= s1 << 9;
+	rand->s[3][0] = til_rand_rotl(rand->s[3][0], 11);
+
+	return r;
+}
+
+
+/* return a random float in [0, 1) */
+static inline float til_rand_float(til_rand_t *rand)
+{
+	return (til_rand(rand) >> 8) * (1.f / 16777216.f);
+}
+
+
+/* return a random float in [min, max) */
+static inline float til_rand_range(til_rand_t *rand, float min, float max)
+{
+	return til_rand_float(rand) * (max - min) + min;
+}
+
+#endif
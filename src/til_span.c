@@ -0,0 +1,337 @@
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define TIL_SPAN_X86
+#endif
+
+#include "til_span.h"
+#include "til_util.h"
+
+/* Span primitives, see til_span.h.
+ *
+ * The SIMD implementations are compiled for their instruction sets using
+ * function target attributes, so the rest of libtil needn't be built for
+ * them and they're only used when til_span_init() finds them supported.
+ *
+ * All implementations must produce identical results, the blend in particular
+ * computes (src * a + dest * (256 - a)) >> 8 per channel everywhere, with
+ * alpha 0-255 scaled to a 0-256.
+ */
+
+
+static int span_supported_generic(void)
+{
+	return 1;
+}
+
+
+static void span_fill_generic(uint32_t *dest, uint32_t pixel, unsigned n)
+{
+	for (unsigned i = 0; i < n; i++)
+		dest[i] = pixel;
+}
+
+
+static void span_copy_generic(uint32_t *dest, const uint32_t *src, unsigned n)
+{
+	memcpy(dest, src, n * sizeof(uint32_t));
+}
+
+
+static inline unsigned span_alpha(uint8_t alpha)
+{
+	return alpha + (alpha >> 7);
+}
+
+
+static void span_blend_generic(uint32_t *dest, const uint32_t *src, unsigned n, uint8_t alpha)
+{
+	unsigned	a = span_alpha(alpha), ia = 256 - a;
+
+	/* two channels at a time, they can't carry into eachother since a + ia is 256 */
+	for (unsigned i = 0; i < n; i++) {
+		uint32_t	s = src[i], d = dest[i];
+		uint32_t	rb = (((s & 0x00ff00ff) * a + (d & 0x00ff00ff) * ia) >> 8) & 0x00ff00ff;
+		uint32_t	ag = (((s >> 8) & 0x00ff00ff) * a + ((d >> 8) & 0x00ff00ff) * ia) & 0xff00ff00;
+
+		dest[i] = rb | ag;
+	}
+}
+
+
+static void span_add_generic(uint32_t *dest, const uint32_t *src, unsigned n)
+{
+	/* two channels at a time again, saturating those which carried into their high byte */
+	for (unsigned i = 0; i < n; i++) {
+		uint32_t	s = src[i], d = dest[i];
+		uint32_t	rb = (s & 0x00ff00ff) + (d & 0x00ff00ff);
+		uint32_t	ag = ((s >> 8) & 0x00ff00ff) + ((d >> 8) & 0x00ff00ff);
+		uint32_t	rb_carry = rb & 0x01000100, ag_carry = ag & 0x01000100;
+
+		rb = (rb | (rb_carry - (rb_carry >> 8))) & 0x00ff00ff;
+		ag = (ag | (ag_carry - (ag_carry >> 8))) & 0x00ff00ff;
+
+		dest[i] = rb | (ag << 8);
+	}
+}
+
+
+static const til_span_ops_t	span_ops_generic = {
+	.name = "generic",
+	.supported = span_supported_generic,
+	.fill = span_fill_generic,
+	.copy = span_copy_generic,
+	.stream = span_copy_generic,
+	.blend = span_blend_generic,
+	.add = span_add_generic,
+};
+
+
+#ifdef TIL_SPAN_X86
+static int span_supported_sse2(void)
+{
+	return __builtin_cpu_supports("sse2");
+}
+
+
+__attribute__((target("sse2")))
+static void span_fill_sse2(uint32_t *dest, uint32_t pixel, unsigned n)
+{
+	__m128i		p = _mm_set1_epi32(pixel);
+	unsigned	i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		_mm_storeu_si128((__m128i *)&dest[i], p);
+		_mm_storeu_si128((__m128i *)&dest[i + 4], p);
+	}
+
+	for (; i < n; i++)
+		dest[i] = pixel;
+}
+
+
+/* non-temporal stores need aligned destinations, the unaligned head and tail are copied normally */
+__attribute__((target("sse2")))
+static void span_stream_sse2(uint32_t *dest, const uint32_t *src, unsigned n)
+{
+	unsigned	i = 0;
+
+	for (; i < n && ((uintptr_t)&dest[i] & 0xf); i++)
+		dest[i] = src[i];
+
+	for (; i + 8 <= n; i += 8) {
+		_mm_stream_si128((__m128i *)&dest[i], _mm_loadu_si128((const __m128i *)&src[i]));
+		_mm_stream_si128((__m128i *)&dest[i + 4], _mm_loadu_si128((const __m128i *)&src[i + 4]));
+	}
+
+	for (; i < n; i++)
+		dest[i] = src[i];
+
+	/* order the streamed stores before whatever follows, like handing the pages to the display */
+	_mm_sfence();
+}
+
+
+__attribute__((target("sse2")))
+static inline __m128i span_blend_4_sse2(__m128i s, __m128i d, __m128i a, __m128i ia)
+{
+	__m128i	zero = _mm_setzero_si128();
+	__m128i	lo, hi;
+
+	lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(s, zero), a), _mm_mullo_epi16(_mm_unpacklo_epi8(d, zero), ia));
+	hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(s, zero), a), _mm_mullo_epi16(_mm_unpackhi_epi8(d, zero), ia));
+
+	return _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+}
+
+
+__attribute__((target("sse2")))
+static void span_blend_sse2(uint32_t *dest, const uint32_t *src, unsigned n, uint8_t alpha)
+{
+	__m128i		a = _mm_set1_epi16(span_alpha(alpha)), ia = _mm_set1_epi16(256 - span_alpha(alpha));
+	unsigned	i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i	s = _mm_loadu_si128((const __m128i *)&src[i]);
+		__m128i	d = _mm_loadu_si128((const __m128i *)&dest[i]);
+
+		_mm_storeu_si128((__m128i *)&dest[i], span_blend_4_sse2(s, d, a, ia));
+	}
+
+	span_blend_generic(&dest[i], &src[i], n - i, alpha);
+}
+
+
+__attribute__((target("sse2")))
+static void span_add_sse2(uint32_t *dest, const uint32_t *src, unsigned n)
+{
+	unsigned	i = 0;
+
+	for (; i + 4 <= n; i += 4) {
+		__m128i	s = _mm_loadu_si128((const __m128i *)&src[i]);
+		__m128i	d = _mm_loadu_si128((const __m128i *)&dest[i]);
+
+		_mm_storeu_si128((__m128i *)&dest[i], _mm_adds_epu8(s, d));
+	}
+
+	span_add_generic(&dest[i], &src[i], n - i);
+}
+
+
+static const til_span_ops_t	span_ops_sse2 = {
+	.name = "sse2",
+	.supported = span_supported_sse2,
+	.fill = span_fill_sse2,
+	.copy = span_copy_generic,	/* memcpy() is already as good as it gets */
+	.stream = span_stream_sse2,
+	.blend = span_blend_sse2,
+	.add = span_add_sse2,
+};
+
+
+static int span_supported_avx2(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+
+
+__attribute__((target("avx2")))
+static void span_fill_avx2(uint32_t *dest, uint32_t pixel, unsigned n)
+{
+	__m256i		p = _mm256_set1_epi32(pixel);
+	unsigned	i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		_mm256_storeu_si256((__m256i *)&dest[i], p);
+		_mm256_storeu_si256((__m256i *)&dest[i + 8], p);
+	}
+
+	for (; i < n; i++)
+		dest[i] = pixel;
+}
+
+
+__attribute__((target("avx2")))
+static void span_stream_avx2(uint32_t *dest, const uint32_t *src, unsigned n)
+{
+	unsigned	i = 0;
+
+	for (; i < n && ((uintptr_t)&dest[i] & 0x1f); i++)
+		dest[i] = src[i];
+
+	for (; i + 16 <= n; i += 16) {
+		_mm256_stream_si256((__m256i *)&dest[i], _mm256_loadu_si256((const __m256i *)&src[i]));
+		_mm256_stream_si256((__m256i *)&dest[i + 8], _mm256_loadu_si256((const __m256i *)&src[i + 8]));
+	}
+
+	for (; i < n; i++)
+		dest[i] = src[i];
+
+	_mm_sfence();
+}
+
+
+__attribute__((target("avx2")))
+static void span_blend_avx2(uint32_t *dest, const uint32_t *src, unsigned n, uint8_t alpha)
+{
+	__m256i		a = _mm256_set1_epi16(span_alpha(alpha)), ia = _mm256_set1_epi16(256 - span_alpha(alpha));
+	__m256i		zero = _mm256_setzero_si256();
+	unsigned	i = 0;
+
+	/* the unpacks and pack all operate within 128-bit lanes, so the pixels come out in order */
+	for (; i + 8 <= n; i += 8) {
+		__m256i	s = _mm256_loadu_si256((const __m256i *)&src[i]);
+		__m256i	d = _mm256_loadu_si256((const __m256i *)&dest[i]);
+		__m256i	lo, hi;
+
+		lo = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpacklo_epi8(s, zero), a), _mm256_mullo_epi16(_mm256_unpacklo_epi8(d, zero), ia));
+		hi = _mm256_add_epi16(_mm256_mullo_epi16(_mm256_unpackhi_epi8(s, zero), a), _mm256_mullo_epi16(_mm256_unpackhi_epi8(d, zero), ia));
+
+		_mm256_storeu_si256((__m256i *)&dest[i], _mm256_packus_epi16(_mm256_srli_epi16(lo, 8), _mm256_srli_epi16(hi, 8)));
+	}
+
+	TIL_AVX_TAIL(span_blend_generic(&dest[i], &src[i], n - i, alpha));
+}
+
+
+__attribute__((target("avx2")))
+static void span_add_avx2(uint32_t *dest, const uint32_t *src, unsigned n)
+{
+	unsigned	i = 0;
+
+	for (; i + 8 <= n; i += 8) {
+		__m256i	s = _mm256_loadu_si256((const __m256i *)&src[i]);
+		__m256i	d = _mm256_loadu_si256((const __m256i *)&dest[i]);
+
+		_mm256_storeu_si256((__m256i *)&dest[i], _mm256_adds_epu8(s, d));
+	}
+
+	TIL_AVX_TAIL(span_add_generic(&dest[i], &src[i], n - i));
+}
+
+
+static const til_span_ops_t	span_ops_avx2 = {
+	.name = "avx2",
+	.supported = span_supported_avx2,
+	.fill = span_fill_avx2,
+	.copy = span_copy_generic,
+	.stream = span_stream_avx2,
+	.blend = span_blend_avx2,
+	.add = span_add_avx2,
+};
+#endif /* TIL_SPAN_X86 */
+
+
+/* in order of preference, least preferred first */
+static const til_span_ops_t	*span_ops[] = {
+	&span_ops_generic,
+#ifdef TIL_SPAN_X86
+	&span_ops_sse2,
+	&span_ops_avx2,
+#endif
+};
+
+const til_span_ops_t	*til_span = &span_ops_generic;
+
+
+/* choose the most preferred span ops supported by the running cpu */
+void til_span_init(void)
+{
+#ifdef TIL_SPAN_X86
+	__builtin_cpu_init();
+#endif
+
+	for (unsigned i = 0; i < nelems(span_ops); i++) {
+		if (span_ops[i]->supported())
+			til_span = span_ops[i];
+	}
+}
+
+
+/* use the span ops named name instead, for benchmarking and testing */
+int til_span_select(const char *name)
+{
+	for (unsigned i = 0; i < nelems(span_ops); i++) {
+		if (strcasecmp(name, span_ops[i]->name))
+			continue;
+
+		if (!span_ops[i]->supported())
+			return -ENOTSUP;
+
+		til_span = span_ops[i];
+
+		return 0;
+	}
+
+	return -ENOENT;
+}
+
+
+void til_span_get_ops(const til_span_ops_t ***res_ops, unsigned *res_n_ops)
+{
+	*res_ops = span_ops;
+	*res_n_ops = nelems(span_ops);
+}
@@ -0,0 +1,64 @@
+#ifndef _TIL_SPAN_H
+#define _TIL_SPAN_H
+
+#include <stdint.h>
+
+/* Primitives operating on spans of 32-bit pixels, the rows of fragments.
+ *
+ * There are multiple implementations of these, using whatever SIMD the cpu
+ * supports, the best of which is chosen at runtime by til_span_init().  The
+ * generic implementation is used until then, so they're always safe to use.
+ */
+
+typedef struct til_span_ops_t {
+	const char	*name;
+	int		(*supported)(void);	/* returns non-zero if the running cpu supports these ops */
+	void		(*fill)(uint32_t *dest, uint32_t pixel, unsigned n);
+	void		(*copy)(uint32_t *dest, const uint32_t *src, unsigned n);
+	void		(*stream)(uint32_t *dest, const uint32_t *src, unsigned n);
+	void		(*blend)(uint32_t *dest, const uint32_t *src, unsigned n, uint8_t alpha);
+	void		(*add)(uint32_t *dest, const uint32_t *src, unsigned n);
+} til_span_ops_t;
+
+extern const til_span_ops_t	*til_span;
+
+void til_span_init(void);
+int til_span_select(const char *name);
+void til_span_get_ops(const til_span_ops_t ***res_ops, unsigned *res_n_ops);
+
+
+/* set n pixels of dest to pixel */
+static inline void til_span_fill(uint32_t *dest, uint32_t pixel, unsigned n)
+{
+	til_span->fill(dest, pixel, n);
+}
+
+
+/* copy n pixels from src to dest, which must not overlap */
+static inline void til_span_copy(uint32_t *dest, const uint32_t *src, unsigned n)
+{
+	til_span->copy(dest, src, n);
+}
+
+
+/* copy n pixels from src to dest bypassing the cache where possible, for writing to uncached memory */
+static inline void til_span_stream(uint32_t *dest, const uint32_t *src, unsigned n)
+{
+	til_span->stream(dest, src, n);
+}
+
+
+/* blend n pixels of src over dest, alpha of 0 leaves dest untouched and 255 copies src */
+static inline void til_span_blend(uint32_t *dest, const uint32_t *src, unsigned n, uint8_t alpha)
+{
+	til_span->blend(dest, src, n, alpha);
+}
+
+
+/* add n pixels of src to dest, saturating each channel */
+static inline void til_span_add(uint32_t *dest, const uint32_t *src, unsigned n)
+{
+	til_span->add(dest, src, n);
+}
+
+#endif
@@ -1,17 +1,73 @@
 #include <assert.h>
 #include <pthread.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "til.h"
 #include "til_fb.h"
 #include "til_threads.h"
 #include "til_util.h"
 
+/* Fragments are distributed to the threads as per-thread queues of contiguous
+ * fragment numbers, packed into a single 64-bit word of [head, tail) so both
+ * ends may be manipulated with a single CAS.  The owner pops from the head,
+ * advancing through neighboring fragments in order, while threads which have
+ * exhausted their own queue steal half of the remaining fragments from the
+ * tail of another's.  This keeps threads off of any shared counter until
+ * they run out of work, and keeps the fragments they do take near eachother.
+ *
+ * The fragments (or simulation pass slices) and their queues make up a job.
+ * The frontend submits the root job and waits for all the threads to idle,
+ * but modules rendering other modules from within their render_fragment(),
+ * like montage, do so on one of the threads.  Waiting for all the threads to
+ * idle there would deadlock, so these submit nested jobs instead: the
+ * submitting thread works on its job's fragments itself, while threads out of
+ * work join in by stealing from it.  Once nothing's left to take the submitter
+ * waits only for the threads still rendering its fragments, helping with other
+ * nested jobs meanwhile.  Threads never take fragments from a job they're
+ * already within, since that would reenter a context's render_fragment() on the
+ * same cpu.  Nested frames using cpu_affinity are rendered serially by the
+ * submitter, as the other threads can't be relied on to take their share.
+ */
+#define QUEUE(_head, _tail)	(((uint64_t)(_head) << 32) | (_tail))
+#define QUEUE_HEAD(_queue)	((unsigned)((_queue) >> 32))
+#define QUEUE_TAIL(_queue)	((unsigned)(_queue))
+
+typedef struct til_threads_queue_t {
+	uint64_t		queue;		/* QUEUE(head, tail) of a thread's remaining fragment numbers */
+} __attribute__((aligned(64))) til_threads_queue_t;	/* keep the hot queues of different threads off the same cachelines */
+
+typedef struct til_threads_job_t til_threads_job_t;
+
+struct til_threads_job_t {
+	til_threads_job_t	*next;		/* nested jobs are listed in til_threads_t.jobs while they may have work */
+	void			(*render_fragment_func)(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment);
+	void			*context;
+	til_fb_fragment_t	*fragment;
+	til_frame_plan_t	frame_plan;
+	til_pass_plan_t		pass_plan;	/* pass_plan.func is set when running a simulation pass instead of rendering */
+	unsigned		ticks;
+	unsigned		n_helpers;	/* threads working on this nested job besides its submitter, under frame_mutex */
+	til_threads_queue_t	*queues;	/* a queue per thread */
+};
+
+/* the jobs a thread is within, innermost first, living on the thread's stack */
+typedef struct til_thread_within_t til_thread_within_t;
+
+struct til_thread_within_t {
+	til_threads_job_t	*job;
+	til_thread_within_t	*outer;
+};
+
 typedef struct til_thread_t {
-	til_threads_t	*threads;
-	pthread_t	pthread;
-	unsigned	id;
-} til_thread_t;
+	til_threads_t		*threads;
+	pthread_t		pthread;
+	unsigned		id;
+	til_thread_within_t	*within;	/* jobs this thread is rendering fragments of */
+	int			timing;		/* within a fragment thread_render_fragment() is timing */
+	uint64_t		blocked_ns;	/* time blocked on nested jobs' helpers while timing */
+	til_thread_stats_t	stats;		/* only written by this thread while rendering */
+} __attribute__((aligned(64))) til_thread_t;
 
 typedef struct til_threads_t {
 	unsigned		n_threads;
@@ -20,20 +76,197 @@ typedef struct til_threads_t {
 	pthread_cond_t		idle_cond;
 	unsigned		n_idle;
 
-	pthread_mutex_t		frame_mutex;
-	pthread_cond_t		frame_cond;
-	void			(*render_fragment_func)(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment);
-	void			*context;
-	til_fb_fragment_t	*fragment;
-	til_frame_plan_t	frame_plan;
-	unsigned		ticks;
+	pthread_mutex_t		frame_mutex;	/* also protects the nested jobs list and their n_helpers */
+	pthread_cond_t		frame_cond;	/* signaled for new root jobs and new nested jobs */
+	pthread_cond_t		jobs_cond;	/* signaled for nested jobs losing their last helper, and new nested jobs */
+	til_threads_job_t	root;
+	til_threads_job_t	*jobs;
 
-	unsigned		next_fragment;
 	unsigned		frame_num;
 
+	uint64_t		wait_ns;	/* accumulated in til_threads_wait_idle() */
+
 	til_thread_t		threads[];
 } til_threads_t;
 
+static __thread til_thread_t	*thread_self;	/* the til_thread_t of the calling thread, if it's one */
+
+
+/* render a fragment of job on thread, accounting for the time spent unless it's within another fragment
+ * already being timed.  Only the root job's fragments are counted as fragments, those of nested jobs are
+ * just busy time for whichever thread renders them.  Time spent blocked waiting on a nested job's helpers
+ * isn't busy time, the helpers account for what they render.
+ */
+static inline void thread_render_fragment(til_thread_t *thread, til_threads_job_t *job, til_fb_fragment_t *fragment)
+{
+	uint64_t	t;
+
+	if (thread->timing) {
+		job->render_fragment_func(job->context, job->ticks, thread->id, fragment);
+
+		return;
+	}
+
+	thread->timing = 1;
+	thread->blocked_ns = 0;
+	t = til_get_ns();
+	job->render_fragment_func(job->context, job->ticks, thread->id, fragment);
+	t = til_get_ns() - t - thread->blocked_ns;
+	thread->timing = 0;
+
+	thread->stats.busy_ns += t;
+	if (job != &thread->threads->root)
+		return;
+
+	thread->stats.n_fragments++;
+	if (t > thread->stats.max_fragment_ns)
+		thread->stats.max_fragment_ns = t;
+}
+
+
+/* take the next fragment number from the head of thread's own queue in job, returns 0 when empty */
+static int thread_pop(til_thread_t *thread, til_threads_job_t *job, unsigned *res_frag_num)
+{
+	uint64_t	*q = &job->queues[thread->id].queue;
+
+	for (;;) {
+		uint64_t	queue = __atomic_load_n(q, __ATOMIC_RELAXED);
+		unsigned	head = QUEUE_HEAD(queue), tail = QUEUE_TAIL(queue);
+
+		if (head >= tail)
+			return 0;
+
+		if (__sync_bool_compare_and_swap(q, queue, QUEUE(head + 1, tail))) {
+			*res_frag_num = head;
+
+			return 1;
+		}
+	}
+}
+
+
+/* steal half of the fragments remaining in another thread's queue of job, visiting the other
+ * threads starting from our neighbor.  The first stolen fragment number is returned for rendering,
+ * the rest become our queue.  Returns 0 when there's nothing left to steal.
+ */
+static int thread_steal(til_thread_t *thread, til_threads_job_t *job, unsigned *res_frag_num)
+{
+	til_threads_t	*threads = thread->threads;
+
+	for (unsigned i = 1; i < threads->n_threads; i++) {
+		uint64_t	*victim = &job->queues[(thread->id + i) % threads->n_threads].queue;
+
+		for (;;) {
+			uint64_t	queue = __atomic_load_n(victim, __ATOMIC_RELAXED);
+			unsigned	head = QUEUE_HEAD(queue), tail = QUEUE_TAIL(queue), n;
+
+			if (head >= tail)
+				break;
+
+			n = (tail - head + 1) >> 1;
+			if (!__sync_bool_compare_and_swap(victim, queue, QUEUE(head, tail - n)))
+				continue;
+
+			__atomic_store_n(&job->queues[thread->id].queue, QUEUE(tail - n + 1, tail), __ATOMIC_RELEASE);
+			if (!job->pass_plan.func && job == &threads->root)
+				thread->stats.n_stolen += n;
+			*res_frag_num = tail - n;
+
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+
+/* work on job's fragments or slices until there's nothing left to take */
+static void thread_run_job(til_thread_t *thread, til_threads_job_t *job)
+{
+	til_threads_t		*threads = thread->threads;
+	til_thread_within_t	within = { .job = job, .outer = thread->within };
+
+	thread->within = &within;
+
+	if (job->pass_plan.func) { /* run simulation pass slices, balanced just like fragments */
+		unsigned	slice;
+
+		while (thread_pop(thread, job, &slice) || thread_steal(thread, job, &slice))
+			job->pass_plan.func(job->context, job->ticks, thread->id, slice, job->pass_plan.n_slices);
+
+	} else if (job->frame_plan.cpu_affinity) { /* render only fragments for my thread->id */
+		til_fb_fragment_t	fragment;
+
+		/* Some modules allocate persistent per-cpu state affecting the contents of fragments,
+		 * which may require a consistent mapping of CPU to fragnum across frames.  Such
+		 * fragments can't be stolen since their state is only for this thread's use, but
+		 * the mapping is static so there's no need to coordinate with the other threads.
+		 */
+		for (unsigned frag_num = thread->id;
+		     job->frame_plan.fragmenter(job->context, job->fragment, frag_num, &fragment);
+		     frag_num += threads->n_threads)
+			thread_render_fragment(thread, job, &fragment);
+
+	} else { /* render my queued fragments, then help the others with theirs */
+		unsigned	frag_num;
+
+		while (thread_pop(thread, job, &frag_num) || thread_steal(thread, job, &frag_num)) {
+			til_fb_fragment_t	fragment;
+
+			if (!job->frame_plan.fragmenter(job->context, job->fragment, frag_num, &fragment))
+				continue;
+
+			thread_render_fragment(thread, job, &fragment);
+		}
+	}
+
+	thread->within = within.outer;
+}
+
+
+/* find a nested job thread may help with, and join it.  Must be called with frame_mutex held. */
+static til_threads_job_t * thread_join_job(til_thread_t *thread)
+{
+	til_threads_t	*threads = thread->threads;
+
+	for (til_threads_job_t *job = threads->jobs; job; job = job->next) {
+		til_thread_within_t	*w;
+		unsigned		i;
+
+		for (w = thread->within; w && w->job != job; w = w->outer);
+		if (w)
+			continue;
+
+		for (i = 0; i < threads->n_threads; i++) {
+			uint64_t	queue = __atomic_load_n(&job->queues[i].queue, __ATOMIC_RELAXED);
+
+			if (QUEUE_HEAD(queue) < QUEUE_TAIL(queue))
+				break;
+		}
+
+		if (i == threads->n_threads)
+			continue;
+
+		job->n_helpers++;
+
+		return job;
+	}
+
+	return NULL;
+}
+
+
+/* leave a nested job joined via thread_join_job(), after which it may cease to exist */
+static void thread_leave_job(til_thread_t *thread, til_threads_job_t *job)
+{
+	til_threads_t	*threads = thread->threads;
+
+	pthread_mutex_lock(&threads->frame_mutex);
+	if (!--job->n_helpers)
+		pthread_cond_broadcast(&threads->jobs_cond);
+	pthread_mutex_unlock(&threads->frame_mutex);
+}
+
 
 /* render fragments using the supplied render function */
 static void * thread_func(void *_thread)
@@ -43,50 +276,29 @@ static void * thread_func(void *_thread)
 	unsigned	prev_frame_num = 0;
 
 	pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+	thread_self = thread;
 
 	for (;;) {
-		/* wait for a new frame */
+		til_threads_job_t	*job = NULL;
+
+		/* wait for a new frame, or a nested job to help with */
 		pthread_mutex_lock(&threads->frame_mutex);
 		pthread_cleanup_push((void (*)(void *))pthread_mutex_unlock, &threads->frame_mutex);
-		while (threads->frame_num == prev_frame_num)
+		while (threads->frame_num == prev_frame_num && !(job = thread_join_job(thread)))
 			pthread_cond_wait(&threads->frame_cond, &threads->frame_mutex);
-		prev_frame_num = threads->frame_num;
+		if (!job)
+			prev_frame_num = threads->frame_num;
 		pthread_cleanup_pop(1);
 
-		if (threads->frame_plan.cpu_affinity) { /* render only fragments for my thread->id */
-			unsigned frag_num = thread->id;
-
-			/* This is less performant, since we'll spin until our fragnum comes up,
-			 * rather than just rendering whatever's next whenever we're available.
-			 *
-			 * Some modules allocate persistent per-cpu state affecting the contents of fragments,
-			 * which may require a consistent mapping of CPU to fragnum across frames.
-			 */
-			for (;;) {
-				til_fb_fragment_t	fragment;
-
-				while (!__sync_bool_compare_and_swap(&threads->next_fragment, frag_num, frag_num + 1));
-
-				if (!threads->frame_plan.fragmenter(threads->context, threads->fragment, frag_num, &fragment))
-					break;
-
-				threads->render_fragment_func(threads->context, threads->ticks, thread->id, &fragment);
-				frag_num += threads->n_threads;
-			}
-		} else { /* render *any* available fragment */
-			for (;;) {
-				unsigned		frag_num;
-				til_fb_fragment_t	fragment;
-
-				frag_num = __sync_fetch_and_add(&threads->next_fragment, 1);
+		if (job) {
+			thread_run_job(thread, job);
+			thread_leave_job(thread, job);
 
-				if (!threads->frame_plan.fragmenter(threads->context, threads->fragment, frag_num, &fragment))
-					break;
-
-				threads->render_fragment_func(threads->context, threads->ticks, thread->id, &fragment);
-			}
+			continue;
 		}
 
+		thread_run_job(thread, &threads->root);
+
 		/* report as idle */
 		pthread_mutex_lock(&threads->idle_mutex);
 		pthread_cleanup_push((void (*)(void *))pthread_mutex_unlock, &threads->idle_mutex);
@@ -100,46 +312,237 @@ static void * thread_func(void *_thread)
 }
 
 
+/* Returns the number of fragments frame_plan's fragmenter produces for fragment.
+ * Fragmenters only describe fragments incrementally, but they're always dense from 0,
+ * so this gallops to an upper bound and then bisects rather than visiting them all.
+ */
+static unsigned count_fragments(til_frame_plan_t *frame_plan, til_module_context_t *context, til_fb_fragment_t *fragment)
+{
+	unsigned		lo = 0, hi = 1;
+	til_fb_fragment_t	frag;
+
+	while (frame_plan->fragmenter(context, fragment, hi - 1, &frag)) {
+		lo = hi;
+		hi <<= 1;
+	}
+
+	while (hi - lo > 1) {
+		unsigned	mid = lo + ((hi - lo) >> 1);
+
+		if (frame_plan->fragmenter(context, fragment, mid - 1, &frag))
+			lo = mid;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+
 /* wait for all threads to be idle */
 void til_threads_wait_idle(til_threads_t *threads)
 {
+	uint64_t	t;
+
+	t = til_get_ns();
 	pthread_mutex_lock(&threads->idle_mutex);
 	pthread_cleanup_push((void (*)(void *))pthread_mutex_unlock, &threads->idle_mutex);
 	while (threads->n_idle < threads->n_threads)
 		pthread_cond_wait(&threads->idle_cond, &threads->idle_mutex);
 	pthread_cleanup_pop(1);
+	threads->wait_ns += til_get_ns() - t;
 }
 
 
-/* submit a frame's fragments to the threads */
-void til_threads_frame_submit(til_threads_t *threads, til_fb_fragment_t *fragment, til_frame_plan_t *frame_plan, void (*render_fragment_func)(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment), til_module_context_t *context, unsigned ticks)
+/* distribute [0, n) to job's queues as contiguous runs, for locality */
+static void queue_runs(til_threads_t *threads, til_threads_job_t *job, unsigned n)
 {
-	til_threads_wait_idle(threads);	/* XXX: likely non-blocking; already happens pre page flip */
+	for (unsigned i = 0; i < threads->n_threads; i++)
+		job->queues[i].queue = QUEUE((uint64_t)n * i / threads->n_threads,
+					     (uint64_t)n * (i + 1) / threads->n_threads);
+}
+
+
+/* submit the root job to the threads, threads must be idle */
+static void submit_root(til_threads_t *threads, const til_threads_job_t *job)
+{
+	assert(!thread_self || thread_self->threads != threads);
 
 	pthread_mutex_lock(&threads->frame_mutex);
 	pthread_cleanup_push((void (*)(void *))pthread_mutex_unlock, &threads->frame_mutex);
-	threads->fragment = fragment;
-	threads->frame_plan = *frame_plan;
-	threads->render_fragment_func = render_fragment_func;
-	threads->context = context;
-	threads->ticks = ticks;
+	threads->root.fragment = job->fragment;
+	threads->root.frame_plan = job->frame_plan;
+	threads->root.pass_plan = job->pass_plan;
+	threads->root.render_fragment_func = job->render_fragment_func;
+	threads->root.context = job->context;
+	threads->root.ticks = job->ticks;
 	threads->frame_num++;
-	threads->n_idle = threads->next_fragment = 0;
+	threads->n_idle = 0;
 	pthread_cond_broadcast(&threads->frame_cond);
 	pthread_cleanup_pop(1);
 }
 
 
-/* create threads instance, a thread per cpu is created */
-til_threads_t * til_threads_create(void)
+/* run job nested within whatever thread is rendering, returning once it's complete */
+static void run_nested(til_thread_t *thread, til_threads_job_t *job, unsigned n)
+{
+	til_threads_t		*threads = thread->threads;
+	til_threads_queue_t	queues[threads->n_threads];
+
+	job->queues = queues;
+	queue_runs(threads, job, n);
+
+	pthread_mutex_lock(&threads->frame_mutex);
+	job->next = threads->jobs;
+	threads->jobs = job;
+	pthread_cond_broadcast(&threads->frame_cond);
+	pthread_cond_broadcast(&threads->jobs_cond);
+	pthread_mutex_unlock(&threads->frame_mutex);
+
+	thread_run_job(thread, job);
+
+	/* nothing's left to take, but helpers may still be rendering what they took */
+	pthread_mutex_lock(&threads->frame_mutex);
+	for (til_threads_job_t **j = &threads->jobs; *j; j = &(*j)->next) {
+		if (*j == job) {
+			*j = job->next;
+			break;
+		}
+	}
+
+	while (job->n_helpers) {
+		til_threads_job_t	*other = thread_join_job(thread);
+
+		if (!other) {
+			uint64_t	t = til_get_ns();
+
+			pthread_cond_wait(&threads->jobs_cond, &threads->frame_mutex);
+			thread->blocked_ns += til_get_ns() - t;
+			continue;
+		}
+
+		pthread_mutex_unlock(&threads->frame_mutex);
+		thread_run_job(thread, other);
+		thread_leave_job(thread, other);
+		pthread_mutex_lock(&threads->frame_mutex);
+	}
+	pthread_mutex_unlock(&threads->frame_mutex);
+}
+
+
+/* submit a frame's fragments to the threads */
+void til_threads_frame_submit(til_threads_t *threads, til_fb_fragment_t *fragment, til_frame_plan_t *frame_plan, void (*render_fragment_func)(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment), til_module_context_t *context, unsigned ticks)
+{
+	til_threads_wait_idle(threads);	/* XXX: likely non-blocking; already happens pre page flip */
+
+	if (!frame_plan->cpu_affinity)
+		queue_runs(threads, &threads->root, count_fragments(frame_plan, context, fragment));
+
+	submit_root(threads, &(til_threads_job_t){
+				.fragment = fragment,
+				.frame_plan = *frame_plan,
+				.render_fragment_func = render_fragment_func,
+				.context = context,
+				.ticks = ticks,
+			});
+}
+
+
+/* submit a simulation pass's slices to the threads */
+void til_threads_pass_submit(til_threads_t *threads, const til_pass_plan_t *pass_plan, til_module_context_t *context, unsigned ticks)
+{
+	assert(pass_plan->func);
+
+	til_threads_wait_idle(threads);
+
+	queue_runs(threads, &threads->root, pass_plan->n_slices);
+
+	submit_root(threads, &(til_threads_job_t){
+				.pass_plan = *pass_plan,
+				.context = context,
+				.ticks = ticks,
+			});
+}
+
+
+/* Render a frame's fragments on the threads, returning when they're all rendered.  This may be
+ * called from the threads themselves, as modules rendering other modules do, in which case the
+ * frame becomes a nested job the calling thread works on alongside any threads out of work.
+ */
+void til_threads_frame_run(til_threads_t *threads, til_fb_fragment_t *fragment, til_frame_plan_t *frame_plan, void (*render_fragment_func)(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment), til_module_context_t *context, unsigned ticks)
+{
+	til_threads_job_t	job = {
+					.fragment = fragment,
+					.frame_plan = *frame_plan,
+					.render_fragment_func = render_fragment_func,
+					.context = context,
+					.ticks = ticks,
+				};
+
+	if (!thread_self || thread_self->threads != threads) {
+		til_threads_frame_submit(threads, fragment, frame_plan, render_fragment_func, context, ticks);
+		til_threads_wait_idle(threads);
+
+		return;
+	}
+
+	if (frame_plan->cpu_affinity) {
+		til_fb_fragment_t	frag;
+
+		/* the cpu:fragnum mapping is kept, but it's all rendered here */
+		for (unsigned frag_num = 0; frame_plan->fragmenter(context, fragment, frag_num, &frag); frag_num++)
+			render_fragment_func(context, ticks, frag_num % threads->n_threads, &frag);
+
+		return;
+	}
+
+	run_nested(thread_self, &job, count_fragments(frame_plan, context, fragment));
+}
+
+
+/* Run a simulation pass's slices on the threads, returning when they've all run.  Like
+ * til_threads_frame_run(), this may be called from the threads themselves.
+ */
+void til_threads_pass_run(til_threads_t *threads, const til_pass_plan_t *pass_plan, til_module_context_t *context, unsigned ticks)
+{
+	til_threads_job_t	job = {
+					.pass_plan = *pass_plan,
+					.context = context,
+					.ticks = ticks,
+				};
+
+	assert(pass_plan->func);
+
+	if (!thread_self || thread_self->threads != threads) {
+		til_threads_pass_submit(threads, pass_plan, context, ticks);
+		til_threads_wait_idle(threads);
+
+		return;
+	}
+
+	run_nested(thread_self, &job, pass_plan->n_slices);
+}
+
+
+/* create threads instance, n_threads threads are created, or a thread per cpu if n_threads is 0 */
+til_threads_t * til_threads_create(unsigned n_threads)
 {
-	unsigned	num = til_get_ncpus();
+	unsigned	num = n_threads ? : til_get_ncpus();
 	til_threads_t	*threads;
 
-	threads = calloc(1, sizeof(til_threads_t) + sizeof(til_thread_t) * num);
+	threads = til_aligned_alloc(__alignof__(til_threads_t), sizeof(til_threads_t) + sizeof(til_thread_t) * num);
 	if (!threads)
 		return NULL;
 
+	memset(threads, 0, sizeof(til_threads_t) + sizeof(til_thread_t) * num);
+
+	threads->root.queues = til_aligned_alloc(__alignof__(til_threads_queue_t), sizeof(til_threads_queue_t) * num);
+	if (!threads->root.queues) {
+		til_aligned_free(threads);
+
+		return NULL;
+	}
+
 	threads->n_idle = threads->n_threads = num;
 
 	pthread_mutex_init(&threads->idle_mutex, NULL);
@@ -147,6 +550,7 @@ til_threads_t * til_threads_create(void)
 
 	pthread_mutex_init(&threads->frame_mutex, NULL);
 	pthread_cond_init(&threads->frame_cond, NULL);
+	pthread_cond_init(&threads->jobs_cond, NULL);
 
 	for (unsigned i = 0; i < num; i++) {
 		til_thread_t	*thread = &threads->threads[i];
@@ -174,8 +578,10 @@ void til_threads_destroy(til_threads_t *threads)
 
 	pthread_mutex_destroy(&threads->frame_mutex);
 	pthread_cond_destroy(&threads->frame_cond);
+	pthread_cond_destroy(&threads->jobs_cond);
 
-	free(threads);
+	til_aligned_free(threads->root.queues);
+	til_aligned_free(threads);
 }
 
 
@@ -184,3 +590,32 @@ unsigned til_threads_num_threads(til_threads_t *threads)
 {
 	return threads->n_threads;
 }
+
+
+/* reset the accumulated stats, threads must be idle */
+void til_threads_stats_reset(til_threads_t *threads)
+{
+	for (unsigned i = 0; i < threads->n_threads; i++)
+		threads->threads[i].stats = (til_thread_stats_t){};
+
+	threads->wait_ns = 0;
+}
+
+
+/* get the stats accumulated since til_threads_stats_reset(), threads must be idle.
+ * res_thread_stats may be NULL, otherwise it must have room for n_threads entries.
+ * returns the number of threads.
+ */
+unsigned til_threads_stats_get(til_threads_t *threads, uint64_t *res_wait_ns, til_thread_stats_t *res_thread_stats)
+{
+	assert(res_wait_ns);
+
+	*res_wait_ns = threads->wait_ns;
+
+	if (res_thread_stats) {
+		for (unsigned i = 0; i < threads->n_threads; i++)
+			res_thread_stats[i] = threads->threads[i].stats;
+	}
+
+	return threads->n_threads;
+}
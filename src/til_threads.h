@@ -1,14 +1,23 @@
 #ifndef _TIL_THREADS_H
 #define _TIL_THREADS_H
 
+#include <stdint.h>
+
 typedef struct til_fb_fragment_t til_fb_fragment_t;
 typedef struct til_threads_t til_threads_t;
+typedef struct til_thread_stats_t til_thread_stats_t;
+typedef struct til_pass_plan_t til_pass_plan_t;
 
-til_threads_t * til_threads_create();
+til_threads_t * til_threads_create(unsigned n_threads);
 void til_threads_destroy(til_threads_t *threads);
 
 void til_threads_frame_submit(til_threads_t *threads, til_fb_fragment_t *fragment, til_frame_plan_t *frame_plan, void (*render_fragment_func)(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment), til_module_context_t *context, unsigned ticks);
+void til_threads_pass_submit(til_threads_t *threads, const til_pass_plan_t *pass_plan, til_module_context_t *context, unsigned ticks);
+void til_threads_frame_run(til_threads_t *threads, til_fb_fragment_t *fragment, til_frame_plan_t *frame_plan, void (*render_fragment_func)(til_module_context_t *context, unsigned ticks, unsigned cpu, til_fb_fragment_t *fragment), til_module_context_t *context, unsigned ticks);
+void til_threads_pass_run(til_threads_t *threads, const til_pass_plan_t *pass_plan, til_module_context_t *context, unsigned ticks);
 void til_threads_wait_idle(til_threads_t *threads);
 unsigned til_threads_num_threads(til_threads_t *threads);
+void til_threads_stats_reset(til_threads_t *threads);
+unsigned til_threads_stats_get(til_threads_t *threads, uint64_t *res_wait_ns, til_thread_stats_t *res_thread_stats);
 
 #endif
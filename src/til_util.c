@@ -1,9 +1,13 @@
 #include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #ifdef __WIN32__
+#include <malloc.h>
 #include <windows.h>
 #endif
 
@@ -33,3 +37,58 @@ unsigned til_get_ncpus(void)
 	return n == 0 ? 1 : n;
 #endif
 }
+
+
+/* returns a monotonic timestamp in nanoseconds, for measuring durations */
+uint64_t til_get_ns(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+
+/* allocate size bytes aligned to alignment, which must be a power of 2.
+ * size is rounded up to a multiple of alignment, free with til_aligned_free().
+ */
+void * til_aligned_alloc(size_t alignment, size_t size)
+{
+	size = (size + alignment - 1) & ~(alignment - 1);
+
+#ifdef __WIN32__
+	return _aligned_malloc(size, alignment);
+#else
+	return aligned_alloc(alignment, size);
+#endif
+}
+
+
+void til_aligned_free(void *ptr)
+{
+#ifdef __WIN32__
+	_aligned_free(ptr);
+#else
+	free(ptr);
+#endif
+}
+
+
+/* return whether the running cpu supports feature, usable from constructors */
+int til_cpu_supports(til_cpu_feature_t feature)
+{
+#ifdef TIL_CPU_X86
+	__builtin_cpu_init();
+
+	switch (feature) {
+	case TIL_CPU_AVX2:
+		return !!__builtin_cpu_supports("avx2");
+
+	default:
+		break;
+	}
+#endif
+
+	return 0;
+}
@@ -2,6 +2,7 @@
 #define _TIL_UTIL_H
 
 #include <errno.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -27,6 +28,52 @@
 #define MAX(_a, _b) \
 	((_a) > (_b) ? (_a) : (_b))
 
+#if defined(__x86_64__) || defined(__i386__)
+#define TIL_CPU_X86
+#endif
+
+/* cpu features kernels may have dedicated builds for, see TIL_CPU_DISPATCH() */
+typedef enum til_cpu_feature_t {
+	TIL_CPU_AVX2,
+} til_cpu_feature_t;
+
+/* Kernels with builds for specific cpu features, typically one always_inline body
+ * compiled again in a __attribute__((target("avx2"))) wrapper, get called through
+ * the static function pointer _func defined by TIL_CPU_DISPATCH().  It's set to
+ * _avx2 when the cpu supports avx2, _generic otherwise, once before main() so it's
+ * settled before any threads call through it.  _avx2 only needs to exist when
+ * TIL_CPU_X86 is defined.
+ */
+#ifdef TIL_CPU_X86
+#define TIL_CPU_SELECT(_generic, _avx2) \
+	(til_cpu_supports(TIL_CPU_AVX2) ? (_avx2) : (_generic))
+#else
+#define TIL_CPU_SELECT(_generic, _avx2) \
+	(_generic)
+#endif
+
+#define TIL_CPU_DISPATCH(_func, _generic, _avx2) \
+	static __typeof__(&_generic) _func; \
+	\
+	static void __attribute__((constructor)) _func##_dispatch(void) \
+	{ \
+		_func = TIL_CPU_SELECT(&_generic, &_avx2); \
+	}
+
+/* AVX kernels handing their remainder to generic code call it through TIL_AVX_TAIL(),
+ * since gcc omits the vzeroupper when tail-calling, leaving later legacy SSE code (libm)
+ * paying for AVX state transitions.  Only for use within target("avx*") functions.
+ */
+#define TIL_AVX_TAIL(_call) \
+	do { \
+		__builtin_ia32_vzeroupper(); \
+		_call; \
+	} while (0)
+
+int til_cpu_supports(til_cpu_feature_t feature);
 unsigned til_get_ncpus(void);
+uint64_t til_get_ns(void);
+void * til_aligned_alloc(size_t alignment, size_t size);
+void til_aligned_free(void *ptr);
 
 #endif /* _TIL_UTIL_H */